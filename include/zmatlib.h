@@ -82,10 +82,17 @@ extern "C"
  * 10: blosc2lz4hc
  * 11: blosc2zlib
  * 12: blosc2zstd
+ * 13: xz
+ * 14: lz4f (LZ4 frame format)
+ * 15: b2nd (blosc2 N-dimensional array, contiguous frame)
+ * 16: blosc2zfp-acc (b2nd frame, lossy zfp with a fixed absolute error)
+ * 17: blosc2zfp-prec (b2nd frame, lossy zfp with a fixed number of bit planes)
+ * 18: blosc2zfp-rate (b2nd frame, lossy zfp with a fixed compression ratio)
+ * 19: blosc2ndlz (b2nd frame, lossless 2-D LZ of 4x4 or 8x8 cells)
  * -1: unknown
  */
 
-typedef enum TZipMethod {zmZlib, zmGzip, zmBase64, zmLzip, zmLzma, zmLz4, zmLz4hc, zmZstd, zmBlosc2Blosclz, zmBlosc2Lz4, zmBlosc2Lz4hc, zmBlosc2Zlib, zmBlosc2Zstd, zmXz, zmUnknown = -1} TZipMethod;
+typedef enum TZipMethod {zmZlib, zmGzip, zmBase64, zmLzip, zmLzma, zmLz4, zmLz4hc, zmZstd, zmBlosc2Blosclz, zmBlosc2Lz4, zmBlosc2Lz4hc, zmBlosc2Zlib, zmBlosc2Zstd, zmXz, zmLz4f, zmB2nd, zmBlosc2ZfpAcc, zmBlosc2ZfpPrec, zmBlosc2ZfpRate, zmBlosc2Ndlz, zmUnknown = -1} TZipMethod;
 
 /**
  * @brief advanced ZMat parameters needed for blosc2 metacompressor
@@ -95,15 +102,109 @@ typedef union TZMatFlags {
     int iscompress;      /**< combined flag used to pass on to zmat_run */
     struct settings {    /**< unpacked flags */
         char clevel;     /**< compression level, 0: decompression, 1: use default level; negative: set compression level (-1 to -19) */
-        char nthread;    /**< number of compression/decompression threads */
-        char shuffle;    /**< byte shuffle length */
+        char nthread;    /**< number of compression/decompression threads, 0: auto (one per 4 MB of input, capped by the thread limit) */
+        char shuffle;    /**< shuffle filter, 1: byte shuffle, 2: bit shuffle of typesize-byte elements; run by blosc2 on
+                              each block, and by zmat on the whole input of the other codecs (reversed when decoding) */
         char typesize;   /**< for ND-array, the byte-size for each array element */
     } param;
 } TZMatFlags;
 
+/**
+ * @brief Flag OR-ed into zipid to wrap the codec payload in a zmat frame
+ *
+ * When compressing, a ZMAT_FRAME_HEADER-byte header recording the method, the
+ * uncompressed length, typesize and shuffle is written before the payload;
+ * when decompressing, the header is checked and the method it records is used.
+ * Accepted by zmat_run, zmat_run_into, zmat_run_ctx and zmat_outputbound.
+ */
+
+#define ZMAT_FRAME        0x100
+
+/**
+ * @brief Length of the zmat frame header
+ *
+ * bytes 0-3: "ZMAT", 4: version (1, or 2 if zmat shuffled the payload), 5: method,
+ * 6: typesize, 7: shuffle, 8-15: uncompressed length (little-endian); the codec
+ * payload follows.
+ */
+
+#define ZMAT_FRAME_HEADER 16
+
+/**
+ * @brief Flag OR-ed into zmGzip or zmZstd to write an indexed gzip or a seekable zstd stream
+ *
+ * For gzip, the input is compressed in independent deflate blocks (1 MB each
+ * unless ZMAT_INDEX_INTERVAL is set at build time) whose compressed lengths are
+ * kept in a "ZI" gzip extra field, so the output stays a standard gzip stream.
+ * For zstd, the input is compressed in independent frames (1 MB each unless
+ * ZMAT_SEEK_FRAME is set at build time) followed by the seek table of the zstd
+ * seekable format, a skippable frame that other zstd decoders pass over.
+ * zmat_run decodes such streams in parallel, and zmat_decode_range() reads a
+ * slice by decoding only the blocks it covers. Ignored when decompressing.
+ * Can not be combined with a shuffle, which the stream would not record (-16).
+ */
+
+#define ZMAT_INDEX        0x200
+
+/**
+ * @brief Flag OR-ed into zipid to write or read a chunked zmat container
+ *
+ * When compressing, the input is cut into 4 MB chunks (see zmat_container_write()
+ * for other lengths), each compressed in parallel with the method in the low
+ * byte of zipid, followed by an index of the chunk offsets, compressed lengths
+ * and crc32s. When decompressing, the chunks are decoded in parallel and checked.
+ * Works with any method; zmat_container_read() and zmat_decode_range() decode
+ * only the chunks covering a byte range. Accepted by zmat_run, zmat_run_into,
+ * zmat_run_ctx and zmat_outputbound.
+ */
+
+#define ZMAT_CONTAINER    0x400
+
+/**
+ * @brief Flag OR-ed into zipid to base64 encode the compressed output, or decode base64 text before decompressing
+ *
+ * The text is one line without line feeds, as stored in the _ArrayZipData_
+ * field of JData; decoding skips line feeds and other characters outside the
+ * base64 alphabet. On one thread, zlib, gzip and zstd pass their output through
+ * the base64 coder in pieces of ZMAT_BASE64_PIECE characters (64 KB), so the
+ * whole compressed stream is never held; the other codecs write their output
+ * into the end of the text buffer, which is then encoded in place. Combines
+ * with ZMAT_FRAME, ZMAT_INDEX and ZMAT_CONTAINER. Accepted by zmat_run,
+ * zmat_run_into, zmat_run_ctx, zmat_decode_range and zmat_outputbound (which
+ * returns 0 for decompression).
+ */
+
+#define ZMAT_BASE64       0x800
+
+/**
+ * @brief Length of the zmat container header
+ *
+ * bytes 0-3: "ZMCN", 4: version (1, or 2 if the chunks are shuffled), 5: method, 6: typesize, 7: shuffle,
+ * 8-15: chunk length, 16-23: uncompressed length (little-endian).
+ */
+
+#define ZMAT_CONTAINER_HEADER 24
+
+/**
+ * @brief Metadata stored in a zmat frame header, returned by zmat_peek()
+ */
+
+typedef struct TZMatFrame {
+    int method;          /**< compression method of the payload, see TZipMethod */
+    int typesize;        /**< byte-size of each array element, 0 if not set */
+    int shuffle;         /**< byte shuffle flag given at compression, 0 if not set */
+    size_t size;         /**< uncompressed length in bytes */
+    size_t headersize;   /**< header length, the payload starts at this offset */
+} TZMatFrame;
+
 /**
  * @brief Main interface to perform compression/decompression
  *
+ * For the zlib, gzip, lzma, lzip, xz, lz4 and zstd methods, a positive shuffle
+ * flag with a typesize above 1 shuffles the input before the codec, and the
+ * same flags unshuffle the decoded output; zmat frames and containers record
+ * them, so that they are decoded without the flags.
+ *
  * @param[in] inputsize: input stream buffer length
  * @param[in] inputstr: input stream buffer pointer
  * @param[in] outputsize: output stream buffer length
@@ -116,6 +217,413 @@ typedef union TZMatFlags {
 
 int zmat_run(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
 
+/**
+ * @brief Perform compression/decompression into a caller-owned output buffer
+ *
+ * zlib, gzip, lz4/lz4hc, zstd and blosc2 write directly into outputbuf; the
+ * other methods run zmat_run() internally and copy the result.
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] outputsize: output length on success; the required length if -12 is returned
+ * @param[out] outputbuf: caller-owned output buffer (may be NULL to query the required length)
+ * @param[in] outputcapacity: length of outputbuf
+ * @param[in] zipid: compression method, see TZipMethod
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return return the coarse grained zmat error code; -12 if outputbuf is too small.
+ */
+
+int zmat_run_into(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char* outputbuf, const size_t outputcapacity, const int zipid, int* ret, const int iscompress);
+
+/**
+ * @brief Upper bound of the output length, used to size the buffer passed to zmat_run_into()
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer (only inspected for decompression)
+ * @param[in] zipid: compression method, see TZipMethod
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return the maximum output length, or 0 if it can not be determined without running the codec
+ */
+
+size_t zmat_outputbound(const size_t inputsize, const unsigned char* inputstr, const int zipid, const int iscompress);
+
+/**
+ * @brief Read the zmat frame header of a buffer without decoding the payload
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer, starting with a frame written with ZMAT_FRAME
+ * @param[out] frame: method, uncompressed length, typesize and shuffle recorded in the header
+ * @return 0 on success, -14 if the buffer does not start with a valid zmat frame
+ */
+
+int zmat_peek(const size_t inputsize, const unsigned char* inputstr, TZMatFrame* frame);
+
+/**
+ * @brief Decode only the bytes [offset, offset + length) of a compressed buffer
+ *
+ * For gzip streams written with ZMAT_INDEX, zstd streams with a seek table and
+ * zmat containers (ZMAT_CONTAINER), only the blocks, frames or chunks covering
+ * the range are decoded, in parallel up to the thread limit. Other zlib and gzip
+ * streams are inflated from the start and stop at the end of the range; all other
+ * methods, zmat frames around them and frames of shuffled data are decoded
+ * whole and the slice copied.
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] offset: offset of the first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[out] outputsize: output length, 0 if offset is past the end of the data
+ * @param[out] outputbuf: the decoded bytes (NULL if empty), free with zmat_free()
+ * @param[in] zipid: compression method, see TZipMethod, may carry the ZMAT_FRAME, ZMAT_CONTAINER or ZMAT_BASE64 flag
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_decode_range(const size_t inputsize, unsigned char* inputstr, const size_t offset, const size_t length,
+                      size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret);
+
+/**
+ * @brief Split a buffer into fixed-length chunks and compress them into a zmat container
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] chunksize: decoded length of each chunk, 0 for the default (4 MB)
+ * @param[out] outputsize: container length
+ * @param[out] outputbuf: the container, free with zmat_free()
+ * @param[in] zipid: compression method of the chunks, see TZipMethod
+ * @param[out] ret: encoder specific detailed error code of the first chunk that failed
+ * @param[in] iscompress: packed flags as in zmat_run, must request compression
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_container_write(const size_t inputsize, unsigned char* inputstr, const size_t chunksize, size_t* outputsize,
+                         unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+
+/**
+ * @brief Decode the bytes [offset, offset + length) of a zmat container
+ *
+ * Only the chunks overlapping the range are decompressed, in parallel up to
+ * the thread limit, and each is checked against the crc32 in the index.
+ *
+ * @param[in] inputsize: container length
+ * @param[in] inputstr: the container, written by zmat_container_write() or with ZMAT_CONTAINER
+ * @param[in] offset: offset of the first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[out] outputsize: output length, 0 if offset is past the end of the data
+ * @param[out] outputbuf: the decoded bytes (NULL if empty), free with zmat_free()
+ * @param[out] ret: decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code, -14 if the container or a chunk is invalid.
+ */
+
+int zmat_container_read(const size_t inputsize, unsigned char* inputstr, const size_t offset, const size_t length,
+                        size_t* outputsize, unsigned char** outputbuf, int* ret);
+
+/**
+ * @brief Compress an N-dimensional C-order array into a b2nd frame
+ *
+ * The array is cut into chunks of about 4 MB and blocks of about 256 KB along
+ * its longest dimensions, so that zmat_b2nd_slice() only decodes what it needs.
+ * zmBlosc2Zfp* need 1 to 4 dimensions of 4- or 8-byte floats with at least 4
+ * elements each, zmBlosc2Ndlz 2 dimensions.
+ *
+ * @param[in] inputsize: input buffer length, must equal prod(shape) * typesize
+ * @param[in] inputstr: input buffer pointer, in C (row-major) order
+ * @param[in] ndim: number of dimensions, 1 to 8
+ * @param[in] shape: length of each dimension, slowest varying first
+ * @param[in] dtype: numpy style dtype string stored with the array (such as "<f4"), or NULL
+ * @param[out] outputsize: frame length
+ * @param[out] outputbuf: the frame, free with zmat_free()
+ * @param[in] zipid: zmB2nd, or the zmBlosc2Zfp* and zmBlosc2Ndlz codecs
+ * @param[out] ret: encoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run; typesize is inputsize/prod(shape) if not set
+ * @return return the coarse grained zmat error code, -15 if the shape does not match the input.
+ */
+
+int zmat_b2nd_write(const size_t inputsize, unsigned char* inputstr, const int ndim, const size_t* shape,
+                    const char* dtype, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+
+/**
+ * @brief Read the shape of a b2nd frame without decoding it
+ *
+ * @param[in] inputsize: frame length
+ * @param[in] inputstr: the frame, written by zmat_b2nd_write() or the b2nd method
+ * @param[out] ndim: number of dimensions
+ * @param[out] shape: length of each dimension, must hold 8 elements
+ * @param[out] typesize: bytes per element
+ * @return return 0 on success, -14 if the frame is not a b2nd array.
+ */
+
+int zmat_b2nd_shape(const size_t inputsize, const unsigned char* inputstr, int* ndim, size_t* shape, int* typesize);
+
+/**
+ * @brief Decode the sub-array [start, stop) of a b2nd frame
+ *
+ * Only the chunks, and the blocks inside them, that intersect the slice are
+ * decompressed. The result is returned in C order with shape stop - start.
+ *
+ * @param[in] inputsize: frame length
+ * @param[in] inputstr: the frame, written by zmat_b2nd_write() or the b2nd method
+ * @param[in] start: first index of each dimension, NULL for the whole array
+ * @param[in] stop: one past the last index of each dimension, NULL for the whole array
+ * @param[out] outputsize: output length
+ * @param[out] outputbuf: the decoded slice, free with zmat_free()
+ * @param[out] ret: decoder specific detailed error code (if error occurs)
+ * @param[in] nthread: number of decoding threads, 0 for all cores
+ * @return return the coarse grained zmat error code, -15 if the slice is outside of the array.
+ */
+
+int zmat_b2nd_slice(const size_t inputsize, unsigned char* inputstr, const size_t* start, const size_t* stop,
+                    size_t* outputsize, unsigned char** outputbuf, int* ret, const int nthread);
+
+/**
+ * @brief Opaque handle caching codec states (zmat_ctx) between zmat_run_ctx() calls
+ *
+ * A context may be used for any method and level, but not by two threads at the same time.
+ */
+
+typedef struct TZMatCtx TZMatCtx;
+
+/**
+ * @brief Create a context that caches codec states across zmat_run_ctx() calls
+ *
+ * The context itself is taken from the global allocator in effect at this
+ * call, and returned to it by zmat_ctx_free().
+ *
+ * @param[out] ctx: the new context, free it with zmat_ctx_free()
+ * @return 0 on success, -5 if the context can not be allocated
+ */
+
+int zmat_ctx_init(TZMatCtx** ctx);
+
+/**
+ * @brief Perform compression/decompression reusing the codec states cached in ctx
+ *
+ * Same as zmat_run, but the deflate/inflate streams, zstd, lz4/lz4hc and blosc2
+ * contexts and the lzma/lzip/xz encoders are created once per context instead
+ * of once per call.
+ *
+ * @param[in] ctx: context created by zmat_ctx_init(), or NULL to behave like zmat_run
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] outputsize: output stream buffer length
+ * @param[out] outputbuf: output stream buffer pointer, free with zmat_free() or the context allocator
+ * @param[in] zipid: compression method, see TZipMethod
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_run_ctx(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+
+/**
+ * @brief Release a context and all cached codec states
+ *
+ * @param[in,out] ctx: the context to be freed, set to NULL on return
+ */
+
+void zmat_ctx_free(TZMatCtx** ctx);
+
+/**
+ * @brief Memory allocation callbacks for codec states, work buffers and output buffers
+ *
+ * The callbacks follow malloc/realloc/free: realloc receives ptr == NULL to
+ * allocate, free is never called with NULL, and returned memory must be aligned
+ * as by malloc. They may be called from codec worker threads. opaque is passed
+ * through unchanged. blosc2 keeps using its own internal allocator.
+ */
+
+typedef struct TZMatAllocator {
+    void* (*alloc)(void* opaque, size_t size);              /**< allocate size bytes */
+    void* (*realloc)(void* opaque, void* ptr, size_t size); /**< resize ptr (NULL to allocate) */
+    void (*free)(void* opaque, void* ptr);                  /**< release ptr */
+    void* opaque;                                           /**< user data passed to the callbacks */
+} TZMatAllocator;
+
+/**
+ * @brief Set the allocator used globally or by one context
+ *
+ * The global allocator (ctx == NULL) is used by zmat_run, zmat_run_into,
+ * zmat_encode/zmat_decode, base64_encode/base64_decode, zmat_free and the
+ * stream handles created afterwards; set it before any other zmat call, as it
+ * is not synchronized. A context starts with the global allocator and, once
+ * set, allocates its codec states and the zmat_run_ctx output buffers from
+ * its own allocator; release those buffers with that allocator's free.
+ *
+ * @param[in] ctx: context created by zmat_ctx_init(), or NULL to set the global allocator
+ * @param[in] allocator: callbacks (copied), or NULL to restore the default (the global allocator for a context)
+ * @return 0 on success, -13 if a callback is missing
+ */
+
+int zmat_set_allocator(TZMatCtx* ctx, const TZMatAllocator* allocator);
+
+/**
+ * @brief Compress/decompress many independent buffers in one call
+ *
+ * Item i is processed as zmat_run(inputsize[i], inputstr[i], &outputsize[i],
+ * &outputbuf[i], zipid[i], &ret[i], iscompress[i]). Items are spread over up to
+ * nthread workers, largest input first, each reusing its own zmat_ctx.
+ * The workers run on the shared pool, see zmat_pool_free().
+ *
+ * @param[in] count: number of items
+ * @param[in] inputsize: input length of each item
+ * @param[in] inputstr: input buffer of each item
+ * @param[out] outputsize: output length of each item
+ * @param[out] outputbuf: output buffer of each item (NULL on error), free each with zmat_free()
+ * @param[in] zipid: compression method of each item, see TZipMethod
+ * @param[out] ret: encoder/decoder specific detailed error code of each item
+ * @param[in] iscompress: packed flags of each item as in zmat_run (0: decompression)
+ * @param[out] errcode: coarse grained zmat error code of each item
+ * @param[in] nthread: number of workers, 0 for the thread limit, negative or 1 to process the items in the calling thread
+ * @return 0 if all items succeed, the error code of the first failed item, or -5 if the workers can not be allocated
+ */
+
+int zmat_run_batch(const size_t count, const size_t* inputsize, unsigned char** inputstr, size_t* outputsize, unsigned char** outputbuf,
+                   const int* zipid, int* ret, const int* iscompress, int* errcode, const int nthread);
+
+/**
+ * @brief Stop and join the threads of the library-owned worker pool
+ *
+ * lzip, xz, zstd and blosc2 multi-threading and zmat_run_batch share one pool
+ * whose threads start on demand and stay until this call. All threaded calls
+ * together use at most ZMAT_NUM_THREADS (or OMP_NUM_THREADS, or the number of
+ * CPUs) threads; concurrent callers split that limit, and calls made from pool
+ * threads run single-threaded. Call it only when no zmat call, context or
+ * stream is active, e.g. before the library is unloaded; the pool restarts on
+ * the next threaded call.
+ */
+
+void zmat_pool_free(void);
+
+/**
+ * @brief Set the largest single output buffer the library allocates
+ *
+ * Decoders fail with -5 (or -12 for a fixed buffer) rather than grow an output
+ * past this limit, and encoders reject larger inputs. The default is read once
+ * from the ZMAT_MAX_ALLOC environment variable (bytes, with an optional K, M or
+ * G suffix), or else is 1 GB on 32-bit and 64 GB on 64-bit builds. Like
+ * zmat_set_allocator(), set it before other zmat calls, as it is not synchronized.
+ *
+ * @param[in] limit: new limit in bytes, or 0 to restore the default
+ * @return the previous limit
+ */
+
+size_t zmat_set_max_alloc(size_t limit);
+
+/**
+ * @brief Largest number of filters in a blosc2 filter pipeline
+ */
+
+#define ZMAT_MAX_FILTERS  6
+
+/**
+ * @brief blosc2 filter pipeline and block settings, see zmat_set_blosc2()
+ *
+ * The filters run in order on each block before the codec: 0 none, 1 byte
+ * shuffle, 2 bit shuffle, 3 delta (against the first block), 4 trunc-prec
+ * (keep filters_meta mantissa bits of 4- or 8-byte floats, or drop -meta bits).
+ *
+ * compmeta tunes the zfp and ndlz codecs: the absolute error 10^compmeta of
+ * blosc2zfp-acc (default -3), the bit planes kept by blosc2zfp-prec (default
+ * 16), the percent of the input length written by blosc2zfp-rate (default 25)
+ * and the cell size, 4 (default) or 8, of blosc2ndlz; 0 selects the default.
+ */
+
+typedef struct TZMatBlosc2Params {
+    int nfilter;                                  /**< number of filters, 0 to use the shuffle of the zmat_run flags */
+    unsigned char filters[ZMAT_MAX_FILTERS];      /**< filter ids, run from the first to the nfilter-th */
+    signed char filters_meta[ZMAT_MAX_FILTERS];   /**< parameter of each filter */
+    int blocksize;                                /**< block length in bytes, 0 to let blosc2 choose */
+    int splitmode;                                /**< 1 always split, 2 never, 3 auto, 4 or 0 forward-compatible (default) */
+    int compmeta;                                 /**< parameter of the zfp and ndlz codecs, 0 for the default */
+} TZMatBlosc2Params;
+
+/**
+ * @brief Set the blosc2 filter pipeline, blocksize, splitmode and codec parameter of the calling thread
+ *
+ * The settings apply to the blosc2 methods, b2nd and the zfp/ndlz methods
+ * (whose blocks follow the array shape, so blocksize is ignored there) in zmat_run, zmat_run_into,
+ * zmat_run_ctx, zmat_run_batch, zmat_b2nd_write and streams updated on this
+ * thread, including the chunks encoded by pool threads on its behalf, until
+ * they are reset. Decompression reads them from the data.
+ *
+ * @param[in] params: settings (copied), or NULL to restore the defaults
+ * @return 0 on success, -16 if a filter id, blocksize, splitmode or compmeta is invalid
+ */
+
+int zmat_set_blosc2(const TZMatBlosc2Params* params);
+
+/**
+ * @brief Default length of a dictionary built by zmat_dict_train()
+ */
+
+#define ZMAT_DICT_CAPACITY  112640
+
+/**
+ * @brief Opaque handle of a pre-digested compression dictionary, see zmat_dict_init()
+ */
+
+typedef struct TZMatDict TZMatDict;
+
+/**
+ * @brief Train a dictionary from many small samples of similar data
+ *
+ * Uses the zstd dictionary builder; the result is a zstd dictionary that also
+ * serves zlib and lz4, whose dictionaries are raw content and read its tail.
+ *
+ * @param[in] count: number of samples, a few hundred or more work best
+ * @param[in] samplesize: length of each sample
+ * @param[in] samples: buffer of each sample
+ * @param[in] capacity: largest dictionary length, 0 for ZMAT_DICT_CAPACITY
+ * @param[out] dictsize: dictionary length
+ * @param[out] dictbuf: the dictionary, free with zmat_free()
+ * @param[out] ret: the zstd dictionary builder error code (if error occurs)
+ * @return 0 on success, -1 if there are no samples, -5 if out of memory, -17 if training fails
+ */
+
+int zmat_dict_train(const size_t count, const size_t* samplesize, unsigned char** samples, const size_t capacity,
+                    size_t* dictsize, unsigned char** dictbuf, int* ret);
+
+/**
+ * @brief Digest a dictionary once for repeated use with zmat_set_dict()
+ *
+ * The bytes are copied and prepared for zstd (ZSTD_CDict/ZSTD_DDict) and lz4
+ * (a loaded LZ4_stream_t and LZ4_streamHC_t) at the compression level of the
+ * packed flags; calls at other levels still use the dictionary, but reload it.
+ * Any byte string is accepted, e.g. one output of zmat_dict_train().
+ *
+ * @param[out] dict: the handle, free with zmat_dict_free()
+ * @param[in] dictsize: dictionary length
+ * @param[in] dictbuf: dictionary bytes
+ * @param[in] iscompress: packed flags as in zmat_run, whose level the dictionary is digested for
+ * @return 0 on success, -1 if the dictionary is empty, -5 if out of memory, -17 if zstd rejects it
+ */
+
+int zmat_dict_init(TZMatDict** dict, const size_t dictsize, const unsigned char* dictbuf, const int iscompress);
+
+/**
+ * @brief Free a dictionary handle and set it to NULL
+ */
+
+void zmat_dict_free(TZMatDict** dict);
+
+/**
+ * @brief Set the dictionary used by zlib, zstd, lz4 and lz4hc on the calling thread
+ *
+ * The dictionary applies to zmat_run, zmat_run_into, zmat_run_ctx,
+ * zmat_run_batch and ZMAT_FRAME/ZMAT_CONTAINER data coded on this thread,
+ * including chunks coded by pool threads on its behalf, until it is reset.
+ * Data compressed with a dictionary must be decompressed with the same one,
+ * and is written as one zlib stream (with the FDICT flag), zstd frame or lz4
+ * block on one thread. gzip, ZMAT_INDEX data and streams ignore it. The
+ * handle must stay valid while it is set.
+ *
+ * @param[in] dict: dictionary from zmat_dict_init(), or NULL to stop using one
+ * @return the previous dictionary of the calling thread
+ */
+
+const TZMatDict* zmat_set_dict(const TZMatDict* dict);
+
 /**
  * @brief Simplified interface to perform compression (use default compression level)
  *
@@ -145,11 +653,76 @@ int zmat_decode(const size_t inputsize, unsigned char* inputstr, size_t* outputs
 /**
  * @brief Free the output buffer to facilitate use in fortran
  *
+ * The buffer is released with the global allocator, see zmat_set_allocator().
+ *
  * @param[in,out] outputbuf: the outputbuf buffer's initial address to be freed
  */
 
 void zmat_free(unsigned char** outputbuf);
 
+/**
+ * @brief Opaque handle for incremental (streaming) compression/decompression
+ */
+
+typedef struct TZMatStream TZMatStream;
+
+/**
+ * @brief Create a stream handle for incremental compression/decompression
+ *
+ * Supported methods: zlib, gzip, zstd, lzma, lzip, xz, lz4/lz4hc (LZ4 frame
+ * format) and blosc2 (a sequence of blosc2 chunks). Memory use is bounded by
+ * the codec window (ZMAT_STREAM_WINDOW for the block based encoders) rather
+ * than by the total input size.
+ *
+ * The lz4/lz4hc decoder also takes the bare LZ4 block written by zmat_run();
+ * such a block does not record where it ends, so it is held whole and decoded
+ * by zmat_stream_finish(). On Windows, lzma compression has no encoder thread
+ * to feed piece by piece: the whole input is held and compressed by
+ * zmat_stream_finish(), so memory grows with the input; lzip and xz streams
+ * stay bounded there.
+ *
+ * @param[out] stream: the new stream handle, free it with zmat_stream_free()
+ * @param[in] zipid: compression method, see TZipMethod
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return 0 on success, otherwise the coarse grained zmat error code
+ */
+
+int zmat_stream_init(TZMatStream** stream, const int zipid, const int iscompress);
+
+/**
+ * @brief Feed the next piece of input to a stream
+ *
+ * @param[in] stream: stream handle created by zmat_stream_init()
+ * @param[in] inputsize: length of the input piece (may be 0)
+ * @param[in] inputstr: input piece
+ * @param[out] outputsize: length of the output produced by this call (may be 0)
+ * @param[out] outputbuf: output produced by this call (NULL if none), free with zmat_free()
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_stream_update(TZMatStream* stream, const size_t inputsize, const unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, int* ret);
+
+/**
+ * @brief Flush the remaining output of a stream and verify that it is complete
+ *
+ * @param[in] stream: stream handle created by zmat_stream_init()
+ * @param[out] outputsize: length of the final output piece (may be 0)
+ * @param[out] outputbuf: final output piece (NULL if none), free with zmat_free()
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_stream_finish(TZMatStream* stream, size_t* outputsize, unsigned char** outputbuf, int* ret);
+
+/**
+ * @brief Release a stream handle
+ *
+ * @param[in,out] stream: the stream handle to be freed, set to NULL on return
+ */
+
+void zmat_stream_free(TZMatStream** stream);
+
 /**
  * @brief Look up a string in a string list and return the index
  *
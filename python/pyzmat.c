@@ -40,6 +40,7 @@ static const char* zipmethods[] = {
 #if !defined(NO_LZ4)
     "lz4",
     "lz4hc",
+    "lz4f",
 #endif
 #if !defined(NO_ZSTD)
     "zstd",
@@ -50,6 +51,11 @@ static const char* zipmethods[] = {
     "blosc2lz4hc",
     "blosc2zlib",
     "blosc2zstd",
+    "b2nd",
+    "blosc2zfp-acc",
+    "blosc2zfp-prec",
+    "blosc2zfp-rate",
+    "blosc2ndlz",
 #endif
     ""
 };
@@ -68,6 +74,7 @@ static const TZipMethod zipmethodid[] = {
 #if !defined(NO_LZ4)
     zmLz4,
     zmLz4hc,
+    zmLz4f,
 #endif
 #if !defined(NO_ZSTD)
     zmZstd,
@@ -78,6 +85,11 @@ static const TZipMethod zipmethodid[] = {
     zmBlosc2Lz4hc,
     zmBlosc2Zlib,
     zmBlosc2Zstd,
+    zmB2nd,
+    zmBlosc2ZfpAcc,
+    zmBlosc2ZfpPrec,
+    zmBlosc2ZfpRate,
+    zmBlosc2Ndlz,
 #endif
     zmUnknown
 };
@@ -95,17 +107,293 @@ static TZipMethod pyzmat_method_lookup(const char* method) {
     return zipmethodid[idx];
 }
 
+static const char* blosc2filters[] = {"nofilter", "shuffle", "bitshuffle", "delta", "truncprec"};
+
+/**
+ * @brief Read the blosc2 filters, filters_meta, blocksize, splitmode and compmeta keywords
+ *
+ * filters is a sequence of at most ZMAT_MAX_FILTERS filter names or ids, run in
+ * order; filters_meta holds the parameter of each filter (e.g. the mantissa
+ * bits kept by 'truncprec'); compmeta is the parameter of the zfp and ndlz codecs.
+ *
+ * @return 1 if any setting differs from the default, 0 if none, -1 with an exception set
+ */
+static int pyzmat_blosc2_params(PyObject* filters, PyObject* meta, int blocksize, int splitmode, int compmeta,
+                                TZMatBlosc2Params* params) {
+    PyObject* seq;
+    Py_ssize_t i, count;
+
+    memset(params, 0, sizeof(TZMatBlosc2Params));
+    params->blocksize = blocksize;
+    params->splitmode = splitmode;
+    params->compmeta = compmeta;
+
+    if (filters != NULL && filters != Py_None) {
+        if (!(seq = PySequence_Fast(filters, "filters must be a sequence of filter names or ids"))) {
+            return -1;
+        }
+
+        count = PySequence_Fast_GET_SIZE(seq);
+
+        if (count > ZMAT_MAX_FILTERS) {
+            Py_DECREF(seq);
+            PyErr_Format(PyExc_ValueError, "at most %d blosc2 filters are supported", ZMAT_MAX_FILTERS);
+            return -1;
+        }
+
+        for (i = 0; i < count; i++) {
+            PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+            long id = -1;
+
+            if (PyUnicode_Check(item)) {
+                const char* name = PyUnicode_AsUTF8(item);
+                size_t k;
+
+                for (k = 0; name && k < sizeof(blosc2filters) / sizeof(blosc2filters[0]); k++) {
+                    if (strcmp(name, blosc2filters[k]) == 0) {
+                        id = (long)k;
+                    }
+                }
+
+                if (id < 0) {
+                    Py_DECREF(seq);
+
+                    if (!PyErr_Occurred()) {
+                        PyErr_Format(PyExc_ValueError, "unsupported blosc2 filter '%s'", name);
+                    }
+
+                    return -1;
+                }
+            } else if ((id = PyLong_AsLong(item)) == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                return -1;
+            }
+
+            if (id < 0 || id > 255) {
+                Py_DECREF(seq);
+                PyErr_Format(PyExc_ValueError, "unsupported blosc2 filter %ld", id);
+                return -1;
+            }
+
+            params->filters[i] = (unsigned char)id;
+        }
+
+        params->nfilter = (int)count;
+        Py_DECREF(seq);
+    }
+
+    if (meta != NULL && meta != Py_None) {
+        if (!(seq = PySequence_Fast(meta, "filters_meta must be a sequence of integers"))) {
+            return -1;
+        }
+
+        count = PySequence_Fast_GET_SIZE(seq);
+
+        if (count > params->nfilter) {
+            Py_DECREF(seq);
+            PyErr_SetString(PyExc_ValueError, "filters_meta is longer than filters");
+            return -1;
+        }
+
+        for (i = 0; i < count; i++) {
+            long val = PyLong_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+
+            if (val == -1 && PyErr_Occurred()) {
+                Py_DECREF(seq);
+                return -1;
+            }
+
+            if (val < -128 || val > 127) {
+                Py_DECREF(seq);
+                PyErr_Format(PyExc_ValueError, "filters_meta value %ld is out of range", val);
+                return -1;
+            }
+
+            params->filters_meta[i] = (signed char)val;
+        }
+
+        Py_DECREF(seq);
+    }
+
+    if (params->nfilter == 0 && blocksize == 0 && splitmode == 0 && compmeta == 0) {
+        return 0;
+    }
+
+    if (zmat_set_blosc2(params) != 0) {
+        PyErr_SetString(PyExc_ValueError, "invalid blosc2 filter, blocksize, splitmode or compmeta");
+        return -1;
+    }
+
+    zmat_set_blosc2(NULL);
+    return 1;
+}
+
+/**
+ * @brief Read the dictionary keyword: a handle from dict_load(), or bytes digested for one call
+ *
+ * @param obj: the keyword value, NULL or None for no dictionary
+ * @param iscompress: packed zmat flags, whose level bytes are digested for
+ * @param owned: set to the handle digested from bytes, free it with zmat_dict_free()
+ * @param dict: set to the dictionary to use, NULL for none
+ * @return 0 on success, -1 with an exception set
+ */
+static int pyzmat_dict_arg(PyObject* obj, int iscompress, TZMatDict** owned, const TZMatDict** dict) {
+    Py_buffer buf;
+    int errcode;
+
+    *owned = NULL;
+    *dict = NULL;
+
+    if (obj == NULL || obj == Py_None) {
+        return 0;
+    }
+
+    if (PyCapsule_CheckExact(obj)) {
+        *dict = (const TZMatDict*)PyCapsule_GetPointer(obj, "zmat.dict");
+        return (*dict == NULL) ? -1 : 0;
+    }
+
+    if (PyObject_GetBuffer(obj, &buf, PyBUF_SIMPLE) < 0) {
+        return -1;
+    }
+
+    errcode = zmat_dict_init(owned, (size_t)buf.len, (const unsigned char*)buf.buf, iscompress);
+    PyBuffer_Release(&buf);
+
+    if (errcode != 0) {
+        PyErr_Format(PyExc_ValueError, "invalid dictionary, error %d: %s", errcode, zmat_error(-errcode));
+        return -1;
+    }
+
+    *dict = *owned;
+    return 0;
+}
+
+/**
+ * @brief Run zmat on a buffer and return the output as a new bytes object
+ *
+ * If zmat_outputbound() can bound the output size, or the caller knows the
+ * decoded length, zmat_run_into() writes directly into the bytes object,
+ * otherwise the zmat_run() output is copied. The GIL is released while
+ * coding, so that threads of a Python pool share the zmat thread limit
+ * instead of waiting on each other. The input buffer is released before
+ * returning.
+ *
+ * @param input_buf: input buffer
+ * @param zipid: compression method, may carry the ZMAT_FRAME flag
+ * @param iscompress: packed zmat flags
+ * @param sizehint: expected output length (e.g. from the info dict), 0 if unknown
+ * @param label: prefix of the error message
+ * @param params: blosc2 filter and block settings, NULL for the defaults
+ * @param dict: dictionary of zlib, zstd and lz4, NULL for none
+ * @return bytes object, or NULL with an exception set
+ */
+static PyObject* pyzmat_run(Py_buffer* input_buf, int zipid, int iscompress, size_t sizehint, const char* label,
+                            const TZMatBlosc2Params* params, const TZMatDict* dict) {
+    unsigned char* inputstr = (unsigned char*)input_buf->buf;
+    size_t inputsize = (size_t)input_buf->len;
+    size_t outputsize = 0;
+    size_t outputbound;
+    PyObject* result = NULL;
+    int ret = 0, errcode;
+
+    /* thread-local in the library, the GIL release below stays on this thread */
+    zmat_set_blosc2(params);
+    zmat_set_dict(dict);
+
+    if ((outputbound = zmat_outputbound(inputsize, inputstr, zipid, iscompress)) == 0) {
+        outputbound = sizehint;
+    }
+
+    if (outputbound > 0 && outputbound <= (size_t)PY_SSIZE_T_MAX) {
+        result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)outputbound);
+
+        if (result == NULL) {
+            zmat_set_blosc2(NULL);
+            zmat_set_dict(NULL);
+            PyBuffer_Release(input_buf);
+            return NULL;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        errcode = zmat_run_into(inputsize, inputstr, &outputsize,
+                                (unsigned char*)PyBytes_AS_STRING(result), outputbound, zipid, &ret, iscompress);
+        Py_END_ALLOW_THREADS
+
+        /* the bound was too small, retry once with the reported size */
+        if (errcode == -12) {
+            Py_DECREF(result);
+            result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)outputsize);
+
+            if (result == NULL) {
+                zmat_set_blosc2(NULL);
+                zmat_set_dict(NULL);
+                PyBuffer_Release(input_buf);
+                return NULL;
+            }
+
+            Py_BEGIN_ALLOW_THREADS
+            errcode = zmat_run_into(inputsize, inputstr, &outputsize,
+                                    (unsigned char*)PyBytes_AS_STRING(result), (size_t)PyBytes_GET_SIZE(result), zipid, &ret, iscompress);
+            Py_END_ALLOW_THREADS
+        }
+
+        if (errcode < 0) {
+            Py_CLEAR(result);
+        } else if (_PyBytes_Resize(&result, (Py_ssize_t)outputsize) < 0) {
+            zmat_set_blosc2(NULL);
+            zmat_set_dict(NULL);
+            PyBuffer_Release(input_buf);
+            return NULL;
+        }
+    } else {
+        unsigned char* outputbuf = NULL;
+
+        Py_BEGIN_ALLOW_THREADS
+        errcode = zmat_run(inputsize, inputstr, &outputsize, &outputbuf, zipid, &ret, iscompress);
+        Py_END_ALLOW_THREADS
+
+        if (errcode >= 0) {
+            result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+        }
+
+        if (outputbuf) {
+            free(outputbuf);
+        }
+    }
+
+    zmat_set_blosc2(NULL);
+    zmat_set_dict(NULL);
+    PyBuffer_Release(input_buf);
+
+    if (errcode < 0) {
+        PyErr_Format(PyExc_RuntimeError, "%s error %d: %s (status=%d)",
+                     label, errcode, zmat_error(-errcode), ret);
+        return NULL;
+    }
+
+    return result;
+}
+
 /**
  * @brief Core function: compress or decompress a buffer
  *
- * zmat.zmat(data, iscompress, method, nthread, shuffle, typesize)
+ * zmat.zmat(data, iscompress, method, nthread, shuffle, typesize, size, frame,
+ *           filters, filters_meta, blocksize, splitmode, compmeta)
  *
  * @param data: bytes or bytearray input
  * @param iscompress: 1=compress (default), 0=decompress, negative=set level
  * @param method: compression method string (default 'zlib')
- * @param nthread: number of threads for blosc2 (default 1)
- * @param shuffle: shuffle flag for blosc2 (default 1)
- * @param typesize: element byte size for blosc2 (default 4)
+ * @param nthread: number of threads for zlib, gzip, lzip, xz, zstd and blosc2 (default 1, 0: auto)
+ * @param shuffle: shuffle flag, 1 byte, 2 bit; blosc2 per block, other codecs whole input (default -1: 1 for blosc2, else 0)
+ * @param typesize: element byte size for the shuffle (default 4)
+ * @param size: expected decompressed length, 0 if unknown (default 0)
+ * @param frame: 1 to write/read a zmat frame header around the payload (default 0)
+ * @param filters: blosc2 filter pipeline replacing shuffle, names or ids (default None)
+ * @param filters_meta: parameter of each blosc2 filter (default None)
+ * @param blocksize: blosc2 block length in bytes, 0 for auto (default 0)
+ * @param splitmode: blosc2 split mode, 1 always, 2 never, 3 auto, 0 default (default 0)
+ * @param compmeta: parameter of the zfp and ndlz codecs, 0 for the default (default 0)
  * @return bytes object with compressed/decompressed data
  */
 static PyObject* pyzmat_zmat(PyObject* self, PyObject* args, PyObject* kwargs) {
@@ -113,14 +401,27 @@ static PyObject* pyzmat_zmat(PyObject* self, PyObject* args, PyObject* kwargs) {
     int iscompress = 1;
     const char* method = "zlib";
     int nthread = 1;
-    int shuffle = 1;
+    int shuffle = -1;
     int typesize = 4;
+    Py_ssize_t size = 0;
+    int frame = 0;
+    PyObject* filters = NULL, *meta = NULL;
+    int blocksize = 0, splitmode = 0, compmeta = 0, tuned;
+    TZMatBlosc2Params params;
 
-    static char* kwlist[] = {"data", "iscompress", "method", "nthread", "shuffle", "typesize", NULL};
+    static char* kwlist[] = {"data", "iscompress", "method", "nthread", "shuffle", "typesize", "size", "frame",
+                             "filters", "filters_meta", "blocksize", "splitmode", "compmeta", NULL
+                            };
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|isiii", kwlist,
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|isiiinpOOiii", kwlist,
                                      &input_buf, &iscompress, &method,
-                                     &nthread, &shuffle, &typesize)) {
+                                     &nthread, &shuffle, &typesize, &size, &frame,
+                                     &filters, &meta, &blocksize, &splitmode, &compmeta)) {
+        return NULL;
+    }
+
+    if ((tuned = pyzmat_blosc2_params(filters, meta, blocksize, splitmode, compmeta, &params)) < 0) {
+        PyBuffer_Release(&input_buf);
         return NULL;
     }
 
@@ -137,6 +438,11 @@ static PyObject* pyzmat_zmat(PyObject* self, PyObject* args, PyObject* kwargs) {
         return NULL;
     }
 
+    /* only blosc2 shuffles by default, the other codecs when asked to */
+    if (shuffle < 0) {
+        shuffle = (zipid < zmBlosc2Blosclz || zipid == zmXz || zipid == zmLz4f) ? 0 : 1;
+    }
+
     /* pack flags the same way as zmat.cpp / zmatlib.c */
     union TZMatFlags flags = {0};
     flags.param.clevel = (char)iscompress;
@@ -144,55 +450,117 @@ static PyObject* pyzmat_zmat(PyObject* self, PyObject* args, PyObject* kwargs) {
     flags.param.shuffle = (char)shuffle;
     flags.param.typesize = (char)typesize;
 
-    unsigned char* outputbuf = NULL;
-    size_t outputsize = 0;
-    int ret = 0;
-
-    int errcode = zmat_run(
-        (size_t)input_buf.len,
-        (unsigned char*)input_buf.buf,
-        &outputsize,
-        &outputbuf,
-        zipid,
-        &ret,
-        flags.iscompress
-    );
+    return pyzmat_run(&input_buf, frame ? (zipid | ZMAT_FRAME) : zipid, flags.iscompress,
+                      (size > 0 && iscompress == 0) ? (size_t)size : 0, "zmat", tuned ? &params : NULL, NULL);
+}
 
-    PyBuffer_Release(&input_buf);
+/**
+ * @brief Convenience function: compress data
+ *
+ * zmat.compress(data, method='zlib', level=1, frame=False, index=False, container=False,
+ *               filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0,
+ *               shuffle=0, typesize=0, base64=False, dictionary=None)
+ *
+ * frame=True prepends a zmat frame header, see zmat.peek(); index=True writes
+ * an indexed gzip or a seekable zstd stream for zmat.decode_range();
+ * container=True writes a chunked zmat container of any method; base64=True
+ * returns the compressed data as base64 text, see ZMAT_BASE64; filters to
+ * compmeta set the blosc2 filter pipeline, blocks and codec, see zmat_set_blosc2();
+ * shuffle (1 byte, 2 bit) and typesize shuffle the input of the other codecs;
+ * dictionary, a dict_load() handle or bytes, is used by zlib, zstd and lz4
+ */
+static PyObject* pyzmat_compress(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    const char* method = "zlib";
+    int level = 1;
+    int frame = 0;
+    int index = 0;
+    int container = 0;
+    int b64 = 0;
+    PyObject* filters = NULL, *meta = NULL;
+    int blocksize = 0, splitmode = 0, compmeta = 0, tuned;
+    int shuffle = 0, typesize = 0;
+    union TZMatFlags flags = {0};
+    TZMatBlosc2Params params;
+    PyObject* dictarg = NULL, *result;
+    TZMatDict* owned;
+    const TZMatDict* dict;
+
+    static char* kwlist[] = {"data", "method", "level", "frame", "index", "container",
+                             "filters", "filters_meta", "blocksize", "splitmode", "compmeta",
+                             "shuffle", "typesize", "base64", "dictionary", NULL
+                            };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|sipppOOiiiiipO", kwlist,
+                                     &input_buf, &method, &level, &frame, &index, &container,
+                                     &filters, &meta, &blocksize, &splitmode, &compmeta,
+                                     &shuffle, &typesize, &b64, &dictarg)) {
+        return NULL;
+    }
 
-    if (errcode < 0) {
-        if (outputbuf) {
-            free(outputbuf);
-        }
+    if ((tuned = pyzmat_blosc2_params(filters, meta, blocksize, splitmode, compmeta, &params)) < 0) {
+        PyBuffer_Release(&input_buf);
+        return NULL;
+    }
+
+    if (input_buf.len == 0) {
+        PyBuffer_Release(&input_buf);
+        return PyBytes_FromStringAndSize("", 0);
+    }
+
+    TZipMethod zipid = pyzmat_method_lookup(method);
 
-        PyErr_Format(PyExc_RuntimeError, "zmat error %d: %s (status=%d)",
-                     errcode, zmat_error(-errcode), ret);
+    if (zipid == zmUnknown) {
+        PyBuffer_Release(&input_buf);
+        PyErr_Format(PyExc_ValueError, "unsupported compression method '%s'", method);
         return NULL;
     }
 
-    PyObject* result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+    flags.param.clevel = (char)((level >= 1) ? 1 : -level);
+    flags.param.shuffle = (char)shuffle;
+    flags.param.typesize = (char)typesize;
 
-    if (outputbuf) {
-        free(outputbuf);
+    if (pyzmat_dict_arg(dictarg, flags.iscompress, &owned, &dict) < 0) {
+        PyBuffer_Release(&input_buf);
+        return NULL;
     }
 
+    result = pyzmat_run(&input_buf, (frame ? ZMAT_FRAME : 0) | (index ? ZMAT_INDEX : 0) | (container ? ZMAT_CONTAINER : 0)
+                        | (b64 ? ZMAT_BASE64 : 0) | zipid, flags.iscompress, 0, "zmat compression", tuned ? &params : NULL, dict);
+    zmat_dict_free(&owned);
     return result;
 }
 
 /**
- * @brief Convenience function: compress data
+ * @brief Convenience function: decompress data
+ *
+ * zmat.decompress(data, method='zlib', size=0, frame=False, container=False, shuffle=0, typesize=0,
+ *                 base64=False, dictionary=None)
  *
- * zmat.compress(data, method='zlib', level=1)
+ * size is the expected decompressed length if known (e.g. from the info
+ * dict), letting codecs that do not record it decode into a right-sized buffer;
+ * with frame=True, the method and length are read from the zmat frame header,
+ * with container=True, from the zmat container header; shuffle and typesize
+ * unshuffle data compressed with them; base64=True takes base64 text;
+ * dictionary is the one the data was compressed with
  */
-static PyObject* pyzmat_compress(PyObject* self, PyObject* args, PyObject* kwargs) {
+static PyObject* pyzmat_decompress(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_buffer input_buf;
     const char* method = "zlib";
-    int level = 1;
+    Py_ssize_t size = 0;
+    int frame = 0;
+    int container = 0;
+    int shuffle = 0, typesize = 0;
+    int b64 = 0;
+    union TZMatFlags flags = {0};
+    PyObject* dictarg = NULL, *result;
+    TZMatDict* owned;
+    const TZMatDict* dict;
 
-    static char* kwlist[] = {"data", "method", "level", NULL};
+    static char* kwlist[] = {"data", "method", "size", "frame", "container", "shuffle", "typesize", "base64", "dictionary", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|si", kwlist,
-                                     &input_buf, &method, &level)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|snppiipO", kwlist,
+                                     &input_buf, &method, &size, &frame, &container, &shuffle, &typesize, &b64, &dictarg)) {
         return NULL;
     }
 
@@ -209,51 +577,60 @@ static PyObject* pyzmat_compress(PyObject* self, PyObject* args, PyObject* kwarg
         return NULL;
     }
 
-    int iscompress = (level >= 1) ? 1 : -level;
+    flags.param.shuffle = (char)shuffle;
+    flags.param.typesize = (char)typesize;
 
-    unsigned char* outputbuf = NULL;
-    size_t outputsize = 0;
-    int ret = 0;
-
-    int errcode = zmat_run(
-        (size_t)input_buf.len,
-        (unsigned char*)input_buf.buf,
-        &outputsize,
-        &outputbuf,
-        zipid,
-        &ret,
-        iscompress
-    );
+    if (pyzmat_dict_arg(dictarg, 1, &owned, &dict) < 0) {
+        PyBuffer_Release(&input_buf);
+        return NULL;
+    }
 
-    PyBuffer_Release(&input_buf);
+    result = pyzmat_run(&input_buf, (frame ? ZMAT_FRAME : 0) | (container ? ZMAT_CONTAINER : 0) | (b64 ? ZMAT_BASE64 : 0) | zipid,
+                        flags.iscompress, (size > 0) ? (size_t)size : 0, "zmat decompression", NULL, dict);
+    zmat_dict_free(&owned);
+    return result;
+}
 
-    if (errcode < 0) {
-        if (outputbuf) {
-            free(outputbuf);
-        }
+/**
+ * @brief Convenience function: base64 encode
+ *
+ * zmat.encode(data, method='base64')
+ */
+static PyObject* pyzmat_encode(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    const char* method = "base64";
+
+    static char* kwlist[] = {"data", "method", NULL};
 
-        PyErr_Format(PyExc_RuntimeError, "zmat compression error %d: %s (status=%d)",
-                     errcode, zmat_error(-errcode), ret);
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|s", kwlist,
+                                     &input_buf, &method)) {
         return NULL;
     }
 
-    PyObject* result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+    if (input_buf.len == 0) {
+        PyBuffer_Release(&input_buf);
+        return PyBytes_FromStringAndSize("", 0);
+    }
+
+    TZipMethod zipid = pyzmat_method_lookup(method);
 
-    if (outputbuf) {
-        free(outputbuf);
+    if (zipid == zmUnknown) {
+        PyBuffer_Release(&input_buf);
+        PyErr_Format(PyExc_ValueError, "unsupported method '%s'", method);
+        return NULL;
     }
 
-    return result;
+    return pyzmat_run(&input_buf, zipid, 1, 0, "zmat encode", NULL, NULL);
 }
 
 /**
- * @brief Convenience function: decompress data
+ * @brief Convenience function: base64 decode
  *
- * zmat.decompress(data, method='zlib')
+ * zmat.decode(data, method='base64')
  */
-static PyObject* pyzmat_decompress(PyObject* self, PyObject* args, PyObject* kwargs) {
+static PyObject* pyzmat_decode(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_buffer input_buf;
-    const char* method = "zlib";
+    const char* method = "base64";
 
     static char* kwlist[] = {"data", "method", NULL};
 
@@ -271,58 +648,190 @@ static PyObject* pyzmat_decompress(PyObject* self, PyObject* args, PyObject* kwa
 
     if (zipid == zmUnknown) {
         PyBuffer_Release(&input_buf);
+        PyErr_Format(PyExc_ValueError, "unsupported method '%s'", method);
+        return NULL;
+    }
+
+    return pyzmat_run(&input_buf, zipid, 0, 0, "zmat decode", NULL, NULL);
+}
+
+/**
+ * @brief Compress or decompress a list of independent buffers in parallel
+ *
+ * zmat.batch(data, iscompress=1, method='zlib', nthread=4, frame=False,
+ *            filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0,
+ *            dictionary=None)
+ *
+ * The GIL is released while zmat_run_batch() spreads the items over nthread
+ * workers; empty items yield empty bytes.
+ *
+ * @return list of bytes objects, or NULL with an exception set
+ */
+static PyObject* pyzmat_batch(PyObject* self, PyObject* args, PyObject* kwargs) {
+    PyObject* data, *seq, *result = NULL;
+    int iscompress = 1;
+    const char* method = "zlib";
+    int nthread = 4;
+    int frame = 0;
+    Py_ssize_t i, count, nbuf = 0;
+    Py_buffer* bufs = NULL;
+    size_t* inputsize = NULL, *outputsize = NULL;
+    unsigned char** inputstr = NULL, **outputbuf = NULL;
+    int* zipids = NULL, *ret = NULL, *flaglist = NULL, *errcode = NULL;
+    union TZMatFlags flags = {0};
+    PyObject* filters = NULL, *meta = NULL;
+    int blocksize = 0, splitmode = 0, compmeta = 0, tuned;
+    TZMatBlosc2Params params;
+    PyObject* dictarg = NULL;
+    TZMatDict* owned = NULL;
+    const TZMatDict* dict;
+
+    static char* kwlist[] = {"data", "iscompress", "method", "nthread", "frame",
+                             "filters", "filters_meta", "blocksize", "splitmode", "compmeta", "dictionary", NULL
+                            };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|isipOOiiiO", kwlist,
+                                     &data, &iscompress, &method, &nthread, &frame,
+                                     &filters, &meta, &blocksize, &splitmode, &compmeta, &dictarg)) {
+        return NULL;
+    }
+
+    if ((tuned = pyzmat_blosc2_params(filters, meta, blocksize, splitmode, compmeta, &params)) < 0) {
+        return NULL;
+    }
+
+    TZipMethod zipid = pyzmat_method_lookup(method);
+
+    if (zipid == zmUnknown) {
         PyErr_Format(PyExc_ValueError, "unsupported compression method '%s'", method);
         return NULL;
     }
 
-    unsigned char* outputbuf = NULL;
-    size_t outputsize = 0;
-    int ret = 0;
-
-    int errcode = zmat_run(
-        (size_t)input_buf.len,
-        (unsigned char*)input_buf.buf,
-        &outputsize,
-        &outputbuf,
-        zipid,
-        &ret,
-        0
-    );
+    if (!(seq = PySequence_Fast(data, "data must be a sequence of bytes-like objects"))) {
+        return NULL;
+    }
 
-    PyBuffer_Release(&input_buf);
+    count = PySequence_Fast_GET_SIZE(seq);
+    bufs = PyMem_Calloc(count + 1, sizeof(Py_buffer));
+    inputsize = PyMem_Calloc(count + 1, sizeof(size_t));
+    outputsize = PyMem_Calloc(count + 1, sizeof(size_t));
+    inputstr = PyMem_Calloc(count + 1, sizeof(unsigned char*));
+    outputbuf = PyMem_Calloc(count + 1, sizeof(unsigned char*));
+    zipids = PyMem_Calloc(count + 1, sizeof(int));
+    ret = PyMem_Calloc(count + 1, sizeof(int));
+    flaglist = PyMem_Calloc(count + 1, sizeof(int));
+    errcode = PyMem_Calloc(count + 1, sizeof(int));
+
+    if (!bufs || !inputsize || !outputsize || !inputstr || !outputbuf || !zipids || !ret || !flaglist || !errcode) {
+        PyErr_NoMemory();
+        goto done;
+    }
 
-    if (errcode < 0) {
-        if (outputbuf) {
-            free(outputbuf);
+    /* pack flags the same way as zmat.zmat(), each item is coded by one thread */
+    flags.param.clevel = (char)iscompress;
+    flags.param.nthread = 1;
+
+    for (nbuf = 0; nbuf < count; nbuf++) {
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, nbuf), bufs + nbuf, PyBUF_SIMPLE) < 0) {
+            goto done;
         }
 
-        PyErr_Format(PyExc_RuntimeError, "zmat decompression error %d: %s (status=%d)",
-                     errcode, zmat_error(-errcode), ret);
-        return NULL;
+        inputsize[nbuf] = (size_t)bufs[nbuf].len;
+        inputstr[nbuf] = (unsigned char*)bufs[nbuf].buf;
+        zipids[nbuf] = frame ? (zipid | ZMAT_FRAME) : zipid;
+        flaglist[nbuf] = flags.iscompress;
+    }
+
+    if (pyzmat_dict_arg(dictarg, flags.iscompress, &owned, &dict) < 0) {
+        goto done;
+    }
+
+    /* the pool threads coding the items take both settings from this thread */
+    zmat_set_blosc2(tuned ? &params : NULL);
+    zmat_set_dict(dict);
+    Py_BEGIN_ALLOW_THREADS
+    zmat_run_batch((size_t)count, inputsize, inputstr, outputsize, outputbuf,
+                   zipids, ret, flaglist, errcode, nthread);
+    Py_END_ALLOW_THREADS
+    zmat_set_blosc2(NULL);
+    zmat_set_dict(NULL);
+
+    for (i = 0; i < count; i++) {
+        if (errcode[i] < 0 && !(errcode[i] == -1 && inputsize[i] == 0)) {
+            PyErr_Format(PyExc_RuntimeError, "zmat batch item %zd error %d: %s (status=%d)",
+                         i, errcode[i], zmat_error(-errcode[i]), ret[i]);
+            goto done;
+        }
+    }
+
+    if (!(result = PyList_New(count))) {
+        goto done;
+    }
+
+    for (i = 0; i < count; i++) {
+        PyObject* item = PyBytes_FromStringAndSize((const char*)outputbuf[i], (Py_ssize_t)outputsize[i]);
+
+        if (item == NULL) {
+            Py_CLEAR(result);
+            goto done;
+        }
+
+        PyList_SET_ITEM(result, i, item);
     }
 
-    PyObject* result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+done:
 
-    if (outputbuf) {
-        free(outputbuf);
+    for (i = 0; i < nbuf; i++) {
+        PyBuffer_Release(bufs + i);
     }
 
+    for (i = 0; outputbuf && i < count; i++) {
+        free(outputbuf[i]);
+    }
+
+    PyMem_Free(bufs);
+    PyMem_Free(inputsize);
+    PyMem_Free(outputsize);
+    PyMem_Free(inputstr);
+    PyMem_Free(outputbuf);
+    PyMem_Free(zipids);
+    PyMem_Free(ret);
+    PyMem_Free(flaglist);
+    PyMem_Free(errcode);
+    zmat_dict_free(&owned);
+    Py_DECREF(seq);
     return result;
 }
 
 /**
- * @brief Convenience function: base64 encode
+ * @brief Decode a byte range of a compressed buffer
  *
- * zmat.encode(data, method='base64')
+ * zmat.decode_range(data, offset, length=-1, method='gzip', frame=False, container=False)
+ *
+ * length < 0 reads to the end of the data; gzip and zstd streams written with
+ * index=True, and containers, are decoded only where the range lies
  */
-static PyObject* pyzmat_encode(PyObject* self, PyObject* args, PyObject* kwargs) {
+static PyObject* pyzmat_decode_range(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_buffer input_buf;
-    const char* method = "base64";
+    Py_ssize_t offset = 0, length = -1;
+    const char* method = "gzip";
+    unsigned char* outputbuf = NULL;
+    size_t outputsize = 0;
+    PyObject* result;
+    int frame = 0, container = 0, ret = 0, errcode;
 
-    static char* kwlist[] = {"data", "method", NULL};
+    static char* kwlist[] = {"data", "offset", "length", "method", "frame", "container", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|s", kwlist,
-                                     &input_buf, &method)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*n|nspp", kwlist,
+                                     &input_buf, &offset, &length, &method, &frame, &container)) {
+        return NULL;
+    }
+
+    TZipMethod zipid = pyzmat_method_lookup(method);
+
+    if (zipid == zmUnknown || offset < 0) {
+        PyBuffer_Release(&input_buf);
+        PyErr_Format(PyExc_ValueError, (offset < 0) ? "offset must not be negative" : "unsupported compression method '%s'", method);
         return NULL;
     }
 
@@ -331,145 +840,487 @@ static PyObject* pyzmat_encode(PyObject* self, PyObject* args, PyObject* kwargs)
         return PyBytes_FromStringAndSize("", 0);
     }
 
-    TZipMethod zipid = pyzmat_method_lookup(method);
+    Py_BEGIN_ALLOW_THREADS
+    errcode = zmat_decode_range((size_t)input_buf.len, (unsigned char*)input_buf.buf, (size_t)offset,
+                                (length < 0) ? (size_t)(-1) : (size_t)length, &outputsize, &outputbuf,
+                                (frame ? ZMAT_FRAME : 0) | (container ? ZMAT_CONTAINER : 0) | zipid, &ret);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input_buf);
 
-    if (zipid == zmUnknown) {
-        PyBuffer_Release(&input_buf);
-        PyErr_Format(PyExc_ValueError, "unsupported method '%s'", method);
+    if (errcode != 0) {
+        zmat_free(&outputbuf);
+        PyErr_Format(PyExc_RuntimeError, "zmat range decoding: %s (error code: %d, status: %d)",
+                     zmat_error(-errcode), errcode, ret);
         return NULL;
     }
 
-    unsigned char* outputbuf = NULL;
-    size_t outputsize = 0;
-    int ret = 0;
-
-    int errcode = zmat_run(
-        (size_t)input_buf.len,
-        (unsigned char*)input_buf.buf,
-        &outputsize,
-        &outputbuf,
-        zipid,
-        &ret,
-        1
-    );
+    result = PyBytes_FromStringAndSize((const char*)outputbuf, (Py_ssize_t)outputsize);
+    zmat_free(&outputbuf);
+    return result;
+}
+
+/**
+ * @brief Read the zmat frame header of a buffer without decoding it
+ *
+ * zmat.peek(data)
+ *
+ * @return dict with method, size, typesize and shuffle, or None if data
+ *         does not start with a zmat frame
+ */
+static PyObject* pyzmat_peek(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    TZMatFrame frame;
+    const char* method = NULL;
+    int i, errcode;
 
+    static char* kwlist[] = {"data", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*", kwlist, &input_buf)) {
+        return NULL;
+    }
+
+    errcode = zmat_peek((size_t)input_buf.len, (const unsigned char*)input_buf.buf, &frame);
     PyBuffer_Release(&input_buf);
 
-    if (errcode < 0) {
-        if (outputbuf) {
-            free(outputbuf);
+    if (errcode != 0) {
+        Py_RETURN_NONE;
+    }
+
+    for (i = 0; zipmethodid[i] != zmUnknown; i++) {
+        if (zipmethodid[i] == frame.method) {
+            method = zipmethods[i];
+            break;
+        }
+    }
+
+    if (method == NULL) {
+        PyErr_Format(PyExc_ValueError, "zmat frame method %d is not supported by this build", frame.method);
+        return NULL;
+    }
+
+    return Py_BuildValue("{s:s,s:n,s:i,s:i}", "method", method, "size", (Py_ssize_t)frame.size,
+                         "typesize", frame.typesize, "shuffle", frame.shuffle);
+}
+
+/**
+ * @brief Read a sequence of at most 8 non-negative integers into a size_t array
+ *
+ * @return the number of items, or -1 with an exception set
+ */
+static int pyzmat_dims(PyObject* obj, size_t* dims, const char* name) {
+    PyObject* seq;
+    Py_ssize_t i, count;
+
+    if (!(seq = PySequence_Fast(obj, "shape, start and stop must be sequences of integers"))) {
+        return -1;
+    }
+
+    count = PySequence_Fast_GET_SIZE(seq);
+
+    if (count < 1 || count > 8) {
+        Py_DECREF(seq);
+        PyErr_Format(PyExc_ValueError, "%s must have 1 to 8 dimensions", name);
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        Py_ssize_t dim = PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, i), PyExc_OverflowError);
+
+        if (dim < 0) {
+            Py_DECREF(seq);
+
+            if (!PyErr_Occurred()) {
+                PyErr_Format(PyExc_ValueError, "%s must not be negative", name);
+            }
+
+            return -1;
         }
 
-        PyErr_Format(PyExc_RuntimeError, "zmat encode error %d: %s (status=%d)",
-                     errcode, zmat_error(-errcode), ret);
+        dims[i] = (size_t)dim;
+    }
+
+    Py_DECREF(seq);
+    return (int)count;
+}
+
+/**
+ * @brief Compress a C-order N-dimensional array into a b2nd frame
+ *
+ * zmat.b2nd_compress(data, shape, typesize=0, dtype=None, level=1, nthread=0,
+ *                    filters=None, filters_meta=None, splitmode=0, method='b2nd', compmeta=0)
+ *
+ * typesize 0 derives the element length from len(data) and shape; the
+ * blocks follow the shape, so there is no blocksize keyword; method may
+ * also name a zfp or ndlz codec, which are only supported in b2nd frames
+ */
+static PyObject* pyzmat_b2nd_compress(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    PyObject* shapeobj, *result;
+    const char* dtype = NULL;
+    int typesize = 0, level = 1, nthread = 0, ndim, ret = 0, errcode;
+    size_t shape[8], outputsize = 0;
+    unsigned char* outputbuf = NULL;
+    union TZMatFlags flags = {0};
+    PyObject* filters = NULL, *meta = NULL;
+    int splitmode = 0, compmeta = 0, tuned;
+    TZMatBlosc2Params params;
+
+    const char* method = "b2nd";
+    TZipMethod zipid;
+
+    static char* kwlist[] = {"data", "shape", "typesize", "dtype", "level", "nthread",
+                             "filters", "filters_meta", "splitmode", "method", "compmeta", NULL
+                            };
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*O|iziiOOisi", kwlist,
+                                     &input_buf, &shapeobj, &typesize, &dtype, &level, &nthread,
+                                     &filters, &meta, &splitmode, &method, &compmeta)) {
+        return NULL;
+    }
+
+    zipid = pyzmat_method_lookup(method);
+
+    if (zipid != zmB2nd && (zipid < zmBlosc2ZfpAcc || zipid > zmBlosc2Ndlz)) {
+        PyBuffer_Release(&input_buf);
+        PyErr_Format(PyExc_ValueError, "method '%s' does not write b2nd frames", method);
         return NULL;
     }
 
-    PyObject* result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+    if ((ndim = pyzmat_dims(shapeobj, shape, "shape")) < 0 ||
+            (tuned = pyzmat_blosc2_params(filters, meta, 0, splitmode, compmeta, &params)) < 0) {
+        PyBuffer_Release(&input_buf);
+        return NULL;
+    }
+
+    flags.param.clevel = (char)((level >= 1) ? 1 : level);
+    flags.param.nthread = (char)nthread;
+    flags.param.typesize = (char)typesize;
+
+    zmat_set_blosc2(tuned ? &params : NULL);
+    Py_BEGIN_ALLOW_THREADS
+    errcode = zmat_b2nd_write((size_t)input_buf.len, (unsigned char*)input_buf.buf, ndim, shape, dtype,
+                              &outputsize, &outputbuf, zipid, &ret, flags.iscompress);
+    Py_END_ALLOW_THREADS
+    zmat_set_blosc2(NULL);
+    PyBuffer_Release(&input_buf);
 
-    if (outputbuf) {
-        free(outputbuf);
+    if (errcode != 0) {
+        zmat_free(&outputbuf);
+        PyErr_Format(PyExc_RuntimeError, "zmat b2nd compression: %s (error code: %d, status: %d)",
+                     zmat_error(-errcode), errcode, ret);
+        return NULL;
     }
 
+    result = PyBytes_FromStringAndSize((const char*)outputbuf, (Py_ssize_t)outputsize);
+    zmat_free(&outputbuf);
     return result;
 }
 
 /**
- * @brief Convenience function: base64 decode
+ * @brief Decode the sub-array [start, stop) of a b2nd frame
  *
- * zmat.decode(data, method='base64')
+ * zmat.b2nd_slice(data, start=None, stop=None, nthread=0)
+ *
+ * only the chunks and blocks intersecting the slice are decompressed; the
+ * result is the C-order bytes of the stop - start sub-array
  */
-static PyObject* pyzmat_decode(PyObject* self, PyObject* args, PyObject* kwargs) {
+static PyObject* pyzmat_b2nd_slice(PyObject* self, PyObject* args, PyObject* kwargs) {
     Py_buffer input_buf;
-    const char* method = "base64";
+    PyObject* startobj = Py_None, *stopobj = Py_None, *result;
+    int nthread = 0, nstart = 0, nstop = 0, ndim, typesize, ret = 0, errcode;
+    size_t start[8], stop[8], shape[8], outputsize = 0;
+    unsigned char* outputbuf = NULL;
 
-    static char* kwlist[] = {"data", "method", NULL};
+    static char* kwlist[] = {"data", "start", "stop", "nthread", NULL};
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|s", kwlist,
-                                     &input_buf, &method)) {
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|OOi", kwlist,
+                                     &input_buf, &startobj, &stopobj, &nthread)) {
         return NULL;
     }
 
-    if (input_buf.len == 0) {
+    if (zmat_b2nd_shape((size_t)input_buf.len, (const unsigned char*)input_buf.buf, &ndim, shape, &typesize) != 0) {
         PyBuffer_Release(&input_buf);
-        return PyBytes_FromStringAndSize("", 0);
+        PyErr_SetString(PyExc_ValueError, "data is not a b2nd array");
+        return NULL;
     }
 
-    TZipMethod zipid = pyzmat_method_lookup(method);
+    if ((startobj != Py_None && (nstart = pyzmat_dims(startobj, start, "start")) < 0)
+            || (stopobj != Py_None && (nstop = pyzmat_dims(stopobj, stop, "stop")) < 0)) {
+        PyBuffer_Release(&input_buf);
+        return NULL;
+    }
 
-    if (zipid == zmUnknown) {
+    if ((startobj != Py_None && nstart != ndim) || (stopobj != Py_None && nstop != ndim)) {
         PyBuffer_Release(&input_buf);
-        PyErr_Format(PyExc_ValueError, "unsupported method '%s'", method);
+        PyErr_Format(PyExc_ValueError, "start and stop must have %d dimensions", ndim);
         return NULL;
     }
 
-    unsigned char* outputbuf = NULL;
-    size_t outputsize = 0;
-    int ret = 0;
-
-    int errcode = zmat_run(
-        (size_t)input_buf.len,
-        (unsigned char*)input_buf.buf,
-        &outputsize,
-        &outputbuf,
-        zipid,
-        &ret,
-        0
-    );
+    Py_BEGIN_ALLOW_THREADS
+    errcode = zmat_b2nd_slice((size_t)input_buf.len, (unsigned char*)input_buf.buf, (startobj != Py_None) ? start : NULL,
+                              (stopobj != Py_None) ? stop : NULL, &outputsize, &outputbuf, &ret, nthread);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&input_buf);
 
+    if (errcode != 0) {
+        zmat_free(&outputbuf);
+        PyErr_Format((errcode == -15) ? PyExc_IndexError : PyExc_RuntimeError, "zmat b2nd slice: %s (error code: %d, status: %d)",
+                     zmat_error(-errcode), errcode, ret);
+        return NULL;
+    }
+
+    result = PyBytes_FromStringAndSize((const char*)outputbuf, (Py_ssize_t)outputsize);
+    zmat_free(&outputbuf);
+    return result;
+}
+
+/**
+ * @brief Read the shape of a b2nd frame without decoding it
+ *
+ * zmat.b2nd_shape(data)
+ *
+ * @return dict with shape (tuple) and typesize, or None if data is not a b2nd frame
+ */
+static PyObject* pyzmat_b2nd_shape(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    PyObject* shapeobj;
+    size_t shape[8];
+    int ndim, typesize, i, errcode;
+
+    static char* kwlist[] = {"data", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*", kwlist, &input_buf)) {
+        return NULL;
+    }
+
+    errcode = zmat_b2nd_shape((size_t)input_buf.len, (const unsigned char*)input_buf.buf, &ndim, shape, &typesize);
     PyBuffer_Release(&input_buf);
 
-    if (errcode < 0) {
-        if (outputbuf) {
-            free(outputbuf);
+    if (errcode != 0) {
+        Py_RETURN_NONE;
+    }
+
+    if (!(shapeobj = PyTuple_New(ndim))) {
+        return NULL;
+    }
+
+    for (i = 0; i < ndim; i++) {
+        PyTuple_SET_ITEM(shapeobj, i, PyLong_FromSize_t(shape[i]));
+    }
+
+    return Py_BuildValue("{s:N,s:i}", "shape", shapeobj, "typesize", typesize);
+}
+
+/**
+ * @brief Train a dictionary from a sequence of small samples
+ *
+ * zmat.dict_train(samples, size=112640)
+ *
+ * @return the dictionary as bytes, or NULL with an exception set
+ */
+static PyObject* pyzmat_dict_train(PyObject* self, PyObject* args, PyObject* kwargs) {
+    PyObject* data, *seq, *result = NULL;
+    Py_ssize_t size = ZMAT_DICT_CAPACITY, i, count, nbuf = 0;
+    Py_buffer* bufs = NULL;
+    size_t* samplesize = NULL, dictsize = 0;
+    unsigned char** samples = NULL, *dictbuf = NULL;
+    int ret = 0, errcode;
+
+    static char* kwlist[] = {"samples", "size", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|n", kwlist, &data, &size)) {
+        return NULL;
+    }
+
+    if (!(seq = PySequence_Fast(data, "samples must be a sequence of bytes-like objects"))) {
+        return NULL;
+    }
+
+    count = PySequence_Fast_GET_SIZE(seq);
+    bufs = PyMem_Calloc(count + 1, sizeof(Py_buffer));
+    samplesize = PyMem_Calloc(count + 1, sizeof(size_t));
+    samples = PyMem_Calloc(count + 1, sizeof(unsigned char*));
+
+    if (!bufs || !samplesize || !samples) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (nbuf = 0; nbuf < count; nbuf++) {
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(seq, nbuf), bufs + nbuf, PyBUF_SIMPLE) < 0) {
+            goto done;
         }
 
-        PyErr_Format(PyExc_RuntimeError, "zmat decode error %d: %s (status=%d)",
-                     errcode, zmat_error(-errcode), ret);
+        samplesize[nbuf] = (size_t)bufs[nbuf].len;
+        samples[nbuf] = (unsigned char*)bufs[nbuf].buf;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    errcode = zmat_dict_train((size_t)count, samplesize, samples, (size > 0) ? (size_t)size : 0, &dictsize, &dictbuf, &ret);
+    Py_END_ALLOW_THREADS
+
+    if (errcode != 0) {
+        PyErr_Format(PyExc_RuntimeError, "zmat dict_train error %d: %s (status=%d)", errcode, zmat_error(-errcode), ret);
+        goto done;
+    }
+
+    result = PyBytes_FromStringAndSize((const char*)dictbuf, (Py_ssize_t)dictsize);
+    zmat_free(&dictbuf);
+
+done:
+
+    for (i = 0; i < nbuf; i++) {
+        PyBuffer_Release(bufs + i);
+    }
+
+    PyMem_Free(bufs);
+    PyMem_Free(samplesize);
+    PyMem_Free(samples);
+    Py_DECREF(seq);
+    return result;
+}
+
+/**
+ * @brief Capsule destructor of a dictionary handle
+ */
+static void pyzmat_dict_release(PyObject* capsule) {
+    TZMatDict* dict = (TZMatDict*)PyCapsule_GetPointer(capsule, "zmat.dict");
+
+    zmat_dict_free(&dict);
+}
+
+/**
+ * @brief Digest a dictionary once for many compress/decompress/batch calls
+ *
+ * zmat.dict_load(data, level=1)
+ *
+ * @return a "zmat.dict" capsule owning the handle, or NULL with an exception set
+ */
+static PyObject* pyzmat_dict_load(PyObject* self, PyObject* args, PyObject* kwargs) {
+    Py_buffer input_buf;
+    int level = 1, errcode;
+    union TZMatFlags flags = {0};
+    TZMatDict* dict = NULL;
+    PyObject* result;
+
+    static char* kwlist[] = {"data", "level", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|i", kwlist, &input_buf, &level)) {
         return NULL;
     }
 
-    PyObject* result = PyBytes_FromStringAndSize((const char*)outputbuf, outputsize);
+    flags.param.clevel = (char)((level >= 1) ? 1 : -level);
+    errcode = zmat_dict_init(&dict, (size_t)input_buf.len, (const unsigned char*)input_buf.buf, flags.iscompress);
+    PyBuffer_Release(&input_buf);
 
-    if (outputbuf) {
-        free(outputbuf);
+    if (errcode != 0) {
+        PyErr_Format(PyExc_ValueError, "invalid dictionary, error %d: %s", errcode, zmat_error(-errcode));
+        return NULL;
+    }
+
+    if (!(result = PyCapsule_New(dict, "zmat.dict", pyzmat_dict_release))) {
+        zmat_dict_free(&dict);
     }
 
     return result;
 }
 
+/**
+ * @brief Set the largest single output buffer the library allocates
+ *
+ * zmat.set_max_alloc(limit=0)
+ *
+ * @return the previous limit in bytes
+ */
+static PyObject* pyzmat_set_max_alloc(PyObject* self, PyObject* args, PyObject* kwargs) {
+    unsigned long long limit = 0;
+
+    static char* kwlist[] = {"limit", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|K", kwlist, &limit)) {
+        return NULL;
+    }
+
+    if (limit > (unsigned long long)((size_t)(-1))) {
+        PyErr_SetString(PyExc_OverflowError, "limit exceeds the address space");
+        return NULL;
+    }
+
+    return PyLong_FromSize_t(zmat_set_max_alloc((size_t)limit));
+}
+
 /* Module method table */
 static PyMethodDef ZmatMethods[] = {
     {"zmat",       (PyCFunction)pyzmat_zmat,       METH_VARARGS | METH_KEYWORDS,
-     "zmat(data, iscompress=1, method='zlib', nthread=1, shuffle=1, typesize=4)\n\n"
+     "zmat(data, iscompress=1, method='zlib', nthread=1, shuffle=-1, typesize=4, size=0, frame=False,\n"
+     "     filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0)\n\n"
      "Low-level compression/decompression interface.\n\n"
      "Args:\n"
      "    data (bytes): Input data buffer\n"
      "    iscompress (int): 1=compress, 0=decompress, negative=set compression level\n"
-     "    method (str): 'zlib','gzip','lzma','lzip','xz','lz4','lz4hc','zstd','base64',\n"
-     "                  'blosc2blosclz','blosc2lz4','blosc2lz4hc','blosc2zlib','blosc2zstd'\n"
-     "    nthread (int): Thread count for lzip, xz, zstd, and blosc2 (default 1)\n"
-     "    shuffle (int): Shuffle flag for blosc2 (default 1)\n"
-     "    typesize (int): Element byte size for blosc2 shuffle (default 4)\n\n"
+     "    method (str): 'zlib','gzip','lzma','lzip','xz','lz4','lz4hc','lz4f','zstd','base64',\n"
+     "                  'blosc2blosclz','blosc2lz4','blosc2lz4hc','blosc2zlib','blosc2zstd','b2nd',\n"
+     "                  'blosc2zfp-acc','blosc2zfp-prec','blosc2zfp-rate','blosc2ndlz'; the last four\n"
+     "                  write b2nd frames, use b2nd_compress() to keep the array shape\n"
+     "    nthread (int): Thread count for zlib, gzip, lzip, xz, lz4f, zstd, and blosc2 (default 1,\n"
+     "        0 for one thread per 4 MB of input); all calls share one thread pool\n"
+     "        capped by ZMAT_NUM_THREADS, OMP_NUM_THREADS or the CPU count\n"
+     "    shuffle (int): Shuffle flag, 1 byte shuffle, 2 bit shuffle: blosc2 shuffles each block\n"
+     "        (0 for the default byte shuffle), zlib, gzip, lzma, lzip, xz, lz4 and zstd the\n"
+     "        whole input, also needed to decompress them (default -1: 1 for blosc2, else 0)\n"
+     "    typesize (int): Element byte size for the shuffle (default 4)\n"
+     "    size (int): Expected decompressed length if known (default 0)\n"
+     "    frame (bool): Write/read a zmat frame header around the payload (default False)\n"
+     "    filters (list): blosc2 filter pipeline replacing shuffle, run in order, of up to 6\n"
+     "        names or ids: 'nofilter' (0), 'shuffle' (1), 'bitshuffle' (2), 'delta' (3),\n"
+     "        'truncprec' (4) (default None)\n"
+     "    filters_meta (list): Parameter of each filter, e.g. the mantissa bits kept by\n"
+     "        'truncprec' (default None)\n"
+     "    blocksize (int): blosc2 block length in bytes, 0 for auto (default 0)\n"
+     "    splitmode (int): blosc2 split of the blocks by byte, 1 always, 2 never, 3 auto,\n"
+     "        0 for the default (default 0)\n"
+     "    compmeta (int): zfp or ndlz parameter, 0 for the default: the zfp-acc error bound\n"
+     "        exponent (-3, i.e. 1e-3), the zfp-prec bit precision (16), the zfp-rate\n"
+     "        percentage of the input size (25) or the ndlz cell size, 4 or 8 (4)\n\n"
      "Returns:\n"
      "    bytes: Compressed or decompressed data"},
 
     {"compress",   (PyCFunction)pyzmat_compress,   METH_VARARGS | METH_KEYWORDS,
-     "compress(data, method='zlib', level=1)\n\n"
+     "compress(data, method='zlib', level=1, frame=False, index=False, container=False,\n"
+     "         filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0, shuffle=0, typesize=0,\n"
+     "         base64=False, dictionary=None)\n\n"
      "Compress data using the specified method.\n\n"
      "Args:\n"
      "    data (bytes): Input data to compress\n"
      "    method (str): Compression method (default 'zlib')\n"
-     "    level (int): Compression level, 1=default, higher=more compression\n\n"
+     "    level (int): Compression level, 1=default, higher=more compression\n"
+     "    frame (bool): Prepend a zmat frame header, see peek() (default False)\n"
+     "    index (bool): Write an indexed gzip or seekable zstd stream, see decode_range() (default False)\n"
+     "    container (bool): Write a zmat container of 4 MB chunks, compressed in parallel (default False)\n"
+     "    shuffle (int): Byte (1) or bit (2) shuffle of typesize-byte elements before the zlib, gzip,\n"
+     "        lzma, lzip, xz, lz4 or zstd codec; decompress() needs the same values (default 0)\n"
+     "    typesize (int): Element byte size for the shuffle (default 0)\n"
+     "    filters, filters_meta, blocksize, splitmode, compmeta: blosc2 filter pipeline, blocks\n"
+     "        and codec parameter, see zmat()\n"
+     "    base64 (bool): Return the compressed data base64 encoded, in one pass (default False)\n"
+     "    dictionary: Handle from dict_load(), or dictionary bytes, used by zlib, zstd, lz4\n"
+     "        and lz4hc; decompress() needs the same one (default None)\n\n"
      "Returns:\n"
      "    bytes: Compressed data"},
 
     {"decompress", (PyCFunction)pyzmat_decompress, METH_VARARGS | METH_KEYWORDS,
-     "decompress(data, method='zlib')\n\n"
+     "decompress(data, method='zlib', size=0, frame=False, container=False, shuffle=0, typesize=0,\n"
+     "           base64=False, dictionary=None)\n\n"
      "Decompress data using the specified method.\n\n"
      "Args:\n"
      "    data (bytes): Compressed input data\n"
-     "    method (str): Compression method used (default 'zlib')\n\n"
+     "    method (str): Compression method used (default 'zlib')\n"
+     "    size (int): Expected decompressed length if known (default 0)\n"
+     "    frame (bool): Input starts with a zmat frame header, whose method is used (default False)\n"
+     "    container (bool): Input is a zmat container, whose method is used (default False)\n"
+     "    shuffle, typesize (int): Shuffle given to compress(); frames and containers record it\n"
+     "    base64 (bool): Input is base64 text from compress(..., base64=True) (default False)\n"
+     "    dictionary: Dictionary given to compress() (default None)\n\n"
      "Returns:\n"
      "    bytes: Decompressed data"},
 
@@ -491,6 +1342,113 @@ static PyMethodDef ZmatMethods[] = {
      "Returns:\n"
      "    bytes: Decoded data"},
 
+    {"batch",      (PyCFunction)pyzmat_batch,      METH_VARARGS | METH_KEYWORDS,
+     "batch(data, iscompress=1, method='zlib', nthread=4, frame=False,\n"
+     "      filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0, dictionary=None)\n\n"
+     "Compress or decompress many independent buffers in parallel.\n\n"
+     "Args:\n"
+     "    data (list): Sequence of bytes-like input buffers\n"
+     "    iscompress (int): 1=compress, 0=decompress, negative=set compression level\n"
+     "    method (str): Compression method used for all items (default 'zlib')\n"
+     "    nthread (int): Number of worker threads, largest items first (default 4,\n"
+     "        0 for the thread limit)\n"
+     "    frame (bool): Write/read a zmat frame header around each payload (default False)\n"
+     "    filters, filters_meta, blocksize, splitmode, compmeta: blosc2 filter pipeline, blocks\n"
+     "        and codec parameter, see zmat()\n"
+     "    dictionary: Dictionary of every item, see compress() (default None)\n\n"
+     "Returns:\n"
+     "    list: Compressed or decompressed bytes of each item"},
+
+    {"dict_train", (PyCFunction)pyzmat_dict_train, METH_VARARGS | METH_KEYWORDS,
+     "dict_train(samples, size=112640)\n\n"
+     "Train a dictionary from many small samples of similar data (zstd dictionary builder).\n\n"
+     "Args:\n"
+     "    samples (list): Sequence of bytes-like samples, a few hundred or more work best\n"
+     "    size (int): Largest dictionary length in bytes (default 112640)\n\n"
+     "Returns:\n"
+     "    bytes: The dictionary, for dict_load() or the dictionary argument"},
+
+    {"dict_load",  (PyCFunction)pyzmat_dict_load,  METH_VARARGS | METH_KEYWORDS,
+     "dict_load(data, level=1)\n\n"
+     "Digest a dictionary once, for reuse by many compress(), decompress() and batch() calls.\n\n"
+     "Args:\n"
+     "    data (bytes): Dictionary from dict_train(), or any byte string\n"
+     "    level (int): Compression level the zstd and lz4hc states are prepared for (default 1)\n\n"
+     "Returns:\n"
+     "    object: Dictionary handle, freed when released"},
+
+    {"decode_range", (PyCFunction)pyzmat_decode_range, METH_VARARGS | METH_KEYWORDS,
+     "decode_range(data, offset, length=-1, method='gzip', frame=False, container=False)\n\n"
+     "Decode only length bytes starting at offset of the decompressed data.\n\n"
+     "Args:\n"
+     "    data (bytes): Compressed input data\n"
+     "    offset (int): Offset of the first decompressed byte to return\n"
+     "    length (int): Number of bytes to return, -1 to the end (default -1)\n"
+     "    method (str): Compression method used (default 'gzip')\n"
+     "    frame (bool): Input starts with a zmat frame header, whose method is used (default False)\n"
+     "    container (bool): Input is a zmat container (default False)\n\n"
+     "gzip and zstd data written with compress(..., index=True), and containers written with\n"
+     "compress(..., container=True), are decoded only where the range lies;\n"
+     "other zlib/gzip data is inflated up to the end of the range.\n\n"
+     "Returns:\n"
+     "    bytes: The decompressed slice, shorter than length at the end of the data"},
+
+    {"peek",       (PyCFunction)pyzmat_peek,       METH_VARARGS | METH_KEYWORDS,
+     "peek(data)\n\n"
+     "Read the zmat frame header written with frame=True, without decoding.\n\n"
+     "Args:\n"
+     "    data (bytes): Framed compressed data\n\n"
+     "Returns:\n"
+     "    dict: 'method', 'size' (uncompressed length), 'typesize' and 'shuffle',\n"
+     "          or None if data does not start with a zmat frame"},
+
+    {"b2nd_compress", (PyCFunction)pyzmat_b2nd_compress, METH_VARARGS | METH_KEYWORDS,
+     "b2nd_compress(data, shape, typesize=0, dtype=None, level=1, nthread=0,\n"
+     "              filters=None, filters_meta=None, splitmode=0, method='b2nd', compmeta=0)\n\n"
+     "Compress a C-order N-dimensional array into a b2nd (blosc2 N-dimensional) frame.\n\n"
+     "Args:\n"
+     "    data (bytes): Array elements in C (row-major) order\n"
+     "    shape (tuple): Length of each dimension, 1 to 8 dimensions\n"
+     "    typesize (int): Element byte size, 0 for len(data) / prod(shape) (default 0)\n"
+     "    dtype (str): NumPy dtype string stored with the array, e.g. '<f4' (default None)\n"
+     "    level (int): Compression level, 1=default (default 1)\n"
+     "    nthread (int): Thread count, 0 for the thread limit (default 0)\n"
+     "    filters, filters_meta, splitmode: blosc2 filter pipeline, see zmat()\n"
+     "    method (str): 'b2nd', or the 'blosc2zfp-acc', 'blosc2zfp-prec', 'blosc2zfp-rate'\n"
+     "        (float32/float64, 1 to 4 dimensions) or 'blosc2ndlz' (2 dimensions) codec (default 'b2nd')\n"
+     "    compmeta (int): zfp or ndlz parameter, see zmat() (default 0)\n\n"
+     "Returns:\n"
+     "    bytes: The b2nd frame, also readable with decompress(data, method='b2nd')"},
+
+    {"b2nd_slice", (PyCFunction)pyzmat_b2nd_slice, METH_VARARGS | METH_KEYWORDS,
+     "b2nd_slice(data, start=None, stop=None, nthread=0)\n\n"
+     "Decode the sub-array [start, stop) of a b2nd frame, decompressing only the\n"
+     "chunks and blocks it intersects.\n\n"
+     "Args:\n"
+     "    data (bytes): b2nd frame\n"
+     "    start (tuple): First index of each dimension, None for 0 (default None)\n"
+     "    stop (tuple): End index (exclusive) of each dimension, None for the shape (default None)\n"
+     "    nthread (int): Thread count, 0 for the thread limit (default 0)\n\n"
+     "Returns:\n"
+     "    bytes: The C-order elements of the stop - start sub-array"},
+
+    {"b2nd_shape", (PyCFunction)pyzmat_b2nd_shape, METH_VARARGS | METH_KEYWORDS,
+     "b2nd_shape(data)\n\n"
+     "Read the shape of a b2nd frame without decoding it.\n\n"
+     "Args:\n"
+     "    data (bytes): b2nd frame\n\n"
+     "Returns:\n"
+     "    dict: 'shape' (tuple) and 'typesize', or None if data is not a b2nd frame"},
+
+    {"set_max_alloc", (PyCFunction)pyzmat_set_max_alloc, METH_VARARGS | METH_KEYWORDS,
+     "set_max_alloc(limit=0)\n\n"
+     "Set the largest single output buffer the library allocates.\n\n"
+     "Args:\n"
+     "    limit (int): Limit in bytes, 0 restores the default: the ZMAT_MAX_ALLOC\n"
+     "                 environment variable, or else 1 GB (32-bit) or 64 GB (64-bit)\n\n"
+     "Returns:\n"
+     "    int: The previous limit"},
+
     {NULL, NULL, 0, NULL}
 };
 
@@ -499,7 +1457,7 @@ static struct PyModuleDef zmatmodule = {
     PyModuleDef_HEAD_INIT,
     "_zmat",
     "ZMat (1.2.preview) — use the 'zmat' package, not this module directly.\n\n"
-    "Supports: zlib, gzip, lzma, lzip, xz, lz4, lz4hc, zstd, blosc2, base64\n\n"
+    "Supports: zlib, gzip, lzma, lzip, xz, lz4, lz4hc, zstd, blosc2, b2nd, base64\n\n"
     "Part of the NeuroJSON project (https://neurojson.org)\n"
     "More information: https://neurojson.org/zmat\n",
     -1,
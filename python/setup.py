@@ -274,6 +274,21 @@ if use_blosc2:
             if _exists(p):
                 sources.append(p)
 
+    # the zfp and ndlz codec plugins, registered by blosc2_init
+    codecs_dir = os.path.join(srcdir, "blosc2", "plugins", "codecs")
+    if _exists(os.path.join(codecs_dir, "codecs-registry.c")):
+        define_macros.append(("HAVE_PLUGINS", "1"))
+        define_macros.append(("NO_FILTER_PLUGINS", "1"))
+        # ahead of zstd/common, which has its own bitstream.h
+        include_dirs.insert(0, os.path.join(codecs_dir, "zfp", "include"))
+        sources.append(os.path.join(codecs_dir, "codecs-registry.c"))
+        for f in ["ndlz.c", "ndlz4x4.c", "ndlz8x8.c", "xxhash.c"]:
+            sources.append(os.path.join(codecs_dir, "ndlz", f))
+        sources.append(os.path.join(codecs_dir, "zfp", "blosc2-zfp.c"))
+        zfp_src = os.path.join(codecs_dir, "zfp", "src")
+        sources.extend(os.path.join(zfp_src, f) for f in sorted(os.listdir(zfp_src))
+                       if f in ("zfp.c", "bitstream.c") or (f.endswith(".c") and f[:6] in ("encode", "decode")))
+
     if platform.system() == "Windows":
         win32_threading = os.path.join(blosc2_dir, "win32", "threading.c")
         if _exists(win32_threading):
@@ -248,6 +248,286 @@ class TestZmatLowLevel(unittest.TestCase):
         self.assertEqual(zmat.decompress(c2, method="zlib"), data)
         self.assertEqual(zmat.decompress(c3, method="zlib"), data)
 
+    def test_decompress_size_hint(self):
+        """Test that a correct, short or long size hint all decode the same data."""
+        data = bytes(range(256)) * 400
+        for method in ["zlib", "gzip", "lzma", "lz4"]:
+            compressed = zmat.compress(data, method=method)
+            for size in [0, len(data), 10, len(data) * 2]:
+                self.assertEqual(zmat._decompress(compressed, method=method, size=size), data)
+                self.assertEqual(zmat._zmat_c(compressed, iscompress=0, method=method, size=size), data)
+
+    def test_frame_peek(self):
+        """Test that a framed buffer records its method and length and decodes without the method."""
+        data = bytes(range(256)) * 400
+        self.assertIsNone(zmat.peek(zmat.compress(data)))
+        for method in ["zlib", "gzip", "base64", "lzma", "lz4", "zstd", "blosc2zstd"]:
+            compressed = zmat.compress(data, method=method, frame=True)
+            meta = zmat.peek(compressed)
+            self.assertEqual(meta["method"], method)
+            self.assertEqual(meta["size"], len(data))
+            self.assertEqual(zmat.decompress(compressed, frame=True), data)
+            with self.assertRaises(RuntimeError):
+                zmat.decompress(compressed[:8] + b"\xff" + compressed[9:], frame=True)
+
+    def test_batch(self):
+        """Test that batch() matches per-item compression and round-trips every item."""
+        items = [bytes(range(256)) * n for n in (400, 1, 0, 37, 2000)] + [b"zmat test"] * 20
+        for method in ["zlib", "lz4", "zstd", "base64"]:
+            for nthread in [1, 4]:
+                packed = zmat.batch(items, method=method, nthread=nthread)
+                self.assertEqual(len(packed), len(items))
+                self.assertEqual(packed[0], zmat.compress(items[0], method=method))
+                self.assertEqual(zmat.batch(packed, iscompress=0, method=method, nthread=nthread), items)
+        with self.assertRaises(RuntimeError):
+            zmat.batch([zmat.compress(items[0]), b"not zlib data"], iscompress=0)
+
+    def test_lzip_members_parallel(self):
+        """Test a multi-member lzip stream decodes the same with 1 and 4 threads."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(200000))
+        packed = zmat.zmat(data, iscompress=1, method="lzip", nthread=4)
+        self.assertEqual(packed[4], 1)  # lzip v1 members with member_size footers
+        for nthread in [1, 4, 0]:
+            self.assertEqual(zmat.zmat(packed, iscompress=0, method="lzip", nthread=nthread), data)
+            self.assertEqual(zmat.decompress(packed, method="lzip"), data)
+
+    def test_xz_blocks_parallel(self):
+        """Test a multi-block xz stream decodes the same with 1, 4 and auto threads."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(3000000))
+        packed = zmat.zmat(data, iscompress=1, method="xz", nthread=4)
+        for nthread in [1, 4, 0]:
+            self.assertEqual(zmat.zmat(packed, iscompress=0, method="xz", nthread=nthread), data)
+        with self.assertRaises(Exception):
+            zmat.zmat(packed[: len(packed) // 2], iscompress=0, method="xz", nthread=4)
+
+    def test_deflate_blocks_parallel(self):
+        """Test parallel zlib/gzip output is one standard stream, the same for any nthread > 1."""
+        import gzip
+        import zlib
+
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(3000000))
+        for method, inflate in [("zlib", zlib.decompress), ("gzip", gzip.decompress)]:
+            packed = zmat.zmat(data, iscompress=1, method=method, nthread=4)
+            self.assertEqual(packed, zmat.zmat(data, iscompress=1, method=method, nthread=2))
+            self.assertEqual(inflate(packed), data)
+            self.assertEqual(zmat.zmat(packed, iscompress=0, method=method), data)
+
+    def test_gzip_index_range(self):
+        """Test indexed gzip stays standard gzip and decode_range returns the requested slices."""
+        import gzip
+        import zlib
+
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(3000000))
+        packed = zmat.compress(data, method="gzip", index=True)
+        self.assertEqual(gzip.decompress(packed), data)
+        self.assertEqual(zmat.decompress(packed, method="gzip"), data)
+        for offset, length in [(0, 10), (1048570, 20), (2999990, 100), (5, -1), (4000000, 10)]:
+            end = len(data) if length < 0 else offset + length
+            self.assertEqual(zmat.decode_range(packed, offset, length), data[offset:end])
+
+        packed = zlib.compress(data)
+        self.assertEqual(zmat.decode_range(packed, 2000000, 1000, method="zlib"), data[2000000:2001000])
+        with self.assertRaises(RuntimeError):
+            zmat.compress(data, method="zlib", index=True)
+
+    def test_zstd_seekable_range(self):
+        """Test seekable zstd decodes with any nthread and decode_range returns the requested slices."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(3000000))
+        packed = zmat.compress(data, method="zstd", index=True)
+        self.assertEqual(packed[-4:], b"\xb1\xea\x92\x8f")
+        for nthread in (1, 4):
+            self.assertEqual(zmat.zmat(packed, iscompress=0, method="zstd", nthread=nthread), data)
+        for offset, length in [(0, 10), (1048570, 20), (2999990, 100), (5, -1), (4000000, 10)]:
+            end = len(data) if length < 0 else offset + length
+            self.assertEqual(zmat.decode_range(packed, offset, length, method="zstd"), data[offset:end])
+
+    def test_container_range(self):
+        """Test zmat containers round-trip for any method and decode_range returns the requested slices."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(10000000))
+        for method in ("lzma", "zlib", "lz4"):
+            packed = zmat.compress(data, method=method, container=True)
+            self.assertEqual(packed[:4], b"ZMCN")
+            self.assertEqual(zmat.decompress(packed, method=method, container=True), data)
+            for offset, length in [(0, 10), (4194300, 20), (9999990, 100), (5, -1), (12000000, 10)]:
+                end = len(data) if length < 0 else offset + length
+                self.assertEqual(zmat.decode_range(packed, offset, length, container=True), data[offset:end])
+        damaged = bytearray(packed)
+        damaged[len(packed) // 2] ^= 0x40
+        with self.assertRaises(RuntimeError):
+            zmat.decompress(bytes(damaged), method="lz4", container=True)
+
+    def test_base64_fused(self):
+        """Test base64=True gives the text of the two-step encoding and decodes in one call."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(3000000))
+        for method in ("zlib", "gzip", "zstd", "lz4", "lzma"):
+            text = zmat.compress(data, method=method, base64=True)
+            self.assertEqual(zmat.decompress(zmat.decode(text), method=method), data)
+            self.assertEqual(zmat.decompress(text, method=method, base64=True), data)
+        text = zmat.compress(data, method="zlib", base64=True)
+        self.assertEqual(text, zmat.encode(zmat.compress(data, method="zlib")))
+        with self.assertRaises(RuntimeError):
+            zmat.decompress(text[: len(text) // 2], method="zlib", base64=True)
+
+    def test_dictionary(self):
+        """Test a trained dictionary shrinks small records and round-trips with zlib, zstd and lz4."""
+        import zlib
+
+        samples = [('{"_ArrayType_":"double","_ArraySize_":[%d,%d],"name":"item%05d"}'
+                    % (i % 17, i % 5, i)).encode() for i in range(2000)]
+        trained = zmat.dict_train(samples, size=4096)
+        self.assertLessEqual(len(trained), 4096)
+        handle = zmat.dict_load(trained)
+        for method in ("zlib", "zstd", "lz4", "lz4hc"):
+            for dictionary in (handle, trained):
+                packed = zmat.compress(samples[7], method=method, dictionary=dictionary)
+                self.assertLess(len(packed), len(zmat.compress(samples[7], method=method)))
+                self.assertEqual(zmat.decompress(packed, method=method, dictionary=handle), samples[7])
+            packed = zmat.batch(samples[:64], method=method, dictionary=handle)
+            self.assertEqual(zmat.batch(packed, iscompress=0, method=method, dictionary=handle), samples[:64])
+        # a standard zlib stream that names the dictionary by its adler32
+        packed = zmat.compress(samples[7], method="zlib", dictionary=handle)
+        self.assertEqual(zlib.decompressobj(zdict=trained[-32768:]).decompress(packed), samples[7])
+        with self.assertRaises(RuntimeError):
+            zmat.decompress(packed, method="zlib")
+        with self.assertRaises(RuntimeError):
+            zmat.dict_train([])
+
+    def test_blosc2_frame(self):
+        """Test blosc2 inputs longer than one chunk round-trip as a contiguous frame with any nthread."""
+        data = bytes(range(256)) * (160 * 1024) + b"tail"
+        for method in ("blosc2zstd", "blosc2lz4"):
+            packed = zmat.zmat(data, iscompress=1, method=method, nthread=4)
+            self.assertEqual(packed[2:9], b"b2frame")
+            self.assertEqual(packed, zmat.zmat(data, iscompress=1, method=method, nthread=1))
+            for nthread in (1, 4):
+                self.assertEqual(zmat.zmat(packed, iscompress=0, method=method, nthread=nthread), data)
+        self.assertNotEqual(zmat.zmat(data[:1000], iscompress=1, method="blosc2zstd")[2:9], b"b2frame")
+
+    def test_b2nd_slice(self):
+        """Test b2nd arrays round-trip and b2nd_slice returns the requested sub-arrays."""
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(4 * 60 * 70 * 80))
+        packed = zmat.b2nd_compress(data, (60, 70, 80), typesize=4)
+        self.assertEqual(zmat.b2nd_shape(packed), {"shape": (60, 70, 80), "typesize": 4})
+        self.assertEqual(zmat.decompress(packed, method="b2nd"), data)
+        sub = zmat.b2nd_slice(packed, (10, 5, 30), (12, 7, 33))
+        rows = [data[((x * 70 + y) * 80 + 30) * 4:((x * 70 + y) * 80 + 33) * 4] for x in (10, 11) for y in (5, 6)]
+        self.assertEqual(sub, b"".join(rows))
+        self.assertEqual(zmat.b2nd_slice(packed), data)
+        self.assertEqual(zmat.decompress(zmat.compress(data, method="b2nd"), method="b2nd"), data)
+        with self.assertRaises(IndexError):
+            zmat.b2nd_slice(packed, (0, 0, 0), (61, 1, 1))
+        self.assertIsNone(zmat.b2nd_shape(zmat.compress(data, method="zstd")))
+
+    def test_b2nd_corrupt(self):
+        """A b2nd frame with a flipped bit in its header or shapes fails or decodes, but never crashes."""
+        data = bytes(i * 7 // 13 & 0xFF for i in range(4 * 16 * 48 * 16))
+        packed = zmat.b2nd_compress(data, (16, 48, 16), typesize=4)
+        for bit in range(200 * 8):
+            bad = bytearray(packed)
+            bad[bit // 8] ^= 1 << (bit % 8)
+            for call in (lambda: zmat.decompress(bytes(bad), method="b2nd"),
+                         lambda: zmat.b2nd_slice(bytes(bad), (0, 0, 0), (4, 4, 4)),
+                         lambda: zmat.b2nd_shape(bytes(bad))):
+                try:
+                    call()
+                except (RuntimeError, ValueError, IndexError):
+                    pass
+
+    def test_blosc2_filters(self):
+        """Test blosc2 filter pipelines round-trip, trunc-prec is lossy, and invalid settings raise ValueError."""
+        import struct
+
+        data = struct.pack("<100000f", *[(i % 1000) * 0.37 for i in range(100000)])
+        default = zmat.compress(data, method="blosc2zstd")
+        for filters in (["bitshuffle"], ["delta", "shuffle"], [3, 2]):
+            packed = zmat.compress(data, method="blosc2zstd", filters=filters, blocksize=16384, splitmode=2)
+            self.assertNotEqual(packed, default)
+            self.assertEqual(zmat.decompress(packed, method="blosc2zstd"), data)
+        lossy = zmat.compress(data, method="blosc2zstd", filters=["truncprec", "shuffle"], filters_meta=[8, 0])
+        self.assertLess(len(lossy), len(default))
+        self.assertEqual(len(zmat.decompress(lossy, method="blosc2zstd")), len(data))
+        big = data * 30
+        packed = zmat.zmat(big, iscompress=1, method="blosc2lz4", nthread=4, filters=["bitshuffle"])
+        self.assertEqual(zmat.zmat(packed, iscompress=0, method="blosc2lz4", nthread=4), big)
+        packed = zmat.b2nd_compress(data, (100, 1000), typesize=4, filters=["bitshuffle"])
+        self.assertEqual(zmat.b2nd_slice(packed), data)
+        self.assertEqual(zmat.batch([data, data], method="blosc2zstd", filters=["delta"])[0],
+                         zmat.compress(data, method="blosc2zstd", filters=["delta"]))
+        self.assertEqual(zmat.compress(data, method="blosc2zstd"), default)
+        for kwargs in ({"filters": ["median"]}, {"filters": [9]}, {"splitmode": 7}, {"blocksize": -1},
+                       {"filters": ["shuffle"] * 7}, {"filters": ["delta"], "filters_meta": [1, 2]}):
+            with self.assertRaises(ValueError):
+                zmat.compress(data, method="blosc2zstd", **kwargs)
+
+    def test_inflate_speculative_parallel(self):
+        """Test unindexed zlib/gzip streams from other encoders decode the same with any nthread."""
+        import gzip
+        import random
+        import zlib
+
+        alphabet = bytes(97 + (i % 16) for i in range(256))
+        data = random.Random(3).randbytes(10000000).translate(alphabet)
+        for method, packed in [("zlib", zlib.compress(data, 6)), ("gzip", gzip.compress(data, 9, mtime=0))]:
+            for nthread in (1, 4, 0):
+                self.assertEqual(zmat.zmat(packed, iscompress=0, method=method, nthread=nthread), data)
+            damaged = bytearray(packed)
+            damaged[len(packed) // 2] ^= 0x40
+            with self.assertRaises(RuntimeError):
+                zmat.zmat(bytes(damaged), iscompress=0, method=method, nthread=4)
+
+    def test_lz4_frame(self):
+        """Test lz4f writes one LZ4 frame with the content size, the same for any nthread."""
+        import struct
+
+        data = bytes(range(256)) * 40000 + bytes(1000)
+        packed = zmat.zmat(data, iscompress=1, method="lz4f", nthread=1)
+        self.assertEqual(packed[:4], b"\x04\x22\x4d\x18")
+        self.assertEqual(struct.unpack("<Q", packed[6:14])[0], len(data))
+        for nthread in (4, 0):
+            self.assertEqual(zmat.zmat(data, iscompress=1, method="lz4f", nthread=nthread), packed)
+            self.assertEqual(zmat.zmat(packed, iscompress=0, method="lz4f", nthread=nthread), data)
+        self.assertEqual(zmat.zmat(zmat.zmat(data, iscompress=-9, method="lz4f"), iscompress=0, method="lz4f"), data)
+        damaged = bytearray(packed)
+        damaged[len(packed) // 2] ^= 0x40
+        with self.assertRaises(RuntimeError):
+            zmat.zmat(bytes(damaged), iscompress=0, method="lz4f", nthread=4)
+
+    def test_nthread_auto_concurrent(self):
+        """Test nthread=0 (auto) from a Python thread pool; below 4 MB it keeps the 1-thread output."""
+        from concurrent.futures import ThreadPoolExecutor
+
+        data = bytes(range(256)) * 12000
+        methods = ["zlib", "lzip", "zstd", "blosc2lz4"]
+
+        def run(method):
+            packed = zmat.zmat(data, iscompress=1, method=method, nthread=0)
+            return packed, zmat.zmat(packed, iscompress=0, method=method, nthread=0)
+
+        with ThreadPoolExecutor(4) as pool:
+            results = list(pool.map(run, methods * 3))
+        for method, (packed, restored) in zip(methods * 3, results):
+            self.assertEqual(restored, data)
+            if "blosc2" not in method:
+                self.assertEqual(packed, zmat.zmat(data, iscompress=1, method=method, nthread=1))
+
+    def test_blosc2_concurrent(self):
+        """Test blosc2 round-trips with mixed nthread from 8 Python threads, each with its own blosc2 context."""
+        from concurrent.futures import ThreadPoolExecutor
+
+        data = bytes((i * 7 + i // 1000) & 0xFF for i in range(2000000))
+        jobs = [(method, nthread, 1000000 + k * 125000) for k, (method, nthread) in
+                enumerate([(m, n) for m in ("blosc2lz4", "blosc2zstd", "blosc2blosclz") for n in (1, 2, 4, 0)] * 2)]
+
+        def run(job):
+            method, nthread, size = job
+            packed = zmat.zmat(data[:size], iscompress=1, method=method, nthread=nthread)
+            return zmat.zmat(packed, iscompress=0, method=method, nthread=(nthread + 1) % 5) == data[:size]
+
+        with ThreadPoolExecutor(8) as pool:
+            self.assertTrue(all(pool.map(run, jobs)))
+        single = zmat.zmat(data, iscompress=1, method="blosc2lz4", nthread=1)
+        self.assertEqual(single, zmat.zmat(data, iscompress=1, method="blosc2lz4", nthread=4))
+
 
 class TestZmatErrors(unittest.TestCase):
     """Error handling tests (mirrors run_zmat_test.m error tests)."""
@@ -350,6 +630,35 @@ class TestZmatLargeData(unittest.TestCase):
                 decompressed, data, f"{method} round-trip failed on sequential data"
             )
 
+    def test_large_incompressible(self):
+        """Test output close to the codec bound (written in place, then trimmed)."""
+        seed = 12345
+        values = []
+        for i in range(200000):
+            seed = (seed * 1103515245 + 12345) & 0xFFFFFFFF
+            values.append(seed >> 24)
+        data = bytes(values)
+        for method in ["zlib", "gzip", "lz4", "zstd", "base64", "blosc2zstd"]:
+            compressed = zmat.compress(data, method=method)
+            decompressed = zmat.decompress(compressed, method=method)
+            self.assertEqual(
+                decompressed, data, f"{method} round-trip failed on random data"
+            )
+
+    def test_max_alloc(self):
+        """Test set_max_alloc caps the output buffer of decoders and 0 restores the default."""
+        data = b"\x00" * (4 << 20)
+        packed = zmat.compress(data, method="zlib")
+        default = zmat.set_max_alloc(1 << 20)
+        try:
+            self.assertGreaterEqual(default, 1 << 30)
+            with self.assertRaises(RuntimeError):
+                zmat.decompress(packed, method="zlib")
+        finally:
+            self.assertEqual(zmat.set_max_alloc(0), 1 << 20)
+        self.assertEqual(zmat.set_max_alloc(0), default)
+        self.assertEqual(zmat.decompress(packed, method="zlib"), data)
+
 
 class TestZmatBytearray(unittest.TestCase):
     """Test that bytearray input works (buffer protocol)."""
@@ -600,11 +909,84 @@ class TestZmatNumpyInfo(unittest.TestCase):
             "blosc2lz4hc",
             "blosc2zlib",
             "blosc2zstd",
+            "b2nd",
         ]
         for m in methods:
             with self.subTest(method=m):
                 self._round_trip(arr, method=m)
 
+    def test_b2nd_ndarray_slice(self):
+        """An ndarray compressed with b2nd keeps its shape, and b2nd_slice returns sub-arrays."""
+        import numpy as np
+
+        arr = np.random.rand(30, 40, 50, 6).astype(np.float32)
+        compressed, info = zmat.compress(arr, method="b2nd", info=True)
+        self.assertEqual(zmat.b2nd_shape(compressed)["shape"], arr.shape)
+        np.testing.assert_array_equal(zmat.decompress(compressed, info=info), arr)
+        sub = zmat.b2nd_slice(compressed, (3, 0, 10, 2), (9, 40, 11, 5), info=info)
+        np.testing.assert_array_equal(sub, arr[3:9, :, 10:11, 2:5])
+        farr = np.asfortranarray(arr[:, :, 0, 0])
+        compressed, info = zmat.compress(farr, method="b2nd", info=True)
+        np.testing.assert_array_equal(zmat.b2nd_slice(compressed, (1, 2), (4, 40), info=info), farr[1:4, 2:40])
+
+    def test_zfp_ndlz(self):
+        """zfp methods meet their error bound or rate, ndlz is lossless on 2-D arrays, bad compmeta raises."""
+        import numpy as np
+
+        grid = np.mgrid[0:40, 0:50, 0:60].astype(np.float32)
+        vol = np.sin(grid[0] / 7) * np.cos(grid[1] / 5) + grid[2] / 60
+        for compmeta, tol in ((0, 1e-3), (-5, 1e-5)):
+            compressed, info = zmat.compress(vol, method="blosc2zfp-acc", info=True, compmeta=compmeta)
+            self.assertEqual(zmat.b2nd_shape(compressed)["shape"], vol.shape)
+            restored = zmat.decompress(compressed, info=info)
+            self.assertEqual(restored.shape, vol.shape)
+            self.assertLessEqual(float(np.abs(restored - vol).max()), tol)
+        self.assertLess(len(compressed), vol.nbytes // 2)
+        rate = zmat.compress(vol, method="blosc2zfp-rate", compmeta=10)
+        self.assertLess(len(rate), vol.nbytes // 8)
+        for method in ("blosc2zfp-rate", "blosc2zfp-prec"):
+            restored = np.frombuffer(zmat.decompress(zmat.compress(vol, method=method), method=method), np.float32)
+            self.assertLess(float(np.abs(restored.reshape(vol.shape) - vol).max()), 0.1)
+        img = (np.arange(256 * 320) % 320 // 16).astype(np.uint8).reshape(256, 320)
+        compressed, info = zmat.compress(img, method="blosc2ndlz", info=True)
+        self.assertLess(len(compressed), img.nbytes // 4)
+        np.testing.assert_array_equal(zmat.decompress(compressed, info=info), img)
+        with self.assertRaises(ValueError):
+            zmat.compress(vol, method="blosc2zfp-acc", compmeta=300)
+        with self.assertRaises(ValueError):
+            zmat.b2nd_compress(vol.tobytes(), vol.shape, method="zstd")
+
+    def test_shuffle_non_blosc2(self):
+        """Byte and bit shuffle of the other codecs run in C, match a numpy shuffle and survive frames."""
+        import numpy as np
+
+        arr = np.arange(50000, dtype=np.float64).reshape(250, 200) / 7
+        planes = arr.view(np.uint8).reshape(-1, 8).T.tobytes()
+        for method in ("zlib", "lz4", "zstd", "xz"):
+            for shuffle in (1, 2):
+                compressed, info = zmat.compress(arr, method=method, info=True, shuffle=shuffle)
+                self.assertEqual((info["shuffle"], info["typesize"]), (shuffle, 8))
+                self.assertEqual(info.get("bitshuffle", False), shuffle == 2)
+                np.testing.assert_array_equal(zmat.decompress(compressed, info=info), arr)
+            # older wrappers byte-shuffled for any positive shuffle and kept the value given
+            compressed, info = zmat.compress(arr, method=method, info=True, shuffle=1)
+            legacy = dict(info, shuffle=2)
+            np.testing.assert_array_equal(zmat.decompress(compressed, info=legacy), arr)
+            np.testing.assert_array_equal(zmat.zmat(compressed, info=legacy), arr)
+            self.assertEqual(zmat.compress(arr, method=method, info=True, shuffle=1)[0],
+                             zmat.compress(planes, method=method))
+        plain = zmat.compress(arr.tobytes(), method="zstd")
+        self.assertLess(len(zmat.compress(arr, method="zstd", info=True, shuffle=2)[0]), len(plain))
+        for opts in ({"frame": True}, {"container": True}):
+            compressed, info = zmat.compress(arr, method="zstd", info=True, shuffle=1, **opts)
+            restored = zmat.decompress(compressed, **opts)
+            self.assertEqual(restored, arr.tobytes())
+            self.assertEqual(zmat.decode_range(compressed, 1000, 5000, method="zstd", **opts), arr.tobytes()[1000:6000])
+        compressed = zmat.compress(arr, method="gzip", shuffle=1, frame=True)
+        self.assertEqual(zmat.decode_range(compressed, 7, 100, frame=True), arr.tobytes()[7:107])
+        compressed, info = zmat.zmat(arr, method="lz4", info=True, shuffle=2)
+        np.testing.assert_array_equal(zmat.zmat(compressed, info=info), arr)
+
     def test_returned_array_is_writable(self):
         """decompress with info must return a writable array."""
         import numpy as np
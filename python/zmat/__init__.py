@@ -12,6 +12,13 @@ Basic API (bytes in, bytes out — no NumPy dependency):
     zmat.encode(data, method='base64')
     zmat.decode(data, method='base64')
     zmat.zmat(data, iscompress=1, method='zlib', ...)   # low-level
+    zmat.peek(data)                                     # read a zmat frame header
+    zmat.decode_range(data, offset, length, method='gzip')  # decode a slice
+    zmat.batch([data, ...], iscompress=1, method='zlib', nthread=4)
+    zmat.b2nd_compress(data, shape, typesize=0)        # N-D array to a b2nd frame
+    zmat.b2nd_shape(data)                              # shape of a b2nd frame
+    zmat.dict_train([sample, ...], size=112640)        # train a dictionary
+    zmat.dict_load(dictionary)                         # digest it for reuse
 
 NumPy-aware API:
     compressed, info = zmat.compress(arr, info=True)
@@ -19,38 +26,59 @@ NumPy-aware API:
 
     compressed, info = zmat.zmat(arr, info=True)          # low-level with info
     restored_arr     = zmat.zmat(compressed, info=info)   # low-level restore
+
+    compressed, info = zmat.compress(arr, method='b2nd', info=True)
+    sub_arr          = zmat.b2nd_slice(compressed, start, stop, info=info)
 """
 
+from _zmat import b2nd_compress
+from _zmat import b2nd_shape
+from _zmat import b2nd_slice as _b2nd_slice
+from _zmat import batch
 from _zmat import compress as _compress
 from _zmat import decode
+from _zmat import decode_range
 from _zmat import decompress as _decompress
+from _zmat import dict_load
+from _zmat import dict_train
 from _zmat import encode
+from _zmat import peek
+from _zmat import set_max_alloc
 from _zmat import zmat as _zmat_c
 
-__all__ = ["compress", "decompress", "encode", "decode", "zmat"]
+__all__ = ["compress", "decompress", "encode", "decode", "zmat", "peek", "batch", "decode_range", "set_max_alloc",
+           "b2nd_compress", "b2nd_slice", "b2nd_shape", "dict_train", "dict_load"]
 
 __version__ = "1.1.0"
 
-def _byte_shuffle(data_bytes, typesize):
-    """Regroup bytes by position within each element (byte-shuffle filter).
+# methods written as b2nd frames, which keep the shape of an ndarray
+_B2ND_METHODS = ("b2nd", "blosc2zfp-acc", "blosc2zfp-prec", "blosc2zfp-rate", "blosc2ndlz")
+
+
+def _info_shuffle(info):
+    """Shuffle of the C library for an info dict: 2 if marked ``'bitshuffle'``, else 1 for any positive ``'shuffle'``.
 
-    Transforms [b0_e1 b1_e1 ... b0_e2 b1_e2 ...] into
-    [b0_e1 b0_e2 ... b1_e1 b1_e2 ...], improving compressibility of
-    structured numerical arrays with any codec.
+    Info dicts written before the bit shuffle existed byte-shuffled for any
+    positive ``'shuffle'`` value, so only the marker selects the bit shuffle.
     """
-    import numpy as np
-    arr = np.frombuffer(data_bytes, dtype=np.uint8).reshape(-1, typesize)
-    return arr.flatten(order='F').tobytes()
+    if int(info.get("shuffle", 0)) <= 0:
+        return 0
+    return 2 if info.get("bitshuffle", False) else 1
 
 
-def _byte_unshuffle(data_bytes, typesize):
-    """Reverse of _byte_shuffle."""
-    import numpy as np
-    nelems = len(data_bytes) // typesize
-    arr = np.frombuffer(data_bytes, dtype=np.uint8).reshape(typesize, nelems)
-    return arr.flatten(order='F').tobytes()
+def _info_nbytes(info):
+    """Decompressed byte length recorded in an info dict, or 0 if unknown."""
+    try:
+        nbytes = int(info.get("byte", 0))
+        for dim in info.get("shape", ()):
+            nbytes *= int(dim)
+        return max(nbytes, 0)
+    except (TypeError, ValueError):
+        return 0
 
-def compress(data, method="zlib", level=1, info=False, shuffle=0):
+
+def compress(data, method="zlib", level=1, info=False, shuffle=0, frame=False, index=False, container=False,
+             filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0, base64=False, dictionary=None):
     """Compress *data* using the requested algorithm.
 
     Parameters
@@ -63,9 +91,17 @@ def compress(data, method="zlib", level=1, info=False, shuffle=0):
         array exactly.
     method : str, optional
         Compression algorithm.  One of ``'zlib'`` (default), ``'gzip'``,
-        ``'lzma'``, ``'lzip'``, ``'lz4'``, ``'lz4hc'``, ``'zstd'``,
+        ``'lzma'``, ``'lzip'``, ``'lz4'``, ``'lz4hc'``, ``'lz4f'``, ``'zstd'``,
         ``'base64'``, ``'blosc2blosclz'``, ``'blosc2lz4'``,
-        ``'blosc2lz4hc'``, ``'blosc2zlib'``, ``'blosc2zstd'``.
+        ``'blosc2lz4hc'``, ``'blosc2zlib'``, ``'blosc2zstd'``, ``'b2nd'``,
+        ``'blosc2zfp-acc'``, ``'blosc2zfp-prec'``, ``'blosc2zfp-rate'``,
+        ``'blosc2ndlz'``.
+        ``'b2nd'`` stores a :class:`numpy.ndarray` with its shape, so that
+        :func:`b2nd_slice` can decode a sub-array; other data is stored as
+        a 1-D byte array.  The zfp methods (lossy, float32/float64 arrays
+        of 1 to 4 dimensions) and ``'blosc2ndlz'`` (2-D arrays) are blosc2
+        codec plugins that need the array shape, so they also write b2nd
+        frames.
     level : int, optional
         Compression level: ``1`` = library default, higher values give
         better compression at the cost of speed.
@@ -79,19 +115,72 @@ def compress(data, method="zlib", level=1, info=False, shuffle=0):
         - ``'byte'``   — bytes per element (``data.itemsize``)
         - ``'method'`` — the compression method used
         - ``'order'``  — ``'F'`` for Fortran-contiguous, ``'C'`` otherwise
-        - ``'shuffle'``— byte-shuffle level applied (0 = none, 1 = byte)
+        - ``'shuffle'``— shuffle applied (0 = none, 1 = byte, 2 = bit)
+        - ``'bitshuffle'``— ``True``, only present for a bit shuffle; without
+          it any positive ``'shuffle'`` is a byte shuffle, as in older dicts
         - ``'typesize'``— element size in bytes used for shuffle
 
         When *info=True* but *data* is not an ndarray, the tuple
         ``(compressed_bytes, None)`` is returned so callers can always
         unpack two values.
     shuffle : int, optional
-        Byte-shuffle level for non-blosc2 codecs (default ``0`` = disabled,
-        ``1`` = byte-shuffle).  Requires *info=True* so that the shuffle
-        state can be recorded and reversed on decompression.  For blosc2
-        methods the shuffle is handled by the C layer and this parameter
-        is ignored.  Has no effect when *data* is not a
-        :class:`numpy.ndarray`.
+        Shuffle of the array elements before a non-blosc2 codec (default
+        ``0`` = disabled, ``1`` = byte-shuffle, ``2`` = bit-shuffle), run by
+        the C library with the blosc2 SIMD kernels.  Requires *info=True*
+        so that the shuffle state can be recorded and reversed on
+        decompression; frames and containers also record it in their
+        header.  For blosc2 methods the shuffle is applied per block and
+        this parameter is ignored, as it is for *index=True* streams and
+        when *data* is not a :class:`numpy.ndarray`.
+    frame : bool, optional
+        When *True*, prepend a 16-byte zmat frame header recording the
+        method and uncompressed length, so that :func:`peek` can read
+        them and ``decompress(data, frame=True)`` needs no method.
+    index : bool, optional
+        ``'gzip'`` and ``'zstd'`` only: when *True*, compress in independent
+        1 MB blocks whose offsets are stored in the gzip header, or in the
+        seek table of the zstd seekable format, so that :func:`decode_range`
+        decodes only the blocks it needs and :func:`decompress` decodes them
+        in parallel.  The output is still a standard gzip or zstd stream.
+    container : bool, optional
+        When *True*, split the input into 4 MB chunks compressed in
+        parallel with *method*, followed by an index of their offsets and
+        crc32s, so that ``decode_range(..., container=True)`` decodes only
+        the chunks it needs.  Works with every method.
+    base64 : bool, optional
+        When *True*, return the compressed data as one line of base64
+        text, as stored in JData ``_ArrayZipData_``, in a single pass:
+        ``'zlib'``, ``'gzip'`` and ``'zstd'`` are encoded piece by piece
+        as the codec writes them, so that the whole compressed stream is
+        never held next to its text.  ``decompress(..., base64=True)``
+        reverses it.
+    dictionary : object or bytes, optional
+        ``'zlib'``, ``'zstd'``, ``'lz4'`` and ``'lz4hc'`` only: a handle
+        from :func:`dict_load`, or dictionary bytes (digested for this
+        call), e.g. from :func:`dict_train`, for small arrays and strings
+        that share content.  The output is one stream, coded on one
+        thread, and ``decompress(..., dictionary=...)`` needs the same
+        dictionary.
+    filters : list, optional
+        blosc2 and ``'b2nd'`` only: the filter pipeline run on each block
+        before the codec, replacing the default byte-shuffle; up to 6 names
+        or ids among ``'nofilter'`` (0), ``'shuffle'`` (1),
+        ``'bitshuffle'`` (2), ``'delta'`` (3) and ``'truncprec'`` (4).
+    filters_meta : list, optional
+        Parameter of each filter, e.g. the mantissa bits kept by
+        ``'truncprec'`` (lossy) for float32/float64 data.
+    blocksize : int, optional
+        blosc2 block length in bytes, ``0`` (default) lets blosc2 choose;
+        ignored by ``'b2nd'``, whose blocks follow the array shape.
+    splitmode : int, optional
+        Whether blosc2 splits blocks into one stream per byte: ``1``
+        always, ``2`` never, ``3`` auto, ``0`` (default) the blosc2 default.
+    compmeta : int, optional
+        Parameter of the zfp and ndlz codecs, ``0`` (default) for: the
+        absolute error bound ``10**compmeta`` of ``'blosc2zfp-acc'``
+        (``-3``), the bit precision of ``'blosc2zfp-prec'`` (``16``), the
+        output size in percent of the input of ``'blosc2zfp-rate'``
+        (``25``), or the cell size of ``'blosc2ndlz'``, 4 or 8 (``4``).
 
     Returns
     -------
@@ -114,8 +203,17 @@ def compress(data, method="zlib", level=1, info=False, shuffle=0):
         compressed, info = zmat.compress(arr, method='lz4', info=True, shuffle=1)
         restored = zmat.decompress(compressed, info=info)
         assert np.array_equal(restored, arr)
+
+    blosc2 with a delta and bit-shuffle filter pipeline::
+
+        compressed = zmat.compress(arr, method='blosc2zstd', filters=['delta', 'bitshuffle'])
+
+    float32 volume with a 1e-4 absolute error bound::
+
+        compressed = zmat.compress(vol, method='blosc2zfp-acc', compmeta=-4)
     """
-    _use_shuffle = (shuffle > 0 and "blosc2" not in method and method != "base64")
+    tuning = dict(filters=filters, filters_meta=filters_meta, splitmode=splitmode, compmeta=compmeta)
+    _use_shuffle = (shuffle > 0 and "blosc2" not in method and method not in ("base64", "b2nd") and not index)
 
     if info:
         try:
@@ -134,21 +232,98 @@ def compress(data, method="zlib", level=1, info=False, shuffle=0):
                     "shuffle": shuffle if apply_shuffle else 0,
                     "typesize": ts,
                 }
+                if apply_shuffle and shuffle == 2:
+                    arr_info["bitshuffle"] = True
+                if method in _B2ND_METHODS and data.size > 0 and not frame and not container and not base64:
+                    compressed = b2nd_compress(np.ascontiguousarray(data), data.shape, typesize=ts,
+                                               dtype=data.dtype.str, level=level, method=method, **tuning)
+                    return compressed, arr_info
+                # the C library shuffles the whole input, or each chunk of a container
                 flat = np.ascontiguousarray(data).tobytes()
-                if apply_shuffle:
-                    flat = _byte_shuffle(flat, ts)
-                compressed = _compress(flat, method=method, level=level)
+                compressed = _compress(flat, method=method, level=level, frame=frame, index=index, container=container,
+                                       blocksize=blocksize, shuffle=shuffle if apply_shuffle else 0, typesize=ts,
+                                       base64=base64, dictionary=dictionary, **tuning)
+                if frame:
+                    arr_info["frame"] = True
+                if container:
+                    arr_info["container"] = True
+                if base64:
+                    arr_info["base64"] = True
                 return compressed, arr_info
         except ImportError:
             pass
 
         # non-ndarray with info=True: compress normally, return (bytes, None)
-        return _compress(data, method=method, level=level), None
+        return _compress(data, method=method, level=level, frame=frame, index=index, container=container,
+                         blocksize=blocksize, base64=base64, dictionary=dictionary, **tuning), None
+
+    if method in _B2ND_METHODS and not frame and not container and not base64:
+        try:
+            import numpy as np
+
+            if isinstance(data, np.ndarray) and data.ndim > 0 and data.size > 0:
+                return b2nd_compress(np.ascontiguousarray(data), data.shape, typesize=data.itemsize,
+                                     dtype=data.dtype.str, level=level, method=method, **tuning)
+        except ImportError:
+            pass
+
+    return _compress(data, method=method, level=level, frame=frame, index=index, container=container,
+                     blocksize=blocksize, base64=base64, dictionary=dictionary, **tuning)
+
+
+def b2nd_slice(data, start=None, stop=None, info=None, nthread=0):
+    """Decode the sub-array ``[start, stop)`` of a b2nd frame.
+
+    Only the chunks, and the blocks inside them, that intersect the slice
+    are decompressed.
 
-    return _compress(data, method=method, level=level)
+    Parameters
+    ----------
+    data : bytes
+        A b2nd frame, written by ``compress(arr, method='b2nd')`` or
+        :func:`b2nd_compress`.
+    start, stop : sequence of int, optional
+        First and one-past-last index of each dimension (C order);
+        ``None`` selects the whole extent.
+    info : dict or None, optional
+        Info dict returned by ``compress(arr, method='b2nd', info=True)``.
+        When given (and NumPy is available), a :class:`numpy.ndarray` of
+        shape ``stop - start`` and the original dtype is returned.
+    nthread : int, optional
+        Decoding threads, ``0`` for the thread limit.
+
+    Returns
+    -------
+    bytes or numpy.ndarray
+        The C-order slice.
+
+    Examples
+    --------
+    ::
+
+        arr = np.arange(1000000, dtype=np.float32).reshape(100, 100, 100)
+        compressed, info = zmat.compress(arr, method='b2nd', info=True)
+        sub = zmat.b2nd_slice(compressed, (10, 0, 50), (20, 100, 60), info=info)
+        assert np.array_equal(sub, arr[10:20, :, 50:60])
+    """
+    raw = _b2nd_slice(data, start, stop, nthread=nthread)
 
+    if info is None:
+        return raw
+
+    try:
+        import numpy as np
 
-def decompress(data, method="zlib", info=None):
+        shape = tuple(info["shape"])
+        lo = tuple(start) if start is not None else (0,) * len(shape)
+        hi = tuple(stop) if stop is not None else shape
+        return np.frombuffer(raw, dtype=np.dtype(info["type"])).copy().reshape(
+            tuple(int(b) - int(a) for a, b in zip(lo, hi)))
+    except ImportError:
+        return raw
+
+
+def decompress(data, method="zlib", info=None, frame=False, container=False, base64=False, dictionary=None):
     """Decompress *data*.
 
     Parameters
@@ -164,6 +339,19 @@ def decompress(data, method="zlib", info=None):
         When provided, the raw decompressed bytes are reinterpreted as a
         :class:`numpy.ndarray` with the original dtype, shape, and memory
         order.  If NumPy is not installed the raw ``bytes`` are returned.
+    frame : bool, optional
+        When *True* (or ``info['frame']`` is set), *data* starts with a
+        zmat frame header written by ``compress(..., frame=True)``; the
+        method and length recorded in it are used.
+    container : bool, optional
+        When *True* (or ``info['container']`` is set), *data* is a zmat
+        container written by ``compress(..., container=True)``.
+    base64 : bool, optional
+        When *True* (or ``info['base64']`` is set), *data* is base64 text
+        written by ``compress(..., base64=True)``, decoded and decompressed
+        in one pass.
+    dictionary : object or bytes, optional
+        The dictionary given to :func:`compress`.
 
     Returns
     -------
@@ -187,13 +375,12 @@ def decompress(data, method="zlib", info=None):
     """
     if info is not None:
         actual_method = info.get("method", method)
-        raw = _decompress(data, method=actual_method)
-
-        # unshuffle if compression applied wrapper-level byte shuffle
-        shuf = info.get("shuffle", 0)
-        ts   = info.get("typesize", 1)
-        if shuf > 0 and ts > 1 and "blosc2" not in actual_method:
-            raw = _byte_unshuffle(raw, ts)
+        # the C library unshuffles what it shuffled, as recorded in info
+        raw = _decompress(data, method=actual_method, size=_info_nbytes(info),
+                          frame=bool(frame or info.get("frame", False)),
+                          container=bool(container or info.get("container", False)),
+                          shuffle=_info_shuffle(info), typesize=int(info.get("typesize", 0)),
+                          base64=bool(base64 or info.get("base64", False)), dictionary=dictionary)
 
         try:
             import numpy as np
@@ -209,10 +396,11 @@ def decompress(data, method="zlib", info=None):
         except ImportError:
             return raw
 
-    return _decompress(data, method=method)
+    return _decompress(data, method=method, frame=frame, container=container, base64=base64, dictionary=dictionary)
 
 
-def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, info=False):
+def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, info=False,
+         filters=None, filters_meta=None, blocksize=0, splitmode=0, compmeta=0):
     """Low-level compression/decompression interface with full parameter control.
 
     Mirrors the MATLAB ``[ss, info] = zmat(arr)`` / ``zmat(ss, info)`` pattern
@@ -230,13 +418,17 @@ def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, in
     method : str
         Compression algorithm (default ``'zlib'``).
     nthread : int
-        Thread count for blosc2 codecs (default ``1``).
+        Thread count for zlib, gzip, lzip, xz, zstd and blosc2 codecs (default ``1``);
+        ``0`` picks one thread per 4 MB of input.  All calls share one
+        library thread pool capped by ``ZMAT_NUM_THREADS``,
+        ``OMP_NUM_THREADS`` or the CPU count.
     shuffle : int
-        Byte-shuffle flag for blosc2: ``0`` = disabled, ``1`` = enabled
-        (default ``1``).
+        Shuffle flag: ``0`` = disabled, ``1`` = byte-shuffle, ``2`` =
+        bit-shuffle (default ``1``).  blosc2 shuffles each block; the other
+        codecs shuffle the whole input only when *info=True* records it.
     typesize : int
-        Element byte size used by the blosc2 byte-shuffle filter
-        (default ``4``).
+        Element byte size used by the blosc2 shuffle filter (default
+        ``4``); the other codecs use the array item size.
     info : bool or dict, optional
         * ``False`` (default) — plain bytes in, bytes out.
         * ``True`` — when *data* is a :class:`numpy.ndarray`, capture its
@@ -248,6 +440,9 @@ def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, in
           reconstructs the original :class:`numpy.ndarray` using the
           stored metadata.  The method is taken from ``info['method']``;
           the *method* argument is used only as a fallback.
+    filters, filters_meta, blocksize, splitmode, compmeta : optional
+        blosc2 filter pipeline, block and codec settings used when compressing,
+        see :func:`compress`; decompression reads them from the data.
 
     Returns
     -------
@@ -273,21 +468,23 @@ def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, in
         out = zmat.zmat(data, iscompress=1, method='blosc2zstd',
                         nthread=4, shuffle=1, typesize=8)
     """
-    _use_shuffle = (shuffle > 0 and "blosc2" not in method and method != "base64")
+    # blosc2 and b2nd always shuffle, the other codecs only when info records it
+    _c_shuffle = ("blosc2" in method or method == "b2nd")
+    _use_shuffle = (shuffle > 0 and not _c_shuffle and method != "base64")
+    tuning = dict(filters=filters, filters_meta=filters_meta, blocksize=blocksize, splitmode=splitmode,
+                  compmeta=compmeta)
 
     # info dict supplied → decompress and reconstruct numpy array
     if isinstance(info, dict):
         actual_method = info.get("method", method)
-        # blosc2 shuffle is handled by the C layer; pass it through unchanged
-        c_shuffle = shuffle if "blosc2" in actual_method else 0
+        # blosc2 takes shuffle as given, the other codecs as recorded in info
+        if "blosc2" in actual_method or actual_method == "b2nd":
+            c_shuffle, c_typesize = shuffle, typesize
+        else:
+            c_shuffle, c_typesize = _info_shuffle(info), int(info.get("typesize", 0))
         raw = _zmat_c(data, iscompress=0, method=actual_method,
-                      nthread=nthread, shuffle=c_shuffle, typesize=typesize)
-
-        # unshuffle if wrapper-level shuffle was recorded in info
-        shuf = info.get("shuffle", 0)
-        ts   = info.get("typesize", 1)
-        if shuf > 0 and ts > 1 and "blosc2" not in actual_method:
-            raw = _byte_unshuffle(raw, ts)
+                      nthread=nthread, shuffle=c_shuffle, typesize=c_typesize,
+                      size=_info_nbytes(info))
 
         try:
             import numpy as np
@@ -320,27 +517,28 @@ def zmat(data, iscompress=1, method="zlib", nthread=1, shuffle=1, typesize=4, in
                     "shuffle": shuffle if apply_shuffle else 0,
                     "typesize": ts,
                 }
+                if apply_shuffle and shuffle == 2:
+                    arr_info["bitshuffle"] = True
                 flat = np.ascontiguousarray(data).tobytes()
-                if apply_shuffle:
-                    flat = _byte_shuffle(flat, ts)
-                # for blosc2, pass shuffle/typesize to C; for others, already done
-                c_shuffle  = shuffle if "blosc2" in method else 0
-                c_typesize = typesize if "blosc2" in method else 1
+                # blosc2 shuffles with the given typesize, the other codecs by element
+                c_shuffle  = shuffle if (_c_shuffle or apply_shuffle) else 0
+                c_typesize = typesize if _c_shuffle else ts
                 compressed = _zmat_c(flat, iscompress=iscompress, method=method,
-                                     nthread=nthread, shuffle=c_shuffle, typesize=c_typesize)
+                                     nthread=nthread, shuffle=c_shuffle, typesize=c_typesize, **tuning)
                 return compressed, arr_info
         except ImportError:
             pass
 
         # non-ndarray with info=True: compress normally, return (bytes, None)
         return _zmat_c(data, iscompress=iscompress, method=method,
-                       nthread=nthread, shuffle=shuffle, typesize=typesize), None
+                       nthread=nthread, shuffle=shuffle if _c_shuffle else 0, typesize=typesize, **tuning), None
 
     return _zmat_c(
         data,
         iscompress=iscompress,
         method=method,
         nthread=nthread,
-        shuffle=shuffle,
+        shuffle=shuffle if _c_shuffle else 0,
         typesize=typesize,
+        **tuning
     )
@@ -42,6 +42,8 @@ cat << 'PREAMBLE'
  *   All other files just:
  *     #include "zmat.h"
  *
+ *   On POSIX systems, link with -pthread (used by the shared worker pool).
+ *
  * COMPILE FLAGS (automatically set inside ZMAT_IMPLEMENTATION; listed here
  * so callers that compile zmatlib.c separately know what to pass):
  *   -DNO_ZLIB    use embedded miniz instead of system zlib
@@ -3902,8 +3902,11 @@ void blosc2_init(void) {
   #include "blosc2/blosc2-common.h"
   #include "blosc2/blosc2-stdio.h"
   register_codecs();
+#if !defined(NO_FILTER_PLUGINS)
+  /* zmat bundles the codec plugins only */
   register_filters();
   register_tuners();
+#endif
 #endif
   blosc2_pthread_mutex_init(&global_comp_mutex, NULL);
   /* Create a global context */
@@ -8,5 +8,7 @@
 /* #undef HAVE_IPP */
 /* #undef BLOSC_DLL_EXPORT */
 #define HAVE_PLUGINS TRUE
+/* zmat bundles the zfp and ndlz codec plugins, but not the filter plugins */
+#define NO_FILTER_PLUGINS TRUE
 
 #endif
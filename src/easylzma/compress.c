@@ -123,10 +123,12 @@ elzma_compress_config(elzma_compress_handle hand,
     hand->uncompressedSize = uncompressedSize;
     hand->format = format;
 
-    /* default of LZMA-Alone is set at alloc time, and there are only
-     * two possible formats */
+    /* there are only two possible formats, set the handler every time
+     * so that a handle can be reconfigured and reused */
     if (format == ELZMA_lzip) {
         initializeLZIPFormatHandler(&(hand->formatHandler));
+    } else {
+        initializeLZMAFormatHandler(&(hand->formatHandler));
     }
 
     return ELZMA_E_OK;
@@ -234,8 +236,11 @@ elzma_compress_run(elzma_compress_handle hand,
     progressStruct.progressCallback = progressCallback;
     progressStruct.progressContext = progressContext;
 
-    /* create an encoding object */
-    hand->encHand = LzmaEnc_Create((ISzAlloc *) &(hand->allocStruct));
+    /* create an encoding object, or reuse the one from a previous run
+     * so that its match finder buffers and threads are kept */
+    if (hand->encHand == NULL) {
+        hand->encHand = LzmaEnc_Create((ISzAlloc *) &(hand->allocStruct));
+    }
 
     if (hand->encHand == NULL) {
         return ELZMA_E_COMPRESS_ERROR;
@@ -261,6 +266,8 @@ elzma_compress_run(elzma_compress_handle hand,
         struct elzma_file_header h;
         size_t wt;
 
+        if (hdr == NULL) return ELZMA_E_COMPRESS_ERROR;
+
         hand->formatHandler.init_header(&h);
         h.pb = (unsigned char) hand->props.pb;
         h.lp = (unsigned char) hand->props.lp;
@@ -301,6 +308,9 @@ elzma_compress_run(elzma_compress_handle hand,
             hand->allocStruct.Alloc(&(hand->allocStruct),
                                     hand->formatHandler.footer_size);
         struct elzma_file_footer ftr;
+
+        if (ftrBuf == NULL) return ELZMA_E_COMPRESS_ERROR;
+
         ftr.crc32 = inStreamStruct.crc32 ^ 0xFFFFFFFF;
         ftr.uncompressedSize = hand->uncompressedSize;
 
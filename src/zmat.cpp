@@ -56,6 +56,15 @@
 #include "zlib.h"
 
 void zmat_usage();
+void zmat_mex_exit(void);
+
+/**
+ * The dictionary digested for the last call, reused while the following calls pass the same bytes and level
+ */
+static TZMatDict* zmat_dict_cache = NULL;
+static unsigned char* zmat_dict_bytes = NULL;
+static size_t zmat_dict_len = 0;
+static int zmat_dict_level = 0;
 
 const char*  metadata[] = {"type", "size", "byte", "method", "status", "level"};
 
@@ -79,6 +88,7 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 #if !defined(NO_LZ4)
         "lz4",
         "lz4hc",
+        "lz4f",
 #endif
 #if !defined(NO_ZSTD)
         "zstd",
@@ -89,6 +99,11 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         "blosc2lz4hc",
         "blosc2zlib",
         "blosc2zstd",
+        "b2nd",
+        "blosc2zfp-acc",
+        "blosc2zfp-prec",
+        "blosc2zfp-rate",
+        "blosc2ndlz",
 #endif
         ""
     };
@@ -107,6 +122,7 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 #if !defined(NO_LZ4)
         zmLz4,
         zmLz4hc,
+        zmLz4f,
 #endif
 #if !defined(NO_ZSTD)
         zmZstd,
@@ -117,6 +133,11 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         zmBlosc2Lz4hc,
         zmBlosc2Zlib,
         zmBlosc2Zstd,
+        zmB2nd,
+        zmBlosc2ZfpAcc,
+        zmBlosc2ZfpPrec,
+        zmBlosc2ZfpRate,
+        zmBlosc2Ndlz,
 #endif
         zmUnknown
     };
@@ -134,8 +155,8 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
      *     int iscompress;      // combined flag used to pass on to zmat_run
      *     struct settings {    // unpacked flags
      *         char clevel;     // compression level, 0: decompression, 1: use default level; negative: set compression level (-1 to -19)
-     *         char nthread;    // number of compression/decompression threads
-     *         char shuffle;    // byte shuffle length
+     *         char nthread;    // number of compression/decompression threads, 0: auto
+     *         char shuffle;    // 1: byte shuffle, 2: bit shuffle
      *         char typesize;   // for ND-array, the byte-size for each array element
      *     } param;
      * };
@@ -143,6 +164,22 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
 
     union TZMatFlags flags = {0};
     int methidx = 0; /* index into zipmethods[] — used to store info.method correctly */
+    size_t sizehint = 0; /* expected decompressed length passed by zmat.m from info, 0 if unknown */
+    int frame = 0;       /* 1: write/read a zmat frame header around the payload (ZMAT_FRAME) */
+    int index = 0;       /* 1: write an indexed gzip or seekable zstd stream (ZMAT_INDEX) */
+    int container = 0;   /* 1: write/read a chunked zmat container (ZMAT_CONTAINER) */
+    int b64 = 0;         /* 1: output, or input, is base64 text (ZMAT_BASE64) */
+    int ndim = 0;        /* b2nd: number of array dimensions, 0 to store a 1-D array */
+    int nslice = 0;      /* b2nd: number of dimensions of the slice to decode, 0 for all */
+    size_t shape[8] = {0}, slicestart[8] = {0}, slicestop[8] = {0}; /* b2nd shape and slice, in C order */
+    TZMatBlosc2Params tuning = {0}; /* blosc2 filter pipeline, blocksize and splitmode */
+    int tuned = 0;                  /* 1 if any of the blosc2 settings above is given */
+    TZMatDict* dict = NULL;         /* digested dictionary for zlib, zstd and lz4, NULL if none */
+
+    /**
+     * Join the zmat worker pool threads and release the cached dictionary before MATLAB/Octave unloads this mex file
+     */
+    mexAtExit(zmat_mex_exit);
 
     /**
      * If no input is given for this function, it prints help information and return.
@@ -206,21 +243,219 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
         flags.param.typesize = val[0];
     }
 
+    // only blosc2 shuffles by default, the other codecs when asked to
+    if (nrhs < 5 && (zipid < zmBlosc2Blosclz || zipid == zmXz || zipid == zmLz4f)) {
+        flags.param.shuffle = 0;
+    }
+
+    if (nrhs >= 7) {
+        double* val = mxGetPr(prhs[6]);
+        sizehint = (val[0] > 0) ? (size_t)val[0] : 0;
+    }
+
+    if (nrhs >= 8) {
+        double* val = mxGetPr(prhs[7]);
+        frame = (val[0] != 0);
+    }
+
+    if (nrhs >= 9) {
+        double* val = mxGetPr(prhs[8]);
+        index = (val[0] != 0);
+    }
+
+    if (nrhs >= 10) {
+        double* val = mxGetPr(prhs[9]);
+        container = (val[0] != 0);
+    }
+
+    /**
+     * b2nd: MATLAB arrays are column-major, so the dimensions are reversed to
+     * give the C-order shape; a slice is a 2xN [start; stop] matrix of 1-based,
+     * inclusive MATLAB indices
+     */
+    if (nrhs >= 11 && !mxIsEmpty(prhs[10])) {
+        double* val = mxGetPr(prhs[10]);
+        ndim = mxGetNumberOfElements(prhs[10]);
+
+        if (ndim > 8) {
+            mexErrMsgTxt("b2nd arrays can not have more than 8 dimensions");
+        }
+
+        for (int i = 0; i < ndim; i++) {
+            shape[ndim - 1 - i] = (size_t)val[i];
+        }
+    }
+
+    if (nrhs >= 12 && !mxIsEmpty(prhs[11])) {
+        double* val = mxGetPr(prhs[11]);
+        nslice = mxGetN(prhs[11]);
+
+        if (mxGetM(prhs[11]) != 2 || nslice > 8) {
+            mexErrMsgTxt("the 'slice' option must be a 2xN matrix of [start; stop] indices");
+        }
+
+        for (int i = 0; i < nslice; i++) {
+            if (val[i * 2] < 1 || val[i * 2 + 1] < val[i * 2] - 1) {
+                mexErrMsgTxt("the 'slice' option must be a 2xN matrix of [start; stop] indices");
+            }
+
+            slicestart[nslice - 1 - i] = (size_t)val[i * 2] - 1;
+            slicestop[nslice - 1 - i] = (size_t)val[i * 2 + 1];
+        }
+    }
+
+    /**
+     * blosc2 filter pipeline (a vector of filter ids, run in order), the
+     * parameter of each filter, the block length in bytes and the split mode
+     */
+    if (nrhs >= 13 && !mxIsEmpty(prhs[12])) {
+        double* val = mxGetPr(prhs[12]);
+        tuning.nfilter = mxGetNumberOfElements(prhs[12]);
+
+        if (tuning.nfilter > ZMAT_MAX_FILTERS) {
+            mexErrMsgTxt("at most 6 blosc2 filters are supported");
+        }
+
+        for (int i = 0; i < tuning.nfilter; i++) {
+            if (val[i] < 0 || val[i] > 255) {
+                mexErrMsgTxt(zmat_error(16));
+            }
+
+            tuning.filters[i] = (unsigned char)val[i];
+        }
+    }
+
+    if (nrhs >= 14 && !mxIsEmpty(prhs[13])) {
+        double* val = mxGetPr(prhs[13]);
+        int nmeta = mxGetNumberOfElements(prhs[13]);
+
+        if (nmeta > tuning.nfilter) {
+            mexErrMsgTxt("the 'filtersmeta' option can not be longer than 'filters'");
+        }
+
+        for (int i = 0; i < nmeta; i++) {
+            tuning.filters_meta[i] = (signed char)val[i];
+        }
+    }
+
+    if (nrhs >= 15 && !mxIsEmpty(prhs[14])) {
+        double* val = mxGetPr(prhs[14]);
+        tuning.blocksize = (int)val[0];
+    }
+
+    if (nrhs >= 16 && !mxIsEmpty(prhs[15])) {
+        double* val = mxGetPr(prhs[15]);
+        tuning.splitmode = (int)val[0];
+    }
+
+    if (nrhs >= 17 && !mxIsEmpty(prhs[16])) {
+        double* val = mxGetPr(prhs[16]);
+        tuning.compmeta = (int)val[0];
+    }
+
+    if (nrhs >= 18 && !mxIsEmpty(prhs[17])) {
+        double* val = mxGetPr(prhs[17]);
+        b64 = (val[0] != 0);
+    }
+
+    if (nrhs >= 19 && !mxIsEmpty(prhs[18])) {
+        size_t dictlen = mxGetNumberOfElements(prhs[18]) * mxGetElementSize(prhs[18]);
+        const unsigned char* dictdata = (const unsigned char*)mxGetData(prhs[18]);
+
+        if (zmat_dict_cache == NULL || dictlen != zmat_dict_len || zmat_dict_level != flags.param.clevel || memcmp(dictdata, zmat_dict_bytes, dictlen)) {
+            zmat_dict_free(&zmat_dict_cache);
+            free(zmat_dict_bytes);
+            zmat_dict_bytes = (unsigned char*)malloc(dictlen);
+            zmat_dict_len = 0;
+
+            if (zmat_dict_bytes == NULL || zmat_dict_init(&zmat_dict_cache, dictlen, dictdata, (flags.param.clevel != 0 ? flags.param.clevel : 1)) != 0) {
+                mexErrMsgTxt(zmat_error(17));
+            }
+
+            memcpy(zmat_dict_bytes, dictdata, dictlen);
+            zmat_dict_len = dictlen;
+            zmat_dict_level = flags.param.clevel;
+        }
+
+        dict = zmat_dict_cache;
+    }
+
+    tuned = (tuning.nfilter > 0 || tuning.blocksize != 0 || tuning.splitmode != 0 || tuning.compmeta != 0);
+
+    if (tuned && zmat_set_blosc2(&tuning) != 0) {
+        mexErrMsgTxt(zmat_error(16));
+    }
+
     try {
         if (mxIsChar(prhs[0]) || (mxIsNumeric(prhs[0]) && !mxIsComplex(prhs[0])) || mxIsLogical(prhs[0])) {
             int ret = -1;
             mwSize inputsize = mxGetNumberOfElements(prhs[0]) * mxGetElementSize(prhs[0]);
             mwSize buflen[2] = {0};
             unsigned char* outputbuf = NULL;
-            size_t outputsize = 0;
+            size_t outputsize = 0, outputbound = 0;
             unsigned char* inputstr = (mxIsChar(prhs[0]) ? (unsigned char*)mxArrayToString(prhs[0]) : (unsigned char*)mxGetData(prhs[0]));
+            mxArray* output = NULL;
             int errcode = 0;
+            int runid = (frame ? ZMAT_FRAME : 0) | (index ? ZMAT_INDEX : 0) | (container ? ZMAT_CONTAINER : 0) | (b64 ? ZMAT_BASE64 : 0) | zipid;
+
+            // the blosc2 settings are kept per thread, reset below once the data is coded
+            zmat_set_blosc2(tuned ? &tuning : NULL);
+            zmat_set_dict(dict);
 
-            // if input buffer is not empty, run main function zmat_run
-            if (inputsize > 0) {
-                errcode = zmat_run(inputsize, inputstr, &outputsize, &outputbuf, zipid, &ret, flags.iscompress);
+            // b2nd, zfp and ndlz: write an N-D array with its shape, or decode a slice of one
+            int isb2nd = (runid >= zmB2nd && runid <= zmBlosc2Ndlz && inputsize > 0 && ((flags.param.clevel != 0 && ndim > 0) || (flags.param.clevel == 0 && nslice > 0)));
+
+            if (isb2nd && flags.param.clevel != 0) {
+                flags.param.typesize = 0;
+                errcode = zmat_b2nd_write(inputsize, inputstr, ndim, shape, NULL, &outputsize, &outputbuf, runid, &ret, flags.iscompress);
+            } else if (isb2nd) {
+                errcode = zmat_b2nd_slice(inputsize, inputstr, slicestart, slicestop, &outputsize, &outputbuf, &ret, flags.param.nthread);
             }
 
+            // if the output size can be bounded, let zmat_run_into write directly into the returned array
+            if (inputsize > 0 && !use4bytedim && !isb2nd) {
+                outputbound = zmat_outputbound(inputsize, inputstr, runid, flags.iscompress);
+
+                // the stream does not record its decoded length, use the one known from info
+                if (outputbound == 0 && flags.param.clevel == 0) {
+                    outputbound = sizehint;
+                }
+            }
+
+            if (outputbound > 0) {
+                buflen[0] = 1;
+                buflen[1] = outputbound;
+                output = mxCreateNumericArray(2, buflen, mxUINT8_CLASS, mxREAL);
+                errcode = zmat_run_into(inputsize, inputstr, &outputsize, (unsigned char*)mxGetData(output), outputbound, runid, &ret, flags.iscompress);
+
+                // the bound was too small, retry once with the reported size
+                if (errcode == -12) {
+                    mxDestroyArray(output);
+                    buflen[1] = outputsize;
+                    output = mxCreateNumericArray(2, buflen, mxUINT8_CLASS, mxREAL);
+                    errcode = zmat_run_into(inputsize, inputstr, &outputsize, (unsigned char*)mxGetData(output), buflen[1], runid, &ret, flags.iscompress);
+                }
+
+                if (errcode < 0) {
+                    mxDestroyArray(output);
+                    output = NULL;
+                    outputsize = 0;
+                } else if (outputsize < buflen[1]) {
+                    // release the unused tail of the array
+                    if (outputsize > 0) {
+                        mxSetData(output, mxRealloc(mxGetData(output), outputsize));
+                    }
+
+                    mxSetN(output, outputsize);
+                }
+            } else if (inputsize > 0 && !isb2nd) {
+                // otherwise run main function zmat_run
+                errcode = zmat_run(inputsize, inputstr, &outputsize, &outputbuf, runid, &ret, flags.iscompress);
+            }
+
+            zmat_set_blosc2(NULL);
+            zmat_set_dict(NULL);
+
             // test error code
             if (errcode < 0) {
                 if (outputbuf) {
@@ -235,7 +470,9 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
             buflen[1] = outputsize;
 
             // if running on octave 4/matlab R2015 or older, dimensions are stored as 4-byte integers, determine this at runtime
-            if (use4bytedim) {
+            if (output) {
+                plhs[0] = output;
+            } else if (use4bytedim) {
                 unsigned int intdims[4] = {0};
                 intdims[0] = 1;
                 intdims[1] = (unsigned int)outputsize;
@@ -323,6 +560,18 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[]) {
     return;
 }
 
+/**
+ * @brief Join the worker pool and release the cached dictionary when the mex file is unloaded
+ */
+
+void zmat_mex_exit(void) {
+    zmat_pool_free();
+    zmat_dict_free(&zmat_dict_cache);
+    free(zmat_dict_bytes);
+    zmat_dict_bytes = NULL;
+    zmat_dict_len = 0;
+}
+
 /**
  * @brief Print a brief help information if nothing is provided
  */
@@ -47,6 +47,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "zmatlib.h"
 
@@ -64,12 +65,17 @@
         #include "easylzma/lzma/XzEnc.h"
         #include "easylzma/lzma/Xz.h"
         #include "easylzma/lzma/Alloc.h"
-        #ifndef _WIN32
-            #include <pthread.h>
-        #endif
+        #include "easylzma/lzma/LzmaDec.h"
+        #include "easylzma/lzma/7zCrc.h"
+        #include "easylzma/lzma/XzCrc64.h"
     #endif
 #endif
 
+#ifndef _WIN32
+    #include <pthread.h>
+    #include <unistd.h>
+#endif
+
 #ifndef NO_LZ4
     #include "lz4/lz4.h"
     #include "lz4/lz4hc.h"
@@ -77,20 +83,52 @@
 
 #ifndef NO_BLOSC2
     #include "blosc2.h"
+    #include "b2nd.h"
+    #include "blosc2/codecs-registry.h"
 #endif
 
 #ifndef NO_ZSTD
+    #define ZSTD_STATIC_LINKING_ONLY  /* ZSTD_customMem, ZSTD_decompressBound */
     #include "zstd.h"
-    unsigned long long ZSTD_decompressBound(const void* src, size_t srcSize);
+    #include "zdict.h"
+#endif
+
+#ifndef NO_LZ4
+    /* XXH32 checksums of the LZ4 frame format, from the xxhash bundled with zstd */
+    #ifdef NO_ZSTD
+        #define XXH_INLINE_ALL        /* libzstd is not linked, compile XXH32 in */
+    #endif
+    #define XXH_STATIC_LINKING_ONLY   /* XXH32_state_t */
+    #include "blosc2/internal-complibs/zstd/common/xxhash.h"
+#endif
+
+/**
+ * @brief SIMD base64 kernels: SSSE3, AVX2 and AVX-512 VBMI picked at run time on x86
+ *        (GCC/Clang), NEON on 64-bit ARM; define NO_SIMD for the scalar code only
+ */
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+    #define ZMAT_SIMD_X86
+    #include <immintrin.h>
+    #if defined(__clang__) || __GNUC__ >= 8
+        #define ZMAT_SIMD_AVX512
+    #endif
+#elif !defined(NO_SIMD) && defined(__aarch64__)
+    #define ZMAT_SIMD_NEON
+    #include <arm_neon.h>
 #endif
 
 /**
- * @brief Maximum single allocation size (1 GB) to prevent runaway growth
+ * @brief Maximum single allocation size to prevent runaway growth, see zmat_alloc_limit()
  */
-#define ZMAT_MAX_ALLOC  ((size_t)1 << 30)
+#define ZMAT_MAX_ALLOC  zmat_alloc_limit()
 
 /**
- * @brief Maximum number of realloc rounds during decompression
+ * @brief Largest initial guess of a decompression buffer whose final size is unknown (1 GB)
+ */
+#define ZMAT_MAX_GUESS  ((size_t)1 << 30)
+
+/**
+ * @brief Maximum number of realloc rounds when inflating zlib data of unknown length
  */
 #define ZMAT_MAX_DECOMPRESS_ROUNDS 20
 
@@ -99,11 +137,222 @@
  */
 #define ZMAT_MIN_OUTBUF 1024
 
+/**
+ * @brief Largest decoded length trusted from a lzma header or lzip footer, as a multiple of
+ *        the compressed length; LZMA needs about a third of a bit for a repeated 273-byte
+ *        match, so even a run of zeros stays near 7000:1
+ */
+#define ZMAT_LZMA_RATIO 16384
+
+/**
+ * @brief Window (block) size buffered by the block based stream encoders (lz4, blosc2, lzip, xz)
+ */
+#ifndef ZMAT_STREAM_WINDOW
+    #define ZMAT_STREAM_WINDOW  ((size_t)4 << 20)
+#endif
+
+/**
+ * @brief Minimum output growth step of the stream interface
+ */
+#define ZMAT_STREAM_CHUNK   ((size_t)1 << 16)
+
+/**
+ * @brief Maximum block size of the LZ4 frames written by zmLz4f and the stream encoder (4 MB, BD=7)
+ */
+#define ZMAT_LZ4_BLOCK      ((size_t)4 << 20)
+
+/**
+ * @brief Write an XXH32 checksum after each block of the zmLz4f frames, 0 to leave them out
+ */
+#ifndef ZMAT_LZ4F_CHECKSUM
+    #define ZMAT_LZ4F_CHECKSUM  1
+#endif
+
+/**
+ * @brief Length of the zmLz4f frame header: magic, FLG, BD, 8-byte content size and HC
+ */
+#define ZMAT_LZ4F_HEADER    15
+
+/**
+ * @brief Largest input piece handed to zlib in one call (avail_in is 32bit)
+ */
+#define ZMAT_STREAM_FEED    ((size_t)1 << 30)
+
+/**
+ * @brief Largest number of threads in the shared worker pool
+ */
+#define ZMAT_POOL_MAX       128
+
+/**
+ * @brief Input length per thread when nthread is 0 (auto); also the lzip chunk length in that case
+ */
+#define ZMAT_MT_BLOCK       ((size_t)4 << 20)
+
+/**
+ * @brief Input length of each deflate block written by the parallel zlib/gzip encoder
+ */
+#define ZMAT_DEFLATE_BLOCK  ((size_t)1 << 20)
+
+/**
+ * @brief Length of the preceding input primed as the dictionary of each parallel deflate block
+ */
+#define ZMAT_DEFLATE_DICT   ((size_t)1 << 15)
+
+/**
+ * @brief Default input length between the access points of an indexed gzip stream (ZMAT_INDEX)
+ */
+#ifndef ZMAT_INDEX_INTERVAL
+    #define ZMAT_INDEX_INTERVAL ZMAT_DEFLATE_BLOCK
+#endif
+
+/**
+ * @brief Largest number of blocks recorded in the gzip extra field of an indexed stream
+ */
+#define ZMAT_INDEX_MAX      16000
+
+/**
+ * @brief Length of the fixed part of the gzip index: version, interval, total length and block count
+ */
+#define ZMAT_INDEX_FIXED    17
+
+/**
+ * @brief Input length of each frame of a zstd seekable stream (ZMAT_INDEX)
+ */
+#ifndef ZMAT_SEEK_FRAME
+    #define ZMAT_SEEK_FRAME     ZMAT_DEFLATE_BLOCK
+#endif
+
+/**
+ * @brief Default decoded length of each chunk of a zmat container (ZMAT_CONTAINER)
+ */
+#ifndef ZMAT_CONTAINER_CHUNK
+    #define ZMAT_CONTAINER_CHUNK ZMAT_MT_BLOCK
+#endif
+
+/**
+ * @brief Length of each index entry of a zmat container: chunk offset, compressed length and crc32
+ */
+#define ZMAT_CONTAINER_ENTRY 20
+
+/**
+ * @brief Largest input stored as a single blosc2 chunk; longer inputs are written as a
+ *        contiguous blosc2 frame (super-chunk) of chunks of this length
+ */
+#ifndef ZMAT_BLOSC2_CHUNK
+    #define ZMAT_BLOSC2_CHUNK ((size_t)16 << 20)
+#endif
+
+/**
+ * @brief Largest chunk and block of a b2nd array; a slice decompresses the chunks it
+ *        intersects, and within them only the blocks it intersects
+ */
+#ifndef ZMAT_B2ND_CHUNK
+    #define ZMAT_B2ND_CHUNK ((size_t)4 << 20)
+#endif
+
+#ifndef ZMAT_B2ND_BLOCK
+    #define ZMAT_B2ND_BLOCK ((size_t)256 << 10)
+#endif
+
+/**
+ * @brief Most dimensions of a b2nd array, the length of the shape arrays of the public API
+ */
+#define ZMAT_B2ND_MAX_DIM   8
+
+/**
+ * @brief Methods writing b2nd frames: b2nd itself, and the zfp and ndlz plugin codecs,
+ *        which read the array shape from the b2nd metalayer
+ */
+#define ZMAT_IS_B2ND(zipid)  ((zipid) == zmB2nd || ((zipid) >= zmBlosc2ZfpAcc && (zipid) <= zmBlosc2Ndlz))
+
+/**
+ * @brief Storage class of the per-thread settings, such as those of zmat_set_blosc2()
+ */
+#ifdef _MSC_VER
+    #define ZMAT_TLS __declspec(thread)
+#else
+    #define ZMAT_TLS __thread
+#endif
+
+/**
+ * @brief Compressed length of each chunk of an unindexed zlib/gzip stream inflated speculatively in parallel
+ */
+#ifndef ZMAT_INFLATE_CHUNK
+    #define ZMAT_INFLATE_CHUNK  ((size_t)2 << 20)
+#endif
+
+/**
+ * @brief Base64 text coded at a time by the zlib, gzip and zstd pipelines of ZMAT_BASE64, a multiple of 4
+ */
+#ifndef ZMAT_BASE64_PIECE
+    #define ZMAT_BASE64_PIECE   ((size_t)64 << 10)
+#endif
+
+/**
+ * @brief Lead kept by the codec output over the text encoded in place before it (ZMAT_BASE64),
+ *        at least one SIMD store
+ */
+#define ZMAT_BASE64_SLACK   64
+
+/**
+ * @brief Compressed length searched for a deflate block header at the start of each speculative chunk
+ */
+#define ZMAT_INFLATE_SEARCH ((size_t)1 << 16)
+
+/**
+ * @brief Code length resolved by a single table lookup in the parallel inflater
+ */
+#define ZMAT_HUFF_FAST      10
+
+/**
+ * @brief Nonzero if zipid carries the ZMAT_FRAME flag
+ */
+#define ZMAT_IS_FRAME(zipid) ((zipid) >= 0 && ((zipid) & ZMAT_FRAME))
+
+/**
+ * @brief Nonzero if zipid carries the ZMAT_INDEX flag
+ */
+#define ZMAT_IS_INDEX(zipid) ((zipid) >= 0 && ((zipid) & ZMAT_INDEX))
+
+/**
+ * @brief Nonzero if zipid carries the ZMAT_CONTAINER flag
+ */
+#define ZMAT_IS_CONTAINER(zipid) ((zipid) >= 0 && ((zipid) & ZMAT_CONTAINER))
+
+/**
+ * @brief Nonzero if zipid carries the ZMAT_BASE64 flag
+ */
+#define ZMAT_IS_BASE64(zipid) ((zipid) >= 0 && ((zipid) & ZMAT_BASE64))
+
 #ifdef NO_ZLIB
-int miniz_gzip_uncompress(void* in_data, size_t in_len,
+int miniz_gzip_uncompress(const TZMatAllocator* al, void* in_data, size_t in_len,
                           void** out_data, size_t* out_len);
 #endif
 
+static unsigned char* zmat_base64_encode(const TZMatAllocator* al, const unsigned char* src, size_t len,
+        size_t* out_len, int mode, int nthread);
+static unsigned char* zmat_base64_decode(const TZMatAllocator* al, const unsigned char* src, size_t len,
+        size_t* out_len, int nthread);
+static int zmat_frame_run(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                          unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+static int zmat_frame_into(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char* outputbuf,
+                           const size_t capacity, const int zipid, int* ret, const int iscompress);
+static int zmat_base64_run(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                           unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+static int zmat_base64_into(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                            unsigned char* text, const size_t capacity, const int zipid, int* ret, const int iscompress);
+static size_t zmat_outputbound_with(const TZMatAllocator* al, const size_t inputsize, const unsigned char* inputstr,
+                                    const int zipid, const int iscompress);
+static int zmat_run_with(const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                         unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+static int zmat_run_direct(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                           unsigned char* outputbuf, const size_t capacity, const int zipid, int* ret, const int iscompress);
+static int zmat_dict_uses(const size_t inputsize, const unsigned char* inputstr, const int zipid, const int iscompress);
+static int zmat_dict_run(TZMatCtx* ctx, const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                         unsigned char** outputbuf, const int zipid, int* ret, const int iscompress);
+static int zmat_dict_direct(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                            unsigned char* outputbuf, const size_t capacity, const int zipid, int* ret, const int iscompress);
+
 #ifndef NO_LZMA
 /**
  * @brief Easylzma interface to perform compression
@@ -118,7 +367,8 @@ int miniz_gzip_uncompress(void* in_data, size_t in_len,
  * @return return the fine grained lzma error code.
  */
 
-int simpleCompress(elzma_file_format format,
+int simpleCompress(const TZMatAllocator* al,
+                   elzma_file_format format,
                    const unsigned char* inData,
                    size_t inLen,
                    unsigned char** outData,
@@ -132,29 +382,44 @@ int simpleCompress(elzma_file_format format,
  * @param[in] format: output format (0 for lzip format, 1 for lzma-alone format)
  * @param[in] inData: input stream buffer pointer
  * @param[in] inLen: input stream buffer length
- * @param[in] outData: output stream buffer pointer
- * @param[in] outLen: output stream buffer length
+ * @param[in,out] outData: output stream buffer pointer; if not NULL on entry, a
+ *             caller-owned buffer of outCap bytes to decode into
+ * @param[out] outLen: output stream buffer length
+ * @param[in] outCap: length of *outData if given, otherwise the planned output length (0 if unknown)
  * @return return the fine grained lzma error code.
  */
 
-int simpleDecompress(elzma_file_format format,
+int simpleDecompress(const TZMatAllocator* al,
+                     elzma_file_format format,
                      const unsigned char* inData,
                      size_t inLen,
                      unsigned char** outData,
                      size_t* outLen,
+                     size_t outCap,
                      size_t* consumed);
 
+static int simpleCompressHandle(const TZMatAllocator* al,
+                                elzma_compress_handle hand,
+                                elzma_file_format format,
+                                const unsigned char* inData,
+                                size_t inLen,
+                                unsigned char** outData,
+                                size_t* outLen,
+                                int level,
+                                int nthread);
+
 #ifdef ZMAT_USE_LZMA_SDK
-int xzCompress(const unsigned char* inData, size_t inLen,
+int xzCompress(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
                unsigned char** outData, size_t* outLen,
-               int level, int nthread);
-int xzDecompress(const unsigned char* inData, size_t inLen,
-                 unsigned char** outData, size_t* outLen);
-#ifndef _WIN32
-int simpleCompressLzipMT(const unsigned char* inData, size_t inLen,
+               int level, int nthread, int nworker);
+static int xzCompressHandle(const TZMatAllocator* al, CXzEncHandle enc, const unsigned char* inData, size_t inLen,
+                            unsigned char** outData, size_t* outLen,
+                            int level, int nthread, int nworker);
+int xzDecompress(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
+                 unsigned char** outData, size_t* outLen, size_t outCap, int nthread);
+int simpleCompressLzipMT(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
                          unsigned char** outData, size_t* outLen,
-                         int level, int nthread);
-#endif
+                         int level, int nthread, int nworker);
 #endif
 #endif
 
@@ -175,6 +440,13 @@ const char* zmat_errcode[] = {
     "blosc2 error, see info.status for error flag, often a result of mismatch in compression method",/*-8*/
     "zstd error, see info.status for error flag, often a result of mismatch in compression method",/*-9*/
     "miniz error, see info.status for error flag, often a result of mismatch in compression method",/*-10*/
+    "invalid or already finished stream handle",/*-11*/
+    "output buffer is too small, the required size is returned in outputsize",/*-12*/
+    "invalid allocator, alloc, realloc and free must all be set",/*-13*/
+    "invalid zmat frame header, or the payload does not match the recorded length",/*-14*/
+    "invalid b2nd array shape, or a slice outside of the array",/*-15*/
+    "invalid blosc2 filter, blocksize, splitmode or codec parameter, or a shuffle with ZMAT_INDEX",/*-16*/
+    "dictionary training failed (too few or too similar samples), or the dictionary is invalid",/*-17*/
     "unsupported method" /*-999*/
 };
 
@@ -193,1885 +465,12618 @@ const char* zmat_error(int id) {
 }
 
 /**
- * @brief Safely compute initial decompression buffer size (inputsize * multiplier),
- *        with overflow protection and floor/ceiling clamping.
- *
- * @param[in] inputsize: the compressed input size
- * @param[in] multiplier: initial growth multiplier (e.g. 4)
- * @return a safe allocation size
+ * @brief Default allocator callbacks, forwarding to the C runtime
  */
 
-static size_t zmat_initial_outbuf(size_t inputsize, size_t multiplier) {
-    size_t outalloc = inputsize * multiplier;
+static void* zmat_std_alloc(void* opaque, size_t size) {
+    (void)opaque;
+    return malloc(size);
+}
 
-    /* check for overflow */
-    if (multiplier != 0 && outalloc / multiplier != inputsize) {
-        outalloc = ZMAT_MAX_ALLOC;
-    }
+static void* zmat_std_realloc(void* opaque, void* ptr, size_t size) {
+    (void)opaque;
+    return realloc(ptr, size);
+}
 
-    if (outalloc < ZMAT_MIN_OUTBUF) {
-        outalloc = ZMAT_MIN_OUTBUF;
-    }
+static void zmat_std_free(void* opaque, void* ptr) {
+    (void)opaque;
+    free(ptr);
+}
 
-    if (outalloc > ZMAT_MAX_ALLOC) {
-        outalloc = ZMAT_MAX_ALLOC;
+/**
+ * @brief Global allocator, set by zmat_set_allocator(NULL, ...)
+ */
+
+static TZMatAllocator zmat_allocator = {zmat_std_alloc, zmat_std_realloc, zmat_std_free, NULL};
+
+static void* zmat_malloc(const TZMatAllocator* al, size_t size) {
+    return al->alloc(al->opaque, size);
+}
+
+static void* zmat_realloc(const TZMatAllocator* al, void* ptr, size_t size) {
+    return al->realloc(al->opaque, ptr, size);
+}
+
+static void zmat_dealloc(const TZMatAllocator* al, void* ptr) {
+    if (ptr) {
+        al->free(al->opaque, ptr);
     }
+}
 
-    return outalloc;
+/**
+ * @brief Allocation limit set by zmat_set_max_alloc() or the ZMAT_MAX_ALLOC variable, 0 if not read yet
+ */
+
+static size_t zmat_max_alloc = 0;
+
+/**
+ * @brief Return the default allocation limit: 1 GB on 32-bit builds, 64 GB on 64-bit builds
+ */
+
+static size_t zmat_alloc_default(void) {
+    return (sizeof(size_t) > 4) ? ((size_t)1 << 30) << 6 : ((size_t)1 << 30);
 }
 
 /**
- * @brief Safely grow a buffer by doubling, with overflow and cap checks.
+ * @brief Return the largest single output allocation, read once from ZMAT_MAX_ALLOC
  *
- * @param[in,out] buf: pointer to the buffer pointer (updated on success)
- * @param[in,out] alloc: pointer to current allocation size (updated on success)
- * @return 0 on success, -5 on failure (*buf is freed and set to NULL)
+ * The variable holds a byte count with an optional K, M or G suffix, e.g. 16G.
  */
 
-static int zmat_grow_buf(unsigned char** buf, size_t* alloc) {
-    size_t newalloc = (*alloc) * 2;
+static size_t zmat_alloc_limit(void) {
+    if (zmat_max_alloc == 0) {
+        const char* env = getenv("ZMAT_MAX_ALLOC");
+        char* end = NULL;
+        unsigned long long n = env ? strtoull(env, &end, 10) : 0;
+        int shift = 0;
 
-    /* overflow or exceeds cap */
-    if (newalloc <= *alloc) {
-        newalloc = (*alloc < ZMAT_MAX_ALLOC) ? ZMAT_MAX_ALLOC : 0;
-    }
+        if (n > 0 && end && *end) {
+            shift = (toupper((unsigned char)*end) == 'K') ? 10 : (toupper((unsigned char)*end) == 'M') ? 20 :
+                    (toupper((unsigned char)*end) == 'G') ? 30 : -1;
+        }
 
-    if (newalloc > ZMAT_MAX_ALLOC) {
-        newalloc = ZMAT_MAX_ALLOC;
-    }
+        if (n == 0 || shift < 0 || n > ((size_t)(-1) >> shift)) {
+            n = zmat_alloc_default();
+        } else {
+            n <<= shift;
+        }
 
-    /* if we can't actually grow, fail */
-    if (newalloc <= *alloc) {
-        free(*buf);
-        *buf = NULL;
-        return -5;
+        zmat_max_alloc = (size_t)n;
     }
 
-    unsigned char* tmp = (unsigned char*)realloc(*buf, newalloc);
+    return zmat_max_alloc;
+}
 
-    if (tmp == NULL) {
-        free(*buf);
-        *buf = NULL;
-        return -5;
+/**
+ * @brief Set the largest single output allocation, 0 restores the default
+ */
+
+size_t zmat_set_max_alloc(size_t limit) {
+    size_t old = zmat_alloc_limit();
+
+    zmat_max_alloc = (limit == 0) ? zmat_alloc_default() : limit;
+    return old;
+}
+
+/**
+ * @brief zlib/miniz allocation hooks, opaque is the TZMatAllocator
+ */
+
+#ifdef NO_ZLIB
+static void* zmat_zalloc(void* opaque, size_t items, size_t size) {
+#else
+static voidpf zmat_zalloc(voidpf opaque, uInt items, uInt size) {
+#endif
+
+    if (size && (size_t)items > ((size_t) -1) / size) {
+        return NULL;
     }
 
-    *buf = tmp;
-    *alloc = newalloc;
-    return 0;
+    return zmat_malloc((const TZMatAllocator*)opaque, (size_t)items * size);
+}
+
+static void zmat_zfree(voidpf opaque, voidpf ptr) {
+    zmat_dealloc((const TZMatAllocator*)opaque, ptr);
 }
 
 /**
- * @brief Shrink buffer to actual used size to free excess memory.
+ * @brief Clear a z_stream and route its allocations to al, call before deflateInit/inflateInit
+ */
+
+static void zmat_zstream_init(z_stream* zs, const TZMatAllocator* al) {
+    memset(zs, 0, sizeof(z_stream));
+    zs->zalloc = zmat_zalloc;
+    zs->zfree = zmat_zfree;
+    zs->opaque = (voidpf)al;
+}
+
+/**
+ * @brief Refill the 32bit avail_in/avail_out of zs in pieces of at most ZMAT_STREAM_FEED bytes
  *
- * @param[in,out] buf: pointer to the buffer pointer
- * @param[in] used: actual bytes used
+ * @param[in,out] zs: the stream, next_in/next_out already point into the buffers
+ * @param[in] inend: end of the input buffer
+ * @param[in] outend: end of the output buffer
+ * @return 1 once the last input piece has been handed to zs, 0 otherwise
  */
 
-static void zmat_shrink_buf(unsigned char** buf, size_t used) {
-    if (*buf != NULL && used > 0) {
-        unsigned char* tmp = (unsigned char*)realloc(*buf, used);
+static int zmat_zstream_feed(z_stream* zs, const unsigned char* inend, const unsigned char* outend) {
+    size_t left;
 
-        if (tmp != NULL) {
-            *buf = tmp;
-        }
+    if (zs->avail_in == 0) {
+        left = (size_t)(inend - (const unsigned char*)zs->next_in);
+        zs->avail_in = (unsigned int)((left > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : left);
+    }
 
-        /* if shrink fails, the original pointer is still valid */
+    if (zs->avail_out == 0) {
+        left = (size_t)(outend - (const unsigned char*)zs->next_out);
+        zs->avail_out = (unsigned int)((left > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : left);
     }
+
+    return (const unsigned char*)zs->next_in + zs->avail_in == inend;
 }
 
 /**
- * @brief Main interface to perform compression/decompression
- *
- * @param[in] inputsize: input stream buffer length
- * @param[in] inputstr: input stream buffer pointer
- * @param[in, out] outputsize: output stream buffer length
- * @param[in, out] outputbuf: output stream buffer pointer
- * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
- * @param[in] iscompress: 0: decompression, 1: use default compression level;
- *             negative interger: set compression level (-1, less, to -9, more compression)
- * @return return the coarse grained zmat error code; detailed error code is in ret.
+ * @brief deflateBound(), or compressBound() if zs is NULL, for lengths that do not fit in a 32bit uLong
+ */
+
+static size_t zmat_deflate_bound(z_stream* zs, size_t len) {
+    if (len <= ZMAT_STREAM_FEED) {
+        return zs ? deflateBound(zs, (uLong)len) : compressBound((uLong)len);
+    }
+
+    /* stored blocks add 5 bytes per 16 kB, plus the header and trailer */
+    return len + (len >> 11) + 1024;
+}
+
+/**
+ * @brief Deflate inputsize bytes into out (capacity cap) with Z_FINISH, fed in 32bit pieces
  *
- * On error, *outputbuf is guaranteed to be NULL and *outputsize is 0.
+ * @return the deflate return code, Z_STREAM_END on success; *outlen is the output length
  */
 
-int zmat_run(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
-    z_stream zs;
-    int clevel;
-    union cflag {
-        int iscompress;
-        struct settings {
-            char clevel;
-            char nthread;
-            char shuffle;
-            char typesize;
-        } param;
-    } flags;
+static int zmat_deflate_all(z_stream* zs, const unsigned char* in, size_t inputsize, unsigned char* out, size_t cap, size_t* outlen) {
+    int rc = Z_OK;
 
-    *outputbuf = NULL;
-    *outputsize = 0;
+    zs->next_in = (Bytef*)in;
+    zs->avail_in = 0;
+    zs->next_out = (Bytef*)out;
+    zs->avail_out = 0;
 
-    flags.iscompress = iscompress;
+    while (rc == Z_OK) {
+        int last = zmat_zstream_feed(zs, in + inputsize, out + cap);
 
-    zs.zalloc = Z_NULL;
-    zs.zfree = Z_NULL;
-    zs.opaque = Z_NULL;
+        if (zs->avail_out == 0) {
+            rc = Z_BUF_ERROR;
+            break;
+        }
 
-    if (inputsize == 0) {
-        return -1;
+        rc = deflate(zs, last ? Z_FINISH : Z_NO_FLUSH);
     }
 
-    clevel = flags.param.clevel;
-    unsigned int nthread = (flags.param.nthread <= 0) ? 1 : (unsigned int)flags.param.nthread;
-    (void)nthread;
+    *outlen = (size_t)((unsigned char*)zs->next_out - out);
+    return rc;
+}
+
+#ifndef NO_LZMA
+
+/**
+ * @brief easylzma allocation hooks, ctx is the TZMatAllocator
+ */
+
+static void* zmat_elzma_alloc(void* ctx, unsigned int size) {
+    return zmat_malloc((const TZMatAllocator*)ctx, size);
+}
+
+static void zmat_elzma_free(void* ctx, void* ptr) {
+    zmat_dealloc((const TZMatAllocator*)ctx, ptr);
+}
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+/**
+ * @brief LZMA SDK allocator interface backed by a TZMatAllocator (vt must be the first field)
+ */
+
+typedef struct {
+    ISzAlloc vt;
+    const TZMatAllocator* al;
+} ZmatSzAlloc;
+
+static void* zmat_sz_alloc(ISzAllocPtr p, size_t size) {
+    return zmat_malloc(((const ZmatSzAlloc*)(const void*)p)->al, size);
+}
+
+static void zmat_sz_free(ISzAllocPtr p, void* ptr) {
+    zmat_dealloc(((const ZmatSzAlloc*)(const void*)p)->al, ptr);
+}
+
+static void zmat_sz_init(ZmatSzAlloc* sz, const TZMatAllocator* al) {
+    sz->vt.Alloc = zmat_sz_alloc;
+    sz->vt.Free = zmat_sz_free;
+    sz->al = al;
+}
+
+#endif
+#endif
+
+#ifndef NO_ZSTD
+
+/**
+ * @brief zstd allocation hooks, the callback signatures match TZMatAllocator
+ */
+
+static ZSTD_customMem zmat_zstd_mem(const TZMatAllocator* al) {
+    ZSTD_customMem mem;
+
+    mem.customAlloc = al->alloc;
+    mem.customFree = al->free;
+    mem.opaque = al->opaque;
+    return mem;
+}
+
+#endif
+
+/**
+ * @brief blosc2 filter pipeline, blocksize and splitmode of the calling thread, see zmat_set_blosc2()
+ */
+
+static ZMAT_TLS TZMatBlosc2Params zmat_blosc2_tuning;
+static ZMAT_TLS int zmat_blosc2_tuned = 0;
+
+/**
+ * @brief Dictionary of the calling thread, see zmat_set_dict()
+ */
+
+static ZMAT_TLS const TZMatDict* zmat_dict_active = NULL;
+
+/**
+ * @brief One fork-join job of the shared worker pool, owned by the submitting thread
+ */
+
+typedef struct TZMatPoolJob {
+    void (*fn)(void*, size_t);
+    void* arg;
+    size_t ntask;
+    size_t next;                 /**< next task index to be claimed */
+    size_t done;                 /**< number of finished tasks */
+    int helpers;                 /**< number of pool threads that may still join this job */
+    TZMatBlosc2Params tuning;    /**< blosc2 settings of the submitting thread, applied in the helpers */
+    int tuned;                   /**< nonzero if tuning is set */
+    const TZMatDict* dict;       /**< dictionary of the submitting thread, applied in the helpers */
+    struct TZMatPoolJob* link;
+} TZMatPoolJob;
+
+/**
+ * @brief Thread count limit, from ZMAT_NUM_THREADS, OMP_NUM_THREADS or the number of CPUs
+ */
+
+static int zmat_thread_limit = 0;
+
+#ifndef _WIN32
+
+/**
+ * @brief Library-owned worker pool, the threads are started on demand and kept until zmat_pool_free()
+ */
+
+static pthread_mutex_t zmat_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zmat_pool_wake = PTHREAD_COND_INITIALIZER;  /* a job is queued or the pool stops */
+static pthread_cond_t zmat_pool_done = PTHREAD_COND_INITIALIZER;  /* the last task of a job finished */
+static pthread_t zmat_pool_threads[ZMAT_POOL_MAX];
+static TZMatPoolJob* zmat_pool_jobs = NULL;
+static int zmat_pool_nthread = 0;
+static int zmat_pool_stop = 0;
+
+/**
+ * @brief Number of threaded codec calls in flight, shares the thread limit between concurrent callers
+ */
+
+static int zmat_pool_busy = 0;
+
+/**
+ * @brief Nonzero while the current thread runs pool tasks; nested parallel calls then run serially
+ */
+
+static __thread int zmat_pool_depth = 0;
+
+/**
+ * @brief Run the unclaimed tasks of a job, called and returning with zmat_pool_lock held
+ *
+ * The job is not touched after its last task finishes, as the owner may return at once.
+ */
+
+static void zmat_pool_work(TZMatPoolJob* job) {
+    size_t i;
+
+    while (job->next < job->ntask) {
+        i = job->next++;
+        pthread_mutex_unlock(&zmat_pool_lock);
+        job->fn(job->arg, i);
+        pthread_mutex_lock(&zmat_pool_lock);
+
+        if (++job->done == job->ntask) {
+            pthread_cond_broadcast(&zmat_pool_done);
+            break;
+        }
+    }
+}
+
+static void* zmat_pool_main(void* arg) {
+    TZMatPoolJob* job;
+
+    (void)arg;
+    zmat_pool_depth = 1;
+    pthread_mutex_lock(&zmat_pool_lock);
+
+    while (!zmat_pool_stop) {
+        for (job = zmat_pool_jobs; job && (job->next >= job->ntask || job->helpers <= 0); job = job->link);
+
+        if (job == NULL) {
+            pthread_cond_wait(&zmat_pool_wake, &zmat_pool_lock);
+            continue;
+        }
+
+        job->helpers--;
+        zmat_blosc2_tuning = job->tuning;
+        zmat_blosc2_tuned = job->tuned;
+        zmat_dict_active = job->dict;
+        zmat_pool_work(job);
+    }
+
+    pthread_mutex_unlock(&zmat_pool_lock);
+    return NULL;
+}
+
+#endif
+
+/**
+ * @brief Run fn(arg, 0) ... fn(arg, ntask - 1) on up to nworker threads of the shared pool
+ *
+ * The calling thread takes part and the call returns once all tasks are done. Tasks
+ * run serially on Windows, when nworker or ntask is 1, or inside another pool task.
+ *
+ * @param[in] fn: task callback, receives arg and the task index
+ * @param[in] arg: user data passed to fn
+ * @param[in] ntask: number of tasks
+ * @param[in] nworker: number of threads, the calling thread included
+ */
+
+static void zmat_pool_run(void (*fn)(void*, size_t), void* arg, size_t ntask, int nworker) {
+    size_t i;
+
+#ifndef _WIN32
+
+    if (nworker > 1 && ntask > 1 && zmat_pool_depth == 0) {
+        TZMatPoolJob job, **p;
+
+        if ((size_t)nworker > ntask) {
+            nworker = (int)ntask;
+        }
+
+        memset(&job, 0, sizeof(job));
+        job.fn = fn;
+        job.arg = arg;
+        job.ntask = ntask;
+        job.helpers = nworker - 1;
+        job.tuning = zmat_blosc2_tuning;
+        job.tuned = zmat_blosc2_tuned;
+        job.dict = zmat_dict_active;
+
+        pthread_mutex_lock(&zmat_pool_lock);
+
+        /* start missing threads; if none can be created, the caller runs all tasks */
+        while (zmat_pool_nthread < nworker - 1 && zmat_pool_nthread < ZMAT_POOL_MAX &&
+                pthread_create(zmat_pool_threads + zmat_pool_nthread, NULL, zmat_pool_main, NULL) == 0) {
+            zmat_pool_nthread++;
+        }
+
+        job.link = zmat_pool_jobs;
+        zmat_pool_jobs = &job;
+        pthread_cond_broadcast(&zmat_pool_wake);
+
+        zmat_pool_depth = 1;
+        zmat_pool_work(&job);
+
+        while (job.done < job.ntask) {
+            pthread_cond_wait(&zmat_pool_done, &zmat_pool_lock);
+        }
+
+        zmat_pool_depth = 0;
+
+        for (p = &zmat_pool_jobs; *p != &job; p = &(*p)->link);
+
+        *p = job.link;
+        pthread_mutex_unlock(&zmat_pool_lock);
+        return;
+    }
+
+#else
+    (void)nworker;
+#endif
+
+    for (i = 0; i < ntask; i++) {
+        fn(arg, i);
+    }
+}
+
+/**
+ * @brief Read the library thread limit from the environment or the CPU count
+ */
+
+static void zmat_thread_init(void) {
+    const char* env = getenv("ZMAT_NUM_THREADS");
+    int n = env ? atoi(env) : 0;
+
+    if (n <= 0 && (env = getenv("OMP_NUM_THREADS"))) {
+        n = atoi(env);
+    }
+
+#ifdef _WIN32
+
+    if (n <= 0 && (env = getenv("NUMBER_OF_PROCESSORS"))) {
+        n = atoi(env);
+    }
+
+#else
+
+    if (n <= 0) {
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+#endif
+    zmat_thread_limit = (n < 1) ? 1 : ((n > ZMAT_POOL_MAX) ? ZMAT_POOL_MAX : n);
+}
+
+#ifndef _WIN32
+static pthread_once_t zmat_thread_once = PTHREAD_ONCE_INIT;
+#endif
+
+/**
+ * @brief Return the library thread limit, read once by the first caller
+ *
+ * Without pthreads, concurrent first callers store the same value.
+ */
+
+static int zmat_thread_max(void) {
+#ifndef _WIN32
+    pthread_once(&zmat_thread_once, zmat_thread_init);
+#else
+
+    if (zmat_thread_limit <= 0) {
+        zmat_thread_init();
+    }
+
+#endif
+    return zmat_thread_limit;
+}
+
+/**
+ * @brief Resolve the nthread flag into the thread count that decides the output layout
+ *
+ * A positive nthread is used as is; 0 (auto) gives one thread per ZMAT_MT_BLOCK of input,
+ * so that the output does not depend on the machine; negative values mean one thread.
+ */
+
+static int zmat_thread_plan(int nthread, size_t inputsize) {
+    size_t n;
+
+    if (nthread != 0) {
+        return (nthread < 0) ? 1 : nthread;
+    }
+
+    n = inputsize / ZMAT_MT_BLOCK + (inputsize % ZMAT_MT_BLOCK != 0);
+    return (n < 1) ? 1 : ((n > ZMAT_POOL_MAX) ? ZMAT_POOL_MAX : (int)n);
+}
+
+/**
+ * @brief Reserve threads for one threaded codec call, pair with zmat_thread_release()
+ *
+ * Concurrent calls, e.g. from a Python thread pool, share the thread limit, and
+ * calls made from inside a pool task (such as zmat_run_batch() items) get one thread.
+ *
+ * @param[in] nthread: planned thread count from zmat_thread_plan()
+ * @return the number of threads to run with, between 1 and nthread
+ */
+
+static int zmat_thread_acquire(int nthread) {
+    int share = zmat_thread_max();
+
+    if (nthread <= 1) {
+        return 1;
+    }
+
+#ifndef _WIN32
+
+    if (zmat_pool_depth) {
+        return 1;
+    }
+
+    share /= __sync_add_and_fetch(&zmat_pool_busy, 1);
+#endif
+    return (share < 1) ? 1 : ((share < nthread) ? share : nthread);
+}
+
+static void zmat_thread_release(int nthread) {
+#ifndef _WIN32
+
+    if (nthread > 1 && !zmat_pool_depth) {
+        __sync_sub_and_fetch(&zmat_pool_busy, 1);
+    }
+
+#else
+    (void)nthread;
+#endif
+}
+
+#ifndef NO_ZSTD
+
+/**
+ * @brief Shared pool of the zstd multi-threaded compressor, created on first use
+ */
+
+#if defined(ZSTD_MULTITHREAD) && !defined(_WIN32)
+static ZSTD_threadPool* zmat_zstd_pool = NULL;
+#endif
+
+/**
+ * @brief Set the zstd worker count; 0 keeps the single-threaded format for nthread <= 1
+ *
+ * When zstd is built with ZSTD_MULTITHREAD (pass the same flag to zmat), all multi-threaded
+ * compressors reference one library-owned zstd pool of zmat_thread_max() threads, instead
+ * of each starting its own nworker threads.
+ */
+
+static void zmat_zstd_workers(ZSTD_CCtx* zctx, int nthread, int nworker) {
+    int nb = (nthread > 1) ? nworker : 0;
+
+    ZSTD_CCtx_setParameter(zctx, ZSTD_c_nbWorkers, nb);
+#if defined(ZSTD_MULTITHREAD) && !defined(_WIN32)
+
+    if (nb > 0) {
+        pthread_mutex_lock(&zmat_pool_lock);
+
+        if (zmat_zstd_pool == NULL) {
+            zmat_zstd_pool = ZSTD_createThreadPool((size_t)zmat_thread_max());
+        }
+
+        pthread_mutex_unlock(&zmat_pool_lock);
+    }
+
+    ZSTD_CCtx_refThreadPool(zctx, (nb > 0) ? zmat_zstd_pool : NULL);
+#endif
+}
+
+#endif
+
+#ifndef NO_BLOSC2
+
+#ifndef _WIN32
+
+/**
+ * @brief blosc2 thread jobs handed to the zmat pool
+ */
+
+typedef struct TZMatBloscJobs {
+    void (*dojob)(void*);
+    size_t elsize;
+    char* jobdata;
+} TZMatBloscJobs;
+
+static void zmat_blosc2_task(void* arg, size_t i) {
+    TZMatBloscJobs* j = (TZMatBloscJobs*)arg;
+    j->dojob(j->jobdata + i * j->elsize);
+}
+
+/**
+ * @brief blosc2 threads callback; each job claims blocks until none is left, so fewer threads suffice
+ */
+
+static void zmat_blosc2_threads(void* data, void (*dojob)(void*), int numjobs, size_t elsize, void* jobdata) {
+    TZMatBloscJobs j;
+    int nworker = zmat_thread_acquire(numjobs);
+
+    (void)data;
+    j.dojob = dojob;
+    j.elsize = elsize;
+    j.jobdata = (char*)jobdata;
+    zmat_pool_run(zmat_blosc2_task, &j, (size_t)numjobs, nworker);
+    zmat_thread_release(numjobs);
+}
+
+static pthread_once_t zmat_blosc2_once = PTHREAD_ONCE_INIT;
+
+static void zmat_blosc2_hook(void) {
+    blosc2_init();
+    blosc2_set_threads_callback(zmat_blosc2_threads, NULL);
+}
+
+#endif
+
+/**
+ * @brief Initialize blosc2 with its threads routed to the zmat pool, call before any blosc2 context is made
+ *
+ * zmat never codes through the global blosc1 style interface (blosc1_compress,
+ * blosc2_set_nthreads ...), whose single context is not safe to share between
+ * threads; every call makes its own context instead.
+ */
+
+static void zmat_blosc2_init(void) {
+#ifndef _WIN32
+    pthread_once(&zmat_blosc2_once, zmat_blosc2_hook);
+#else
+    blosc2_init();
+#endif
+}
+
+/**
+ * @brief Fill blosc2 compression parameters, with the settings of the calling thread if any
+ *
+ * Without a filter pipeline, shuffle is the only filter, as with blosc1_compress().
+ */
+
+static void zmat_blosc2_cparams(blosc2_cparams* cparams, int compcode, int clevel, int shuffle, int typesize, int nthread) {
+    int i;
+
+    *cparams = BLOSC2_CPARAMS_DEFAULTS;
+    cparams->compcode = (uint8_t)compcode;
+    cparams->clevel = (uint8_t)clevel;
+    cparams->typesize = typesize;
+    cparams->nthreads = (int16_t)nthread;
+    /* a byte shuffle of 1-byte elements is no filter, as blosc1_compress() writes it */
+    cparams->filters[BLOSC2_MAX_FILTERS - 1] = (uint8_t)((shuffle == BLOSC_SHUFFLE && typesize <= 1) ? BLOSC_NOSHUFFLE : shuffle);
+
+    if (!zmat_blosc2_tuned) {
+        return;
+    }
+
+    if (zmat_blosc2_tuning.nfilter > 0) {
+        for (i = 0; i < BLOSC2_MAX_FILTERS; i++) {
+            cparams->filters[i] = (i < zmat_blosc2_tuning.nfilter) ? zmat_blosc2_tuning.filters[i] : BLOSC_NOFILTER;
+            cparams->filters_meta[i] = (i < zmat_blosc2_tuning.nfilter) ? (uint8_t)zmat_blosc2_tuning.filters_meta[i] : 0;
+        }
+    }
+
+    cparams->blocksize = zmat_blosc2_tuning.blocksize;
+    cparams->splitmode = zmat_blosc2_tuning.splitmode ? zmat_blosc2_tuning.splitmode : BLOSC_FORWARD_COMPAT_SPLIT;
+}
+
+/**
+ * @brief Compress a buffer into one blosc2 chunk with a temporary context
+ *
+ * Without zmat_set_blosc2() settings, the chunk is the same as that of blosc1_compress().
+ *
+ * @param[in] zipid: one of the zmBlosc2* methods
+ * @param[out] ret: compressed length, 0 if it did not fit, or a negative blosc2 error code
+ * @return 0 if the codec ran, -7 if it is not supported
+ */
+
+static int zmat_blosc2_chunk_encode(int zipid, int clevel, int shuffle, int typesize, int nthread,
+                                    const unsigned char* inputstr, size_t inputsize, unsigned char* outputbuf, size_t capacity, int* ret) {
+    const char* codecs[] = {"blosclz", "lz4", "lz4hc", "zlib", "zstd"};
+    blosc2_cparams cparams;
+    blosc2_context* cctx;
+    int compcode;
+
+    if ((compcode = blosc2_compname_to_compcode(codecs[zipid - zmBlosc2Blosclz])) < 0) {
+        return -7;
+    }
+
+    zmat_blosc2_init();
+    zmat_blosc2_cparams(&cparams, compcode, clevel, shuffle, typesize, nthread);
+
+    if (!(cctx = blosc2_create_cctx(cparams))) {
+        *ret = BLOSC2_ERROR_FAILURE;
+        return 0;
+    }
+
+    *ret = blosc2_compress_ctx(cctx, inputstr, (int32_t)inputsize, outputbuf, (capacity > INT32_MAX) ? INT32_MAX : (int32_t)capacity);
+    blosc2_free_ctx(cctx);
+    return 0;
+}
+
+#endif
+
+/**
+ * @brief Stop and join the threads of the shared worker pool
+ *
+ * The pool restarts on the next threaded call. Call it only when no zmat call, zmat_ctx
+ * or stream is in use, e.g. before unloading the library.
+ */
+
+void zmat_pool_free(void) {
+#ifndef _WIN32
+    int i, n;
+
+    pthread_mutex_lock(&zmat_pool_lock);
+    zmat_pool_stop = 1;
+    n = zmat_pool_nthread;
+    pthread_cond_broadcast(&zmat_pool_wake);
+    pthread_mutex_unlock(&zmat_pool_lock);
+
+    for (i = 0; i < n; i++) {
+        pthread_join(zmat_pool_threads[i], NULL);
+    }
+
+    pthread_mutex_lock(&zmat_pool_lock);
+    zmat_pool_nthread = 0;
+    zmat_pool_stop = 0;
+#if !defined(NO_ZSTD) && defined(ZSTD_MULTITHREAD)
+    ZSTD_freeThreadPool(zmat_zstd_pool);
+    zmat_zstd_pool = NULL;
+#endif
+    pthread_mutex_unlock(&zmat_pool_lock);
+#endif
+}
+
+/**
+ * @brief Set the blosc2 filter pipeline, blocksize and splitmode of the calling thread
+ *
+ * @param[in] params: settings (copied), or NULL to restore the defaults
+ * @return 0 on success, -16 if a filter id, blocksize or splitmode is invalid
+ */
+
+int zmat_set_blosc2(const TZMatBlosc2Params* params) {
+#ifndef NO_BLOSC2
+    int i;
+
+    if (params == NULL) {
+        memset(&zmat_blosc2_tuning, 0, sizeof(zmat_blosc2_tuning));
+        zmat_blosc2_tuned = 0;
+        return 0;
+    }
+
+    if (params->nfilter < 0 || params->nfilter > ZMAT_MAX_FILTERS || params->blocksize < 0
+            || params->splitmode < 0 || params->splitmode > BLOSC_FORWARD_COMPAT_SPLIT
+            || params->compmeta < INT8_MIN || params->compmeta > UINT8_MAX) {
+        return -16;
+    }
+
+    for (i = 0; i < params->nfilter; i++) {
+        if (params->filters[i] >= BLOSC_LAST_FILTER) {
+            return -16;
+        }
+    }
+
+    zmat_blosc2_tuning = *params;
+    zmat_blosc2_tuned = 1;
+    return 0;
+#else
+    return (params == NULL) ? 0 : -999;
+#endif
+}
+
+#ifndef NO_LZ4
+
+/**
+ * @brief LZ4_compress_HC() with its state allocated from al instead of malloc
+ *
+ * @return the compressed length, 0 on failure
+ */
+
+static int zmat_lz4hc_compress(const TZMatAllocator* al, const char* src, char* dst, int srclen, int dstcap, int level) {
+    void* state = zmat_malloc(al, LZ4_sizeofStateHC());
+    int len;
+
+    if (state == NULL) {
+        return 0;
+    }
+
+    len = LZ4_compress_HC_extStateHC(state, src, dst, srclen, dstcap, level);
+    zmat_dealloc(al, state);
+    return len;
+}
+
+#endif
+
+/**
+ * @brief Safely compute initial decompression buffer size (inputsize * multiplier),
+ *        with overflow protection and floor/ceiling clamping.
+ *
+ * @param[in] inputsize: the compressed input size
+ * @param[in] multiplier: initial growth multiplier (e.g. 4)
+ * @return a safe allocation size
+ */
+
+static size_t zmat_initial_outbuf(size_t inputsize, size_t multiplier) {
+    size_t outalloc = inputsize * multiplier;
+
+    /* check for overflow */
+    if (multiplier != 0 && outalloc / multiplier != inputsize) {
+        outalloc = ZMAT_MAX_GUESS;
+    }
+
+    if (outalloc < ZMAT_MIN_OUTBUF) {
+        outalloc = ZMAT_MIN_OUTBUF;
+    }
+
+    if (outalloc > ZMAT_MAX_GUESS) {
+        outalloc = ZMAT_MAX_GUESS;
+    }
+
+    if (outalloc > ZMAT_MAX_ALLOC) {
+        outalloc = ZMAT_MAX_ALLOC;
+    }
+
+    return outalloc;
+}
+
+/**
+ * @brief Little-endian integer helpers for container headers and footers
+ */
+
+static void zmat_put_le(unsigned char* p, unsigned long long val, int nbytes) {
+    int i;
+
+    for (i = 0; i < nbytes; i++) {
+        p[i] = (unsigned char)(val >> (8 * i));
+    }
+}
+
+static unsigned long long zmat_get_le(const unsigned char* p, int nbytes) {
+    unsigned long long val = 0;
+    int i;
+
+    for (i = 0; i < nbytes; i++) {
+        val |= ((unsigned long long)p[i]) << (8 * i);
+    }
+
+    return val;
+}
+
+/**
+ * @brief Safely grow a buffer by doubling, with overflow and cap checks.
+ *
+ * @param[in] al: allocator that owns the buffer
+ * @param[in,out] buf: pointer to the buffer pointer (updated on success)
+ * @param[in,out] alloc: pointer to current allocation size (updated on success)
+ * @return 0 on success, -5 on failure (*buf is freed and set to NULL)
+ */
+
+static int zmat_grow_buf(const TZMatAllocator* al, unsigned char** buf, size_t* alloc) {
+    size_t newalloc = (*alloc) ? (*alloc) * 2 : ZMAT_MIN_OUTBUF;
+
+    /* overflow or exceeds cap */
+    if (newalloc <= *alloc) {
+        newalloc = (*alloc < ZMAT_MAX_ALLOC) ? ZMAT_MAX_ALLOC : 0;
+    }
+
+    if (newalloc > ZMAT_MAX_ALLOC) {
+        newalloc = ZMAT_MAX_ALLOC;
+    }
+
+    /* if we can't actually grow, fail */
+    if (newalloc <= *alloc) {
+        zmat_dealloc(al, *buf);
+        *buf = NULL;
+        return -5;
+    }
+
+    unsigned char* tmp = (unsigned char*)zmat_realloc(al, *buf, newalloc);
+
+    if (tmp == NULL) {
+        zmat_dealloc(al, *buf);
+        *buf = NULL;
+        return -5;
+    }
+
+    *buf = tmp;
+    *alloc = newalloc;
+    return 0;
+}
+
+/**
+ * @brief Inflate inputsize bytes into a buffer grown with zmat_grow_buf, fed in 32bit pieces
+ *
+ * @param[in,out] buf: output buffer of *alloc bytes, freed and set to NULL on failure
+ * @param[out] outlen: inflated length
+ * @param[out] rc: the inflate return code
+ * @return 0 on success, -3 for a corrupt or truncated stream, -5 if the output can not grow
+ */
+
+static int zmat_inflate_all(const TZMatAllocator* al, z_stream* zs, const unsigned char* in, size_t inputsize,
+                            unsigned char** buf, size_t* alloc, size_t* outlen, int* rc) {
+    int rounds = 0;
+
+    zs->next_in = (Bytef*)in;
+    zs->avail_in = 0;
+    zs->next_out = (Bytef*)(*buf);
+    zs->avail_out = 0;
+
+    while (1) {
+        int last = zmat_zstream_feed(zs, in + inputsize, *buf + *alloc);
+
+        /* output buffer full — need to grow */
+        if (zs->avail_out == 0) {
+            size_t used = (size_t)((unsigned char*)zs->next_out - *buf);
+
+            if (++rounds > ZMAT_MAX_DECOMPRESS_ROUNDS) {
+                zmat_dealloc(al, *buf);
+                *buf = NULL;
+                return -5;
+            }
+
+            if (zmat_grow_buf(al, buf, alloc) != 0) {
+                return -5;
+            }
+
+            zs->next_out = (Bytef*)(*buf + used);
+            continue;
+        }
+
+        *rc = inflate(zs, Z_SYNC_FLUSH);
+
+        if (*rc == Z_STREAM_END) {
+            break;
+        }
+
+        /* a truncated stream stops making progress with output space left */
+        if ((*rc != Z_OK && *rc != Z_BUF_ERROR) || (last && zs->avail_in == 0 && zs->avail_out > 0)) {
+            zmat_dealloc(al, *buf);
+            *buf = NULL;
+            return -3;
+        }
+    }
+
+    *outlen = (size_t)((unsigned char*)zs->next_out - *buf);
+    return 0;
+}
+
+/**
+ * @brief Shrink buffer to actual used size to free excess memory.
+ *
+ * @param[in] al: allocator that owns the buffer
+ * @param[in,out] buf: pointer to the buffer pointer
+ * @param[in] used: actual bytes used
+ */
+
+static void zmat_shrink_buf(const TZMatAllocator* al, unsigned char** buf, size_t used) {
+    if (*buf != NULL && used > 0) {
+        unsigned char* tmp = (unsigned char*)zmat_realloc(al, *buf, used);
+
+        if (tmp != NULL) {
+            *buf = tmp;
+        }
+
+        /* if shrink fails, the original pointer is still valid */
+    }
+}
+
+/**
+ * @brief Reusable codec states cached by a zmat_ctx handle (see zmat_run_ctx)
+ *
+ * A state is created on first use and kept until zmat_ctx_free(); deflate
+ * and blosc2 compression states are rebuilt only when the level or the
+ * blosc2 parameters change between calls.
+ */
+
+struct TZMatCtx {
+    TZMatAllocator alloc;           /**< allocator of the cached states and output buffers */
+    TZMatAllocator owner;           /**< global allocator at zmat_ctx_init(), which releases the context itself */
+    z_stream deflater;              /**< cached deflate stream, valid if deflatebits != 0 */
+    int deflatelevel;               /**< compression level of deflater */
+    int deflatebits;                /**< windowBits of deflater, 0 if not initialized */
+    z_stream inflater;              /**< cached inflate stream, valid if inflatebits != 0 */
+    int inflatebits;                /**< windowBits of inflater, 0 if not initialized */
+#ifndef NO_LZ4
+    void* lz4state;                 /**< LZ4_compress_fast_extState() state */
+    void* lz4hcstate;               /**< LZ4_compress_HC_extStateHC() state */
+#endif
+#ifndef NO_ZSTD
+    ZSTD_CCtx* zstdc;               /**< zstd compression context */
+    ZSTD_DCtx* zstdd;               /**< zstd decompression context */
+#endif
+#ifndef NO_BLOSC2
+    blosc2_context* bloscc;         /**< blosc2 compression context */
+    blosc2_cparams bloscparam;      /**< parameters bloscc was created with */
+    blosc2_context* bloscd;         /**< blosc2 decompression context */
+    int bloscdthread;               /**< thread count bloscd was created with */
+#endif
+#ifndef NO_LZMA
+    elzma_compress_handle lzmaenc;  /**< easylzma encoder for lzma/lzip */
+#ifdef ZMAT_USE_LZMA_SDK
+    CXzEncHandle xzenc;             /**< LZMA SDK xz encoder */
+    ZmatSzAlloc szalloc;            /**< SDK allocator interface forwarding to alloc */
+#endif
+#endif
+};
+
+/**
+ * @brief Prepare a deflate stream, reusing the one cached in ctx if possible
+ *
+ * @param[in] ctx: zmat_ctx handle, or NULL to initialize the caller's local stream
+ * @param[in] local: caller's stream used when ctx is NULL
+ * @param[out] zs: the stream to use; call deflateEnd() on it only if ctx is NULL
+ * @param[in] level: compression level
+ * @param[in] bits: windowBits passed to deflateInit2
+ * @param[in] memlevel: memLevel passed to deflateInit2
+ * @return Z_OK on success, otherwise the zlib error code
+ */
+
+static int zmat_ctx_deflater(TZMatCtx* ctx, z_stream* local, z_stream** zs, int level, int bits, int memlevel) {
+    int res;
+
+    if (ctx == NULL) {
+        zmat_zstream_init(local, &zmat_allocator);
+        *zs = local;
+        return deflateInit2(local, level, Z_DEFLATED, bits, memlevel, Z_DEFAULT_STRATEGY);
+    }
+
+    *zs = &ctx->deflater;
+
+    if (ctx->deflatebits == bits && ctx->deflatelevel == level) {
+        return deflateReset(&ctx->deflater);
+    }
+
+    if (ctx->deflatebits) {
+        deflateEnd(&ctx->deflater);
+        ctx->deflatebits = 0;
+    }
+
+    zmat_zstream_init(&ctx->deflater, &ctx->alloc);
+
+    if ((res = deflateInit2(&ctx->deflater, level, Z_DEFLATED, bits, memlevel, Z_DEFAULT_STRATEGY)) == Z_OK) {
+        ctx->deflatebits = bits;
+        ctx->deflatelevel = level;
+    }
+
+    return res;
+}
+
+/**
+ * @brief Prepare an inflate stream, reusing the one cached in ctx if possible
+ *
+ * @param[in] ctx: zmat_ctx handle, or NULL to initialize the caller's local stream
+ * @param[in] local: caller's stream used when ctx is NULL
+ * @param[out] zs: the stream to use; call inflateEnd() on it only if ctx is NULL
+ * @param[in] bits: windowBits passed to inflateInit2
+ * @return Z_OK on success, otherwise the zlib error code
+ */
+
+static int zmat_ctx_inflater(TZMatCtx* ctx, z_stream* local, z_stream** zs, int bits) {
+    int res;
+
+    if (ctx == NULL) {
+        zmat_zstream_init(local, &zmat_allocator);
+        *zs = local;
+        return inflateInit2(local, bits);
+    }
+
+    *zs = &ctx->inflater;
+
+    if (ctx->inflatebits == bits) {
+        return inflateReset(&ctx->inflater);
+    }
+
+    if (ctx->inflatebits) {
+        inflateEnd(&ctx->inflater);
+        ctx->inflatebits = 0;
+    }
+
+    zmat_zstream_init(&ctx->inflater, &ctx->alloc);
+
+    if ((res = inflateInit2(&ctx->inflater, bits)) == Z_OK) {
+        ctx->inflatebits = bits;
+    }
+
+    return res;
+}
+
+#ifndef NO_BLOSC2
+
+/**
+ * @brief Return the blosc2 compression context cached in ctx, recreating it if the parameters changed
+ *
+ * @return the context, or NULL if it can not be created
+ */
+
+static blosc2_context* zmat_ctx_blosc2c(TZMatCtx* ctx, int compcode, int clevel, int shuffle, int typesize, int nthread) {
+    blosc2_cparams cparams;
+
+    zmat_blosc2_cparams(&cparams, compcode, clevel, shuffle, typesize, nthread);
+
+    if (ctx->bloscc && ctx->bloscparam.compcode == cparams.compcode && ctx->bloscparam.clevel == cparams.clevel &&
+            ctx->bloscparam.typesize == cparams.typesize && ctx->bloscparam.nthreads == cparams.nthreads &&
+            ctx->bloscparam.blocksize == cparams.blocksize && ctx->bloscparam.splitmode == cparams.splitmode &&
+            memcmp(ctx->bloscparam.filters, cparams.filters, BLOSC2_MAX_FILTERS) == 0 &&
+            memcmp(ctx->bloscparam.filters_meta, cparams.filters_meta, BLOSC2_MAX_FILTERS) == 0) {
+        return ctx->bloscc;
+    }
+
+    if (ctx->bloscc) {
+        blosc2_free_ctx(ctx->bloscc);
+    }
+
+    ctx->bloscc = blosc2_create_cctx(cparams);
+    ctx->bloscparam = cparams;
+    return ctx->bloscc;
+}
+
+/**
+ * @brief Return the blosc2 decompression context cached in ctx, recreating it if the thread count changed
+ *
+ * @return the context, or NULL if it can not be created
+ */
+
+static blosc2_context* zmat_ctx_blosc2d(TZMatCtx* ctx, int nthread) {
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+
+    if (ctx->bloscd && ctx->bloscdthread == nthread) {
+        return ctx->bloscd;
+    }
+
+    if (ctx->bloscd) {
+        blosc2_free_ctx(ctx->bloscd);
+    }
+
+    dparams.nthreads = nthread;
+    ctx->bloscd = blosc2_create_dctx(dparams);
+    ctx->bloscdthread = nthread;
+    return ctx->bloscd;
+}
+
+#endif
+
+#ifndef NO_BLOSC2
+
+/**
+ * @brief Walk the chunk headers of a blosc2 buffer (a single chunk or a sequence of chunks)
+ *
+ * @param[in] inputstr: blosc2 compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @param[out] total: total decompressed length of all chunks
+ * @return number of chunks if the chunks cover the whole input exactly, otherwise 0
+ */
+
+static int zmat_blosc2_chunks(const unsigned char* inputstr, size_t inputsize, size_t* total) {
+    size_t chunkpos = 0;
+    int nchunks = 0;
+
+    *total = 0;
+
+    while (chunkpos + BLOSC_MIN_HEADER_LENGTH <= inputsize) {
+        size_t nbytes = 0, cbytes = 0, blocksize = 0;
+
+        blosc1_cbuffer_sizes(inputstr + chunkpos, &nbytes, &cbytes, &blocksize);
+
+        if (cbytes < BLOSC_MIN_HEADER_LENGTH || cbytes > inputsize - chunkpos || nbytes > ZMAT_MAX_ALLOC - *total) {
+            break;
+        }
+
+        chunkpos += cbytes;
+        *total += nbytes;
+        nchunks++;
+    }
+
+    return (chunkpos == inputsize) ? nchunks : 0;
+}
+
+/**
+ * @brief Decode a blosc2 chunk sequence validated by zmat_blosc2_chunks() into a preallocated buffer
+ *
+ * @param[in] dctx: blosc2 decompression context, or NULL to make a temporary one with nthread threads
+ * @param[in] nthread: number of threads of the temporary context
+ * @param[in] inputstr: blosc2 compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @param[out] outputbuf: output buffer, must hold the total length reported by zmat_blosc2_chunks()
+ * @param[out] ret: blosc2 error code (if error occurs)
+ * @return 0 on success, -8 on failure
+ */
+
+static int zmat_blosc2_decode_chunks(blosc2_context* dctx, int nthread, const unsigned char* inputstr, size_t inputsize,
+                                     unsigned char* outputbuf, int* ret) {
+    size_t chunkpos = 0, pos = 0;
+    blosc2_context* tmpctx = NULL;
+    int res = 0;
+
+    if (dctx == NULL) {
+        blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+
+        zmat_blosc2_init();
+        dparams.nthreads = (int16_t)nthread;
+
+        if (!(dctx = tmpctx = blosc2_create_dctx(dparams))) {
+            *ret = BLOSC2_ERROR_FAILURE;
+            return -8;
+        }
+    }
+
+    while (chunkpos < inputsize) {
+        size_t nbytes = 0, cbytes = 0, blocksize = 0;
+
+        blosc1_cbuffer_sizes(inputstr + chunkpos, &nbytes, &cbytes, &blocksize);
+        *ret = blosc2_decompress_ctx(dctx, inputstr + chunkpos, (int32_t)cbytes, outputbuf + pos, (int32_t)nbytes);
+
+        if (*ret < 0 || (size_t)(*ret) != nbytes) {
+            res = -8;
+            break;
+        }
+
+        chunkpos += cbytes;
+        pos += nbytes;
+    }
+
+    if (tmpctx) {
+        blosc2_free_ctx(tmpctx);
+    }
+
+    return res;
+}
+
+/**
+ * @brief Chunks of a blosc2 contiguous frame compressed or decompressed in parallel
+ */
+
+typedef struct TZMatBloscFrameJob {
+    const unsigned char* in;    /**< raw input (compression) */
+    size_t inputsize;           /**< raw input length (compression) */
+    size_t chunk;               /**< decoded length of each chunk (compression) */
+    size_t first;               /**< first chunk of the current round (compression) */
+    blosc2_cparams cparams;     /**< parameters of each chunk (compression) */
+    uint8_t** cchunk;           /**< compressed chunks */
+    int32_t* clen;              /**< compressed lengths (decompression) */
+    size_t* pos;                /**< decoded offset of each chunk, then the total (decompression) */
+    unsigned char* dest;        /**< decoded output (decompression) */
+    int* rc;                    /**< blosc2 return code of each chunk */
+} TZMatBloscFrameJob;
+
+/**
+ * @brief Open a blosc2 contiguous frame in place, without copying or taking ownership of the buffer
+ *
+ * @return the super-chunk, free with blosc2_schunk_free(), or NULL if the buffer is not a
+ *         frame or decodes to more than ZMAT_MAX_ALLOC bytes
+ */
+
+static blosc2_schunk* zmat_blosc2_frame_open(const unsigned char* inputstr, size_t inputsize) {
+    blosc2_schunk* schunk;
+
+    /* msgpack fixarray, then the "b2frame" magic string */
+    if (inputsize < 112 || inputstr[1] != 0xa8 || memcmp(inputstr + 2, "b2frame", 8)) {
+        return NULL;
+    }
+
+    zmat_blosc2_init();
+
+    if (!(schunk = blosc2_schunk_from_buffer((uint8_t*)inputstr, (int64_t)inputsize, false))) {
+        return NULL;
+    }
+
+    blosc2_schunk_avoid_cframe_free(schunk, true);
+
+    if (schunk->nbytes < 0 || (uint64_t)schunk->nbytes > ZMAT_MAX_ALLOC || schunk->nchunks < 0) {
+        blosc2_schunk_free(schunk);
+        return NULL;
+    }
+
+    return schunk;
+}
+
+/**
+ * @brief Compress one chunk of a frame on the calling thread
+ */
+
+static void zmat_blosc2_frame_encode_chunk(void* arg, size_t i) {
+    TZMatBloscFrameJob* job = (TZMatBloscFrameJob*)arg;
+    size_t start = (job->first + i) * job->chunk;
+    size_t blen = (job->inputsize - start < job->chunk) ? job->inputsize - start : job->chunk;
+    blosc2_context* cctx = blosc2_create_cctx(job->cparams);
+
+    job->rc[i] = cctx ? blosc2_compress_ctx(cctx, job->in + start, (int32_t)blen, job->cchunk[i], (int32_t)(blen + BLOSC2_MAX_OVERHEAD)) : -1;
+
+    if (cctx) {
+        blosc2_free_ctx(cctx);
+    }
+}
+
+/**
+ * @brief Compress a buffer into a blosc2 contiguous frame of ZMAT_BLOSC2_CHUNK-long chunks
+ *
+ * The chunks are compressed in rounds of one chunk per thread and appended to an
+ * in-memory super-chunk, so the scratch memory is one chunk per thread whatever the
+ * input length. The output does not depend on the thread count.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: raw input
+ * @param[in] inputsize: raw input length
+ * @param[in] cparams: codec, level, filters and element length of the chunks; the chunk
+ *            length is rounded down to a multiple of the element length
+ * @param[in] nthread: number of threads
+ * @param[out] outputbuf: the frame, free with zmat_free()
+ * @param[out] outputsize: frame length
+ * @param[out] ret: blosc2 error code (if error occurs)
+ * @return 0 on success, -5 if out of memory, -8 on blosc2 errors
+ */
+
+static int zmat_blosc2_frame_encode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize,
+                                    const blosc2_cparams* cparams, int nthread, unsigned char** outputbuf, size_t* outputsize, int* ret) {
+    blosc2_storage storage = BLOSC2_STORAGE_DEFAULTS;
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    blosc2_schunk* schunk;
+    TZMatBloscFrameJob job;
+    uint8_t* cframe = NULL;
+    bool needs_free = false;
+    size_t nchunk, round, i;
+    int64_t cframelen;
+    int errcode = 0, nworker;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    job.cparams = *cparams;
+    job.cparams.nthreads = 1;
+    dparams.nthreads = 1;
+
+    storage.contiguous = true;
+    storage.cparams = &job.cparams;
+    storage.dparams = &dparams;
+
+    zmat_blosc2_init();
+
+    if (!(schunk = blosc2_schunk_new(&storage))) {
+        return -8;
+    }
+
+    job.in = inputstr;
+    job.inputsize = inputsize;
+    job.chunk = ZMAT_BLOSC2_CHUNK - ZMAT_BLOSC2_CHUNK % cparams->typesize;
+    nchunk = inputsize / job.chunk + (inputsize % job.chunk != 0);
+
+    nworker = zmat_thread_acquire(nthread);
+    round = ((size_t)nworker < nchunk) ? (size_t)nworker : nchunk;
+
+    job.cchunk = (uint8_t**)zmat_malloc(al, round * (sizeof(uint8_t*) + sizeof(int)));
+
+    if (job.cchunk) {
+        job.rc = (int*)(job.cchunk + round);
+
+        for (i = 0; i < round; i++) {
+            job.cchunk[i] = (uint8_t*)zmat_malloc(al, job.chunk + BLOSC2_MAX_OVERHEAD);
+            errcode = (job.cchunk[i] || errcode) ? errcode : -5;
+        }
+    } else {
+        errcode = -5;
+    }
+
+    for (job.first = 0; job.first < nchunk && errcode == 0; job.first += round) {
+        size_t n = (nchunk - job.first < round) ? nchunk - job.first : round;
+
+        zmat_pool_run(zmat_blosc2_frame_encode_chunk, &job, n, nworker);
+
+        for (i = 0; i < n && errcode == 0; i++) {
+            int64_t nappend = (job.rc[i] > 0) ? blosc2_schunk_append_chunk(schunk, job.cchunk[i], true) : job.rc[i];
+
+            if (nappend <= 0) {
+                *ret = (int)nappend;
+                errcode = -8;
+            }
+        }
+    }
+
+    zmat_thread_release(nthread);
+
+    if (job.cchunk) {
+        for (i = 0; i < round; i++) {
+            zmat_dealloc(al, job.cchunk[i]);
+        }
+
+        zmat_dealloc(al, job.cchunk);
+    }
+
+    if (errcode == 0 && (cframelen = blosc2_schunk_to_buffer(schunk, &cframe, &needs_free)) > 0) {
+        if ((*outputbuf = (unsigned char*)zmat_malloc(al, (size_t)cframelen))) {
+            memcpy(*outputbuf, cframe, (size_t)cframelen);
+            *outputsize = (size_t)cframelen;
+        } else {
+            errcode = -5;
+        }
+    } else if (errcode == 0) {
+        *ret = (int)cframelen;
+        errcode = -8;
+    }
+
+    if (needs_free) {
+        free(cframe);
+    }
+
+    blosc2_schunk_free(schunk);
+    return errcode;
+}
+
+/**
+ * @brief Decompress one chunk of a frame into its offset of the output
+ */
+
+static void zmat_blosc2_frame_decode_chunk(void* arg, size_t i) {
+    TZMatBloscFrameJob* job = (TZMatBloscFrameJob*)arg;
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    blosc2_context* dctx;
+    int32_t nbytes = (int32_t)(job->pos[i + 1] - job->pos[i]);
+
+    dparams.nthreads = 1;
+    dctx = blosc2_create_dctx(dparams);
+    job->rc[i] = dctx ? blosc2_decompress_ctx(dctx, job->cchunk[i], job->clen[i], job->dest + job->pos[i], nbytes) : -1;
+
+    if (job->rc[i] >= 0 && job->rc[i] != nbytes) {
+        job->rc[i] = -1;
+    }
+
+    if (dctx) {
+        blosc2_free_ctx(dctx);
+    }
+}
+
+/**
+ * @brief Decompress the chunks of a blosc2 contiguous frame in parallel
+ *
+ * @param[in] al: allocator
+ * @param[in] schunk: the frame, from zmat_blosc2_frame_open()
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nthread: number of threads
+ * @param[out] ret: blosc2 error code (if error occurs)
+ * @return 0 on success, -5 if out of memory, -8 on blosc2 errors, -12 if *outputbuf is too small
+ */
+
+static int zmat_blosc2_frame_decode(const TZMatAllocator* al, blosc2_schunk* schunk, unsigned char** outputbuf,
+                                    size_t* outputsize, size_t capacity, int nthread, int* ret) {
+    size_t nchunk = (size_t)schunk->nchunks, total = (size_t)schunk->nbytes, i;
+    int fixed = (*outputbuf != NULL), errcode = 0, nworker;
+    TZMatBloscFrameJob job;
+    bool* needs_free;
+
+    *outputsize = 0;
+    *ret = 0;
+
+    if (fixed && total > capacity) {
+        *outputsize = total;
+        return -12;
+    }
+
+    job.cchunk = (uint8_t**)zmat_malloc(al, nchunk * (sizeof(uint8_t*) + sizeof(size_t) + sizeof(int32_t) + sizeof(int) + sizeof(bool)) + sizeof(size_t));
+
+    if (!job.cchunk) {
+        return -5;
+    }
+
+    job.pos = (size_t*)(job.cchunk + nchunk);
+    job.clen = (int32_t*)(job.pos + nchunk + 1);
+    job.rc = (int*)(job.clen + nchunk);
+    needs_free = (bool*)(job.rc + nchunk);
+    job.pos[0] = 0;
+
+    /* the chunk offsets are read serially, as they share the decoder of the super-chunk */
+    for (i = 0; i < nchunk; i++) {
+        int32_t nbytes = 0;
+
+        needs_free[i] = false;
+
+        if (errcode == 0 && (*ret = blosc2_schunk_get_chunk(schunk, (int64_t)i, job.cchunk + i, needs_free + i)) > 0
+                && blosc2_cbuffer_sizes(job.cchunk[i], &nbytes, job.clen + i, NULL) >= 0 && nbytes >= 0) {
+            job.pos[i + 1] = job.pos[i] + (size_t)nbytes;
+        } else {
+            errcode = -8;
+        }
+    }
+
+    if (errcode == 0 && job.pos[nchunk] != total) {
+        errcode = -8;
+    }
+
+    if (errcode == 0) {
+        *ret = 0;
+        job.dest = fixed ? *outputbuf : (unsigned char*)zmat_malloc(al, total ? total : 1);
+        errcode = job.dest ? 0 : -5;
+    }
+
+    if (errcode == 0) {
+        nworker = zmat_thread_acquire(nthread);
+        zmat_pool_run(zmat_blosc2_frame_decode_chunk, &job, nchunk, nworker);
+        zmat_thread_release(nthread);
+
+        for (i = 0; i < nchunk && errcode == 0; i++) {
+            if (job.rc[i] < 0) {
+                *ret = job.rc[i];
+                errcode = -8;
+            }
+        }
+
+        if (errcode == 0) {
+            *outputbuf = job.dest;
+            *outputsize = total;
+        } else if (!fixed) {
+            zmat_dealloc(al, job.dest);
+        }
+    }
+
+    for (i = 0; i < nchunk; i++) {
+        if (needs_free[i]) {
+            free(job.cchunk[i]);
+        }
+    }
+
+    zmat_dealloc(al, job.cchunk);
+    return errcode;
+}
+
+
+/**
+ * @brief Split shape into a chunk or block shape of at most maxbytes, halving the longest dimension first
+ */
+
+static void zmat_b2nd_partition(int ndim, const int64_t* shape, const int32_t* outer, int typesize, size_t maxbytes, int32_t* part) {
+    int i;
+
+    for (i = 0; i < ndim; i++) {
+        int64_t len = outer ? outer[i] : shape[i];
+        part[i] = (int32_t)((len < 1) ? 1 : (len > INT32_MAX / 2) ? INT32_MAX / 2 : len);
+    }
+
+    while (1) {
+        double bytes = typesize;
+        int longest = 0;
+
+        for (i = 0; i < ndim; i++) {
+            bytes *= part[i];
+            longest = (part[i] > part[longest]) ? i : longest;
+        }
+
+        if (bytes <= (double)maxbytes || part[longest] == 1) {
+            break;
+        }
+
+        part[longest] = (part[longest] + 1) / 2;
+    }
+}
+
+/**
+ * @brief Compress a C-order N-dimensional array into a b2nd frame of ZMAT_B2ND_CHUNK-long chunks
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: raw array, inputsize must equal the product of shape times typesize
+ * @param[in] ndim: number of dimensions, 1 to ZMAT_B2ND_MAX_DIM
+ * @param[in] shape: length of each dimension, the last one varies fastest
+ * @param[in] dtype: NumPy dtype string stored with the array, NULL for "|V<typesize>"
+ * @param[in] zipid: zmB2nd for the zstd codec, or one of the zfp and ndlz methods
+ * @param[in] clevel: blosc2 compression level
+ * @param[in] shuffle: blosc2 shuffle filter, not used by zfp and ndlz
+ * @param[in] typesize: element length
+ * @param[in] nthread: number of threads compressing the blocks of a chunk
+ * @param[out] outputbuf: the frame, free with zmat_free()
+ * @param[out] outputsize: frame length
+ * @param[out] ret: blosc2 error code (if error occurs)
+ * @return 0 on success, -5 if out of memory, -8 on blosc2 errors, -15 if the shape does not match the input
+ */
+
+static int zmat_b2nd_encode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int ndim,
+                            const int64_t* shape, const char* dtype, int zipid, int clevel, int shuffle, int typesize, int nthread,
+                            unsigned char** outputbuf, size_t* outputsize, int* ret) {
+    const int codecs[] = {BLOSC_CODEC_ZFP_FIXED_ACCURACY, BLOSC_CODEC_ZFP_FIXED_PRECISION, BLOSC_CODEC_ZFP_FIXED_RATE, BLOSC_CODEC_NDLZ};
+    const int codecmeta[] = {-3, 16, 25, 4};
+    blosc2_cparams cparams;
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    blosc2_storage storage = BLOSC2_STORAGE_DEFAULTS;
+    int32_t chunkshape[B2ND_MAX_DIM], blockshape[B2ND_MAX_DIM];
+    b2nd_context_t* bctx;
+    b2nd_array_t* array = NULL;
+    uint8_t* cframe = NULL;
+    bool needs_free = false;
+    int64_t cframelen = 0;
+    size_t nelem = 1;
+    char vdtype[16];
+    int i, errcode = 0;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (ndim < 1 || ndim > ZMAT_B2ND_MAX_DIM || typesize < 1) {
+        return -15;
+    }
+
+    for (i = 0; i < ndim; i++) {
+        if (shape[i] < 0 || (shape[i] > 0 && nelem > ((size_t)(-1) / typesize) / (size_t)shape[i])) {
+            return -15;
+        }
+
+        nelem *= (size_t)shape[i];
+    }
+
+    if (nelem * typesize != inputsize) {
+        return -15;
+    }
+
+    zmat_b2nd_partition(ndim, shape, NULL, typesize, ZMAT_B2ND_CHUNK, chunkshape);
+    zmat_b2nd_partition(ndim, shape, chunkshape, typesize, ZMAT_B2ND_BLOCK, blockshape);
+
+    if (dtype == NULL) {
+        sprintf(vdtype, "|V%d", typesize);
+        dtype = vdtype;
+    }
+
+    /* b2nd derives the blocksize from the block shape */
+    if (zipid == zmB2nd) {
+        zmat_blosc2_cparams(&cparams, BLOSC_ZSTD, clevel, shuffle, typesize, nthread);
+    } else {
+        /* zfp and ndlz read the values themselves, so no shuffle by default */
+        zmat_blosc2_cparams(&cparams, codecs[zipid - zmBlosc2ZfpAcc], clevel, BLOSC_NOSHUFFLE, typesize, nthread);
+        i = (zmat_blosc2_tuned && zmat_blosc2_tuning.compmeta) ? zmat_blosc2_tuning.compmeta : codecmeta[zipid - zmBlosc2ZfpAcc];
+        cparams.compcode_meta = (uint8_t)i;
+    }
+
+    cparams.blocksize = 0;
+    dparams.nthreads = (int16_t)nthread;
+
+    storage.contiguous = true;
+    storage.cparams = &cparams;
+    storage.dparams = &dparams;
+
+    zmat_blosc2_init();
+
+    if (!(bctx = b2nd_create_ctx(&storage, (int8_t)ndim, shape, chunkshape, blockshape, dtype, DTYPE_NUMPY_FORMAT, NULL, 0))) {
+        return -8;
+    }
+
+    if ((*ret = b2nd_from_cbuffer(bctx, &array, inputstr, (int64_t)inputsize)) < 0
+            || (*ret = b2nd_to_cframe(array, &cframe, &cframelen, &needs_free)) < 0) {
+        errcode = -8;
+    } else if ((*outputbuf = (unsigned char*)zmat_malloc(al, (size_t)cframelen))) {
+        memcpy(*outputbuf, cframe, (size_t)cframelen);
+        *outputsize = (size_t)cframelen;
+    } else {
+        errcode = -5;
+    }
+
+    if (needs_free) {
+        free(cframe);
+    }
+
+    if (array) {
+        b2nd_free(array);
+    }
+
+    b2nd_free_ctx(bctx);
+    return errcode;
+}
+
+/**
+ * @brief Check the b2nd metalayer of a frame before blosc2 divides by its shapes
+ *
+ * The metalayer is a msgpack array of version, ndim, then the shape (int64), chunk shape and
+ * block shape (int32) arrays of ndim elements, and an optional dtype string
+ *
+ * @return 0 if every length is positive, the blocks fit in the chunks, the array and its
+ *         chunks fit in ZMAT_MAX_ALLOC and the frame holds one chunk of that size per chunk
+ *         of the array, -15 otherwise
+ */
+
+static int zmat_b2nd_check(blosc2_schunk* schunk) {
+    int64_t shape[B2ND_MAX_DIM];
+    int32_t chunkshape[B2ND_MAX_DIM], blockshape[B2ND_MAX_DIM];
+    uint8_t* smeta = NULL;
+    int32_t smeta_len = 0, len;
+    int8_t ndim;
+    size_t total = (size_t)schunk->typesize, chunk = total, nchunk = 1, ext, dtypelen;
+    int i, errcode = -15;
+
+    if (blosc2_meta_get(schunk, "b2nd", &smeta, &smeta_len) < 0 && blosc2_meta_get(schunk, "caterva", &smeta, &smeta_len) < 0) {
+        return -15;
+    }
+
+    if (smeta_len < 3 || smeta[2] < 1 || smeta[2] > ZMAT_B2ND_MAX_DIM || smeta_len < 6 + 19 * smeta[2]) {
+        free(smeta);
+        return -15;
+    }
+
+    len = b2nd_deserialize_meta(smeta, smeta_len, &ndim, shape, chunkshape, blockshape, NULL, NULL);
+
+    /* the dtype entry: a format byte, a str32 marker, a big-endian length and the string */
+    if (len < smeta_len) {
+        if (smeta_len - len < 6) {
+            goto done;
+        }
+
+        dtypelen = ((size_t)smeta[len + 2] << 24) | ((size_t)smeta[len + 3] << 16) | ((size_t)smeta[len + 4] << 8) | smeta[len + 5];
+
+        if (dtypelen > (size_t)(smeta_len - len - 6)) {
+            goto done;
+        }
+    }
+
+    if (total == 0) {
+        goto done;
+    }
+
+    for (i = 0; i < ndim; i++) {
+        if (shape[i] <= 0 || chunkshape[i] <= 0 || blockshape[i] <= 0 || blockshape[i] > chunkshape[i]
+                || (uint64_t)shape[i] > ZMAT_MAX_ALLOC / total) {
+            goto done;
+        }
+
+        /* blosc2 pads each chunk to whole blocks */
+        ext = ((size_t)chunkshape[i] + blockshape[i] - 1) / blockshape[i] * blockshape[i];
+
+        if (ext > ZMAT_MAX_ALLOC / chunk) {
+            goto done;
+        }
+
+        total *= (size_t)shape[i];
+        chunk *= ext;
+        nchunk *= ((size_t)shape[i] + chunkshape[i] - 1) / chunkshape[i];
+    }
+
+    /* a frame header that disagrees with the shapes, e.g. a damaged typesize */
+    if ((size_t)schunk->chunksize == chunk && (size_t)schunk->nchunks == nchunk) {
+        errcode = 0;
+    }
+
+done:
+    free(smeta);
+    return errcode;
+}
+
+/**
+ * @brief Open a b2nd frame in place, without copying or taking ownership of the buffer
+ *
+ * @param[in] nthread: number of threads decompressing the blocks of a chunk
+ * @return the array, free with b2nd_free(), or NULL if the buffer is not a b2nd frame or its
+ *         shapes are invalid (see zmat_b2nd_check())
+ */
+
+static b2nd_array_t* zmat_b2nd_open(const unsigned char* inputstr, size_t inputsize, int nthread) {
+    blosc2_dparams dparams = BLOSC2_DPARAMS_DEFAULTS;
+    blosc2_schunk* schunk = zmat_blosc2_frame_open(inputstr, inputsize);
+    b2nd_array_t* array = NULL;
+    blosc2_context* dctx;
+
+    if (schunk == NULL || zmat_b2nd_check(schunk) != 0 || b2nd_from_schunk(schunk, &array) < 0) {
+        if (schunk) {
+            blosc2_schunk_free(schunk);
+        }
+
+        return NULL;
+    }
+
+    /* the decoder threads come from the frame header; use the caller's count instead */
+    dparams.nthreads = (int16_t)nthread;
+    dparams.schunk = schunk;
+
+    if ((dctx = blosc2_create_dctx(dparams))) {
+        blosc2_free_ctx(schunk->dctx);
+        schunk->dctx = dctx;
+    }
+
+    return array;
+}
+
+/**
+ * @brief Decompress the sub-array [start, stop) of a b2nd frame, touching only the chunks it intersects
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: b2nd frame
+ * @param[in] inputsize: frame length
+ * @param[in] start: first index of each dimension, NULL for the whole array
+ * @param[in] stop: end index (exclusive) of each dimension, NULL for the whole array
+ * @param[in] nthread: number of threads decompressing the blocks of a chunk
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length, a C-order array of stop - start elements; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[out] ret: blosc2 error code (if error occurs)
+ * @return 0 on success, -5 if out of memory, -8 on blosc2 errors, -12 if *outputbuf is too small,
+ *         -15 if the input is not a b2nd frame or the slice is outside of the array
+ */
+
+static int zmat_b2nd_decode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, const size_t* start,
+                            const size_t* stop, int nthread, unsigned char** outputbuf, size_t* outputsize, size_t capacity, int* ret) {
+    int64_t from[B2ND_MAX_DIM], to[B2ND_MAX_DIM], len[B2ND_MAX_DIM];
+    int fixed = (*outputbuf != NULL), errcode = 0, i;
+    size_t total;
+    unsigned char* buf;
+    b2nd_array_t* array;
+
+    *outputsize = 0;
+    *ret = 0;
+
+    if (!(array = zmat_b2nd_open(inputstr, inputsize, nthread))) {
+        return -15;
+    }
+
+    total = (size_t)array->sc->typesize;
+
+    for (i = 0; i < array->ndim; i++) {
+        from[i] = start ? (int64_t)start[i] : 0;
+        to[i] = stop ? (int64_t)stop[i] : array->shape[i];
+
+        if (from[i] < 0 || from[i] > to[i] || to[i] > array->shape[i]) {
+            b2nd_free(array);
+            return -15;
+        }
+
+        len[i] = to[i] - from[i];
+
+        if (total > 0 && (uint64_t)len[i] > ZMAT_MAX_ALLOC / total) {
+            b2nd_free(array);
+            return -15;
+        }
+
+        total *= (size_t)len[i];
+    }
+
+    if (fixed && total > capacity) {
+        b2nd_free(array);
+        *outputsize = total;
+        return -12;
+    }
+
+    buf = fixed ? *outputbuf : (unsigned char*)zmat_malloc(al, total ? total : 1);
+
+    if (buf == NULL) {
+        errcode = -5;
+    } else if (total > 0 && (*ret = b2nd_get_slice_cbuffer(array, from, to, buf, len, (int64_t)total)) < 0) {
+        errcode = -8;
+
+        if (!fixed) {
+            zmat_dealloc(al, buf);
+        }
+    } else {
+        *ret = 0;
+        *outputbuf = buf;
+        *outputsize = total;
+    }
+
+    b2nd_free(array);
+    return errcode;
+}
+
+#endif
+
+/**
+ * @brief Initial output length for inflating zlib/gzip data
+ *
+ * A single-member gzip file records its decoded length (modulo 4GB) in the
+ * last four bytes; one spare byte lets inflate reach the end of the stream
+ * without growing the buffer. zlib data records no length, and an
+ * implausible gzip length (beyond the 1032:1 deflate limit) is ignored.
+ *
+ * @param[in] inputsize: the compressed input size
+ * @param[in] inputstr: the compressed input
+ * @param[in] zipid: zmZlib or zmGzip
+ * @return the planned allocation size
+ */
+
+static size_t zmat_inflate_plan(size_t inputsize, const unsigned char* inputstr, int zipid) {
+    if (zipid == zmGzip && inputsize >= 18 && inputstr[0] == 0x1F && inputstr[1] == 0x8B) {
+        size_t isize = (size_t)zmat_get_le(inputstr + inputsize - 4, 4);
+
+        if (isize < ZMAT_MAX_ALLOC && isize / 1032 <= inputsize) {
+            return (isize < ZMAT_MIN_OUTBUF) ? ZMAT_MIN_OUTBUF : isize + 1;
+        }
+    }
+
+    return zmat_initial_outbuf(inputsize, 4);
+}
+
+/**
+ * @brief Multiply two polynomials modulo the CRC-32 polynomial (reflected)
+ */
+
+static unsigned long zmat_crc32_multmodp(unsigned long a, unsigned long b) {
+    unsigned long m = 1UL << 31, p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xEDB88320UL : b >> 1;
+    }
+
+    return p;
+}
+
+/**
+ * @brief CRC-32 of two concatenated pieces from their CRCs and the length of the second
+ */
+
+static unsigned long zmat_crc32_combine(unsigned long crc1, unsigned long crc2, size_t len2) {
+    unsigned long p = 1UL << 31, x2k = 1UL << 30;  /* x^0 and x^1 */
+    int k;
+
+    for (k = 0; k < 3; k++) {
+        x2k = zmat_crc32_multmodp(x2k, x2k);       /* x^8, one byte */
+    }
+
+    for (; len2; len2 >>= 1) {
+        if (len2 & 1) {
+            p = zmat_crc32_multmodp(x2k, p);
+        }
+
+        x2k = zmat_crc32_multmodp(x2k, x2k);
+    }
+
+    return zmat_crc32_multmodp(p, crc1 & 0xFFFFFFFFUL) ^ (crc2 & 0xFFFFFFFFUL);
+}
+
+/**
+ * @brief Adler-32 of two concatenated pieces from their checksums and the length of the second
+ */
+
+static unsigned long zmat_adler32_combine(unsigned long adler1, unsigned long adler2, size_t len2) {
+    const unsigned long base = 65521UL;
+    unsigned long rem = (unsigned long)(len2 % base);
+    unsigned long sum1 = adler1 & 0xFFFF;
+    unsigned long sum2 = (rem * sum1) % base;
+
+    sum1 += (adler2 & 0xFFFF) + base - 1;
+    sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + base - rem;
+    sum1 = (sum1 >= base) ? sum1 - base : sum1;
+    sum1 = (sum1 >= base) ? sum1 - base : sum1;
+    sum2 = (sum2 >= (base << 1)) ? sum2 - (base << 1) : sum2;
+    sum2 = (sum2 >= base) ? sum2 - base : sum2;
+    return sum1 | (sum2 << 16);
+}
+
+/**
+ * @brief One block of the parallel zlib/gzip encoder
+ */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;     /* start of the whole input */
+    size_t len;                  /* whole input length */
+    size_t block;                /* input length of each block */
+    size_t dict;                 /* primed dictionary length, 0 for independent blocks */
+    int level;
+    int zipid;
+    unsigned char* out;          /* slots of slotlen bytes, one per block */
+    size_t slotlen;
+    size_t* outlen;              /* compressed length of each block */
+    unsigned long* check;        /* crc32 (gzip) or adler32 (zlib) of each block */
+    int* rc;                     /* deflate status of each block */
+} TZMatDeflateJob;
+
+/**
+ * @brief Compress block i as raw deflate data that can be concatenated with its neighbours
+ *
+ * Each block is primed with the preceding job->dict bytes of input and ends
+ * with a sync flush (byte aligned, not final), except the last block which
+ * finishes the deflate stream. miniz can not load a preset dictionary, so it
+ * compresses the dictionary bytes with a sync flush and drops that output.
+ * Blocks without a dictionary can be inflated on their own.
+ */
+
+static void zmat_deflate_block(void* arg, size_t i) {
+    TZMatDeflateJob* job = (TZMatDeflateJob*)arg;
+    size_t start = i * job->block;
+    size_t blen = (job->len - start < job->block) ? job->len - start : job->block;
+    size_t dict = (start < job->dict) ? start : job->dict;
+    int last = (start + blen == job->len);
+    unsigned char* slot = job->out + i * job->slotlen;
+    z_stream zs;
+    int rc;
+
+    job->check[i] = (job->zipid == zmZlib) ? adler32(1, job->in + start, blen) : crc32(0, job->in + start, blen);
+
+    zmat_zstream_init(&zs, job->al);
+
+    if ((rc = deflateInit2(&zs, job->level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)) != Z_OK) {
+        job->rc[i] = rc;
+        return;
+    }
+
+    if (dict) {
+#ifdef NO_ZLIB
+        zs.next_in = (unsigned char*)job->in + start - dict;
+        zs.avail_in = (unsigned int)dict;
+        zs.next_out = slot;
+        zs.avail_out = (unsigned int)job->slotlen;
+        rc = deflate(&zs, Z_SYNC_FLUSH);
+        rc = (rc == Z_OK && zs.avail_in == 0) ? Z_OK : Z_BUF_ERROR;
+#else
+        rc = deflateSetDictionary(&zs, job->in + start - dict, (uInt)dict);
+#endif
+    }
+
+    if (rc == Z_OK) {
+        zs.next_in = (unsigned char*)job->in + start;
+        zs.avail_in = (unsigned int)blen;
+        zs.next_out = slot;
+        zs.avail_out = (unsigned int)job->slotlen;
+        rc = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+
+        if (rc == (last ? Z_STREAM_END : Z_OK) && zs.avail_in == 0 && zs.avail_out > 0) {
+            rc = Z_OK;
+        } else if (rc == Z_OK || rc == Z_STREAM_END) {
+            rc = Z_BUF_ERROR;
+        }
+    }
+
+    job->outlen[i] = job->slotlen - zs.avail_out;
+    job->rc[i] = rc;
+    deflateEnd(&zs);
+}
+
+/**
+ * @brief Parallel zlib (.zip) or gzip (.gz) compression in independent deflate blocks
+ *
+ * The input is cut into ZMAT_DEFLATE_BLOCK blocks that are compressed on up to
+ * nworker threads (pigz style) and joined into one standard zlib or gzip stream
+ * with a combined adler32/crc32 check; the output does not depend on nworker.
+ *
+ * With indexed set (gzip only), the blocks are ZMAT_INDEX_INTERVAL long, not
+ * primed with a dictionary, and their compressed lengths are recorded in a
+ * gzip extra field (subfield "ZI"), see zmat_gzip_index().
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: input buffer
+ * @param[in] inputsize: input length
+ * @param[in] zipid: zmZlib or zmGzip
+ * @param[in] level: deflate compression level
+ * @param[in] nworker: number of threads to run the blocks on
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is copied into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[out] ret: the first failing deflate status
+ * @param[in] indexed: 1 to write independent blocks and their index (gzip only)
+ * @return 0 on success, -3 on a deflate error, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_deflate_mt(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int zipid, int level,
+                           int nworker, unsigned char** outputbuf, size_t* outputsize, size_t capacity, int* ret, int indexed) {
+    size_t block = indexed ? ZMAT_INDEX_INTERVAL : ZMAT_DEFLATE_BLOCK, nblock, i, pos;
+    size_t head = (zipid == zmZlib) ? 2 : 10, tail = (zipid == zmZlib) ? 4 : 8;
+    size_t slotlen;
+    unsigned long check;
+    unsigned char* buf;
+    TZMatDeflateJob job;
+
+    /* the index holds at most ZMAT_INDEX_MAX blocks, longer inputs use longer blocks */
+    while (indexed && (inputsize + block - 1) / block > ZMAT_INDEX_MAX) {
+        block <<= 1;
+    }
+
+    nblock = (inputsize + block - 1) / block;
+    nblock = (nblock < 1) ? 1 : nblock;
+    slotlen = compressBound(block) + 16;
+
+    if (indexed) {
+        head += 2 + 4 + ZMAT_INDEX_FIXED + 4 * nblock;  /* XLEN, subfield id and length, index */
+    }
+
+    *outputsize = 0;
+    job.outlen = (size_t*)zmat_malloc(al, nblock * (sizeof(size_t) + sizeof(unsigned long) + sizeof(int)));
+    buf = (unsigned char*)zmat_malloc(al, head + nblock * slotlen + tail);
+
+    if (!job.outlen || !buf) {
+        zmat_dealloc(al, job.outlen);
+        zmat_dealloc(al, buf);
+        return -5;
+    }
+
+    job.check = (unsigned long*)(job.outlen + nblock);
+    job.rc = (int*)(job.check + nblock);
+    job.al = al;
+    job.in = inputstr;
+    job.len = inputsize;
+    job.block = block;
+    job.dict = indexed ? 0 : ZMAT_DEFLATE_DICT;
+    job.level = level;
+    job.zipid = zipid;
+    job.out = buf + head;
+    job.slotlen = slotlen;
+
+    zmat_pool_run(zmat_deflate_block, &job, nblock, nworker);
+
+    /* join the blocks in place and combine the per-block checks */
+    *ret = Z_OK;
+    pos = head;
+    check = job.check[0];
+
+    for (i = 0; i < nblock && *ret == Z_OK; i++) {
+        *ret = job.rc[i];
+
+        if (i > 0) {
+            size_t blen = (inputsize - i * block < block) ? inputsize - i * block : block;
+            check = (zipid == zmZlib) ? zmat_adler32_combine(check, job.check[i], blen) : zmat_crc32_combine(check, job.check[i], blen);
+        }
+
+        if (indexed) {
+            zmat_put_le(buf + 16 + ZMAT_INDEX_FIXED + 4 * i, job.outlen[i], 4);
+        }
+
+        memmove(buf + pos, buf + head + i * slotlen, job.outlen[i]);
+        pos += job.outlen[i];
+    }
+
+    zmat_dealloc(al, job.outlen);
+
+    if (*ret != Z_OK) {
+        zmat_dealloc(al, buf);
+        return -3;
+    }
+
+    if (zipid == zmZlib) {
+        /* zlib header with the FLEVEL of level, as deflateInit writes it */
+        int lv = (level == Z_DEFAULT_COMPRESSION) ? 6 : level;
+        unsigned int hdr = (0x78 << 8) | ((lv < 2) ? 0 : (lv < 6) ? 1 : (lv == 6) ? 2 : 3) << 6;
+
+        hdr += 31 - hdr % 31;
+        buf[0] = (unsigned char)(hdr >> 8);
+        buf[1] = (unsigned char)hdr;
+        buf[pos++] = (unsigned char)(check >> 24);
+        buf[pos++] = (unsigned char)(check >> 16);
+        buf[pos++] = (unsigned char)(check >> 8);
+        buf[pos++] = (unsigned char)check;
+    } else {
+        const unsigned char gzip_magic_header [] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+
+        memcpy(buf, gzip_magic_header, 10);
+
+        if (indexed) {
+            /* FEXTRA: XLEN, "ZI", subfield length, version, interval, total length, block count */
+            buf[3] = 4;
+            zmat_put_le(buf + 10, head - 12, 2);
+            buf[12] = 'Z';
+            buf[13] = 'I';
+            zmat_put_le(buf + 14, head - 16, 2);
+            buf[16] = 1;
+            zmat_put_le(buf + 17, block, 4);
+            zmat_put_le(buf + 21, inputsize, 8);
+            zmat_put_le(buf + 29, nblock, 4);
+        }
+
+        zmat_put_le(buf + pos, check, 4);
+        zmat_put_le(buf + pos + 4, inputsize, 4);
+        pos += 8;
+    }
+
+    *outputsize = pos;
+
+    if (*outputbuf == NULL) {
+        zmat_shrink_buf(al, &buf, pos);
+        *outputbuf = buf;
+        return 0;
+    }
+
+    if (pos <= capacity) {
+        memcpy(*outputbuf, buf, pos);
+    }
+
+    zmat_dealloc(al, buf);
+    return (pos <= capacity) ? 0 : -12;
+}
+
+/**
+ * @brief Length of the gzip member header, up to the first deflate block
+ *
+ * @param[in] inputstr: gzip stream
+ * @param[in] inputsize: length of the gzip stream
+ * @return the header length, or 0 if the header is invalid or leaves no room for the 8-byte trailer
+ */
+
+static size_t zmat_gzip_header(const unsigned char* inputstr, size_t inputsize) {
+    size_t pos = 10, flag;
+    int flg;
+
+    if (inputsize < 18 || inputstr[0] != 0x1F || inputstr[1] != 0x8B || inputstr[2] != 8 || (inputstr[3] & 0xE0)) {
+        return 0;
+    }
+
+    flg = inputstr[3];
+
+    if (flg & 4) {
+        pos += 2 + (size_t)zmat_get_le(inputstr + 10, 2);    /* FEXTRA */
+    }
+
+    /* FNAME and FCOMMENT are zero-terminated */
+    for (flag = 8; flag <= 16; flag <<= 1) {
+        if (flg & flag) {
+            while (pos < inputsize && inputstr[pos]) {
+                pos++;
+            }
+
+            pos++;
+        }
+    }
+
+    pos += (flg & 2) ? 2 : 0;                                /* FHCRC */
+    return (pos <= inputsize - 8) ? pos : 0;
+}
+
+/**
+ * @brief Access points of an indexed gzip stream written with ZMAT_INDEX
+ */
+
+typedef struct {
+    size_t interval;             /* input length of each block */
+    size_t total;                /* uncompressed length */
+    size_t count;                /* number of blocks */
+    size_t start;                /* offset of the first deflate block */
+    const unsigned char* lens;   /* compressed length of each block, 4 bytes little-endian */
+} TZMatGzipIndex;
+
+/**
+ * @brief Read the block index from the "ZI" extra field of a gzip stream
+ *
+ * @param[in] inputstr: gzip stream
+ * @param[in] inputsize: length of the gzip stream
+ * @param[out] index: the access points
+ * @return 0 if the stream is a single gzip member with a consistent index, -1 otherwise
+ */
+
+static int zmat_gzip_index(const unsigned char* inputstr, size_t inputsize, TZMatGzipIndex* index) {
+    size_t pos = 12, xend, i, packed;
+
+    if (!(index->start = zmat_gzip_header(inputstr, inputsize)) || !(inputstr[3] & 4)) {
+        return -1;
+    }
+
+    xend = pos + (size_t)zmat_get_le(inputstr + 10, 2);
+    index->lens = NULL;
+
+    /* subfields: 2-byte id, 2-byte length, payload */
+    while (pos + 4 <= xend) {
+        size_t sublen = (size_t)zmat_get_le(inputstr + pos + 2, 2);
+
+        if (pos + 4 + sublen > xend) {
+            return -1;
+        }
+
+        if (inputstr[pos] == 'Z' && inputstr[pos + 1] == 'I' && sublen >= ZMAT_INDEX_FIXED && inputstr[pos + 4] == 1) {
+            index->interval = (size_t)zmat_get_le(inputstr + pos + 5, 4);
+            index->total = (size_t)zmat_get_le(inputstr + pos + 9, 8);
+            index->count = (size_t)zmat_get_le(inputstr + pos + 17, 4);
+            index->lens = inputstr + pos + 4 + ZMAT_INDEX_FIXED;
+
+            if (index->count == 0 || index->interval == 0 || index->total == 0 || (sublen - ZMAT_INDEX_FIXED) / 4 < index->count
+                    || (index->total - 1) / index->interval != index->count - 1) {
+                return -1;
+            }
+        }
+
+        pos += 4 + sublen;
+    }
+
+    if (index->lens == NULL) {
+        return -1;
+    }
+
+    /* the blocks and the 8-byte trailer must fill the stream exactly */
+    for (i = 0, packed = 0; i < index->count && packed <= inputsize; i++) {
+        packed += (size_t)zmat_get_le(index->lens + 4 * i, 4);
+    }
+
+    return (packed == inputsize - 8 - index->start) ? 0 : -1;
+}
+
+/**
+ * @brief Inflate a zlib or gzip stream from the start up to the end of a byte range
+ *
+ * The output before offset is inflated into a scratch buffer and dropped, and
+ * the rest of the stream after offset + length is not inflated.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: zlib or gzip stream
+ * @param[in] inputsize: length of the stream
+ * @param[in] zipid: zmZlib or zmGzip
+ * @param[in] offset: first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[out] outputbuf: the decoded bytes (NULL if empty)
+ * @param[out] outputsize: output length
+ * @param[out] ret: inflate status (if error occurs)
+ * @return 0 on success, -2 if the stream can not be initialized, -3 on an inflate error or -5 if out of memory
+ */
+
+static int zmat_inflate_range(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int zipid,
+                              size_t offset, size_t length, unsigned char** outputbuf, size_t* outputsize, int* ret) {
+    size_t start = 0, consumed, produced = 0, cap, used;
+    unsigned char* scratch;
+    unsigned char* buf;
+    z_stream zs;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    length = (length > (size_t)(-1) - offset) ? (size_t)(-1) - offset : length;
+
+    if (zipid == zmGzip && !(start = zmat_gzip_header(inputstr, inputsize))) {
+        *ret = Z_DATA_ERROR;
+        return -3;
+    }
+
+    zmat_zstream_init(&zs, al);
+
+    if ((*ret = (zipid == zmGzip) ? inflateInit2(&zs, -15) : inflateInit(&zs)) != Z_OK) {
+        return -2;
+    }
+
+    cap = zmat_inflate_plan(inputsize, inputstr, zipid);
+    cap = (cap > length) ? length : cap;
+    scratch = (unsigned char*)zmat_malloc(al, ZMAT_STREAM_CHUNK);
+    buf = (unsigned char*)zmat_malloc(al, cap);
+
+    if (!scratch || !buf) {
+        inflateEnd(&zs);
+        zmat_dealloc(al, scratch);
+        zmat_dealloc(al, buf);
+        return -5;
+    }
+
+    consumed = start;
+    *ret = Z_OK;
+
+    while (produced < offset + length && *ret == Z_OK) {
+        size_t avail;
+
+        /* avail_in and avail_out are 32bit, feed long streams in pieces */
+        if (zs.avail_in == 0) {
+            zs.next_in = (unsigned char*)inputstr + consumed;
+            zs.avail_in = (unsigned int)((inputsize - consumed > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : inputsize - consumed);
+            consumed += zs.avail_in;
+        }
+
+        if (produced < offset) {
+            avail = (offset - produced < ZMAT_STREAM_CHUNK) ? offset - produced : ZMAT_STREAM_CHUNK;
+            zs.next_out = scratch;
+        } else {
+            used = produced - offset;
+
+            if (used == cap && zmat_grow_buf(al, &buf, &cap) != 0) {
+                inflateEnd(&zs);
+                zmat_dealloc(al, scratch);
+                return -5;
+            }
+
+            cap = (cap > length) ? length : cap;
+            avail = (cap - used > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : cap - used;
+            zs.next_out = buf + used;
+        }
+
+        zs.avail_out = (unsigned int)avail;
+        *ret = inflate(&zs, Z_SYNC_FLUSH);
+        produced += avail - zs.avail_out;
+
+        /* a truncated stream stops making progress */
+        if (*ret == Z_BUF_ERROR || (*ret == Z_OK && zs.avail_out > 0 && zs.avail_in == 0 && consumed == inputsize)) {
+            *ret = Z_DATA_ERROR;
+        }
+    }
+
+    inflateEnd(&zs);
+    zmat_dealloc(al, scratch);
+
+    if (*ret != Z_OK && *ret != Z_STREAM_END) {
+        zmat_dealloc(al, buf);
+        return -3;
+    }
+
+    *ret = Z_OK;
+
+    if (produced <= offset) {
+        zmat_dealloc(al, buf);
+        return 0;
+    }
+
+    *outputsize = produced - offset;
+    zmat_shrink_buf(al, &buf, *outputsize);
+    *outputbuf = buf;
+    return 0;
+}
+
+/**
+ * @brief A run of blocks of an indexed gzip stream inflated in parallel
+ */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;     /* first deflate block of the stream */
+    size_t* offset;              /* compressed offset of each block from in, count + 1 entries */
+    const TZMatGzipIndex* index;
+    size_t first;                /* first block to inflate */
+    unsigned char* out;          /* output of the first block */
+    unsigned long* crc;          /* crc32 of each inflated block */
+    int* rc;                     /* inflate status of each inflated block */
+} TZMatInflateJob;
+
+/**
+ * @brief Inflate block first + i of an indexed gzip stream into its slot of the output
+ */
+
+static void zmat_inflate_block(void* arg, size_t i) {
+    TZMatInflateJob* job = (TZMatInflateJob*)arg;
+    size_t b = job->first + i, interval = job->index->interval;
+    size_t blen = (job->index->total - b * interval < interval) ? job->index->total - b * interval : interval;
+    int last = (b + 1 == job->index->count);
+    unsigned char spare;
+    z_stream zs;
+    int rc;
+
+    zmat_zstream_init(&zs, job->al);
+
+    if ((rc = inflateInit2(&zs, -15)) != Z_OK) {
+        job->rc[i] = rc;
+        return;
+    }
+
+    zs.next_in = (unsigned char*)job->in + job->offset[b];
+    zs.avail_in = (unsigned int)(job->offset[b + 1] - job->offset[b]);
+    zs.next_out = job->out + i * interval;
+    zs.avail_out = (unsigned int)blen;
+    rc = inflate(&zs, Z_SYNC_FLUSH);
+
+    /* the output is full, the empty block of the sync flush is left */
+    if ((rc == Z_OK || rc == Z_BUF_ERROR) && zs.avail_out == 0 && zs.avail_in > 0) {
+        zs.next_out = &spare;
+        zs.avail_out = 1;
+        rc = inflate(&zs, Z_SYNC_FLUSH);
+    }
+
+    if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) {
+        job->rc[i] = rc;
+    } else if (zs.total_out != blen || zs.avail_in > 0 || last != (rc == Z_STREAM_END)) {
+        job->rc[i] = Z_DATA_ERROR;
+    } else {
+        job->crc[i] = crc32(0, job->out + i * interval, blen);
+        job->rc[i] = Z_OK;
+    }
+
+    inflateEnd(&zs);
+}
+
+/**
+ * @brief Inflate the blocks of an indexed gzip stream that cover a byte range, in parallel
+ *
+ * Only the blocks overlapping [offset, offset + length) are inflated; the crc32
+ * and length in the trailer are checked when the whole stream is decoded.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: indexed gzip stream
+ * @param[in] index: its access points, from zmat_gzip_index()
+ * @param[in] offset: first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nworker: number of threads to inflate the blocks on
+ * @param[out] ret: the first failing inflate status
+ * @return 0 on success, -3 on an inflate or check error, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_inflate_indexed(const TZMatAllocator* al, const unsigned char* inputstr, const TZMatGzipIndex* index,
+                                size_t offset, size_t length, unsigned char** outputbuf, size_t* outputsize,
+                                size_t capacity, int nworker, int* ret) {
+    size_t first, nblock, span, skip, i;
+    int fixed = (*outputbuf != NULL), aligned;
+    unsigned char* work;
+    TZMatInflateJob job;
+
+    *outputsize = 0;
+    *ret = Z_OK;
+
+    if (offset >= index->total || length == 0) {
+        return 0;
+    }
+
+    length = (length > index->total - offset) ? index->total - offset : length;
+    first = offset / index->interval;
+    nblock = (offset + length - 1) / index->interval - first + 1;
+    skip = offset - first * index->interval;
+    span = ((first + nblock) * index->interval > index->total ? index->total : (first + nblock) * index->interval)
+           - first * index->interval;
+    aligned = (skip == 0 && span == length);
+
+    if (fixed && length > capacity) {
+        *outputsize = length;
+        return -12;
+    }
+
+    job.offset = (size_t*)zmat_malloc(al, (index->count + 1) * sizeof(size_t) + nblock * (sizeof(unsigned long) + sizeof(int)));
+    work = (fixed && aligned) ? *outputbuf : (unsigned char*)zmat_malloc(al, span);
+
+    if (!job.offset || !work) {
+        zmat_dealloc(al, job.offset);
+
+        if (work != *outputbuf) {
+            zmat_dealloc(al, work);
+        }
+
+        return -5;
+    }
+
+    job.crc = (unsigned long*)(job.offset + index->count + 1);
+    job.rc = (int*)(job.crc + nblock);
+    job.offset[0] = 0;
+
+    for (i = 0; i < index->count; i++) {
+        job.offset[i + 1] = job.offset[i] + (size_t)zmat_get_le(index->lens + 4 * i, 4);
+    }
+
+    job.al = al;
+    job.in = inputstr + index->start;
+    job.index = index;
+    job.first = first;
+    job.out = work;
+
+    zmat_pool_run(zmat_inflate_block, &job, nblock, nworker);
+
+    for (i = 0; i < nblock && *ret == Z_OK; i++) {
+        *ret = job.rc[i];
+    }
+
+    /* a whole stream is checked against the crc32 and length of its trailer */
+    if (*ret == Z_OK && nblock == index->count) {
+        const unsigned char* trailer = job.in + job.offset[index->count];
+        unsigned long crc = job.crc[0];
+
+        for (i = 1; i < nblock; i++) {
+            size_t blen = (index->total - i * index->interval < index->interval) ? index->total - i * index->interval : index->interval;
+            crc = zmat_crc32_combine(crc, job.crc[i], blen);
+        }
+
+        if (crc != (unsigned long)zmat_get_le(trailer, 4) || (index->total & 0xFFFFFFFFUL) != (size_t)zmat_get_le(trailer + 4, 4)) {
+            *ret = Z_DATA_ERROR;
+        }
+    }
+
+    zmat_dealloc(al, job.offset);
+
+    if (*ret != Z_OK) {
+        if (work != *outputbuf) {
+            zmat_dealloc(al, work);
+        }
+
+        return -3;
+    }
+
+    if (fixed && !aligned) {
+        memcpy(*outputbuf, work + skip, length);
+        zmat_dealloc(al, work);
+    } else if (!fixed) {
+        if (skip > 0) {
+            memmove(work, work + skip, length);
+        }
+
+        zmat_shrink_buf(al, &work, length);
+        *outputbuf = work;
+    }
+
+    *outputsize = length;
+    return 0;
+}
+
+/**
+ * @brief LSB-first bit reader over a deflate stream
+ */
+
+typedef struct {
+    const unsigned char* in;
+    size_t len;                  /* input length in bytes */
+    size_t pos;                  /* next byte to load */
+    unsigned long long buf;      /* loaded bits, the next bit is the lowest */
+    int nbit;                    /* number of loaded bits */
+    int err;                     /* set once a read runs past the input */
+} TZMatBitReader;
+
+/**
+ * @brief Canonical Huffman code of a deflate block
+ */
+
+typedef struct {
+    unsigned short count[16];    /* number of codes of each length */
+    unsigned short symbol[288];  /* symbols in code order */
+    unsigned short fast[1 << ZMAT_HUFF_FAST]; /* (symbol << 4) | length of the codes up to ZMAT_HUFF_FAST bits, 0 otherwise */
+} TZMatHuffman;
+
+static const unsigned short zmat_len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+                                                };
+static const unsigned char zmat_len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const unsigned short zmat_dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+                                                  1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+                                                 };
+static const unsigned char zmat_dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+static void zmat_bits_fill(TZMatBitReader* br) {
+    while (br->nbit <= 56 && br->pos < br->len) {
+        br->buf |= (unsigned long long)br->in[br->pos++] << br->nbit;
+        br->nbit += 8;
+    }
+}
+
+static void zmat_bits_init(TZMatBitReader* br, const unsigned char* in, size_t len, size_t bitpos) {
+    int drop = (int)(bitpos & 7);
+
+    br->in = in;
+    br->len = len;
+    br->pos = bitpos >> 3;
+    br->buf = 0;
+    br->nbit = 0;
+    br->err = (br->pos >= len);
+    zmat_bits_fill(br);
+
+    if (br->nbit >= drop) {
+        br->buf >>= drop;
+        br->nbit -= drop;
+    }
+}
+
+static size_t zmat_bits_tell(const TZMatBitReader* br) {
+    return (br->pos << 3) - (size_t)br->nbit;
+}
+
+static unsigned int zmat_bits_get(TZMatBitReader* br, int n) {
+    unsigned int val;
+
+    if (br->nbit < n) {
+        zmat_bits_fill(br);
+
+        if (br->nbit < n) {
+            br->err = 1;
+            return 0;
+        }
+    }
+
+    val = (unsigned int)(br->buf & ((1ULL << n) - 1));
+    br->buf >>= n;
+    br->nbit -= n;
+    return val;
+}
+
+/**
+ * @brief Build a canonical Huffman code from its code lengths
+ *
+ * @param[out] h: the code
+ * @param[in] lens: code length of each symbol, 0 if unused
+ * @param[in] n: number of symbols
+ * @param[in] fast: 1 to fill the lookup table used by zmat_huff_fast()
+ * @return 0 if the code is complete, > 0 if incomplete, < 0 if over-subscribed
+ */
+
+static int zmat_huff_build(TZMatHuffman* h, const unsigned char* lens, int n, int fast) {
+    unsigned short offs[16];
+    int len, sym, left = 1;
+
+    memset(h->count, 0, sizeof(h->count));
+
+    if (fast) {
+        memset(h->fast, 0, sizeof(h->fast));
+    }
+
+    for (sym = 0; sym < n; sym++) {
+        h->count[lens[sym]]++;
+    }
+
+    if (h->count[0] == n) {
+        return 0;
+    }
+
+    for (len = 1; len < 16; len++) {
+        left = (left << 1) - h->count[len];
+
+        if (left < 0) {
+            return left;
+        }
+    }
+
+    for (offs[1] = 0, len = 1; len < 15; len++) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+
+    for (sym = 0; sym < n; sym++) {
+        if (lens[sym]) {
+            h->symbol[offs[lens[sym]]++] = (unsigned short)sym;
+        }
+    }
+
+    if (fast) {
+        unsigned int code = 0, idx = 0, k, rev, j;
+        int b;
+
+        for (len = 1; len <= ZMAT_HUFF_FAST; len++, code <<= 1) {
+            for (k = 0; k < h->count[len]; k++, code++, idx++) {
+                for (rev = 0, b = 0; b < len; b++) {
+                    rev |= ((code >> b) & 1) << (len - 1 - b);
+                }
+
+                for (j = rev; j < (1U << ZMAT_HUFF_FAST); j += 1U << len) {
+                    h->fast[j] = (unsigned short)((h->symbol[idx] << 4) | len);
+                }
+            }
+        }
+    }
+
+    return left;
+}
+
+/**
+ * @brief Decode one symbol bit by bit, -1 if the bits match no code
+ */
+
+static int zmat_huff_decode(TZMatBitReader* br, const TZMatHuffman* h) {
+    int code = 0, first = 0, index = 0, len, count;
+    unsigned long long bits;
+
+    if (br->nbit < 15) {
+        zmat_bits_fill(br);
+    }
+
+    for (bits = br->buf, len = 1; len < 16 && len <= br->nbit; len++) {
+        code |= (int)(bits & 1);
+        bits >>= 1;
+        count = h->count[len];
+
+        if (code - count < first) {
+            br->buf >>= len;
+            br->nbit -= len;
+            return h->symbol[index + (code - first)];
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    br->err = 1;
+    return -1;
+}
+
+static int zmat_huff_fast(TZMatBitReader* br, const TZMatHuffman* h) {
+    unsigned int entry;
+
+    if (br->nbit < 15) {
+        zmat_bits_fill(br);
+    }
+
+    entry = h->fast[br->buf & ((1U << ZMAT_HUFF_FAST) - 1)];
+
+    if (entry && (int)(entry & 15) <= br->nbit) {
+        br->buf >>= entry & 15;
+        br->nbit -= entry & 15;
+        return (int)(entry >> 4);
+    }
+
+    return zmat_huff_decode(br, h);
+}
+
+/**
+ * @brief Read the code tables of a dynamic deflate block, after its 3 header bits
+ *
+ * The checks follow zlib: the code length code must be complete, the literal
+ * code must have an end-of-block code, and an incomplete literal or distance
+ * code may only hold a single code.
+ *
+ * @return 0 on success, -1 if the tables are invalid
+ */
+
+static int zmat_inflate_tables(TZMatBitReader* br, TZMatHuffman* lit, TZMatHuffman* dist, int fast) {
+    static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+    unsigned char lens[320];
+    int nlen, ndist, ncode, i, sym, rep, left;
+
+    nlen = (int)zmat_bits_get(br, 5) + 257;
+    ndist = (int)zmat_bits_get(br, 5) + 1;
+    ncode = (int)zmat_bits_get(br, 4) + 4;
+
+    if (nlen > 286 || ndist > 30) {
+        return -1;
+    }
+
+    memset(lens, 0, 19);
+
+    /* a complete code length code has a Kraft sum of exactly 2^7 */
+    for (i = 0, left = 0; i < ncode; i++) {
+        lens[order[i]] = (unsigned char)zmat_bits_get(br, 3);
+        left += lens[order[i]] ? 1 << (7 - lens[order[i]]) : 0;
+    }
+
+    if (br->err || left != 128 || zmat_huff_build(lit, lens, 19, 0) != 0) {
+        return -1;
+    }
+
+    for (i = 0; i < nlen + ndist;) {
+        unsigned char val = 0;
+
+        if ((sym = zmat_huff_decode(br, lit)) < 0) {
+            return -1;
+        }
+
+        if (sym < 16) {
+            lens[i++] = (unsigned char)sym;
+            continue;
+        }
+
+        if (sym == 16) {
+            if (i == 0) {
+                return -1;
+            }
+
+            val = lens[i - 1];
+            rep = 3 + (int)zmat_bits_get(br, 2);
+        } else {
+            rep = (sym == 17) ? 3 + (int)zmat_bits_get(br, 3) : 11 + (int)zmat_bits_get(br, 7);
+        }
+
+        if (i + rep > nlen + ndist) {
+            return -1;
+        }
+
+        while (rep--) {
+            lens[i++] = val;
+        }
+    }
+
+    if (br->err || lens[256] == 0) {
+        return -1;
+    }
+
+    left = zmat_huff_build(lit, lens, nlen, fast);
+
+    if (left < 0 || (left > 0 && nlen != lit->count[0] + lit->count[1])) {
+        return -1;
+    }
+
+    left = zmat_huff_build(dist, lens + nlen, ndist, fast);
+    return (left < 0 || (left > 0 && ndist != dist->count[0] + dist->count[1])) ? -1 : 0;
+}
+
+/**
+ * @brief A run of deflate blocks of the parallel inflater
+ *
+ * The output is kept as 16-bit symbols: values below 256 are bytes, and
+ * 256 + k stands for byte k of the unknown 32 KB window before the run,
+ * which is filled in once the preceding run is decoded.
+ */
+
+typedef struct {
+    size_t start;                /* bit offset of the first block */
+    size_t stop;                 /* stop at the first block boundary at or after this bit offset */
+    size_t end;                  /* bit offset after the last decoded block */
+    unsigned short* sym;         /* decoded symbols */
+    size_t count;                /* number of decoded symbols */
+    size_t cap;                  /* allocated symbols */
+    int final;                   /* the last decoded block is the final block */
+    int rc;                      /* 0 on success */
+} TZMatInflateRun;
+
+static int zmat_inflate_reserve(const TZMatAllocator* al, TZMatInflateRun* run, size_t need) {
+    if (run->count + need > run->cap) {
+        size_t cap = (run->cap < ((size_t)1 << 16)) ? ((size_t)1 << 16) : run->cap << 1;
+        unsigned short* sym;
+
+        if (cap > ZMAT_MAX_ALLOC || !(sym = (unsigned short*)zmat_realloc(al, run->sym, cap * sizeof(unsigned short)))) {
+            return -1;
+        }
+
+        run->sym = sym;
+        run->cap = cap;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Inflate the deflate blocks of a run, from run->start up to run->stop or the final block
+ *
+ * @param[in] al: allocator
+ * @param[in] in: deflate stream
+ * @param[in] len: length of the stream in bytes
+ * @param[in,out] run: start and stop in, the decoded symbols out
+ * @param[in] known: 1 if the run starts the stream, so that no distance may reach before it
+ * @return 0 on success, -1 on invalid data or if out of memory
+ */
+
+static int zmat_inflate_run(const TZMatAllocator* al, const unsigned char* in, size_t len, TZMatInflateRun* run, int known) {
+    TZMatBitReader br;
+    TZMatHuffman lit, dist;
+    unsigned int head;
+
+    zmat_bits_init(&br, in, len, run->start);
+    run->count = 0;
+    run->final = 0;
+
+    while ((run->end = zmat_bits_tell(&br)) < run->stop) {
+        head = zmat_bits_get(&br, 3);
+
+        if (br.err || (head >> 1) == 3) {
+            return -1;
+        }
+
+        if ((head >> 1) == 0) {
+            /* stored block: byte aligned length and its complement */
+            unsigned int n, i;
+
+            zmat_bits_get(&br, br.nbit & 7);
+            n = zmat_bits_get(&br, 16);
+
+            if (br.err || n != (~zmat_bits_get(&br, 16) & 0xFFFF) || zmat_inflate_reserve(al, run, n)) {
+                return -1;
+            }
+
+            for (i = 0; i < n && br.nbit > 0; i++) {
+                run->sym[run->count++] = (unsigned short)zmat_bits_get(&br, 8);
+            }
+
+            /* the rest is copied straight from the input */
+            if (n - i > br.len - br.pos) {
+                return -1;
+            }
+
+            for (; i < n; i++) {
+                run->sym[run->count++] = br.in[br.pos++];
+            }
+        } else {
+            if ((head >> 1) == 1) {
+                unsigned char lens[288];
+
+                memset(lens, 8, 144);
+                memset(lens + 144, 9, 112);
+                memset(lens + 256, 7, 24);
+                memset(lens + 280, 8, 8);
+                zmat_huff_build(&lit, lens, 288, 1);
+                memset(lens, 5, 30);
+                zmat_huff_build(&dist, lens, 30, 1);
+            } else if (zmat_inflate_tables(&br, &lit, &dist, 1) != 0) {
+                return -1;
+            }
+
+            for (;;) {
+                int sym = zmat_huff_fast(&br, &lit);
+                size_t n, d, k;
+                unsigned short* out;
+
+                if (sym < 256) {
+                    if (sym < 0 || zmat_inflate_reserve(al, run, 1)) {
+                        return -1;
+                    }
+
+                    run->sym[run->count++] = (unsigned short)sym;
+                    continue;
+                }
+
+                if (sym == 256) {
+                    break;
+                }
+
+                if ((sym -= 257) >= 29) {
+                    return -1;
+                }
+
+                n = zmat_len_base[sym] + zmat_bits_get(&br, zmat_len_extra[sym]);
+
+                if ((sym = zmat_huff_fast(&br, &dist)) < 0 || sym >= 30) {
+                    return -1;
+                }
+
+                d = zmat_dist_base[sym] + zmat_bits_get(&br, zmat_dist_extra[sym]);
+
+                if (br.err || (known && d > run->count) || zmat_inflate_reserve(al, run, n)) {
+                    return -1;
+                }
+
+                out = run->sym + run->count;
+
+                if (d <= run->count) {
+                    const unsigned short* src = out - d;
+
+                    for (k = 0; k < n; k++) {
+                        out[k] = src[k];
+                    }
+                } else {
+                    /* a byte before the run is a reference into its window */
+                    for (k = 0; k < n; k++) {
+                        out[k] = (run->count + k < d) ? (unsigned short)(256 + ZMAT_DEFLATE_DICT + run->count + k - d)
+                                 : run->sym[run->count + k - d];
+                    }
+                }
+
+                run->count += n;
+            }
+        }
+
+        if (br.err) {
+            return -1;
+        }
+
+        if (head & 1) {
+            run->final = 1;
+            run->end = zmat_bits_tell(&br);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find the first plausible non-final dynamic block header in [from, to), (size_t)-1 if none
+ */
+
+static size_t zmat_inflate_find(const unsigned char* in, size_t len, size_t from, size_t to) {
+    TZMatHuffman lit, dist;
+    TZMatBitReader br;
+    size_t b;
+
+    for (b = from; b < to && (b >> 3) + 3 <= len; b++) {
+        const unsigned char* p = in + (b >> 3);
+        unsigned int head = ((unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16)) >> (b & 7);
+
+        /* BFINAL 0, BTYPE 2, at most 286 literal and 30 distance codes */
+        if ((head & 7) != 4 || ((head >> 3) & 31) > 29 || ((head >> 8) & 31) > 29) {
+            continue;
+        }
+
+        zmat_bits_init(&br, in, len, b + 3);
+
+        if (zmat_inflate_tables(&br, &lit, &dist, 0) == 0) {
+            return b;
+        }
+    }
+
+    return (size_t)-1;
+}
+
+/**
+ * @brief Write symbols [from, to) of a run that starts at out + offset, replacing its window references
+ *
+ * @return 0 on success, -1 if a reference reaches before the start of the output
+ */
+
+static int zmat_inflate_resolve(const unsigned short* sym, size_t from, size_t to, unsigned char* out, size_t offset) {
+    unsigned char* dst = out + offset;
+    size_t k;
+
+    for (k = from; k < to; k++) {
+        if (sym[k] < 256) {
+            dst[k] = (unsigned char)sym[k];
+        } else if (offset + (sym[k] - 256) >= ZMAT_DEFLATE_DICT) {
+            dst[k] = out[offset + (sym[k] - 256) - ZMAT_DEFLATE_DICT];
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Chunks of an unindexed zlib/gzip stream inflated speculatively in parallel
+ */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;     /* the stream */
+    size_t len;                  /* stream length without the trailer */
+    TZMatInflateRun* run;        /* one run per chunk */
+    unsigned char* out;          /* decoded output */
+    size_t* offset;              /* output offset of each run */
+    unsigned long* check;        /* crc32 (gzip) or adler32 (zlib) of each run */
+    int zipid;
+} TZMatSpecJob;
+
+/**
+ * @brief Decode chunk i from the first block header found in it; chunk 0 starts the stream
+ */
+
+static void zmat_inflate_guess(void* arg, size_t i) {
+    TZMatSpecJob* job = (TZMatSpecJob*)arg;
+    TZMatInflateRun* run = job->run + i;
+
+    if (i > 0) {
+        size_t to = run->start + (ZMAT_INFLATE_SEARCH << 3);
+        run->start = zmat_inflate_find(job->in, job->len, run->start, (to < run->stop) ? to : run->stop);
+    }
+
+    run->rc = (run->start == (size_t)-1) ? -1 : zmat_inflate_run(job->al, job->in, job->len, run, i == 0);
+}
+
+/**
+ * @brief Resolve the symbols of run i before its last 32 KB and compute its checksum
+ */
+
+static void zmat_inflate_settle(void* arg, size_t i) {
+    TZMatSpecJob* job = (TZMatSpecJob*)arg;
+    TZMatInflateRun* run = job->run + i;
+    size_t head = (run->count > ZMAT_DEFLATE_DICT) ? run->count - ZMAT_DEFLATE_DICT : 0;
+    unsigned char* out = job->out + job->offset[i];
+
+    run->rc = zmat_inflate_resolve(run->sym, 0, head, job->out, job->offset[i]);
+    job->check[i] = (job->zipid == zmZlib) ? adler32(1, out, run->count) : crc32(0, out, run->count);
+}
+
+/**
+ * @brief Inflate an unindexed single-member zlib or gzip stream on several threads
+ *
+ * The deflate data is cut into ZMAT_INFLATE_CHUNK pieces. Each thread looks for
+ * the first dynamic block header in the first ZMAT_INFLATE_SEARCH bytes of its
+ * piece and inflates from there up to the first block boundary in the next
+ * piece, recording references into the unknown preceding window. The runs are
+ * then chained: a run whose guessed start is not where the previous run ended
+ * is inflated again from the right place. Finally the windows are carried
+ * forward serially, 32 KB per run, and the rest of each run is resolved and
+ * checksummed in parallel.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: zlib or gzip stream
+ * @param[in] inputsize: length of the stream
+ * @param[in] zipid: zmZlib or zmGzip
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nthread: number of threads requested
+ * @param[out] ret: Z_STREAM_END on success
+ * @return 0 on success, -12 if *outputbuf is too small, or 1 if the stream is left to the serial
+ *         inflater (too small, fewer than two threads, several members, trailing data, or any error)
+ */
+
+static int zmat_inflate_mt(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int zipid,
+                           unsigned char** outputbuf, size_t* outputsize, size_t capacity, int nthread, int* ret) {
+    size_t head, tail, nrun, used, total, i;
+    int fixed = (*outputbuf != NULL), nworker, res = 1;
+    TZMatSpecJob job;
+
+    *outputsize = 0;
+
+    if (zipid == zmZlib) {
+        /* deflate method, 32 KB window, no preset dictionary */
+        head = (inputsize > 6 && (inputstr[0] & 0x0F) == 8 && (inputstr[0] >> 4) <= 7 && !(inputstr[1] & 0x20)
+                && ((inputstr[0] << 8) | inputstr[1]) % 31 == 0) ? 2 : 0;
+        tail = 4;
+    } else {
+        head = zmat_gzip_header(inputstr, inputsize);
+        tail = 8;
+    }
+
+    if (nthread <= 1 || head == 0 || inputsize - head - tail < 2 * ZMAT_INFLATE_CHUNK) {
+        return 1;
+    }
+
+    /* on one thread the speculative runs are slower than the serial inflater */
+    if ((nworker = zmat_thread_acquire(nthread)) < 2) {
+        zmat_thread_release(nthread);
+        return 1;
+    }
+
+    nrun = (inputsize - head - tail + ZMAT_INFLATE_CHUNK - 1) / ZMAT_INFLATE_CHUNK;
+    job.run = (TZMatInflateRun*)zmat_malloc(al, nrun * (sizeof(TZMatInflateRun) + sizeof(size_t) + sizeof(unsigned long)));
+
+    if (!job.run) {
+        zmat_thread_release(nthread);
+        return 1;
+    }
+
+    memset(job.run, 0, nrun * sizeof(TZMatInflateRun));
+    job.offset = (size_t*)(job.run + nrun);
+    job.check = (unsigned long*)(job.offset + nrun);
+    job.al = al;
+    job.in = inputstr;
+    job.len = inputsize - tail;
+    job.out = NULL;
+    job.zipid = zipid;
+
+    for (i = 0; i < nrun; i++) {
+        job.run[i].start = (head + i * ZMAT_INFLATE_CHUNK) << 3;
+        job.run[i].stop = (i + 1 < nrun) ? (head + (i + 1) * ZMAT_INFLATE_CHUNK) << 3 : (size_t)-1;
+    }
+
+    zmat_pool_run(zmat_inflate_guess, &job, nrun, nworker);
+
+    /* chain the runs, re-inflating those that did not start where the previous one ended */
+    for (used = 1; used < nrun && job.run[0].rc == 0 && !job.run[used - 1].final; used++) {
+        TZMatInflateRun* run = job.run + used;
+
+        if (run->rc != 0 || run->start != job.run[used - 1].end) {
+            run->start = job.run[used - 1].end;
+
+            if ((run->rc = zmat_inflate_run(al, job.in, job.len, run, 0)) != 0) {
+                break;
+            }
+        }
+    }
+
+    for (i = 0, total = 0; i < used; i++) {
+        job.offset[i] = total;
+        total += job.run[i].count;
+    }
+
+    /* the final block must be followed by the trailer and nothing else */
+    if (job.run[used - 1].rc == 0 && job.run[used - 1].final && ((job.run[used - 1].end + 7) >> 3) == job.len
+            && total <= ZMAT_MAX_ALLOC) {
+        if (fixed && total > capacity) {
+            *outputsize = total;
+            res = -12;
+        } else if ((job.out = fixed ? *outputbuf : (unsigned char*)zmat_malloc(al, total ? total : 1)) != NULL) {
+            /* carry the windows forward, then resolve the rest of every run in parallel */
+            for (i = 0, res = 0; i < used && res == 0; i++) {
+                size_t last = (job.run[i].count > ZMAT_DEFLATE_DICT) ? job.run[i].count - ZMAT_DEFLATE_DICT : 0;
+                res = -zmat_inflate_resolve(job.run[i].sym, last, job.run[i].count, job.out, job.offset[i]);
+            }
+
+            if (res == 0) {
+                zmat_pool_run(zmat_inflate_settle, &job, used, nworker);
+            }
+
+            for (i = 0; i < used && res == 0; i++) {
+                res = -job.run[i].rc;
+            }
+
+            if (res == 0) {
+                const unsigned char* trailer = inputstr + job.len;
+                unsigned long check = job.check[0];
+
+                for (i = 1; i < used; i++) {
+                    check = (zipid == zmZlib) ? zmat_adler32_combine(check, job.check[i], job.run[i].count)
+                            : zmat_crc32_combine(check, job.check[i], job.run[i].count);
+                }
+
+                if (zipid == zmZlib) {
+                    res = (check != (((unsigned long)trailer[0] << 24) | ((unsigned long)trailer[1] << 16)
+                                     | ((unsigned long)trailer[2] << 8) | trailer[3]));
+                } else {
+                    res = (check != (unsigned long)zmat_get_le(trailer, 4) || (total & 0xFFFFFFFFUL) != (size_t)zmat_get_le(trailer + 4, 4));
+                }
+            }
+
+            if (res != 0 && !fixed) {
+                zmat_dealloc(al, job.out);
+            }
+        }
+    }
+
+    zmat_thread_release(nthread);
+
+    for (i = 0; i < nrun; i++) {
+        zmat_dealloc(al, job.run[i].sym);
+    }
+
+    zmat_dealloc(al, job.run);
+
+    if (res == 0) {
+        if (!fixed) {
+            *outputbuf = job.out;
+        }
+
+        *outputsize = total;
+        *ret = Z_STREAM_END;
+    }
+
+    return res;
+}
+
+#ifndef NO_LZ4
+
+/**
+ * @brief Test whether lz4/lz4hc data is an LZ4 frame, written for inputs above LZ4_MAX_INPUT_SIZE
+ *
+ * A raw block can not start with the frame magic: its first token 0x04 has no
+ * literals, so its match would reference data before the start of the block.
+ */
+
+static int zmat_lz4_isframe(const unsigned char* inputstr, size_t inputsize) {
+    return inputsize >= 7 && inputstr[0] == 0x04 && inputstr[1] == 0x22 && inputstr[2] == 0x4D && inputstr[3] == 0x18;
+}
+
+/**
+ * @brief Decoded length of a raw lz4 block, summed from its sequence headers without decoding
+ *
+ * @param[in] inputstr: lz4 compressed block
+ * @param[in] inputsize: length of the compressed block
+ * @return the decoded length, or 0 if the block is malformed, empty or too large
+ */
+
+static size_t zmat_lz4_size(const unsigned char* inputstr, size_t inputsize) {
+    size_t pos = 0, total = 0;
+
+    while (pos < inputsize) {
+        unsigned int token = inputstr[pos++];
+        size_t len = token >> 4;
+        unsigned char b;
+
+        /* literal run, then an optional 2-byte offset and match length */
+        if (len == 15) {
+            do {
+                if (pos >= inputsize) {
+                    return 0;
+                }
+
+                b = inputstr[pos++];
+                len += b;
+            } while (b == 255);
+        }
+
+        if (len > inputsize - pos) {
+            return 0;
+        }
+
+        pos += len;
+        total += len;
+
+        if (pos == inputsize) {
+            break;    /* the last sequence carries literals only */
+        }
+
+        if (inputsize - pos < 2) {
+            return 0;
+        }
+
+        pos += 2;
+        len = (token & 15) + 4;
+
+        if ((token & 15) == 15) {
+            do {
+                if (pos >= inputsize) {
+                    return 0;
+                }
+
+                b = inputstr[pos++];
+                len += b;
+            } while (b == 255);
+        }
+
+        if (len > ZMAT_MAX_ALLOC - total) {
+            return 0;
+        }
+
+        total += len;
+    }
+
+    return (total <= ZMAT_MAX_ALLOC) ? total : 0;
+}
+
+/**
+ * @brief Largest zmLz4f output for an input of inputsize bytes, reached when all blocks are stored
+ */
+
+static size_t zmat_lz4f_bound(size_t inputsize) {
+    size_t nblock = (inputsize + ZMAT_LZ4_BLOCK - 1) / ZMAT_LZ4_BLOCK;
+
+    return ZMAT_LZ4F_HEADER + nblock * (4 + 4 * ZMAT_LZ4F_CHECKSUM) + inputsize + 4;
+}
+
+/**
+ * @brief Shared state of the parallel zmLz4f block encoder
+ */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;     /**< input buffer */
+    size_t len;                  /**< input length */
+    unsigned char* out;          /**< block slots, one per ZMAT_LZ4_BLOCK of input */
+    size_t* outlen;              /**< framed length of each block */
+    int level;                   /**< lz4hc level, 0 for the fast lz4 encoder */
+} TZMatLz4fJob;
+
+/**
+ * @brief Compress block i of a zmLz4f frame into its slot: length, data and block checksum
+ *
+ * A block that does not shrink is stored, flagged by the high bit of its length.
+ */
+
+static void zmat_lz4f_encode_block(void* arg, size_t i) {
+    TZMatLz4fJob* job = (TZMatLz4fJob*)arg;
+    size_t start = i * ZMAT_LZ4_BLOCK;
+    int blen = (int)((job->len - start < ZMAT_LZ4_BLOCK) ? job->len - start : ZMAT_LZ4_BLOCK);
+    const char* src = (const char*)job->in + start;
+    unsigned char* slot = job->out + i * (ZMAT_LZ4_BLOCK + 4 + 4 * ZMAT_LZ4F_CHECKSUM);
+    int n = 0;
+
+    if (blen > 1) {
+        n = job->level ? zmat_lz4hc_compress(job->al, src, (char*)slot + 4, blen, blen - 1, job->level)
+            : LZ4_compress_default(src, (char*)slot + 4, blen, blen - 1);
+    }
+
+    if (n > 0) {
+        zmat_put_le(slot, n, 4);
+    } else {
+        memcpy(slot + 4, src, blen);
+        zmat_put_le(slot, 0x80000000U | (unsigned int)blen, 4);
+        n = blen;
+    }
+
+#if ZMAT_LZ4F_CHECKSUM
+    zmat_put_le(slot + 4 + n, XXH32(slot + 4, n, 0), 4);
+    n += 4;
+#endif
+    job->outlen[i] = 4 + (size_t)n;
+}
+
+/**
+ * @brief LZ4 frame (.lz4) compression in independent blocks on up to nworker threads
+ *
+ * The frame is cut into ZMAT_LZ4_BLOCK (4 MB) independent blocks, records the
+ * content size and, unless ZMAT_LZ4F_CHECKSUM is 0, an XXH32 checksum after each
+ * block. No content checksum is written, as it would need a serial pass over the
+ * input. The output does not depend on nworker and is read by the lz4 tool.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: input buffer
+ * @param[in] inputsize: input length
+ * @param[in] level: lz4hc compression level, or 0 for the fast lz4 encoder
+ * @param[in] nworker: number of threads to run the blocks on
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @return 0 on success, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_lz4f_encode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int level,
+                            int nworker, unsigned char** outputbuf, size_t* outputsize, size_t capacity) {
+    size_t nblock = (inputsize + ZMAT_LZ4_BLOCK - 1) / ZMAT_LZ4_BLOCK, bound = zmat_lz4f_bound(inputsize);
+    size_t pos = ZMAT_LZ4F_HEADER, i;
+    unsigned char* buf;
+    TZMatLz4fJob job;
+
+    *outputsize = 0;
+
+    /* a given buffer that can hold every block stored is written in place */
+    buf = (*outputbuf && capacity >= bound) ? *outputbuf : (unsigned char*)zmat_malloc(al, bound);
+    job.outlen = (size_t*)zmat_malloc(al, (nblock ? nblock : 1) * sizeof(size_t));
+
+    if (!job.outlen || !buf) {
+        zmat_dealloc(al, job.outlen);
+
+        if (buf != *outputbuf) {
+            zmat_dealloc(al, buf);
+        }
+
+        return -5;
+    }
+
+    job.al = al;
+    job.in = inputstr;
+    job.len = inputsize;
+    job.out = buf + ZMAT_LZ4F_HEADER;
+    job.level = level;
+
+    zmat_pool_run(zmat_lz4f_encode_block, &job, nblock, nworker);
+
+    for (i = 0; i < nblock; i++) {
+        memmove(buf + pos, job.out + i * (ZMAT_LZ4_BLOCK + 4 + 4 * ZMAT_LZ4F_CHECKSUM), job.outlen[i]);
+        pos += job.outlen[i];
+    }
+
+    zmat_dealloc(al, job.outlen);
+
+    /* FLG: version 1, independent blocks, content size, block checksums; BD: 4 MB blocks */
+    zmat_put_le(buf, 0x184D2204U, 4);
+    buf[4] = 0x40 | 0x20 | 0x08 | (ZMAT_LZ4F_CHECKSUM ? 0x10 : 0);
+    buf[5] = 0x70;
+    zmat_put_le(buf + 6, inputsize, 8);
+    buf[14] = (unsigned char)((XXH32(buf + 4, 10, 0) >> 8) & 0xFF);
+    zmat_put_le(buf + pos, 0, 4);
+    pos += 4;
+
+    *outputsize = pos;
+
+    if (buf == *outputbuf) {
+        return 0;
+    }
+
+    if (*outputbuf == NULL) {
+        zmat_shrink_buf(al, &buf, pos);
+        *outputbuf = buf;
+        return 0;
+    }
+
+    if (pos <= capacity) {
+        memcpy(*outputbuf, buf, pos);
+    }
+
+    zmat_dealloc(al, buf);
+    return (pos <= capacity) ? 0 : -12;
+}
+
+/**
+ * @brief One data block of a LZ4 frame, see zmat_lz4f_scan()
+ */
+
+typedef struct {
+    const unsigned char* flg;    /**< FLG byte of its frame */
+    const unsigned char* src;    /**< block data */
+    const unsigned char* check;  /**< content checksum following the last block of a frame, or NULL */
+    size_t size;                 /**< block data length */
+    size_t base;                 /**< output offset of its frame */
+    size_t out;                  /**< output offset */
+    size_t outlen;               /**< decoded length */
+    int stored;                  /**< 1 if the block is stored uncompressed */
+    int rc;                      /**< 0 once decoded, -1 on a decoding error, -2 on a checksum mismatch */
+} TZMatLz4fBlock;
+
+/**
+ * @brief List the data blocks of the LZ4 frames in a buffer and place their output
+ *
+ * Skippable frames are passed over; frames with a dictionary id are not supported.
+ * With exact set, compressed blocks are sized from their sequence headers.
+ * Otherwise all but the last block of a frame are taken to be full and the
+ * last one gets the rest of the content size, which holds for the frames
+ * written by zmLz4f, the stream interface and the lz4 tool; decoding checks it.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: LZ4 frames
+ * @param[in] inputsize: length of the input
+ * @param[in] exact: 1 to size every block from its data
+ * @param[out] list: receives the block list, freed by the caller
+ * @param[out] count: number of blocks
+ * @param[out] total: decoded length of all frames
+ * @return 0 on success, 1 if the guessed sizes disagree with a content size,
+ *         -1 if the input is not a supported LZ4 frame or -5 if out of memory
+ */
+
+static int zmat_lz4f_scan(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int exact,
+                          TZMatLz4fBlock** list, size_t* count, size_t* total) {
+    TZMatLz4fBlock* blocks = NULL;
+    size_t pos = 0, n = 0, cap = 0, out = 0, i;
+    int res = 0;
+
+    while (pos < inputsize && res == 0) {
+        const unsigned char* flg = inputstr + pos + 4;
+        size_t first = n, base = out, hdrlen, bmax, sum = 0;
+        unsigned long long content;
+
+        if (inputsize - pos < 8) {
+            res = -1;
+            break;
+        }
+
+        if (((unsigned int)zmat_get_le(inputstr + pos, 4) & 0xFFFFFFF0U) == 0x184D2A50U) {
+            size_t skip = (size_t)zmat_get_le(inputstr + pos + 4, 4);
+
+            if (skip > inputsize - pos - 8) {
+                res = -1;
+                break;
+            }
+
+            pos += 8 + skip;
+            continue;
+        }
+
+        hdrlen = (flg[0] & 0x08) ? 15 : 7;
+
+        if ((unsigned int)zmat_get_le(inputstr + pos, 4) != 0x184D2204U || (flg[0] & 0xC3) != 0x40
+                || (flg[1] & 0x8F) || ((flg[1] >> 4) & 7) < 4 || inputsize - pos < hdrlen + 4
+                || inputstr[pos + hdrlen - 1] != ((XXH32(flg, hdrlen - 5, 0) >> 8) & 0xFF)) {
+            res = -1;
+            break;
+        }
+
+        bmax = (size_t)1 << (8 + 2 * ((flg[1] >> 4) & 7));
+        content = (flg[0] & 0x08) ? zmat_get_le(flg + 2, 8) : 0;
+        pos += hdrlen;
+
+        /* blocks up to the end mark, each may be followed by its checksum */
+        for (;;) {
+            size_t extra = (flg[0] & 0x10) ? 4 : 0, bsize;
+            TZMatLz4fBlock* b;
+
+            if (inputsize - pos < 4) {
+                res = -1;
+                break;
+            }
+
+            bsize = (size_t)zmat_get_le(inputstr + pos, 4);
+            pos += 4;
+
+            if (bsize == 0) {
+                break;
+            }
+
+            if ((bsize & 0x7FFFFFFF) > bmax || (bsize & 0x7FFFFFFF) + extra > inputsize - pos) {
+                res = -1;
+                break;
+            }
+
+            if (n == cap) {
+                TZMatLz4fBlock* grown;
+
+                cap = cap ? cap * 2 : 64;
+
+                if (!(grown = (TZMatLz4fBlock*)zmat_realloc(al, blocks, cap * sizeof(TZMatLz4fBlock)))) {
+                    res = -5;
+                    break;
+                }
+
+                blocks = grown;
+            }
+
+            b = blocks + n++;
+            b->flg = flg;
+            b->src = inputstr + pos;
+            b->check = NULL;
+            b->size = bsize & 0x7FFFFFFF;
+            b->base = base;
+            b->stored = (bsize >> 31) & 1;
+            b->rc = -1;
+            b->outlen = b->stored ? b->size : (exact ? zmat_lz4_size(b->src, b->size) : bmax);
+            pos += b->size + extra;
+        }
+
+        if (res != 0) {
+            break;
+        }
+
+        for (i = first; i + 1 < n; i++) {
+            sum += blocks[i].outlen;
+        }
+
+        if (n > first && !exact && !blocks[n - 1].stored) {
+            TZMatLz4fBlock* b = blocks + n - 1;
+
+            b->outlen = ((flg[0] & 0x08) && content > sum && content - sum <= bmax) ? (size_t)(content - sum)
+                        : zmat_lz4_size(b->src, b->size);
+        }
+
+        for (i = first; i < n; i++) {
+            if (blocks[i].outlen > ZMAT_MAX_ALLOC - out) {
+                res = -1;
+                break;
+            }
+
+            blocks[i].out = out;
+            out += blocks[i].outlen;
+        }
+
+        if (res == 0 && (flg[0] & 0x08) && out - base != content) {
+            res = exact ? -1 : 1;
+        }
+
+        if (flg[0] & 0x04) {
+            if (inputsize - pos < 4) {
+                res = -1;
+            } else {
+                if (n > first) {
+                    blocks[n - 1].check = inputstr + pos;
+                }
+
+                pos += 4;
+            }
+        }
+    }
+
+    if (res != 0) {
+        zmat_dealloc(al, blocks);
+        return res;
+    }
+
+    *list = blocks;
+    *count = n;
+    *total = out;
+    return 0;
+}
+
+/**
+ * @brief Decoded length of the LZ4 frames in a buffer, 0 if it can not be read
+ *
+ * @param[in] al: allocator of the temporary block list
+ */
+
+static size_t zmat_lz4f_size(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize) {
+    TZMatLz4fBlock* blocks;
+    size_t count, total;
+    int res = zmat_lz4f_scan(al, inputstr, inputsize, 0, &blocks, &count, &total);
+
+    if (res == 1) {
+        res = zmat_lz4f_scan(al, inputstr, inputsize, 1, &blocks, &count, &total);
+    }
+
+    if (res != 0) {
+        return 0;
+    }
+
+    zmat_dealloc(al, blocks);
+    return total;
+}
+
+/**
+ * @brief Shared state of the parallel LZ4 frame block decoder
+ */
+
+typedef struct {
+    TZMatLz4fBlock* blocks;      /**< blocks from zmat_lz4f_scan() */
+    unsigned char* out;          /**< output buffer */
+} TZMatLz4fDecodeJob;
+
+/**
+ * @brief Check and decode block i of a LZ4 frame at its output offset
+ *
+ * Linked blocks reference up to 64 KB of the output of their frame before
+ * them, so they must be decoded in order.
+ */
+
+static void zmat_lz4f_decode_block(void* arg, size_t i) {
+    TZMatLz4fDecodeJob* job = (TZMatLz4fDecodeJob*)arg;
+    TZMatLz4fBlock* b = job->blocks + i;
+    char* dst = (char*)job->out + b->out;
+    size_t dict = b->out - b->base;
+    int n;
+
+    if ((b->flg[0] & 0x10) && (unsigned int)zmat_get_le(b->src + b->size, 4) != XXH32(b->src, b->size, 0)) {
+        b->rc = -2;
+        return;
+    }
+
+    if (b->stored) {
+        memcpy(dst, b->src, b->size);
+        n = (int)b->size;
+    } else if (!(b->flg[0] & 0x20) && dict > 0) {
+        dict = (dict > 65536) ? 65536 : dict;
+        n = LZ4_decompress_safe_usingDict((const char*)b->src, dst, (int)b->size, (int)b->outlen, dst - dict, (int)dict);
+    } else {
+        n = LZ4_decompress_safe((const char*)b->src, dst, (int)b->size, (int)b->outlen);
+    }
+
+    b->rc = (n >= 0 && (size_t)n == b->outlen) ? 0 : -1;
+}
+
+/**
+ * @brief LZ4 frame (.lz4) decompression, decoding independent blocks on up to nworker threads
+ *
+ * Reads the frames of zmLz4f, the stream interface and the lz4 tool, including
+ * concatenated and skippable frames. Block and content checksums are verified
+ * when present; frames with linked blocks are decoded serially.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: LZ4 frames
+ * @param[in] inputsize: length of the input
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nworker: number of threads to decode the blocks on
+ * @param[out] ret: -1 on a malformed frame or block, -2 on a checksum mismatch
+ * @return 0 on success, -6 if the input can not be decoded, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_lz4f_decode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize,
+                            unsigned char** outputbuf, size_t* outputsize, size_t capacity, int nworker, int* ret) {
+    int fixed = (*outputbuf != NULL), exact, res = 1;
+    unsigned char* out = NULL;
+    size_t count = 0, total = 0, i;
+    TZMatLz4fDecodeJob job;
+
+    *outputsize = 0;
+
+    /* decoding checks the block sizes guessed from the frame headers; on a mismatch, retry with exact sizes */
+    for (exact = 0; exact < 2 && res != 0; exact++) {
+        int linked = 0;
+
+        if ((res = zmat_lz4f_scan(al, inputstr, inputsize, exact, &job.blocks, &count, &total)) != 0) {
+            if (res == 1) {
+                continue;
+            }
+
+            *ret = -1;
+            return (res == -5) ? -5 : -6;
+        }
+
+        if (fixed && total > capacity) {
+            zmat_dealloc(al, job.blocks);
+            res = 1;
+
+            if (exact) {
+                *outputsize = total;
+                return -12;
+            }
+
+            continue;
+        }
+
+        if (!(out = fixed ? *outputbuf : (unsigned char*)zmat_malloc(al, total ? total : 1))) {
+            zmat_dealloc(al, job.blocks);
+            return -5;
+        }
+
+        for (i = 0; i < count; i++) {
+            linked |= !(job.blocks[i].flg[0] & 0x20);
+        }
+
+        job.out = out;
+        zmat_pool_run(zmat_lz4f_decode_block, &job, count, linked ? 1 : nworker);
+
+        for (i = 0; i < count && res == 0; i++) {
+            TZMatLz4fBlock* b = job.blocks + i;
+
+            res = b->rc;
+
+            if (res == 0 && b->check && (unsigned int)zmat_get_le(b->check, 4) != XXH32(out + b->base, b->out + b->outlen - b->base, 0)) {
+                res = -2;
+            }
+        }
+
+        zmat_dealloc(al, job.blocks);
+
+        if (res != 0 && !fixed) {
+            zmat_dealloc(al, out);
+        }
+    }
+
+    if (res != 0) {
+        *ret = res;
+        return -6;
+    }
+
+    *ret = 0;
+    *outputsize = total;
+
+    if (!fixed) {
+        *outputbuf = out;
+    }
+
+    return 0;
+}
+
+#endif
+
+#ifndef NO_ZSTD
+
+/**
+ * @brief Seek table of a zstd seekable stream, see zmat_zstd_seektable()
+ */
+
+typedef struct {
+    const unsigned char* entries;  /**< first seek table entry */
+    size_t count;                  /**< number of frames */
+    size_t stride;                 /**< entry length: compressed and decoded size, and an optional checksum */
+    size_t datalen;                /**< length of the frames before the seek table */
+    size_t total;                  /**< decoded length of all frames */
+} TZMatZstdSeek;
+
+/**
+ * @brief Read the seek table at the end of a zstd seekable stream (zstd seekable format)
+ *
+ * The table is a skippable frame after the last zstd frame, listing the
+ * compressed and decoded size of each frame; any zstd decoder skips it. The
+ * optional frame checksums of the table are not used, the frames written by
+ * zmat_zstd_seek_encode() carry the zstd content checksum instead.
+ *
+ * @param[in] inputstr: zstd stream
+ * @param[in] inputsize: length of the stream
+ * @param[out] seek: the seek table
+ * @return 0 if a valid seek table is found, -1 otherwise
+ */
+
+static int zmat_zstd_seektable(const unsigned char* inputstr, size_t inputsize, TZMatZstdSeek* seek) {
+    size_t i, tablelen, clen = 0, dlen = 0;
+    const unsigned char* footer;
+
+    if (inputsize < 17) {
+        return -1;
+    }
+
+    footer = inputstr + inputsize - 9;
+
+    if ((unsigned int)zmat_get_le(footer + 5, 4) != 0x8F92EAB1U || (footer[4] & 0x7F)) {
+        return -1;
+    }
+
+    seek->count = (size_t)zmat_get_le(footer, 4);
+    seek->stride = (footer[4] & 0x80) ? 12 : 8;
+
+    if (seek->count > (inputsize - 17) / seek->stride) {
+        return -1;
+    }
+
+    tablelen = seek->count * seek->stride + 9;
+
+    if ((unsigned int)zmat_get_le(inputstr + inputsize - tablelen - 8, 4) != 0x184D2A5EU
+            || (size_t)zmat_get_le(inputstr + inputsize - tablelen - 4, 4) != tablelen) {
+        return -1;
+    }
+
+    seek->entries = inputstr + inputsize - tablelen;
+    seek->datalen = inputsize - tablelen - 8;
+
+    for (i = 0; i < seek->count; i++) {
+        clen += (size_t)zmat_get_le(seek->entries + i * seek->stride, 4);
+        dlen += (size_t)zmat_get_le(seek->entries + i * seek->stride + 4, 4);
+
+        if (clen > seek->datalen || dlen > ZMAT_MAX_ALLOC) {
+            return -1;
+        }
+    }
+
+    if (clen != seek->datalen) {
+        return -1;
+    }
+
+    seek->total = dlen;
+    return 0;
+}
+
+/**
+ * @brief Shared state of the parallel zstd seekable encoder and decoder
+ *
+ * Task t codes frames first + t, first + t + ntask, ... with one zstd context.
+ */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;     /**< encoder: input; decoder: first zstd frame */
+    size_t* inoff;               /**< offset of each frame in in, nframe + 1 entries */
+    unsigned char* out;          /**< encoder: frame slots; decoder: output of frame first */
+    size_t* outoff;              /**< offset of each frame in out, nframe + 1 entries */
+    size_t* outlen;              /**< encoder: compressed length or zstd error of each frame */
+    size_t first;                /**< first frame to code */
+    size_t nframe;               /**< number of frames to code */
+    size_t ntask;                /**< number of tasks */
+    int level;                   /**< compression level */
+    int* rc;                     /**< decoder: 0, or -1 once a frame of the task fails */
+} TZMatZstdSeekJob;
+
+/**
+ * @brief Compress every ntask-th frame of a zstd seekable stream into its slot
+ */
+
+static void zmat_zstd_seek_encode_task(void* arg, size_t t) {
+    TZMatZstdSeekJob* job = (TZMatZstdSeekJob*)arg;
+    ZSTD_CCtx* zctx = ZSTD_createCCtx_advanced(zmat_zstd_mem(job->al));
+    size_t i;
+
+    for (i = t; i < job->nframe; i += job->ntask) {
+        if (!zctx) {
+            job->outlen[i] = (size_t) - ZSTD_error_memory_allocation;
+            continue;
+        }
+
+        ZSTD_CCtx_reset(zctx, ZSTD_reset_session_and_parameters);
+        ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel, job->level);
+        ZSTD_CCtx_setParameter(zctx, ZSTD_c_checksumFlag, 1);
+        job->outlen[i] = ZSTD_compress2(zctx, job->out + job->outoff[i], job->outoff[i + 1] - job->outoff[i],
+                                        job->in + job->inoff[i], job->inoff[i + 1] - job->inoff[i]);
+    }
+
+    ZSTD_freeCCtx(zctx);
+}
+
+/**
+ * @brief zstd seekable compression: independent frames compressed in parallel and a seek table
+ *
+ * The input is cut into ZMAT_SEEK_FRAME frames, each with its content size
+ * and checksum, followed by the seek table of the zstd seekable format, see
+ * zmat_zstd_seektable(). The output is a standard zstd stream and does not
+ * depend on nworker.
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: input buffer
+ * @param[in] inputsize: input length
+ * @param[in] level: zstd compression level
+ * @param[in] nworker: number of threads to run the frames on
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is copied into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[out] ret: the first zstd error code
+ * @return 0 on success, -9 on a zstd error, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_zstd_seek_encode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, int level,
+                                 int nworker, unsigned char** outputbuf, size_t* outputsize, size_t capacity, int* ret) {
+    size_t nframe = (inputsize + ZMAT_SEEK_FRAME - 1) / ZMAT_SEEK_FRAME, i, pos = 0;
+    size_t slotlen = ZSTD_compressBound(ZMAT_SEEK_FRAME);
+    unsigned char* buf;
+    TZMatZstdSeekJob job;
+
+    *outputsize = 0;
+    *ret = 0;
+    nframe = (nframe < 1) ? 1 : nframe;
+
+    job.inoff = (size_t*)zmat_malloc(al, (nframe + 1) * 3 * sizeof(size_t));
+    buf = (unsigned char*)zmat_malloc(al, nframe * slotlen + 8 + nframe * 8 + 9);
+
+    if (!job.inoff || !buf) {
+        zmat_dealloc(al, job.inoff);
+        zmat_dealloc(al, buf);
+        return -5;
+    }
+
+    job.outoff = job.inoff + nframe + 1;
+    job.outlen = job.outoff + nframe + 1;
+
+    for (i = 0; i <= nframe; i++) {
+        job.inoff[i] = (i * ZMAT_SEEK_FRAME < inputsize) ? i * ZMAT_SEEK_FRAME : inputsize;
+        job.outoff[i] = i * slotlen;
+    }
+
+    job.al = al;
+    job.in = inputstr;
+    job.out = buf;
+    job.first = 0;
+    job.nframe = nframe;
+    job.ntask = ((size_t)nworker < nframe) ? (size_t)(nworker < 1 ? 1 : nworker) : nframe;
+    job.level = level;
+
+    zmat_pool_run(zmat_zstd_seek_encode_task, &job, job.ntask, (int)job.ntask);
+
+    /* join the frames in place and append the seek table */
+    for (i = 0; i < nframe; i++) {
+        if (ZSTD_isError(job.outlen[i])) {
+            *ret = (int)job.outlen[i];
+            zmat_dealloc(al, job.inoff);
+            zmat_dealloc(al, buf);
+            return -9;
+        }
+
+        memmove(buf + pos, buf + job.outoff[i], job.outlen[i]);
+        pos += job.outlen[i];
+    }
+
+    zmat_put_le(buf + pos, 0x184D2A5EU, 4);
+    zmat_put_le(buf + pos + 4, nframe * 8 + 9, 4);
+    pos += 8;
+
+    for (i = 0; i < nframe; i++, pos += 8) {
+        zmat_put_le(buf + pos, job.outlen[i], 4);
+        zmat_put_le(buf + pos + 4, job.inoff[i + 1] - job.inoff[i], 4);
+    }
+
+    zmat_put_le(buf + pos, nframe, 4);
+    buf[pos + 4] = 0;
+    zmat_put_le(buf + pos + 5, 0x8F92EAB1U, 4);
+    pos += 9;
+
+    zmat_dealloc(al, job.inoff);
+    *outputsize = pos;
+
+    if (*outputbuf == NULL) {
+        zmat_shrink_buf(al, &buf, pos);
+        *outputbuf = buf;
+        return 0;
+    }
+
+    if (pos <= capacity) {
+        memcpy(*outputbuf, buf, pos);
+    }
+
+    zmat_dealloc(al, buf);
+    return (pos <= capacity) ? 0 : -12;
+}
+
+/**
+ * @brief Decompress every ntask-th frame of a zstd seekable stream at its output offset
+ */
+
+static void zmat_zstd_seek_decode_task(void* arg, size_t t) {
+    TZMatZstdSeekJob* job = (TZMatZstdSeekJob*)arg;
+    ZSTD_DCtx* zdctx = ZSTD_createDCtx_advanced(zmat_zstd_mem(job->al));
+    size_t i;
+
+    job->rc[t] = zdctx ? 0 : -5;
+
+    for (i = t; i < job->nframe && job->rc[t] == 0; i += job->ntask) {
+        size_t f = job->first + i, dlen = job->outoff[f + 1] - job->outoff[f];
+        size_t res = ZSTD_decompressDCtx(zdctx, job->out + job->outoff[f] - job->outoff[job->first], dlen,
+                                         job->in + job->inoff[f], job->inoff[f + 1] - job->inoff[f]);
+
+        job->rc[t] = (ZSTD_isError(res) || res != dlen) ? -9 : 0;
+    }
+
+    ZSTD_freeDCtx(zdctx);
+}
+
+/**
+ * @brief Decompress the frames of a zstd seekable stream that cover a byte range, in parallel
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: zstd seekable stream
+ * @param[in] seek: its seek table, from zmat_zstd_seektable()
+ * @param[in] offset: first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nworker: number of threads to decode the frames on
+ * @param[out] ret: -9 if a frame fails to decode or does not match the seek table
+ * @return 0 on success, -9 on a zstd error, -5 if out of memory or -12 if *outputbuf is too small
+ */
+
+static int zmat_zstd_seek_decode(const TZMatAllocator* al, const unsigned char* inputstr, const TZMatZstdSeek* seek,
+                                 size_t offset, size_t length, unsigned char** outputbuf, size_t* outputsize,
+                                 size_t capacity, int nworker, int* ret) {
+    size_t first, last, span, skip, i;
+    int fixed = (*outputbuf != NULL), aligned;
+    unsigned char* work;
+    TZMatZstdSeekJob job;
+
+    *outputsize = 0;
+    *ret = 0;
+
+    if (offset >= seek->total || length == 0) {
+        return 0;
+    }
+
+    length = (length > seek->total - offset) ? seek->total - offset : length;
+
+    if (fixed && length > capacity) {
+        *outputsize = length;
+        return -12;
+    }
+
+    job.inoff = (size_t*)zmat_malloc(al, (seek->count + 1) * 2 * sizeof(size_t) + (size_t)(nworker < 1 ? 1 : nworker) * sizeof(int));
+
+    if (!job.inoff) {
+        return -5;
+    }
+
+    job.outoff = job.inoff + seek->count + 1;
+    job.rc = (int*)(job.outoff + seek->count + 1);
+    job.inoff[0] = job.outoff[0] = 0;
+
+    for (i = 0; i < seek->count; i++) {
+        job.inoff[i + 1] = job.inoff[i] + (size_t)zmat_get_le(seek->entries + i * seek->stride, 4);
+        job.outoff[i + 1] = job.outoff[i] + (size_t)zmat_get_le(seek->entries + i * seek->stride + 4, 4);
+    }
+
+    /* frames may differ in length, find the ones holding the first and the last byte */
+    for (first = 0; job.outoff[first + 1] <= offset; first++);
+
+    for (last = first; job.outoff[last + 1] < offset + length; last++);
+
+    skip = offset - job.outoff[first];
+    span = job.outoff[last + 1] - job.outoff[first];
+    aligned = (skip == 0 && span == length);
+    work = (fixed && aligned) ? *outputbuf : (unsigned char*)zmat_malloc(al, span ? span : 1);
+
+    if (!work) {
+        zmat_dealloc(al, job.inoff);
+        return -5;
+    }
+
+    job.al = al;
+    job.in = inputstr;
+    job.out = work;
+    job.first = first;
+    job.nframe = last - first + 1;
+    job.ntask = ((size_t)nworker < job.nframe) ? (size_t)(nworker < 1 ? 1 : nworker) : job.nframe;
+
+    zmat_pool_run(zmat_zstd_seek_decode_task, &job, job.ntask, (int)job.ntask);
+
+    for (i = 0; i < job.ntask && *ret == 0; i++) {
+        *ret = job.rc[i];
+    }
+
+    zmat_dealloc(al, job.inoff);
+
+    if (*ret != 0) {
+        if (work != *outputbuf) {
+            zmat_dealloc(al, work);
+        }
+
+        return (*ret == -5) ? -5 : -9;
+    }
+
+    if (fixed && !aligned) {
+        memcpy(*outputbuf, work + skip, length);
+        zmat_dealloc(al, work);
+    } else if (!fixed) {
+        if (skip > 0) {
+            memmove(work, work + skip, length);
+        }
+
+        zmat_shrink_buf(al, &work, length);
+        *outputbuf = work;
+    }
+
+    *outputsize = length;
+    return 0;
+}
+
+#endif
+
+#ifndef NO_LZMA
+
+/**
+ * @brief Locate the members of a lzip v1 stream by walking its member_size fields backward
+ *
+ * lzip v1 members (written by simpleCompressLzipMT() and by the lzip tool)
+ * end with a 20-byte footer: CRC32, data_size and member_size, the latter two
+ * as little-endian uint64. Walking backward from the end of the stream using
+ * member_size gives exact per-member byte ranges; data_size gives the decoded
+ * length of each member.
+ *
+ * @param[in] al: allocator of *starts
+ * @param[in] inputstr: lzip compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @param[out] starts: if not NULL, receives the member offsets in forward order, free with zmat_dealloc
+ * @param[out] datasize: total decoded length of all members
+ * @return number of members if they cover the whole input exactly, otherwise 0
+ */
+
+static size_t zmat_lzip_members(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize, size_t** starts, size_t* datasize) {
+    size_t end = inputsize, n = 0, k;
+
+    *datasize = 0;
+
+    /* minimum v1 member: 6 header + some LZMA + 12 footer + 8 member_size */
+    while (end >= 40) {
+        unsigned long long ms = zmat_get_le(inputstr + end - 8, 8);
+        unsigned long long ds = zmat_get_le(inputstr + end - 16, 8);
+
+        /* verify lzip magic "LZIP" and version == 1 */
+        if (ms < 40 || ms > (unsigned long long)end || ds > (unsigned long long)(ZMAT_MAX_ALLOC - *datasize) ||
+                memcmp(inputstr + end - ms, "LZIP\1", 5) != 0) {
+            return 0;
+        }
+
+        *datasize += (size_t)ds;
+        end -= (size_t)ms;
+        n++;
+    }
+
+    if (end != 0 || n == 0) {
+        return 0;
+    }
+
+    if (starts) {
+        if (!(*starts = (size_t*)zmat_malloc(al, n * sizeof(size_t)))) {
+            return 0;
+        }
+
+        for (end = inputsize, k = n; k > 0; k--) {
+            end -= (size_t)zmat_get_le(inputstr + end - 8, 8);
+            (*starts)[k - 1] = end;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Decoded length recorded in a lzma-alone header or in the lzip member footers
+ *
+ * @param[in] inputstr: lzma or lzip compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @param[in] zipid: zmLzma or zmLzip
+ * @return the decoded length, or 0 if it is not recorded, too large, or beyond
+ *         ZMAT_LZMA_RATIO times inputsize (the output then grows as it is decoded)
+ */
+
+static size_t zmat_lzma_size(const unsigned char* inputstr, size_t inputsize, int zipid) {
+    unsigned long long len = 0;
+    size_t total = 0;
+
+    if (zipid == zmLzma) {
+        /* 13-byte header: properties, dictionary size, decoded length (all ones if streamed) */
+        if (inputsize >= 13) {
+            len = zmat_get_le(inputstr + 5, 8);
+        }
+    } else if (inputsize >= 18 && memcmp(inputstr, "LZIP", 4) == 0) {
+        if (inputstr[4] == 1 && zmat_lzip_members(NULL, inputstr, inputsize, NULL, &total) > 0) {
+            len = total;
+        } else if (inputstr[4] == 0) {
+            /* single v0 member: 12-byte footer of CRC32 and data_size */
+            len = zmat_get_le(inputstr + inputsize - 8, 8);
+        }
+    }
+
+    return (len <= ZMAT_MAX_ALLOC && len / ZMAT_LZMA_RATIO <= inputsize) ? (size_t)len : 0;
+}
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+/**
+ * @brief One lzip v1 member and the slice of the output it decodes into
+ */
+
+typedef struct TZMatLzipMember {
+    const TZMatAllocator* al;
+    const unsigned char* in;
+    size_t inlen;
+    unsigned char* out;
+    size_t outlen;               /**< data_size recorded in the member footer */
+    int rc;
+} TZMatLzipMember;
+
+/**
+ * @brief Pool task: decode member i into its slice, which must be filled exactly
+ */
+
+static void zmat_lzip_decode_member(void* arg, size_t i) {
+    TZMatLzipMember* m = (TZMatLzipMember*)arg + i;
+    unsigned char* slice = m->out;
+    size_t len = 0;
+
+    m->rc = simpleDecompress(m->al, ELZMA_lzip, m->in, m->inlen, &slice, &len, m->outlen, NULL);
+
+    if (m->rc == ELZMA_E_OK && len != m->outlen) {
+        m->rc = ELZMA_E_SIZE_MISMATCH;
+    }
+}
+
+#endif
+
+/**
+ * @brief Decode lzma-alone or lzip data, including multi-member lzip v1 streams
+ *
+ * The members of a lzip v1 stream are independent; they are decoded concurrently
+ * on up to nthread pool threads, each into its offset of one output buffer.
+ *
+ * @param[in] al: allocator of the output buffer and the decoder states
+ * @param[in] format: ELZMA_lzip or ELZMA_lzma
+ * @param[in] inputstr: compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @param[in,out] outputbuf: if not NULL on entry, a caller-owned buffer of capacity bytes to decode into
+ * @param[out] outputsize: decoded length
+ * @param[in] capacity: length of *outputbuf if given, otherwise the planned output length (0 if unknown)
+ * @param[out] ret: easylzma error code (if error occurs)
+ * @param[in] nthread: number of threads for multi-member lzip streams
+ * @return 0 on success, -4 on a decoder error or -5 if the output can not be allocated
+ */
+
+static int zmat_lzma_decode(const TZMatAllocator* al, elzma_file_format format, const unsigned char* inputstr, size_t inputsize,
+                            unsigned char** outputbuf, size_t* outputsize, size_t capacity, int* ret, int nthread) {
+    *outputsize = 0;
+    (void)nthread;
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+    /* the v0 decompressor reads ahead into subsequent members, so decode
+     * every member of a multi-member stream with its exact byte range */
+    if (format == ELZMA_lzip && inputsize > 5 && inputstr[4] == 1) {
+        size_t* starts = NULL;
+        size_t total = 0, pos = 0, mi;
+        size_t nmembers = zmat_lzip_members(al, inputstr, inputsize, &starts, &total);
+        int fixed = (*outputbuf != NULL), nworker;
+        TZMatLzipMember* members;
+
+        if (nmembers == 1) {
+            zmat_dealloc(al, starts);
+        } else if (nmembers >= 2) {
+            *ret = ELZMA_E_OK;
+
+            /* the members are decoded into slices of one buffer sized from their footers */
+            if (total / ZMAT_LZMA_RATIO > inputsize) {
+                zmat_dealloc(al, starts);
+                *ret = ELZMA_E_CORRUPT_HEADER;
+                return -4;
+            }
+
+            if (fixed && total > capacity) {
+                zmat_dealloc(al, starts);
+                *ret = ELZMA_E_OUTPUT_ERROR;
+                return -4;
+            }
+
+            members = (TZMatLzipMember*)zmat_malloc(al, nmembers * sizeof(TZMatLzipMember));
+
+            if (!members || (!fixed && !(*outputbuf = (unsigned char*)zmat_malloc(al, total ? total : 1)))) {
+                zmat_dealloc(al, members);
+                zmat_dealloc(al, starts);
+                return -5;
+            }
+
+            /* the member footers give the exact total and the data_size of each member */
+            for (mi = 0; mi < nmembers; mi++) {
+                size_t mend = (mi + 1 < nmembers) ? starts[mi + 1] : inputsize;
+
+                members[mi].al = al;
+                members[mi].in = inputstr + starts[mi];
+                members[mi].inlen = mend - starts[mi];
+                members[mi].out = *outputbuf + pos;
+                members[mi].outlen = (size_t)zmat_get_le(inputstr + mend - 16, 8);
+                members[mi].rc = ELZMA_E_OK;
+                pos += members[mi].outlen;
+            }
+
+            nworker = zmat_thread_acquire(nthread);
+            zmat_pool_run(zmat_lzip_decode_member, members, nmembers, nworker);
+            zmat_thread_release(nthread);
+
+            for (mi = 0; mi < nmembers && *ret == ELZMA_E_OK; mi++) {
+                *ret = members[mi].rc;
+            }
+
+            zmat_dealloc(al, members);
+            zmat_dealloc(al, starts);
+
+            if (*ret != ELZMA_E_OK) {
+                if (!fixed) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                }
+
+                return -4;
+            }
+
+            *outputsize = pos;
+            return 0;
+        }
+    }
+
+#endif
+
+    *ret = simpleDecompress(al, format, inputstr, inputsize, outputbuf, outputsize, capacity, NULL);
+
+    if (*ret != ELZMA_E_OK) {
+        *outputsize = 0;
+        return -4;
+    }
+
+    return 0;
+}
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+/**
+ * @brief Read one xz variable-length integer (7 bits per byte, at most 9 bytes)
+ *
+ * @return 0 on success, -1 if the integer is truncated or too long
+ */
+
+static int zmat_xz_varint(const unsigned char** p, const unsigned char* end, unsigned long long* val) {
+    int i;
+
+    *val = 0;
+
+    for (i = 0; i < 9 && *p < end; i++) {
+        unsigned char b = *(*p)++;
+
+        *val |= (unsigned long long)(b & 0x7F) << (7 * i);
+
+        if (!(b & 0x80)) {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Decoded length of xz data, summed from the index of each stream
+ *
+ * Walks backward over concatenated (and optionally zero-padded) streams: the
+ * 12-byte stream footer gives the index size, and the index lists the
+ * unpadded and uncompressed size of every block.
+ *
+ * @param[in] inputstr: xz compressed buffer
+ * @param[in] inputsize: length of the compressed buffer
+ * @return the decoded length, or 0 if the indices can not be parsed or the length is too large
+ */
+
+static size_t zmat_xz_size(const unsigned char* inputstr, size_t inputsize) {
+    static const unsigned char magic[6] = {0xFD, '7', 'z', 'X', 'Z', 0};
+    size_t end = inputsize, total = 0;
+
+    while (end > 0) {
+        const unsigned char* footer, *p;
+        size_t indexsize, blocks = 0;
+        unsigned long long nrec, i;
+
+        /* stream padding is a multiple of four zero bytes */
+        while (end >= 4 && zmat_get_le(inputstr + end - 4, 4) == 0) {
+            end -= 4;
+        }
+
+        if (end < 24) {
+            return 0;
+        }
+
+        footer = inputstr + end - 12;
+        indexsize = ((size_t)zmat_get_le(footer + 4, 4) + 1) * 4;
+
+        if (footer[10] != 'Y' || footer[11] != 'Z' || indexsize > end - 24) {
+            return 0;
+        }
+
+        /* index: indicator, record count, records, padding and CRC32 */
+        p = footer - indexsize;
+
+        if (*p++ != 0 || zmat_xz_varint(&p, footer - 4, &nrec) != 0) {
+            return 0;
+        }
+
+        for (i = 0; i < nrec; i++) {
+            unsigned long long unpadded, usize;
+
+            if (zmat_xz_varint(&p, footer - 4, &unpadded) != 0 || zmat_xz_varint(&p, footer - 4, &usize) != 0 ||
+                    unpadded > end || usize > ZMAT_MAX_ALLOC - total) {
+                return 0;
+            }
+
+            total += (size_t)usize;
+            blocks += ((size_t)unpadded + 3) & ~(size_t)3;
+
+            if (blocks > end) {
+                return 0;
+            }
+        }
+
+        if (blocks + indexsize + 24 > end) {
+            return 0;
+        }
+
+        end -= blocks + indexsize + 24;
+
+        if (memcmp(inputstr + end, magic, sizeof(magic)) != 0) {
+            return 0;
+        }
+    }
+
+    return total;
+}
+
+#endif
+#endif
+
+/**
+ * @brief Length of the elements transposed by one zmat_shuffle_buf() task, in bytes
+ */
+
+#define ZMAT_SHUFFLE_TILE  (1 << 20)
+
+/**
+ * @brief Shuffle filter of the packed flags for a method: 1 byte shuffle, 2 bit shuffle, 0 none
+ *
+ * blosc2 and b2nd shuffle inside their own blocks and base64 is an encoding, so
+ * only the zlib, gzip, lzma, lzip, xz, lz4 and zstd methods are shuffled by zmat.
+ * Indexed streams are not, as zmat_decode_range() reads them by block, and nothing
+ * in them records a shuffle: compressing them with a shuffle fails with -16.
+ */
+
+static int zmat_shuffle_mode(const int zipid, const int iscompress) {
+    union TZMatFlags flags;
+    int method = zipid & ~(ZMAT_FRAME | ZMAT_INDEX | ZMAT_CONTAINER);
+
+    flags.iscompress = iscompress;
+
+    if (zipid < 0 || (zipid & ZMAT_INDEX) || flags.param.shuffle <= 0 || flags.param.typesize <= 1 || method == zmBase64
+            || (method >= zmBlosc2Blosclz && method <= zmBlosc2Zstd) || ZMAT_IS_B2ND(method)) {
+        return 0;
+    }
+
+    return (flags.param.shuffle == 2) ? 2 : 1;
+}
+
+/**
+ * @brief Shuffle or unshuffle len bytes of typesize-byte elements with one call
+ *
+ * @return 0 on success, -999 if the bit shuffle is not built in
+ */
+
+static int zmat_shuffle_block(int typesize, size_t len, const unsigned char* src, unsigned char* dest, int mode, int forward) {
+#ifndef NO_BLOSC2
+    int32_t res;
+
+    if (mode == 2) {
+        res = forward ? blosc2_bitshuffle(typesize, (int32_t)len, src, dest) : blosc2_bitunshuffle(typesize, (int32_t)len, src, dest);
+    } else {
+        res = forward ? blosc2_shuffle(typesize, (int32_t)len, src, dest) : blosc2_unshuffle(typesize, (int32_t)len, src, dest);
+    }
+
+    return (res < 0) ? -999 : 0;
+#else
+    size_t n = len / typesize, i;
+    int j;
+
+    if (mode == 2) {
+        return -999;
+    }
+
+    for (j = 0; j < typesize; j++) {
+        for (i = 0; i < n; i++) {
+            if (forward) {
+                dest[j * n + i] = src[i * typesize + j];
+            } else {
+                dest[i * typesize + j] = src[j * n + i];
+            }
+        }
+    }
+
+    memcpy(dest + n * typesize, src + n * typesize, len - n * typesize);
+    return 0;
+#endif
+}
+
+/**
+ * @brief Tiles of a buffer shuffled in parallel by zmat_shuffle_buf()
+ */
+
+typedef struct TZMatShuffleJob {
+    const TZMatAllocator* al;
+    const unsigned char* src;
+    unsigned char* dest;
+    size_t nelem;        /**< number of elements transposed, a multiple of 8 for the bit shuffle */
+    size_t tile;         /**< elements per task, a multiple of 8 */
+    int typesize;
+    int mode;            /**< 1: byte shuffle, 2: bit shuffle */
+    int forward;         /**< 1: shuffle, 0: unshuffle */
+    int errcode;
+} TZMatShuffleJob;
+
+/**
+ * @brief Transpose the elements of one tile through a scratch buffer
+ *
+ * The tile is shuffled as one block, whose byte (or bit) rows are then copied
+ * to their offset in the rows of the whole buffer, or gathered from them to
+ * unshuffle.
+ */
+
+static void zmat_shuffle_tile(void* arg, size_t i) {
+    TZMatShuffleJob* job = (TZMatShuffleJob*)arg;
+    size_t first = i * job->tile, count = (job->nelem - first < job->tile) ? job->nelem - first : job->tile;
+    size_t nrow = (job->mode == 2) ? 8 * (size_t)job->typesize : (size_t)job->typesize;
+    size_t rowlen = (job->mode == 2) ? count / 8 : count;
+    size_t stride = (job->mode == 2) ? job->nelem / 8 : job->nelem;
+    size_t offset = (job->mode == 2) ? first / 8 : first, r;
+    unsigned char* tmp = (unsigned char*)zmat_malloc(job->al, count * job->typesize);
+    int errcode = 0;
+
+    if (tmp == NULL) {
+        job->errcode = -5;
+        return;
+    }
+
+    if (job->forward) {
+        if ((errcode = zmat_shuffle_block(job->typesize, count * job->typesize, job->src + first * job->typesize, tmp, job->mode, 1)) == 0) {
+            for (r = 0; r < nrow; r++) {
+                memcpy(job->dest + r * stride + offset, tmp + r * rowlen, rowlen);
+            }
+        }
+    } else {
+        for (r = 0; r < nrow; r++) {
+            memcpy(tmp + r * rowlen, job->src + r * stride + offset, rowlen);
+        }
+
+        errcode = zmat_shuffle_block(job->typesize, count * job->typesize, tmp, job->dest + first * job->typesize, job->mode, 0);
+    }
+
+    if (errcode != 0) {
+        job->errcode = errcode;
+    }
+
+    zmat_dealloc(job->al, tmp);
+}
+
+/**
+ * @brief Byte or bit shuffle, or unshuffle, a whole buffer of typesize-byte elements
+ *
+ * Byte j of every element is stored in row j (bit b of byte j in row 8j+b for
+ * the bit shuffle), as the blosc2 filters do within a block; trailing bytes that
+ * do not fill an element, or a group of 8 elements for the bit shuffle, are
+ * copied. Buffers of more than one tile are transposed tile by tile on the pool.
+ *
+ * @param[in] al: allocator of the tile scratch buffers
+ * @param[in] src: input buffer
+ * @param[out] dest: output buffer of len bytes, must not overlap src
+ * @param[in] len: buffer length
+ * @param[in] typesize: element length, 2 to 127
+ * @param[in] mode: 1 for the byte shuffle, 2 for the bit shuffle
+ * @param[in] forward: 1 to shuffle, 0 to unshuffle
+ * @param[in] nthread: planned thread count from zmat_thread_plan()
+ * @return 0 on success, -5 if out of memory, -999 if the bit shuffle is not built in
+ */
+
+static int zmat_shuffle_buf(const TZMatAllocator* al, const unsigned char* src, unsigned char* dest, size_t len,
+                            int typesize, int mode, int forward, int nthread) {
+    TZMatShuffleJob job;
+    size_t ntile, done;
+    int nworker;
+
+    job.nelem = len / typesize;
+    job.nelem -= (mode == 2) ? job.nelem % 8 : 0;
+    job.tile = ((size_t)ZMAT_SHUFFLE_TILE / typesize) & ~(size_t)7;
+    ntile = (job.nelem + job.tile - 1) / job.tile;
+
+    if (ntile <= 1 || (nthread <= 1 && len <= INT32_MAX)) {
+        return zmat_shuffle_block(typesize, len, src, dest, mode, forward);
+    }
+
+    job.al = al;
+    job.src = src;
+    job.dest = dest;
+    job.typesize = typesize;
+    job.mode = mode;
+    job.forward = forward;
+    job.errcode = 0;
+
+    nworker = zmat_thread_acquire(nthread);
+    zmat_pool_run(zmat_shuffle_tile, &job, ntile, nworker);
+    zmat_thread_release(nthread);
+
+    done = job.nelem * typesize;
+    memcpy(dest + done, src + done, len - done);
+    return job.errcode;
+}
+
+/**
+ * @brief zmat_run_with()/zmat_run_ctx() for the methods that zmat shuffles
+ *
+ * Compression shuffles the input into a scratch buffer before the codec reads
+ * it; decompression unshuffles the decoded output into a new buffer.
+ *
+ * @param[in] ctx: zmat_ctx handle, or NULL to run zmat_run_with() on al
+ * @param[in] mode: the shuffle filter from zmat_shuffle_mode()
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+static int zmat_shuffle_run(TZMatCtx* ctx, const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr,
+                            size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress, int mode) {
+    union TZMatFlags flags;
+    unsigned char* tmp;
+    int typesize, nthread, errcode;
+
+    flags.iscompress = iscompress;
+    typesize = flags.param.typesize;
+    nthread = zmat_thread_plan(flags.param.nthread, inputsize);
+    flags.param.shuffle = 0;
+
+    if (flags.param.clevel) {
+        if (!(tmp = (unsigned char*)zmat_malloc(al, inputsize))) {
+            return -5;
+        }
+
+        if ((errcode = zmat_shuffle_buf(al, inputstr, tmp, inputsize, typesize, mode, 1, nthread)) == 0) {
+            errcode = ctx ? zmat_run_ctx(ctx, inputsize, tmp, outputsize, outputbuf, zipid, ret, flags.iscompress)
+                      : zmat_run_with(al, inputsize, tmp, outputsize, outputbuf, zipid, ret, flags.iscompress);
+        }
+
+        zmat_dealloc(al, tmp);
+        return errcode;
+    }
+
+    errcode = ctx ? zmat_run_ctx(ctx, inputsize, inputstr, outputsize, outputbuf, zipid, ret, flags.iscompress)
+              : zmat_run_with(al, inputsize, inputstr, outputsize, outputbuf, zipid, ret, flags.iscompress);
+
+    if (errcode != 0 || *outputsize == 0) {
+        return errcode;
+    }
+
+    tmp = (unsigned char*)zmat_malloc(al, *outputsize);
+    errcode = tmp ? zmat_shuffle_buf(al, *outputbuf, tmp, *outputsize, typesize, mode, 0, nthread) : -5;
+    zmat_dealloc(al, *outputbuf);
+    *outputbuf = NULL;
+
+    if (errcode != 0) {
+        zmat_dealloc(al, tmp);
+        *outputsize = 0;
+        return errcode;
+    }
+
+    *outputbuf = tmp;
+    return 0;
+}
+
+/**
+ * @brief zmat_run_direct() for the methods that zmat shuffles
+ *
+ * The decoded output is copied to a scratch buffer and unshuffled back into
+ * outputbuf, as the transpose can not run in place.
+ */
+
+static int zmat_shuffle_direct(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                               unsigned char* outputbuf, const size_t capacity, const int zipid, int* ret, const int iscompress, int mode) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    union TZMatFlags flags;
+    unsigned char* tmp;
+    int typesize, nthread, errcode;
+
+    flags.iscompress = iscompress;
+    typesize = flags.param.typesize;
+    nthread = zmat_thread_plan(flags.param.nthread, inputsize);
+    flags.param.shuffle = 0;
+
+    if (flags.param.clevel) {
+        /* lzma, lzip and xz are only compressed by zmat_run_with() */
+        if (zipid == zmLzma || zipid == zmLzip || zipid == zmXz) {
+            return 1;
+        }
+
+        if (!(tmp = (unsigned char*)zmat_malloc(al, inputsize))) {
+            return -5;
+        }
+
+        if ((errcode = zmat_shuffle_buf(al, inputstr, tmp, inputsize, typesize, mode, 1, nthread)) == 0) {
+            errcode = zmat_run_direct(ctx, inputsize, tmp, outputsize, outputbuf, capacity, zipid, ret, flags.iscompress);
+        }
+
+        zmat_dealloc(al, tmp);
+        return errcode;
+    }
+
+    errcode = zmat_run_direct(ctx, inputsize, inputstr, outputsize, outputbuf, capacity, zipid, ret, flags.iscompress);
+
+    if (errcode != 0 || *outputsize == 0) {
+        return errcode;
+    }
+
+    if (!(tmp = (unsigned char*)zmat_malloc(al, *outputsize))) {
+        *outputsize = 0;
+        return -5;
+    }
+
+    memcpy(tmp, outputbuf, *outputsize);
+    errcode = zmat_shuffle_buf(al, tmp, outputbuf, *outputsize, typesize, mode, 0, nthread);
+    zmat_dealloc(al, tmp);
+
+    if (errcode != 0) {
+        *outputsize = 0;
+    }
+
+    return errcode;
+}
+
+/**
+ * @brief zmat_run() allocating the output buffer and the codec states from al
+ *
+ * @param[in] al: allocator used for the output buffer and all temporary memory
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+static int zmat_run_with(const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    z_stream zs;
+    TZMatGzipIndex index;
+#ifndef NO_ZSTD
+    TZMatZstdSeek seek;
+#endif
+    union TZMatFlags flags;
+    int clevel, shuffle;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+
+    flags.iscompress = iscompress;
+
+    zmat_zstream_init(&zs, al);
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if ((shuffle = zmat_shuffle_mode(zipid, iscompress)) != 0) {
+        return zmat_shuffle_run(NULL, al, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress, shuffle);
+    }
+
+    if (zmat_dict_uses(inputsize, inputstr, zipid, iscompress)) {
+        return zmat_dict_run(NULL, al, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    clevel = flags.param.clevel;
+    int nthread = zmat_thread_plan(flags.param.nthread, inputsize), nworker = 1;
+
+    if (ZMAT_IS_INDEX(zipid)) {
+        /**
+          * indexed gzip or zstd seekable compression; the stream is decoded as a plain gzip or zstd stream
+          */
+        int res;
+
+        if (!clevel) {
+            return zmat_run_with(al, inputsize, inputstr, outputsize, outputbuf, zipid & ~ZMAT_INDEX, ret, iscompress);
+        }
+
+        if (zmat_shuffle_mode(zipid & ~ZMAT_INDEX, iscompress) != 0) {
+            return -16;
+        }
+
+#ifndef NO_ZSTD
+
+        if ((zipid & ~ZMAT_INDEX) == zmZstd) {
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_zstd_seek_encode(al, inputstr, inputsize, (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel),
+                                        nworker, outputbuf, outputsize, 0, ret);
+            zmat_thread_release(nthread);
+            return res;
+        }
+
+#endif
+
+        if ((zipid & ~ZMAT_INDEX) != zmGzip) {
+            return -999;
+        }
+
+        nworker = zmat_thread_acquire(nthread);
+        res = zmat_deflate_mt(al, inputstr, inputsize, zmGzip, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel),
+                              nworker, outputbuf, outputsize, 0, ret, 1);
+        zmat_thread_release(nthread);
+        return res;
+    }
+
+    if (clevel) {
+        /**
+          * perform compression or encoding
+          */
+        if (zipid == zmBase64) {
+            /**
+              * base64 encoding
+              */
+            *outputbuf = zmat_base64_encode(al, (const unsigned char*)inputstr, inputsize, outputsize, clevel, nthread);
+
+            if (*outputbuf == NULL) {
+                *outputsize = 0;
+                return -5;
+            }
+        } else if ((zipid == zmZlib || zipid == zmGzip) && nthread > 1 && inputsize > ZMAT_DEFLATE_BLOCK) {
+            /**
+              * zlib (.zip) or gzip (.gz) compression in parallel deflate blocks
+              */
+            int res;
+
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_deflate_mt(al, inputstr, inputsize, zipid, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel),
+                                  nworker, outputbuf, outputsize, 0, ret, 0);
+            zmat_thread_release(nthread);
+
+            if (res != 0) {
+                return res;
+            }
+        } else if (zipid == zmZlib || zipid == zmGzip) {
+            /**
+              * zlib (.zip) or gzip (.gz) compression
+              */
+            if (zipid == zmZlib) {
+                if (deflateInit(&zs,  (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel)) != Z_OK) {
+                    return -2;
+                }
+            } else {
+#ifdef NO_ZLIB
+                /* Initialize streaming buffer context (clears all fields) */
+                zmat_zstream_init(&zs, al);
+                zs.next_in  = inputstr;
+                zs.avail_in = inputsize;
+
+                if (deflateInit2(&zs, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel), Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    return -2;
+                }
+
+#else
+
+                if (deflateInit2(&zs, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel), Z_DEFLATED, 15 | 16, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+                    return -2;
+                }
+
+#endif
+            }
+
+#ifdef NO_ZLIB
+
+            if (zipid == zmGzip) {
+
+                /*
+                 * miniz based gzip compression code was adapted based on the following
+                 * https://github.com/atheriel/fluent-bit/blob/8f0002b36601006240d50ea3c86769629d99b1e8/src/flb_gzip.c
+                 */
+                void* out_buf;
+                size_t out_size;
+                unsigned char* pb;
+                const unsigned char gzip_magic_header [] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+
+                /* use deflateBound for safe sizing, plus header + footer */
+                out_size = zmat_deflate_bound(&zs, inputsize) + GZIP_HEADER_SIZE + 8;
+
+                out_buf = (unsigned char*)zmat_malloc(al, out_size);
+
+                if (out_buf == NULL) {
+                    deflateEnd(&zs);
+                    return -5;
+                }
+
+                memcpy(out_buf, gzip_magic_header, GZIP_HEADER_SIZE);
+                pb = (unsigned char*) out_buf + GZIP_HEADER_SIZE;
+
+                *ret = zmat_deflate_all(&zs, inputstr, inputsize, pb, out_size - GZIP_HEADER_SIZE - 8, outputsize);
+
+                if (*ret != Z_STREAM_END) {
+                    deflateEnd(&zs);
+                    zmat_dealloc(al, out_buf);
+                    return -3;
+                }
+
+                if (deflateEnd(&zs) != Z_OK) {
+                    zmat_dealloc(al, out_buf);
+                    return -3;
+                }
+
+                /* Construct the gzip checksum (CRC32 footer) */
+                size_t footer_start = GZIP_HEADER_SIZE + *outputsize;
+                pb = (unsigned char*) out_buf + footer_start;
+
+                mz_ulong crc = mz_crc32(MZ_CRC32_INIT, inputstr, inputsize);
+                *pb++ = crc & 0xFF;
+                *pb++ = (crc >> 8) & 0xFF;
+                *pb++ = (crc >> 16) & 0xFF;
+                *pb++ = (crc >> 24) & 0xFF;
+                *pb++ = inputsize & 0xFF;
+                *pb++ = (inputsize >> 8) & 0xFF;
+                *pb++ = (inputsize >> 16) & 0xFF;
+                *pb++ = (inputsize >> 24) & 0xFF;
+
+                /* update the final output buffer size */
+                *outputsize += GZIP_HEADER_SIZE + 8;
+                *outputbuf = (unsigned char*)out_buf;
+
+                /* shrink to actual size */
+                zmat_shrink_buf(al, outputbuf, *outputsize);
+            } else {
+#endif
+                size_t bound = zmat_deflate_bound(&zs, inputsize);
+                *outputbuf = (unsigned char*)zmat_malloc(al, bound);
+
+                if (*outputbuf == NULL) {
+                    deflateEnd(&zs);
+                    return -5;
+                }
+
+                *ret = zmat_deflate_all(&zs, inputstr, inputsize, *outputbuf, bound, outputsize);
+
+                if (*ret != Z_STREAM_END) {
+                    deflateEnd(&zs);
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -3;
+                }
+
+                deflateEnd(&zs);
+
+                /* shrink to actual size */
+                zmat_shrink_buf(al, outputbuf, *outputsize);
+#ifdef NO_ZLIB
+            }
+
+#endif
+#ifndef NO_LZMA
+        } else if (zipid == zmLzma || zipid == zmLzip) {
+            /**
+              * lzma (.lzma) or lzip (.lzip) compression
+              * for lzip with nthread>1: compress chunks in parallel (Option 3)
+              */
+#ifdef ZMAT_USE_LZMA_SDK
+            if (zipid == zmLzip && nthread > 1) {
+                nworker = zmat_thread_acquire(nthread);
+                *ret = simpleCompressLzipMT(al, (unsigned char*)inputstr, inputsize,
+                                            outputbuf, outputsize, clevel, nthread, nworker);
+                zmat_thread_release(nthread);
+            } else
+#endif
+            {
+                *ret = simpleCompress(al, (elzma_file_format)(zipid - 3), (unsigned char*)inputstr,
+                                      inputsize, outputbuf, outputsize, clevel, nthread);
+            }
+
+            if (*ret != ELZMA_E_OK) {
+                if (*outputbuf) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                }
+
+                *outputsize = 0;
+                return -4;
+            }
+
+#endif
+#if defined(ZMAT_USE_LZMA_SDK) && !defined(NO_LZMA)
+        } else if (zipid == zmXz) {
+            /**
+              * XZ (.xz) compression using LZMA2 with native multi-thread block encoding
+              */
+            nworker = zmat_thread_acquire(nthread);
+            *ret = xzCompress(al, (unsigned char*)inputstr, inputsize, outputbuf, outputsize,
+                              clevel, nthread, nworker);
+            zmat_thread_release(nthread);
+
+            if (*ret != SZ_OK) {
+                if (*outputbuf) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                }
+
+                *outputsize = 0;
+                return -4;
+            }
+
+#endif
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4f || ((zipid == zmLz4 || zipid == zmLz4hc) && inputsize > LZ4_MAX_INPUT_SIZE)) {
+            /**
+              * LZ4 frame (.lz4) compression, the independent blocks are compressed in parallel;
+              * lz4/lz4hc inputs too long for one raw block are written as a frame as well
+              */
+            int res, level = (zipid == zmLz4f) ? ((clevel < -2) ? (-clevel) : 0) : (zipid == zmLz4hc) ? ((clevel > 0) ? 8 : (-clevel)) : 0;
+
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_lz4f_encode(al, inputstr, inputsize, level, nworker, outputbuf, outputsize, 0);
+            zmat_thread_release(nthread);
+
+            if (res != 0) {
+                return res;
+            }
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
+            /**
+              * lz4 or lz4hc compression
+              */
+            *outputsize = LZ4_compressBound(inputsize);
+
+            if (*outputsize == 0) {
+                return -6;
+            }
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, *outputsize))) {
+                *outputsize = 0;
+                return -5;
+            }
+
+            if (zipid == zmLz4) {
+                *outputsize = LZ4_compress_default((const char*)inputstr, (char*)(*outputbuf), inputsize, *outputsize);
+            } else {
+                *outputsize = zmat_lz4hc_compress(al, (const char*)inputstr, (char*)(*outputbuf), inputsize, *outputsize, (clevel > 0) ? 8 : (-clevel));
+            }
+
+            *ret = *outputsize;
+
+            if (*outputsize == 0) {
+                zmat_dealloc(al, *outputbuf);
+                *outputbuf = NULL;
+                return -6;
+            }
+
+            /* shrink to actual size */
+            zmat_shrink_buf(al, outputbuf, *outputsize);
+
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd) {
+            /**
+              * zstd compression — uses MT worker threads when nthread > 1
+              * (ZSTD_MULTITHREAD is compiled into the bundled zstd)
+              */
+            *outputsize = ZSTD_compressBound(inputsize);
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, *outputsize))) {
+                *outputsize = 0;
+                return -5;
+            }
+
+            {
+                ZSTD_CCtx* zctx = ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+                size_t zret;
+
+                if (!zctx) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -5;
+                }
+
+                ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel,
+                                       (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel));
+                /* nbWorkers=0 → single-thread (no overhead); >=1 → MT worker threads */
+                nworker = zmat_thread_acquire(nthread);
+                zmat_zstd_workers(zctx, nthread, nworker);
+
+                /* the length is kept in size_t, an int return would turn a >2 GB frame into an error */
+                zret = ZSTD_compress2(zctx, (char*)(*outputbuf), *outputsize,
+                                      (const char*)inputstr, inputsize);
+                zmat_thread_release(nthread);
+                ZSTD_freeCCtx(zctx);
+                *ret = (int)zret;
+
+                if (ZSTD_isError(zret)) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -9;
+                }
+
+                *outputsize = zret;
+            }
+
+            /* shrink to actual size */
+            zmat_shrink_buf(al, outputbuf, *outputsize);
+
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            /**
+              * blosc2 meta-compressor (support various filters and compression codecs)
+              */
+            unsigned int shuffle = 1, typesize = 4;
+            const char* codecs[] = {"blosclz", "lz4", "lz4hc", "zlib", "zstd"};
+            shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
+            typesize = (flags.param.typesize == 0 || flags.param.typesize == -1) ? 4 : flags.param.typesize;
+
+            /* inputs longer than one chunk are compressed chunk-parallel into a contiguous frame */
+            if (inputsize > ZMAT_BLOSC2_CHUNK) {
+                blosc2_cparams cparams;
+                int compcode = blosc2_compname_to_compcode(codecs[zipid - zmBlosc2Blosclz]);
+
+                if (compcode < 0) {
+                    return -7;
+                }
+
+                zmat_blosc2_cparams(&cparams, compcode, (clevel > 0) ? 5 : (-clevel), shuffle, typesize, 1);
+                return zmat_blosc2_frame_encode(al, inputstr, inputsize, &cparams, (flags.param.nthread == 0) ? zmat_thread_max() : nthread,
+                                                outputbuf, outputsize, ret);
+            }
+
+            *outputsize = inputsize + BLOSC2_MAX_OVERHEAD;
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, *outputsize))) {
+                *outputsize = 0;
+                return -5;
+            }
+
+            /* blosc2 output does not depend on the thread count, auto uses the thread limit */
+            if (zmat_blosc2_chunk_encode(zipid, (clevel > 0) ? 5 : (-clevel), shuffle, typesize, (flags.param.nthread == 0) ? zmat_thread_max() : nthread,
+                                         inputstr, inputsize, *outputbuf, *outputsize, ret) != 0) {
+                zmat_dealloc(al, *outputbuf);
+                *outputbuf = NULL;
+                *outputsize = 0;
+                return -7;
+            }
+
+            if (*ret <= 0) {
+                zmat_dealloc(al, *outputbuf);
+                *outputbuf = NULL;
+                *outputsize = 0;
+                return -8;
+            }
+
+            *outputsize = *ret;
+
+            /* shrink to actual size */
+            zmat_shrink_buf(al, outputbuf, *outputsize);
+
+        } else if (ZMAT_IS_B2ND(zipid)) {
+            /**
+              * b2nd array, zmat_run stores a 1-D array of typesize-byte elements; see zmat_b2nd_write
+              */
+            int typesize = (flags.param.typesize > 0 && inputsize % flags.param.typesize == 0) ? flags.param.typesize : 1;
+            int shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
+            int64_t shape = (int64_t)(inputsize / typesize);
+
+            return zmat_b2nd_encode(al, inputstr, inputsize, 1, &shape, NULL, zipid, (clevel > 0) ? 5 : (-clevel), shuffle, typesize,
+                                    (flags.param.nthread == 0) ? zmat_thread_max() : nthread, outputbuf, outputsize, ret);
+#endif
+        } else {
+            return -999;
+        }
+    } else {
+        /**
+          * perform decompression or decoding
+          */
+        if (zipid == zmBase64) {
+            /**
+              * base64 decoding
+              */
+            *outputbuf = zmat_base64_decode(al, (const unsigned char*)inputstr, inputsize, outputsize, nthread);
+
+            if (*outputbuf == NULL) {
+                *outputsize = 0;
+                return -5;
+            }
+        } else if (zipid == zmGzip && zmat_gzip_index(inputstr, inputsize, &index) == 0) {
+            /**
+              * indexed gzip decompression, the blocks are inflated in parallel
+              */
+            int res;
+
+            nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_inflate_indexed(al, inputstr, &index, 0, index.total, outputbuf, outputsize, 0, nworker, ret);
+            zmat_thread_release(nthread);
+
+            if (res != 0) {
+                return res;
+            }
+        } else if ((zipid == zmZlib || zipid == zmGzip)
+                   && zmat_inflate_mt(al, inputstr, inputsize, zipid, outputbuf, outputsize, 0,
+                                      (flags.param.nthread == 0) ? zmat_thread_max() : nthread, ret) == 0) {
+            /**
+              * zlib or gzip decompression in speculative parallel chunks; streams it
+              * declines are inflated serially below
+              */
+        } else if (zipid == zmZlib || zipid == zmGzip) {
+            /**
+              * zlib (.zip) or gzip (.gz) decompression
+              */
+            if (zipid == zmZlib) {
+                if (inflateInit(&zs) != Z_OK) {
+                    return -2;
+                }
+            } else {
+#ifndef NO_ZLIB
+
+                if (inflateInit2(&zs, 15 | 32) != Z_OK) {
+                    return -2;
+                }
+
+#endif
+            }
+
+#ifdef NO_ZLIB
+
+            if (zipid == zmZlib) {
+#endif
+                size_t outalloc = zmat_inflate_plan(inputsize, inputstr, zipid);
+                *outputbuf = (unsigned char*)zmat_malloc(al, outalloc);
+
+                if (*outputbuf == NULL) {
+                    inflateEnd(&zs);
+                    return -5;
+                }
+
+                int res = zmat_inflate_all(al, &zs, inputstr, inputsize, outputbuf, &outalloc, outputsize, ret);
+
+                if (res != 0) {
+                    inflateEnd(&zs);
+                    *outputsize = 0;
+                    return res;
+                }
+
+                inflateEnd(&zs);
+
+                /* shrink to actual size */
+                zmat_shrink_buf(al, outputbuf, *outputsize);
+
+#ifdef NO_ZLIB
+            } else {
+
+                *ret = miniz_gzip_uncompress(al, inputstr, inputsize, (void**)outputbuf, outputsize);
+
+                if (*ret != 0) {
+                    if (*outputbuf) {
+                        zmat_dealloc(al, *outputbuf);
+                        *outputbuf = NULL;
+                    }
+
+                    *outputsize = 0;
+                    return -10;
+                }
+            }
+
+#endif
+
+#ifndef NO_LZMA
+        } else if (zipid == zmLzma || zipid == zmLzip) {
+            /**
+              * lzma (.lzma) or lzip (.lzip) decompression, the output is sized from
+              * the lzma header or the lzip member footers when they record a length
+              */
+            int res = zmat_lzma_decode(al, (elzma_file_format)(zipid - 3), inputstr, inputsize, outputbuf, outputsize,
+                                       zmat_lzma_size(inputstr, inputsize, zipid), ret,
+                                       (flags.param.nthread == 0) ? zmat_thread_max() : nthread);
+
+            if (res != 0) {
+                *outputbuf = NULL;
+                *outputsize = 0;
+                return res;
+            }
+
+#endif
+#if defined(ZMAT_USE_LZMA_SDK) && !defined(NO_LZMA)
+        } else if (zipid == zmXz) {
+            /**
+              * XZ (.xz) decompression, the output is sized from the xz index
+              */
+            *ret = xzDecompress(al, (unsigned char*)inputstr, inputsize, outputbuf, outputsize,
+                                zmat_xz_size(inputstr, inputsize),
+                                (flags.param.nthread == 0) ? zmat_thread_max() : nthread);
+
+            if (*ret != SZ_OK) {
+                if (*outputbuf) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                }
+
+                *outputsize = 0;
+                return -4;
+            }
+
+#endif
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4f || ((zipid == zmLz4 || zipid == zmLz4hc) && zmat_lz4_isframe(inputstr, inputsize))) {
+            /**
+              * LZ4 frame (.lz4) decompression, the independent blocks are decoded in parallel
+              */
+            int res;
+
+            nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_lz4f_decode(al, inputstr, inputsize, outputbuf, outputsize, 0, nworker, ret);
+            zmat_thread_release(nthread);
+
+            if (res != 0) {
+                return res;
+            }
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
+            /**
+              * lz4 or lz4hc decompression, the output is sized by walking the sequence headers
+              */
+            size_t outalloc = zmat_lz4_size(inputstr, inputsize);
+
+            if (inputsize > INT_MAX || outalloc > INT_MAX) {
+                *outputsize = 0;
+                return -6;
+            }
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, outalloc ? outalloc : ZMAT_MIN_OUTBUF))) {
+                return -5;
+            }
+
+            *ret = LZ4_decompress_safe((const char*)inputstr, (char*)(*outputbuf), (int)inputsize, outalloc ? (int)outalloc : ZMAT_MIN_OUTBUF);
+
+            if (*ret < 0) {
+                zmat_dealloc(al, *outputbuf);
+                *outputbuf = NULL;
+                *outputsize = 0;
+                return -6;
+            }
+
+            *outputsize = *ret;
+
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd && zmat_zstd_seektable(inputstr, inputsize, &seek) == 0) {
+            /**
+              * zstd seekable decompression, the frames are decompressed in parallel
+              */
+            int res;
+
+            nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_zstd_seek_decode(al, inputstr, &seek, 0, seek.total, outputbuf, outputsize, 0, nworker, ret);
+            zmat_thread_release(nthread);
+
+            if (res != 0) {
+                return res;
+            }
+        } else if (zipid == zmZstd) {
+            /**
+              * zstd decompression
+              */
+            {
+                unsigned long long zstd_bound = ZSTD_decompressBound(inputstr, inputsize);
+
+                if (zstd_bound == ZSTD_CONTENTSIZE_ERROR || zstd_bound > ZMAT_MAX_ALLOC) {
+                    *ret = -9;
+                    *outputsize = 0;
+                    return -9;
+                }
+
+                *outputsize = (size_t)zstd_bound;
+            }
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, *outputsize))) {
+                *ret = -5;
+                *outputsize = 0;
+                return -5;
+            }
+
+            {
+                ZSTD_DCtx* zdctx = ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+                size_t zret;
+
+                if (!zdctx) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -5;
+                }
+
+                zret = ZSTD_decompressDCtx(zdctx, (void*)(*outputbuf), *outputsize, (const void*)inputstr, inputsize);
+                ZSTD_freeDCtx(zdctx);
+                *ret = (int)zret;
+
+                if (ZSTD_isError(zret)) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -9;
+                }
+
+                *outputsize = zret;
+            }
+
+            /* shrink to actual size */
+            zmat_shrink_buf(al, outputbuf, *outputsize);
+
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            /**
+              * blosc2 meta-compressor, the output is sized from the chunk headers or the frame
+              */
+            size_t chunktotal = 0, cbytes = 0, blocksize = 0;
+            blosc2_schunk* schunk;
+
+            /* a contiguous frame, its chunks are decoded in parallel */
+            if ((schunk = zmat_blosc2_frame_open(inputstr, inputsize))) {
+                int res = zmat_blosc2_frame_decode(al, schunk, outputbuf, outputsize, 0,
+                                                   (flags.param.nthread == 0) ? zmat_thread_max() : nthread, ret);
+
+                blosc2_schunk_free(schunk);
+                return res;
+            }
+
+            nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+
+            /* zmat_stream_* writes a sequence of chunks, decode them one by one */
+            if (zmat_blosc2_chunks(inputstr, inputsize, &chunktotal) > 1) {
+                if (!(*outputbuf = (unsigned char*)zmat_malloc(al, chunktotal ? chunktotal : 1))) {
+                    return -5;
+                }
+
+                if (zmat_blosc2_decode_chunks(NULL, nthread, inputstr, inputsize, *outputbuf, ret) != 0) {
+                    zmat_dealloc(al, *outputbuf);
+                    *outputbuf = NULL;
+                    *outputsize = 0;
+                    return -8;
+                }
+
+                *outputsize = chunktotal;
+                return 0;
+            }
+
+            /* a single chunk, possibly followed by trailing bytes */
+            if (inputsize < BLOSC_MIN_HEADER_LENGTH) {
+                return -8;
+            }
+
+            blosc1_cbuffer_sizes(inputstr, &chunktotal, &cbytes, &blocksize);
+
+            if (cbytes < BLOSC_MIN_HEADER_LENGTH || cbytes > inputsize || chunktotal > ZMAT_MAX_ALLOC) {
+                return -8;
+            }
+
+            if (!(*outputbuf = (unsigned char*)zmat_malloc(al, chunktotal ? chunktotal : 1))) {
+                return -5;
+            }
+
+            if (zmat_blosc2_decode_chunks(NULL, nthread, inputstr, cbytes, *outputbuf, ret) != 0) {
+                zmat_dealloc(al, *outputbuf);
+                *outputbuf = NULL;
+                *outputsize = 0;
+                return -8;
+            }
+
+            *outputsize = chunktotal;
+
+        } else if (ZMAT_IS_B2ND(zipid)) {
+            /**
+              * b2nd array, the whole array is decompressed in C order
+              */
+            return zmat_b2nd_decode(al, inputstr, inputsize, NULL, NULL, (flags.param.nthread == 0) ? zmat_thread_max() : nthread,
+                                    outputbuf, outputsize, 0, ret);
+#endif
+        } else {
+            return -999;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parsed header, index and footer of a chunked zmat container (ZMAT_CONTAINER)
+ *
+ * Layout: a ZMAT_CONTAINER_HEADER-byte header ("ZMCN", version 1, or 2 if the chunks are shuffled, method,
+ * typesize, shuffle, chunk length and total length as 8-byte little-endian
+ * integers), the compressed chunks, one ZMAT_CONTAINER_ENTRY-byte index entry
+ * per chunk (offset of the compressed chunk in the container and its length,
+ * 8 bytes each, then the crc32 of the decoded chunk) and a 16-byte footer
+ * (offset of the index, 8 bytes, chunk count, 4 bytes, and "NCMZ").
+ */
+
+typedef struct TZMatContainer {
+    int method;                 /**< compression method of the chunks */
+    int typesize;               /**< element length given at compression */
+    int shuffle;                /**< shuffle filter given at compression, reversed in each chunk */
+    size_t chunk;               /**< decoded length of each chunk but the last */
+    size_t total;               /**< decoded length of the container */
+    size_t count;               /**< number of chunks */
+    const unsigned char* index; /**< first index entry */
+} TZMatContainer;
+
+/**
+ * @brief Chunks of a container compressed or decompressed in parallel
+ */
+
+typedef struct TZMatContainerJob {
+    const TZMatAllocator* al;
+    const unsigned char* in;    /**< raw input (compression) or the container (decompression) */
+    size_t inputsize;           /**< raw input length (compression) */
+    const TZMatContainer* info; /**< parsed container (decompression) */
+    size_t chunk;               /**< decoded length of each chunk */
+    size_t first;               /**< first chunk to decode */
+    int zipid;                  /**< method of the chunks */
+    int iscompress;             /**< flags passed to each chunk, nthread forced to 1 when compressing */
+    unsigned char** out;        /**< compressed chunks */
+    size_t* outlen;             /**< compressed lengths */
+    unsigned long* crc;         /**< crc32 of each raw chunk */
+    unsigned char* dest;        /**< decoded chunks (decompression) */
+    int* rc;                    /**< zmat error code of each chunk */
+    int* ret;                   /**< detailed error code of each chunk */
+} TZMatContainerJob;
+
+/**
+ * @brief Read and check the header, footer and index of a container
+ *
+ * @return 0 on success, -14 if the buffer is not a valid container
+ */
+
+static int zmat_container_parse(const unsigned char* inputstr, size_t inputsize, TZMatContainer* info) {
+    const unsigned char* footer;
+    size_t indexpos, i;
+
+    if (inputsize < ZMAT_CONTAINER_HEADER + 16 || memcmp(inputstr, "ZMCN", 4) || inputstr[4] < 1 || inputstr[4] > 2) {
+        return -14;
+    }
+
+    footer = inputstr + inputsize - 16;
+
+    if (memcmp(footer + 12, "NCMZ", 4)) {
+        return -14;
+    }
+
+    info->method = inputstr[5];
+    info->typesize = inputstr[6];
+    info->shuffle = (inputstr[4] == 2) ? inputstr[7] : 0; /* only version 2 chunks are shuffled */
+    info->chunk = (size_t)zmat_get_le(inputstr + 8, 8);
+    info->total = (size_t)zmat_get_le(inputstr + 16, 8);
+    info->count = (size_t)zmat_get_le(footer + 8, 4);
+    indexpos = (size_t)zmat_get_le(footer, 8);
+
+    if (info->chunk == 0 || info->total > ZMAT_MAX_ALLOC || info->count != info->total / info->chunk + (info->total % info->chunk != 0)
+            || indexpos < ZMAT_CONTAINER_HEADER || indexpos > inputsize - 16
+            || (inputsize - 16 - indexpos) / ZMAT_CONTAINER_ENTRY != info->count
+            || (inputsize - 16 - indexpos) % ZMAT_CONTAINER_ENTRY != 0) {
+        return -14;
+    }
+
+    info->index = inputstr + indexpos;
+
+    for (i = 0; i < info->count; i++) {
+        size_t pos = (size_t)zmat_get_le(info->index + i * ZMAT_CONTAINER_ENTRY, 8);
+        size_t len = (size_t)zmat_get_le(info->index + i * ZMAT_CONTAINER_ENTRY + 8, 8);
+
+        if (pos < ZMAT_CONTAINER_HEADER || pos > indexpos || len == 0 || len > indexpos - pos) {
+            return -14;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Compress one chunk of a container and record the crc32 of its input
+ */
+
+static void zmat_container_encode_chunk(void* arg, size_t i) {
+    TZMatContainerJob* job = (TZMatContainerJob*)arg;
+    size_t start = i * job->chunk;
+    size_t blen = (job->inputsize - start < job->chunk) ? job->inputsize - start : job->chunk;
+
+    job->crc[i] = crc32(0, job->in + start, blen);
+    job->rc[i] = zmat_run_with(job->al, blen, (unsigned char*)job->in + start, job->outlen + i, job->out + i,
+                               job->zipid, job->ret + i, job->iscompress);
+}
+
+/**
+ * @brief Split the input into chunks, compress them in parallel and write a container
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: raw input
+ * @param[in] inputsize: raw input length
+ * @param[in] chunksize: decoded length of each chunk, 0 for ZMAT_CONTAINER_CHUNK
+ * @param[out] outputsize: container length
+ * @param[out] outputbuf: the container, free with zmat_free()
+ * @param[in] zipid: method of the chunks, the flag bits are ignored
+ * @param[out] ret: detailed error code of the first chunk that failed
+ * @param[in] iscompress: packed flags as in zmat_run, clevel must not be 0
+ * @return 0 on success, or the zmat error code of the first chunk that failed
+ */
+
+static int zmat_container_encode(const TZMatAllocator* al, const unsigned char* inputstr, size_t inputsize,
+                                 size_t chunksize, size_t* outputsize, unsigned char** outputbuf,
+                                 const int zipid, int* ret, const int iscompress) {
+    union TZMatFlags flags;
+    TZMatContainerJob job;
+    size_t nchunk, total, pos, i;
+    unsigned char* buf;
+    int errcode = 0, nthread, nworker;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+    flags.iscompress = iscompress;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (!flags.param.clevel || zipid < 0 || (zipid & 0xFF) > zmLz4f) {
+        return -999;
+    }
+
+    job.chunk = chunksize ? chunksize : ZMAT_CONTAINER_CHUNK;
+    nchunk = inputsize / job.chunk + (inputsize % job.chunk != 0);
+
+    if (nchunk > 0xFFFFFFFFU) {
+        return -999;
+    }
+
+    job.out = (unsigned char**)zmat_malloc(al, nchunk * (sizeof(unsigned char*) + sizeof(size_t) + sizeof(unsigned long) + 2 * sizeof(int)));
+
+    if (!job.out) {
+        return -5;
+    }
+
+    memset(job.out, 0, nchunk * sizeof(unsigned char*));
+    job.outlen = (size_t*)(job.out + nchunk);
+    job.crc = (unsigned long*)(job.outlen + nchunk);
+    job.rc = (int*)(job.crc + nchunk);
+    job.ret = job.rc + nchunk;
+    job.al = al;
+    job.in = inputstr;
+    job.inputsize = inputsize;
+    job.zipid = zipid & 0xFF;
+
+    /* chunks are compressed one per thread */
+    nthread = zmat_thread_plan(flags.param.nthread, inputsize);
+    flags.param.nthread = 1;
+    job.iscompress = flags.iscompress;
+
+    nworker = zmat_thread_acquire(nthread);
+    zmat_pool_run(zmat_container_encode_chunk, &job, nchunk, nworker);
+    zmat_thread_release(nthread);
+
+    total = ZMAT_CONTAINER_HEADER + nchunk * ZMAT_CONTAINER_ENTRY + 16;
+
+    for (i = 0; i < nchunk; i++) {
+        if (job.rc[i] != 0 && errcode == 0) {
+            errcode = job.rc[i];
+            *ret = job.ret[i];
+        }
+
+        total += job.outlen[i];
+    }
+
+    buf = (errcode == 0) ? (unsigned char*)zmat_malloc(al, total) : NULL;
+
+    if (buf) {
+        memcpy(buf, "ZMCN", 4);
+        buf[4] = zmat_shuffle_mode(job.zipid, flags.iscompress) ? 2 : 1;
+        buf[5] = (unsigned char)job.zipid;
+        buf[6] = (unsigned char)flags.param.typesize;
+        buf[7] = (unsigned char)flags.param.shuffle;
+        zmat_put_le(buf + 8, job.chunk, 8);
+        zmat_put_le(buf + 16, inputsize, 8);
+        pos = ZMAT_CONTAINER_HEADER;
+
+        for (i = 0; i < nchunk; i++) {
+            unsigned char* entry = buf + total - 16 - (nchunk - i) * ZMAT_CONTAINER_ENTRY;
+
+            zmat_put_le(entry, pos, 8);
+            zmat_put_le(entry + 8, job.outlen[i], 8);
+            zmat_put_le(entry + 16, job.crc[i], 4);
+            memcpy(buf + pos, job.out[i], job.outlen[i]);
+            pos += job.outlen[i];
+        }
+
+        zmat_put_le(buf + pos + nchunk * ZMAT_CONTAINER_ENTRY, pos, 8);
+        zmat_put_le(buf + pos + nchunk * ZMAT_CONTAINER_ENTRY + 8, nchunk, 4);
+        memcpy(buf + total - 4, "NCMZ", 4);
+        *outputbuf = buf;
+        *outputsize = total;
+    } else if (errcode == 0) {
+        errcode = -5;
+    }
+
+    for (i = 0; i < nchunk; i++) {
+        zmat_dealloc(al, job.out[i]);
+    }
+
+    zmat_dealloc(al, job.out);
+    return errcode;
+}
+
+/**
+ * @brief Decompress one chunk of a container into its slot and check its length and crc32
+ */
+
+static void zmat_container_decode_chunk(void* arg, size_t i) {
+    TZMatContainerJob* job = (TZMatContainerJob*)arg;
+    const TZMatContainer* info = job->info;
+    const unsigned char* entry = info->index + (job->first + i) * ZMAT_CONTAINER_ENTRY;
+    size_t start = (job->first + i) * info->chunk, outlen = 0;
+    size_t dlen = (info->total - start < info->chunk) ? info->total - start : info->chunk;
+    unsigned char* dest = job->dest + i * info->chunk;
+    union TZMatFlags flags = {0};
+
+    flags.param.shuffle = (char)info->shuffle;
+    flags.param.typesize = (char)info->typesize;
+    job->ret[i] = 0;
+    job->rc[i] = zmat_run_into((size_t)zmat_get_le(entry + 8, 8), (unsigned char*)job->in + (size_t)zmat_get_le(entry, 8),
+                               &outlen, dest, dlen, info->method, job->ret + i, flags.iscompress);
+
+    if (job->rc[i] == -12 || (job->rc[i] == 0 && (outlen != dlen || crc32(0, dest, dlen) != (unsigned long)zmat_get_le(entry + 16, 4)))) {
+        job->rc[i] = -14;
+    }
+}
+
+/**
+ * @brief Decompress the chunks of a container that cover a byte range, in parallel
+ *
+ * @param[in] al: allocator
+ * @param[in] inputstr: the container
+ * @param[in] info: its index, from zmat_container_parse()
+ * @param[in] offset: first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[in,out] outputbuf: if *outputbuf is NULL, receives a new buffer, otherwise the output is written into it
+ * @param[out] outputsize: output length; the required length if -12 is returned
+ * @param[in] capacity: length of *outputbuf if given
+ * @param[in] nworker: number of threads to decode the chunks on
+ * @param[out] ret: detailed error code of the first chunk that failed
+ * @return 0 on success, -5 if out of memory, -12 if *outputbuf is too small, -14 if
+ *         a chunk does not match the index, or the zmat error code of its codec
+ */
+
+static int zmat_container_decode(const TZMatAllocator* al, const unsigned char* inputstr, const TZMatContainer* info,
+                                 size_t offset, size_t length, unsigned char** outputbuf, size_t* outputsize,
+                                 size_t capacity, int nworker, int* ret) {
+    size_t first, last, span, skip, i;
+    int fixed = (*outputbuf != NULL), aligned, errcode = 0;
+    unsigned char* work;
+    TZMatContainerJob job;
+
+    *outputsize = 0;
+    *ret = 0;
+
+    if (offset >= info->total || length == 0) {
+        return 0;
+    }
+
+    length = (length > info->total - offset) ? info->total - offset : length;
+
+    if (fixed && length > capacity) {
+        *outputsize = length;
+        return -12;
+    }
+
+    first = offset / info->chunk;
+    last = (offset + length - 1) / info->chunk;
+    skip = offset - first * info->chunk;
+    span = ((last + 1) * info->chunk < info->total ? (last + 1) * info->chunk : info->total) - first * info->chunk;
+    aligned = (skip == 0 && span == length);
+
+    job.rc = (int*)zmat_malloc(al, (last - first + 1) * 2 * sizeof(int));
+    work = (fixed && aligned) ? *outputbuf : (unsigned char*)zmat_malloc(al, span);
+
+    if (!job.rc || !work) {
+        zmat_dealloc(al, job.rc);
+
+        if (work != *outputbuf) {
+            zmat_dealloc(al, work);
+        }
+
+        return -5;
+    }
+
+    job.ret = job.rc + (last - first + 1);
+    job.al = al;
+    job.in = inputstr;
+    job.info = info;
+    job.first = first;
+    job.dest = work;
+
+    zmat_pool_run(zmat_container_decode_chunk, &job, last - first + 1, nworker);
+
+    for (i = 0; i <= last - first && errcode == 0; i++) {
+        errcode = job.rc[i];
+        *ret = job.ret[i];
+    }
+
+    zmat_dealloc(al, job.rc);
+
+    if (errcode != 0) {
+        if (work != *outputbuf) {
+            zmat_dealloc(al, work);
+        }
+
+        return errcode;
+    }
+
+    if (fixed && !aligned) {
+        memcpy(*outputbuf, work + skip, length);
+        zmat_dealloc(al, work);
+    } else if (!fixed) {
+        if (skip > 0) {
+            memmove(work, work + skip, length);
+        }
+
+        zmat_shrink_buf(al, &work, length);
+        *outputbuf = work;
+    }
+
+    *outputsize = length;
+    return 0;
+}
+
+/**
+ * @brief Write a container with the default chunk length, or decode a whole container
+ */
+
+static int zmat_container_run(const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                              unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    union TZMatFlags flags;
+    TZMatContainer info;
+    int nthread, errcode;
+
+    flags.iscompress = iscompress;
+    *outputbuf = NULL;
+    *outputsize = 0;
+
+    if (flags.param.clevel) {
+        return zmat_container_encode(al, inputstr, inputsize, 0, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (zmat_container_parse(inputstr, inputsize, &info) != 0) {
+        return -14;
+    }
+
+    nthread = (flags.param.nthread == 0) ? zmat_thread_max() : zmat_thread_plan(flags.param.nthread, info.total);
+    errcode = zmat_container_decode(al, inputstr, &info, 0, info.total, outputbuf, outputsize, 0,
+                                    zmat_thread_acquire(nthread), ret);
+    zmat_thread_release(nthread);
+    return errcode;
+}
+
+/**
+ * @brief A dictionary digested once by zmat_dict_init(), read-only while it is set
+ */
+
+struct TZMatDict {
+    TZMatAllocator alloc;           /**< allocator of the handle and its states */
+    unsigned char* data;            /**< copy of the dictionary bytes, referenced by the states */
+    size_t size;                    /**< dictionary length */
+    unsigned int id;                /**< zstd dictionary id, 0 for raw content */
+    int level;                      /**< zstd level cdict is digested for */
+    int hclevel;                    /**< lz4hc level lz4hc is loaded for */
+#ifndef NO_ZSTD
+    ZSTD_CDict* cdict;              /**< digested zstd compression dictionary */
+    ZSTD_DDict* ddict;              /**< digested zstd decompression dictionary */
+#endif
+#ifndef NO_LZ4
+    LZ4_stream_t* lz4;              /**< lz4 state loaded with the last 64 kB, attached to each block */
+    LZ4_streamHC_t* lz4hc;          /**< lz4hc state loaded with the last 64 kB */
+#endif
+};
+
+/**
+ * @brief Length of the dictionary tail a codec with a window of len bytes reads
+ */
+
+static size_t zmat_dict_tail(const TZMatDict* dict, size_t len) {
+    return (dict->size > len) ? len : dict->size;
+}
+
+/**
+ * @brief Train a dictionary from samples with the zstd dictionary builder
+ */
+
+int zmat_dict_train(const size_t count, const size_t* samplesize, unsigned char** samples, const size_t capacity,
+                    size_t* dictsize, unsigned char** dictbuf, int* ret) {
+#ifndef NO_ZSTD
+    size_t total = 0, cap = (capacity == 0) ? ZMAT_DICT_CAPACITY : capacity, len, i;
+    unsigned char* buf, *pos;
+
+    *dictsize = 0;
+    *dictbuf = NULL;
+    *ret = 0;
+
+    for (i = 0; i < count; i++) {
+        total += samplesize[i];
+    }
+
+    if (count == 0 || total == 0) {
+        return -1;
+    }
+
+    if (total > ZMAT_MAX_ALLOC || cap > ZMAT_MAX_ALLOC || count > UINT_MAX) {
+        return -5;
+    }
+
+    if (!(buf = (unsigned char*)zmat_malloc(&zmat_allocator, total))) {
+        return -5;
+    }
+
+    for (i = 0, pos = buf; i < count; i++) {
+        if (samplesize[i]) {
+            memcpy(pos, samples[i], samplesize[i]);
+            pos += samplesize[i];
+        }
+    }
+
+    if (!(*dictbuf = (unsigned char*)zmat_malloc(&zmat_allocator, cap))) {
+        zmat_dealloc(&zmat_allocator, buf);
+        return -5;
+    }
+
+    len = ZDICT_trainFromBuffer(*dictbuf, cap, buf, samplesize, (unsigned)count);
+    zmat_dealloc(&zmat_allocator, buf);
+
+    if (ZDICT_isError(len)) {
+        *ret = (int)len;
+        zmat_dealloc(&zmat_allocator, *dictbuf);
+        *dictbuf = NULL;
+        return -17;
+    }
+
+    zmat_shrink_buf(&zmat_allocator, dictbuf, len);
+    *dictsize = len;
+    return 0;
+#else
+    (void)count;
+    (void)samplesize;
+    (void)samples;
+    (void)capacity;
+    *dictsize = 0;
+    *dictbuf = NULL;
+    *ret = 0;
+    return -999;
+#endif
+}
+
+/**
+ * @brief Copy a dictionary and digest it for zstd and lz4 at the level of the packed flags
+ */
+
+int zmat_dict_init(TZMatDict** dict, const size_t dictsize, const unsigned char* dictbuf, const int iscompress) {
+    const TZMatAllocator* al = &zmat_allocator;
+    union TZMatFlags flags;
+    TZMatDict* d;
+    int clevel;
+
+    *dict = NULL;
+    flags.iscompress = iscompress;
+    clevel = flags.param.clevel;
+
+    if (dictsize == 0 || dictbuf == NULL) {
+        return -1;
+    }
+
+    if (dictsize > ZMAT_MAX_ALLOC || !(d = (TZMatDict*)zmat_malloc(al, sizeof(TZMatDict)))) {
+        return -5;
+    }
+
+    memset(d, 0, sizeof(TZMatDict));
+    d->alloc = *al;
+    d->size = dictsize;
+
+    if (!(d->data = (unsigned char*)zmat_malloc(al, dictsize))) {
+        zmat_dict_free(&d);
+        return -5;
+    }
+
+    memcpy(d->data, dictbuf, dictsize);
+
+#ifndef NO_ZSTD
+    d->level = (clevel >= 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel);
+    d->id = ZSTD_getDictID_fromDict(d->data, dictsize);
+    d->cdict = ZSTD_createCDict_advanced(d->data, dictsize, ZSTD_dlm_byRef, ZSTD_dct_auto,
+                                         ZSTD_getCParams(d->level, ZSTD_CONTENTSIZE_UNKNOWN, dictsize), zmat_zstd_mem(&d->alloc));
+    d->ddict = ZSTD_createDDict_advanced(d->data, dictsize, ZSTD_dlm_byRef, ZSTD_dct_auto, zmat_zstd_mem(&d->alloc));
+
+    if (!d->cdict || !d->ddict) {
+        zmat_dict_free(&d);
+        return -17;
+    }
+
+#endif
+#ifndef NO_LZ4
+    d->hclevel = (clevel >= 0) ? 8 : (-clevel);
+    d->lz4 = (LZ4_stream_t*)zmat_malloc(al, sizeof(LZ4_stream_t));
+    d->lz4hc = (LZ4_streamHC_t*)zmat_malloc(al, sizeof(LZ4_streamHC_t));
+
+    if (!d->lz4 || !d->lz4hc) {
+        zmat_dict_free(&d);
+        return -5;
+    }
+
+    LZ4_initStream(d->lz4, sizeof(LZ4_stream_t));
+    LZ4_loadDict(d->lz4, (const char*)d->data + dictsize - zmat_dict_tail(d, 65536), (int)zmat_dict_tail(d, 65536));
+    LZ4_initStreamHC(d->lz4hc, sizeof(LZ4_streamHC_t));
+    LZ4_resetStreamHC_fast(d->lz4hc, d->hclevel);
+    LZ4_loadDictHC(d->lz4hc, (const char*)d->data + dictsize - zmat_dict_tail(d, 65536), (int)zmat_dict_tail(d, 65536));
+#endif
+
+    (void)clevel;
+    *dict = d;
+    return 0;
+}
+
+/**
+ * @brief Free a dictionary handle from zmat_dict_init()
+ */
+
+void zmat_dict_free(TZMatDict** dict) {
+    TZMatDict* d = *dict;
+
+    if (d == NULL) {
+        return;
+    }
+
+#ifndef NO_ZSTD
+    ZSTD_freeCDict(d->cdict);
+    ZSTD_freeDDict(d->ddict);
+#endif
+#ifndef NO_LZ4
+    zmat_dealloc(&d->alloc, d->lz4);
+    zmat_dealloc(&d->alloc, d->lz4hc);
+#endif
+    zmat_dealloc(&d->alloc, d->data);
+    zmat_dealloc(&d->alloc, d);
+    *dict = NULL;
+}
+
+/**
+ * @brief Set the dictionary of the calling thread, see zmat_dict_uses() for where it applies
+ */
+
+const TZMatDict* zmat_set_dict(const TZMatDict* dict) {
+    const TZMatDict* old = zmat_dict_active;
+
+    zmat_dict_active = dict;
+    return old;
+}
+
+/**
+ * @brief Nonzero if the dictionary of the calling thread codes this input
+ *
+ * Compression uses it for zlib, zstd and lz4/lz4hc blocks (lz4 inputs above
+ * LZ4_MAX_INPUT_SIZE are written as frames without it). Decompression uses it
+ * for zlib streams with the FDICT flag, lz4 blocks, zstd frames that name a
+ * dictionary, and, for a raw content dictionary (id 0), zstd frames without a
+ * seek table: data written without a dictionary decodes the same with one.
+ */
+
+static int zmat_dict_uses(const size_t inputsize, const unsigned char* inputstr, const int zipid, const int iscompress) {
+    const TZMatDict* dict = zmat_dict_active;
+    union TZMatFlags flags;
+
+    flags.iscompress = iscompress;
+
+    if (dict == NULL || inputsize == 0) {
+        return 0;
+    }
+
+    if (zipid == zmZlib) {
+        return flags.param.clevel || (inputsize >= 10 && (inputstr[0] & 0x0F) == Z_DEFLATED
+                                      && ((inputstr[0] << 8) | inputstr[1]) % 31 == 0 && (inputstr[1] & 0x20));
+    }
+
+#ifndef NO_LZ4
+
+    if (zipid == zmLz4 || zipid == zmLz4hc) {
+        return flags.param.clevel ? (inputsize <= LZ4_MAX_INPUT_SIZE) : !zmat_lz4_isframe(inputstr, inputsize);
+    }
+
+#endif
+#ifndef NO_ZSTD
+
+    if (zipid == zmZstd) {
+        TZMatZstdSeek seek;
+
+        return flags.param.clevel || ZSTD_getDictID_fromFrame(inputstr, inputsize) != 0
+               || (dict->id == 0 && zmat_zstd_seektable(inputstr, inputsize, &seek) != 0);
+    }
+
+#endif
+    (void)inputstr;
+    (void)flags;
+    return 0;
+}
+
+#ifdef NO_ZLIB
+
+/**
+ * @brief Give a miniz stream the dictionary tail as history, as miniz has no preset dictionaries
+ *
+ * Compression deflates the tail with a sync flush, decompression inflates it
+ * from a stored block; the output is dropped and the stream continues from it.
+ *
+ * @return Z_OK on success, otherwise a zlib error code
+ */
+
+static int zmat_dict_prime(const TZMatAllocator* al, z_stream* zs, const TZMatDict* dict, const int iscompress) {
+    size_t len = zmat_dict_tail(dict, 32768), cap = iscompress ? zmat_deflate_bound(NULL, len) : len + 5 + len;
+    unsigned char* scratch = (unsigned char*)zmat_malloc(al, cap);
+    int rc;
+
+    if (!scratch) {
+        return Z_MEM_ERROR;
+    }
+
+    if (iscompress) {
+        zs->next_in = dict->data + dict->size - len;
+        zs->avail_in = (unsigned int)len;
+        zs->next_out = scratch;
+        zs->avail_out = (unsigned int)cap;
+        rc = deflate(zs, Z_SYNC_FLUSH);
+    } else {
+        /* a stored block header: not final, LEN and its complement */
+        scratch[0] = 0;
+        zmat_put_le(scratch + 1, len, 2);
+        zmat_put_le(scratch + 3, ~len & 0xFFFF, 2);
+        memcpy(scratch + 5, dict->data + dict->size - len, len);
+        zs->next_in = scratch;
+        zs->avail_in = (unsigned int)(len + 5);
+        zs->next_out = scratch + len + 5;
+        zs->avail_out = (unsigned int)len;
+        rc = inflate(zs, Z_SYNC_FLUSH);
+        rc = (zs->avail_out == 0) ? rc : Z_DATA_ERROR;
+    }
+
+    rc = ((rc == Z_OK || rc == Z_BUF_ERROR) && zs->avail_in == 0) ? Z_OK : Z_BUF_ERROR;
+    zmat_dealloc(al, scratch);
+    return rc;
+}
+
+#endif
+
+#ifdef NO_ZLIB
+
+/**
+ * @brief Big-endian 32bit value of the zlib header and trailer, read here only for miniz
+ */
+
+static unsigned long zmat_dict_be32(const unsigned char* p) {
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | ((unsigned long)p[2] << 8) | p[3];
+}
+
+#endif
+
+/**
+ * @brief Prepare an inflate stream past the zlib header and its dictionary id, and set the dictionary
+ *
+ * zlib reads the header itself; miniz inflates the raw deflate data after it,
+ * see zmat_dict_check() for the trailer.
+ *
+ * @return Z_OK on success, Z_DATA_ERROR if the stream names another dictionary; the
+ *         stream is ended on failure if ctx is NULL
+ */
+
+static int zmat_dict_inflater(TZMatCtx* ctx, z_stream* local, z_stream** zs, const TZMatDict* dict, const unsigned char* inputstr) {
+    size_t len = zmat_dict_tail(dict, 32768);
+    int rc;
+
+#ifdef NO_ZLIB
+
+    if (zmat_dict_be32(inputstr + 2) != adler32(1, dict->data + dict->size - len, len)) {
+        return Z_DATA_ERROR;
+    }
+
+    if ((rc = zmat_ctx_inflater(ctx, local, zs, -15)) != Z_OK) {
+        return rc;
+    }
+
+    rc = zmat_dict_prime(ctx ? &ctx->alloc : &zmat_allocator, *zs, dict, 0);
+#else
+    unsigned char sink;
+
+    if ((rc = zmat_ctx_inflater(ctx, local, zs, 15)) != Z_OK) {
+        return rc;
+    }
+
+    (*zs)->next_in = (Bytef*)inputstr;
+    (*zs)->avail_in = 6;
+    (*zs)->next_out = &sink;
+    (*zs)->avail_out = 0;
+
+    rc = inflate(*zs, Z_NO_FLUSH);
+    rc = (rc == Z_NEED_DICT) ? inflateSetDictionary(*zs, dict->data + dict->size - len, (uInt)len) : Z_DATA_ERROR;
+#endif
+
+    if (rc != Z_OK && ctx == NULL) {
+        inflateEnd(*zs);
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Nonzero if the adler32 trailer after an inflated stream matches its output
+ *
+ * zlib checks the trailer while inflating; the raw miniz stream ends before it.
+ */
+
+static int zmat_dict_check(z_stream* zs, const unsigned char* inputstr, size_t inputsize, const unsigned char* out, size_t outlen) {
+#ifdef NO_ZLIB
+    const unsigned char* trailer = (const unsigned char*)zs->next_in;
+
+    return trailer + 4 <= inputstr + inputsize && zmat_dict_be32(trailer) == adler32(1, out, outlen);
+#else
+    (void)zs;
+    (void)inputstr;
+    (void)inputsize;
+    (void)out;
+    (void)outlen;
+    return 1;
+#endif
+}
+
+/**
+ * @brief zmat_run_direct() with the dictionary of the calling thread, see zmat_dict_uses()
+ *
+ * The data is coded as one zlib stream, zstd frame or lz4 block on one thread.
+ *
+ * @return 0 on success, a zmat error code, or 1 if the output did not fit
+ */
+
+static int zmat_dict_direct(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                            unsigned char* outputbuf, const size_t capacity, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    const TZMatDict* dict = zmat_dict_active;
+    union TZMatFlags flags;
+    int clevel;
+
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+    clevel = flags.param.clevel;
+    (void)al;
+
+    if (zipid == zmZlib) {
+        z_stream local, *zs;
+        size_t len = zmat_dict_tail(dict, 32768);
+        int res = -3;
+
+        if (clevel) {
+            /**
+              * zlib compression with a preset dictionary, recorded by its adler32 in the
+              * header; the zlib wrapper is added manually for miniz
+              */
+            int level = (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel);
+#ifdef NO_ZLIB
+            size_t head = 6, tail = 4;
+            unsigned long adler = adler32(1, dict->data + dict->size - len, len);
+            unsigned char flg = (unsigned char)(((level < 0 || level == 6) ? 2 : (level < 2) ? 0 : (level < 6) ? 1 : 3) << 6 | 0x20);
+
+            *ret = zmat_ctx_deflater(ctx, &local, &zs, level, -15, 8);
+#else
+            size_t head = 0, tail = 0;
+
+            *ret = zmat_ctx_deflater(ctx, &local, &zs, level, 15, 8);
+#endif
+
+            if (*ret != Z_OK) {
+                return -2;
+            }
+
+#ifdef NO_ZLIB
+            *ret = zmat_dict_prime(al, zs, dict, 1);
+#else
+            *ret = deflateSetDictionary(zs, dict->data + dict->size - len, (uInt)len);
+#endif
+
+            if (*ret == Z_OK) {
+                *ret = Z_BUF_ERROR;
+
+                if (capacity > head + tail) {
+                    *ret = zmat_deflate_all(zs, inputstr, inputsize, outputbuf + head, capacity - head - tail, outputsize);
+                }
+
+                res = (*ret == Z_STREAM_END) ? 0 : (*ret == Z_BUF_ERROR) ? 1 : -3;
+            }
+
+            if (ctx == NULL) {
+                deflateEnd(zs);
+            }
+
+#ifdef NO_ZLIB
+
+            if (res == 0) {
+                unsigned char* pb = outputbuf + head + *outputsize;
+                unsigned long sum = adler32(1, inputstr, inputsize);
+                int i;
+
+                outputbuf[0] = 0x78;
+                outputbuf[1] = (unsigned char)(flg + 31 - ((0x78 << 8) | flg) % 31);
+
+                for (i = 0; i < 4; i++) {
+                    outputbuf[2 + i] = (unsigned char)(adler >> (24 - 8 * i));
+                    pb[i] = (unsigned char)(sum >> (24 - 8 * i));
+                }
+
+                *outputsize += head + tail;
+            }
+
+#endif
+        } else {
+            /**
+              * zlib decompression, the dictionary is set once the header asks for it
+              */
+            if ((*ret = zmat_dict_inflater(ctx, &local, &zs, dict, inputstr)) != Z_OK) {
+                return (*ret == Z_DATA_ERROR) ? -3 : -2;
+            }
+
+            zs->next_in = inputstr + 6;
+            zs->avail_in = 0;
+            zs->next_out = (Bytef*)outputbuf;
+            zs->avail_out = 0;
+
+            while (1) {
+                int last = zmat_zstream_feed(zs, inputstr + inputsize, outputbuf + capacity);
+
+                if (zs->avail_out == 0) {
+                    res = 1;
+                    break;
+                }
+
+                *ret = inflate(zs, Z_SYNC_FLUSH);
+
+                if (*ret == Z_STREAM_END) {
+                    *outputsize = (size_t)((unsigned char*)zs->next_out - outputbuf);
+                    res = zmat_dict_check(zs, inputstr, inputsize, outputbuf, *outputsize) ? 0 : -3;
+                    break;
+                }
+
+                if ((*ret != Z_OK && *ret != Z_BUF_ERROR) || (last && zs->avail_in == 0 && zs->avail_out > 0)) {
+                    break;
+                }
+            }
+
+            if (ctx == NULL) {
+                inflateEnd(zs);
+            }
+        }
+
+        if (res != 0) {
+            *outputsize = 0;
+        }
+
+        return res;
+    }
+
+#ifndef NO_ZSTD
+
+    if (zipid == zmZstd) {
+        size_t zret;
+
+        if (clevel) {
+            /**
+              * zstd compression with the digested dictionary, or one digested for this level
+              */
+            int level = (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel);
+            ZSTD_CCtx* zctx = ctx ? ctx->zstdc : ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+
+            if (ctx && !zctx) {
+                zctx = ctx->zstdc = ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+            }
+
+            if (!zctx) {
+                return -5;
+            }
+
+            zret = (level == dict->level) ? ZSTD_compress_usingCDict(zctx, outputbuf, capacity, inputstr, inputsize, dict->cdict)
+                   : ZSTD_compress_usingDict(zctx, outputbuf, capacity, inputstr, inputsize, dict->data, dict->size, level);
+
+            if (ctx == NULL) {
+                ZSTD_freeCCtx(zctx);
+            }
+        } else {
+            ZSTD_DCtx* zdctx = ctx ? ctx->zstdd : ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+
+            if (ctx && !zdctx) {
+                zdctx = ctx->zstdd = ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+            }
+
+            if (!zdctx) {
+                return -5;
+            }
+
+            zret = ZSTD_decompress_usingDDict(zdctx, outputbuf, capacity, inputstr, inputsize, dict->ddict);
+
+            if (ctx == NULL) {
+                ZSTD_freeDCtx(zdctx);
+            }
+        }
+
+        *ret = (int)zret;
+
+        /* a full output and a corrupt frame both go through zmat_dict_run() for the error */
+        if (ZSTD_isError(zret)) {
+            return 1;
+        }
+
+        *outputsize = zret;
+        return 0;
+    }
+
+#endif
+#ifndef NO_LZ4
+
+    if (zipid == zmLz4 || zipid == zmLz4hc) {
+        int cap = (capacity > INT_MAX) ? INT_MAX : (int)capacity;
+        size_t len = zmat_dict_tail(dict, 65536);
+
+        if (!clevel) {
+            *ret = LZ4_decompress_safe_usingDict((const char*)inputstr, (char*)outputbuf, (int)inputsize, cap,
+                                                 (const char*)dict->data + dict->size - len, (int)len);
+        } else if (zipid == zmLz4) {
+            /**
+              * lz4 compression, the working state references the loaded dictionary
+              */
+            LZ4_stream_t* state = ctx ? (LZ4_stream_t*)ctx->lz4state : NULL;
+            int fresh = (state == NULL);
+
+            if (!state && !(state = (LZ4_stream_t*)zmat_malloc(al, sizeof(LZ4_stream_t)))) {
+                return -5;
+            }
+
+            if (fresh) {
+                LZ4_initStream(state, sizeof(LZ4_stream_t));
+            } else {
+                LZ4_resetStream_fast(state);
+            }
+
+            LZ4_attach_dictionary(state, dict->lz4);
+            *ret = LZ4_compress_fast_continue(state, (const char*)inputstr, (char*)outputbuf, (int)inputsize, cap, 1);
+
+            if (ctx) {
+                ctx->lz4state = state;
+            } else {
+                zmat_dealloc(al, state);
+            }
+        } else {
+            /**
+              * lz4hc compression, attaching the loaded dictionary at its level or loading it anew
+              */
+            LZ4_streamHC_t* state = ctx ? (LZ4_streamHC_t*)ctx->lz4hcstate : NULL;
+            int level = (clevel > 0) ? 8 : (-clevel);
+
+            if (!state) {
+                if (!(state = (LZ4_streamHC_t*)zmat_malloc(al, sizeof(LZ4_streamHC_t)))) {
+                    return -5;
+                }
+
+                LZ4_initStreamHC(state, sizeof(LZ4_streamHC_t));
+            }
+
+            LZ4_resetStreamHC_fast(state, level);
+
+            if (level == dict->hclevel) {
+                LZ4_attach_HC_dictionary(state, dict->lz4hc);
+            } else {
+                LZ4_loadDictHC(state, (const char*)dict->data + dict->size - len, (int)len);
+            }
+
+            *ret = LZ4_compress_HC_continue(state, (const char*)inputstr, (char*)outputbuf, (int)inputsize, cap);
+
+            if (ctx) {
+                ctx->lz4hcstate = state;
+            } else {
+                zmat_dealloc(al, state);
+            }
+        }
+
+        if (*ret <= 0) {
+            return 1;
+        }
+
+        *outputsize = (size_t)(*ret);
+        return 0;
+    }
+
+#endif
+    (void)ctx;
+    (void)inputstr;
+    (void)outputbuf;
+    (void)capacity;
+    (void)ret;
+    (void)dict;
+    return -999;
+}
+
+/**
+ * @brief zmat_run_with()/zmat_run_ctx() with the dictionary of the calling thread
+ *
+ * zlib streams are inflated into a growing buffer; the other codecs write into
+ * a buffer of zmat_outputbound() bytes.
+ *
+ * @param[in] ctx: zmat_ctx handle, or NULL to create temporary codec states
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+static int zmat_dict_run(TZMatCtx* ctx, const TZMatAllocator* al, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                         unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    union TZMatFlags flags;
+    size_t bound;
+    int errcode;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if (zipid == zmZlib && !flags.param.clevel) {
+        z_stream local, *zs;
+        size_t outalloc = zmat_inflate_plan(inputsize, inputstr, zipid);
+
+        if ((*ret = zmat_dict_inflater(ctx, &local, &zs, zmat_dict_active, inputstr)) != Z_OK) {
+            return (*ret == Z_DATA_ERROR) ? -3 : -2;
+        }
+
+        if (!(*outputbuf = (unsigned char*)zmat_malloc(al, outalloc))) {
+            errcode = -5;
+        } else {
+            errcode = zmat_inflate_all(al, zs, inputstr + 6, inputsize - 6, outputbuf, &outalloc, outputsize, ret);
+        }
+
+        if (errcode == 0 && !zmat_dict_check(zs, inputstr, inputsize, *outputbuf, *outputsize)) {
+            zmat_dealloc(al, *outputbuf);
+            *outputbuf = NULL;
+            errcode = -3;
+        }
+
+        if (ctx == NULL) {
+            inflateEnd(zs);
+        }
+
+        if (errcode != 0) {
+            *outputsize = 0;
+            return errcode;
+        }
+
+        zmat_shrink_buf(al, outputbuf, *outputsize);
+        return 0;
+    }
+
+    if ((bound = zmat_outputbound_with(al, inputsize, inputstr, zipid, iscompress)) == 0) {
+        return (zipid == zmZlib) ? -5 : (zipid == zmZstd) ? -9 : -6;
+    }
+
+    if (!(*outputbuf = (unsigned char*)zmat_malloc(al, bound))) {
+        return -5;
+    }
+
+    if ((errcode = zmat_dict_direct(ctx, inputsize, inputstr, outputsize, *outputbuf, bound, zipid, ret, iscompress)) != 0) {
+        zmat_dealloc(al, *outputbuf);
+        *outputbuf = NULL;
+        *outputsize = 0;
+        return (errcode != 1) ? errcode : (zipid == zmZlib) ? -3 : (zipid == zmZstd) ? -9 : -6;
+    }
+
+    zmat_shrink_buf(al, outputbuf, *outputsize);
+    return 0;
+}
+
+/**
+ * @brief Main interface to perform compression/decompression
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in, out] outputsize: output stream buffer length
+ * @param[in, out] outputbuf: output stream buffer pointer
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: 0: decompression, 1: use default compression level;
+ *             negative interger: set compression level (-1, less, to -9, more compression)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ *
+ * On error, *outputbuf is guaranteed to be NULL and *outputsize is 0.
+ */
+
+int zmat_run(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    if (ZMAT_IS_BASE64(zipid)) {
+        return zmat_base64_run(NULL, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_CONTAINER(zipid)) {
+        return zmat_container_run(&zmat_allocator, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_FRAME(zipid)) {
+        return zmat_frame_run(NULL, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    return zmat_run_with(&zmat_allocator, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+}
+
+/**
+ * @brief zmat_outputbound() taking the temporary memory of the LZ4 frame scan from al
+ */
+
+static size_t zmat_outputbound_with(const TZMatAllocator* al, const size_t inputsize, const unsigned char* inputstr, const int zipid, const int iscompress) {
+    union TZMatFlags flags;
+    size_t bound = 0;
+
+    flags.iscompress = iscompress;
+
+    if (inputsize == 0 || inputsize > ZMAT_MAX_ALLOC) {
+        return 0;
+    }
+
+    if (ZMAT_IS_BASE64(zipid)) {
+        /* the text and the lead of the codec output encoded in place; base64 text must be decoded first */
+        bound = flags.param.clevel ? zmat_outputbound_with(al, inputsize, inputstr, zipid & ~ZMAT_BASE64, iscompress) : 0;
+        return (bound > 0) ? (bound + 2) / 3 * 4 + ZMAT_BASE64_SLACK : 0;
+    }
+
+    if (ZMAT_IS_CONTAINER(zipid)) {
+        TZMatContainer info;
+        size_t nchunk = (inputsize + ZMAT_CONTAINER_CHUNK - 1) / ZMAT_CONTAINER_CHUNK, last;
+
+        if (!flags.param.clevel) {
+            return (zmat_container_parse(inputstr, inputsize, &info) == 0) ? info.total : 0;
+        }
+
+        /* the bound of each full chunk, the last chunk, the header, index and footer */
+        last = inputsize - (nchunk - 1) * ZMAT_CONTAINER_CHUNK;
+        bound = zmat_outputbound_with(al, last, inputstr, zipid & 0xFF, iscompress);
+
+        if (bound > 0 && nchunk > 1) {
+            size_t full = zmat_outputbound_with(al, ZMAT_CONTAINER_CHUNK, inputstr, zipid & 0xFF, iscompress);
+            bound = (full > 0) ? bound + full * (nchunk - 1) : 0;
+        }
+
+        return (bound > 0) ? bound + ZMAT_CONTAINER_HEADER + nchunk * ZMAT_CONTAINER_ENTRY + 16 : 0;
+    }
+
+    if (ZMAT_IS_INDEX(zipid)) {
+        size_t nblock = (inputsize + ZMAT_INDEX_INTERVAL - 1) / ZMAT_INDEX_INTERVAL;
+
+        if (!flags.param.clevel) {
+            return zmat_outputbound_with(al, inputsize, inputstr, zipid & ~ZMAT_INDEX, iscompress);
+        }
+
+#ifndef NO_ZSTD
+
+        if ((zipid & ~ZMAT_INDEX) == zmZstd) {
+            /* frames of ZMAT_SEEK_FRAME bytes and the seek table */
+            nblock = (inputsize + ZMAT_SEEK_FRAME - 1) / ZMAT_SEEK_FRAME;
+            return nblock * (ZSTD_compressBound(ZMAT_SEEK_FRAME) + 8) + 17;
+        }
+
+#endif
+
+        /* the gzip extra field and the sync flush of each independent block */
+        nblock = (nblock > ZMAT_INDEX_MAX) ? ZMAT_INDEX_MAX : nblock;
+        bound = zmat_outputbound_with(al, inputsize, inputstr, zipid & ~ZMAT_INDEX, iscompress);
+        return (bound > 0) ? bound + 16 + ZMAT_INDEX_FIXED + 20 * nblock : 0;
+    }
+
+    if (ZMAT_IS_FRAME(zipid)) {
+        TZMatFrame frame;
+
+        if (flags.param.clevel) {
+            bound = zmat_outputbound_with(al, inputsize, inputstr, zipid & ~ZMAT_FRAME, iscompress);
+            return (bound > 0) ? bound + ZMAT_FRAME_HEADER : 0;
+        }
+
+        return (zmat_peek(inputsize, inputstr, &frame) == 0 && frame.size <= ZMAT_MAX_ALLOC) ? frame.size : 0;
+    }
+
+    if (flags.param.clevel) {
+        if (zipid == zmBase64) {
+            bound = inputsize * 4 / 3 + 4;
+            bound += bound / 72;
+        } else if (zipid == zmZlib || zipid == zmGzip) {
+            bound = zmat_deflate_bound(NULL, inputsize) + 18; /* 10-byte gzip header and 8-byte trailer */
+            bound += (inputsize / ZMAT_DEFLATE_BLOCK) * 16; /* sync flush of each parallel deflate block */
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
+            bound = (inputsize > LZ4_MAX_INPUT_SIZE) ? zmat_lz4f_bound(inputsize) : (size_t)LZ4_compressBound((int)inputsize);
+        } else if (zipid == zmLz4f) {
+            bound = zmat_lz4f_bound(inputsize);
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd) {
+            bound = ZSTD_compressBound(inputsize);
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            size_t nchunk = inputsize / (ZMAT_BLOSC2_CHUNK / 2) + 1;
+
+            /* a frame adds its header, chunk offsets and trailer; chunks shrink to a typesize multiple */
+            bound = (inputsize > ZMAT_BLOSC2_CHUNK) ? inputsize + nchunk * (BLOSC2_MAX_OVERHEAD + 8) + 4096
+                    : inputsize + BLOSC2_MAX_OVERHEAD;
+#endif
+        }
+    } else {
+        TZMatGzipIndex index;
+#ifndef NO_ZSTD
+        TZMatZstdSeek seek;
+#endif
 
-    if (clevel) {
-        /**
-          * perform compression or encoding
-          */
         if (zipid == zmBase64) {
+            bound = (inputsize / 4 + 1) * 3;
+        } else if (zipid == zmGzip) {
+            bound = (zmat_gzip_index(inputstr, inputsize, &index) == 0 && index.total <= ZMAT_MAX_ALLOC) ? index.total : 0;
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
+            bound = zmat_lz4_isframe(inputstr, inputsize) ? zmat_lz4f_size(al, inputstr, inputsize) : zmat_lz4_size(inputstr, inputsize);
+        } else if (zipid == zmLz4f) {
+            bound = zmat_lz4f_size(al, inputstr, inputsize);
+#endif
+#ifndef NO_LZMA
+        } else if (zipid == zmLzma || zipid == zmLzip) {
+            bound = zmat_lzma_size(inputstr, inputsize, zipid);
+#ifdef ZMAT_USE_LZMA_SDK
+        } else if (zipid == zmXz) {
+            bound = zmat_xz_size(inputstr, inputsize);
+#endif
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd && zmat_zstd_seektable(inputstr, inputsize, &seek) == 0) {
+            bound = seek.total;
+        } else if (zipid == zmZstd) {
+            unsigned long long zstd_bound = ZSTD_decompressBound(inputstr, inputsize);
+
+            if (zstd_bound != ZSTD_CONTENTSIZE_ERROR && zstd_bound <= ZMAT_MAX_ALLOC) {
+                bound = (size_t)zstd_bound;
+            }
+
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            size_t chunktotal = 0;
+            blosc2_schunk* schunk;
+
+            if ((schunk = zmat_blosc2_frame_open(inputstr, inputsize))) {
+                bound = (size_t)schunk->nbytes;
+                blosc2_schunk_free(schunk);
+            } else if (zmat_blosc2_chunks(inputstr, inputsize, &chunktotal) > 0) {
+                bound = chunktotal;
+            }
+
+        } else if (ZMAT_IS_B2ND(zipid)) {
+            b2nd_array_t* array = zmat_b2nd_open(inputstr, inputsize, 1);
+
+            if (array) {
+                bound = (size_t)array->nitems * array->sc->typesize;
+                b2nd_free(array);
+            }
+
+#endif
+        }
+    }
+
+    return bound;
+}
+
+/**
+ * @brief Upper bound of the output length of zmat_run()/zmat_run_into()
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer (only inspected for decompression)
+ * @param[in] zipid: compression method, see TZipMethod
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return the maximum output length, or 0 if it can not be determined without running the codec
+ *
+ * For decompression, the length is read from the stream metadata: zstd frame
+ * headers, blosc2 chunk headers, lzma headers, lzip member footers and the xz
+ * index, LZ4 frame headers, or summed from the lz4 sequence headers. zlib data
+ * records no length.
+ */
+
+size_t zmat_outputbound(const size_t inputsize, const unsigned char* inputstr, const int zipid, const int iscompress) {
+    return zmat_outputbound_with(&zmat_allocator, inputsize, inputstr, zipid, iscompress);
+}
+
+/**
+ * @brief Code directly into a fixed-size output buffer, optionally reusing the codec states in ctx
+ *
+ * Handles zlib, gzip, lz4/lz4hc/lz4f, zstd and blosc2, and the decompression of
+ * lzma, lzip and xz data that records its decoded length; shared by
+ * zmat_run_into() and zmat_run_ctx().
+ *
+ * @param[in] ctx: zmat_ctx handle, or NULL to create temporary codec states
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] outputsize: output length on success; the required length if -12 is returned
+ * @param[out] outputbuf: output buffer
+ * @param[in] capacity: length of outputbuf, must be positive
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return 0 on success, a zmat error code, or 1 if the method is not handled
+ *         here or the output did not fit and the size is unknown
+ */
+
+static int zmat_run_direct(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char* outputbuf, const size_t capacity, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    union TZMatFlags flags;
+    int clevel, shuffle;
+
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if ((shuffle = zmat_shuffle_mode(zipid, iscompress)) != 0) {
+        return zmat_shuffle_direct(ctx, inputsize, inputstr, outputsize, outputbuf, capacity, zipid, ret, iscompress, shuffle);
+    }
+
+    if (zmat_dict_uses(inputsize, inputstr, zipid, iscompress)) {
+        return zmat_dict_direct(ctx, inputsize, inputstr, outputsize, outputbuf, capacity, zipid, ret, iscompress);
+    }
+
+    clevel = flags.param.clevel;
+    int nthread = zmat_thread_plan(flags.param.nthread, inputsize), nworker = 1;
+    TZMatGzipIndex index;
+#ifndef NO_ZSTD
+    TZMatZstdSeek seek;
+#endif
+
+    if (ZMAT_IS_INDEX(zipid)) {
+        /**
+          * indexed gzip or zstd seekable compression; the stream is decoded as a plain gzip or zstd stream
+          */
+        int res;
+
+        if (!clevel) {
+            return zmat_run_direct(ctx, inputsize, inputstr, outputsize, outputbuf, capacity, zipid & ~ZMAT_INDEX, ret, iscompress);
+        }
+
+        if (zmat_shuffle_mode(zipid & ~ZMAT_INDEX, iscompress) != 0) {
+            return -16;
+        }
+
+#ifndef NO_ZSTD
+
+        if ((zipid & ~ZMAT_INDEX) == zmZstd) {
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_zstd_seek_encode(al, inputstr, inputsize, (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel),
+                                        nworker, &outputbuf, outputsize, capacity, ret);
+            zmat_thread_release(nthread);
+            return res;
+        }
+
+#endif
+
+        if ((zipid & ~ZMAT_INDEX) != zmGzip) {
+            return -999;
+        }
+
+        nworker = zmat_thread_acquire(nthread);
+        res = zmat_deflate_mt(al, inputstr, inputsize, zmGzip, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel),
+                              nworker, &outputbuf, outputsize, capacity, ret, 1);
+        zmat_thread_release(nthread);
+        return res;
+    }
+
+    if (!clevel && zipid == zmGzip && zmat_gzip_index(inputstr, inputsize, &index) == 0) {
+        /**
+          * indexed gzip decompression, the blocks are inflated in parallel
+          */
+        int res;
+
+        nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+        nworker = zmat_thread_acquire(nthread);
+        res = zmat_inflate_indexed(al, inputstr, &index, 0, index.total, &outputbuf, outputsize, capacity, nworker, ret);
+        zmat_thread_release(nthread);
+        return res;
+    }
+
+#ifndef NO_ZSTD
+
+    if (!clevel && zipid == zmZstd && zmat_zstd_seektable(inputstr, inputsize, &seek) == 0) {
+        /**
+          * zstd seekable decompression, the frames are decompressed in parallel
+          */
+        int res;
+
+        nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+        nworker = zmat_thread_acquire(nthread);
+        res = zmat_zstd_seek_decode(al, inputstr, &seek, 0, seek.total, &outputbuf, outputsize, capacity, nworker, ret);
+        zmat_thread_release(nthread);
+        return res;
+    }
+
+#endif
+#ifndef NO_LZ4
+
+    if (zipid == zmLz4f || ((zipid == zmLz4 || zipid == zmLz4hc)
+                            && (clevel ? inputsize > LZ4_MAX_INPUT_SIZE : zmat_lz4_isframe(inputstr, inputsize)))) {
+        /**
+          * LZ4 frame (.lz4) compression or decompression, the independent blocks run in parallel;
+          * lz4/lz4hc inputs too long for one raw block use a frame as well
+          */
+        int res, level = (zipid == zmLz4f) ? ((clevel < -2) ? (-clevel) : 0) : (zipid == zmLz4hc) ? ((clevel > 0) ? 8 : (-clevel)) : 0;
+
+        if (!clevel) {
+            nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+        }
+
+        nworker = zmat_thread_acquire(nthread);
+
+        if (clevel) {
+            res = zmat_lz4f_encode(al, inputstr, inputsize, level, nworker, &outputbuf, outputsize, capacity);
+        } else {
+            res = zmat_lz4f_decode(al, inputstr, inputsize, &outputbuf, outputsize, capacity, nworker, ret);
+        }
+
+        zmat_thread_release(nthread);
+        return res;
+    }
+
+#endif
+
+    if (!clevel && (zipid == zmZlib || zipid == zmGzip)) {
+        /**
+          * zlib or gzip decompression in speculative parallel chunks; streams it
+          * declines are inflated serially below
+          */
+        int res = zmat_inflate_mt(al, inputstr, inputsize, zipid, &outputbuf, outputsize, capacity,
+                                  (flags.param.nthread == 0) ? zmat_thread_max() : nthread, ret);
+
+        if (res <= 0) {
+            return res;
+        }
+    }
+
+    if (clevel) {
+        if ((zipid == zmZlib || zipid == zmGzip) && nthread > 1 && inputsize > ZMAT_DEFLATE_BLOCK) {
+            /**
+              * zlib (.zip) or gzip (.gz) compression in parallel deflate blocks
+              */
+            int res;
+
+            nworker = zmat_thread_acquire(nthread);
+            res = zmat_deflate_mt(al, inputstr, inputsize, zipid, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel),
+                                  nworker, &outputbuf, outputsize, capacity, ret, 0);
+            zmat_thread_release(nthread);
+            return res;
+        } else if (zipid == zmZlib || zipid == zmGzip) {
+            /**
+              * zlib (.zip) or gzip (.gz) compression, the gzip wrapper is added manually for miniz
+              */
+            z_stream local, *zs;
+            size_t head = 0, tail = 0;
+            int level = (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel);
+
+            if (zipid == zmZlib) {
+                *ret = zmat_ctx_deflater(ctx, &local, &zs, level, 15, 8);
+            } else {
+#ifdef NO_ZLIB
+                *ret = zmat_ctx_deflater(ctx, &local, &zs, level, -Z_DEFAULT_WINDOW_BITS, 9);
+                head = GZIP_HEADER_SIZE;
+                tail = 8;
+#else
+                *ret = zmat_ctx_deflater(ctx, &local, &zs, level, 15 | 16, MAX_MEM_LEVEL);
+#endif
+            }
+
+            if (*ret != Z_OK) {
+                return -2;
+            }
+
+            *ret = Z_BUF_ERROR;
+            *outputsize = 0;
+
+            if (capacity > head + tail) {
+                *ret = zmat_deflate_all(zs, inputstr, inputsize, outputbuf + head, capacity - head - tail, outputsize);
+            }
+
+            *outputsize += head + tail;
+
+            if (ctx == NULL) {
+                deflateEnd(zs);
+            }
+
+            if (*ret == Z_STREAM_END) {
+#ifdef NO_ZLIB
+
+                if (head) {
+                    const unsigned char gzip_magic_header [] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+                    unsigned long crc = crc32(0, inputstr, inputsize);
+                    unsigned char* pb = outputbuf + *outputsize - tail;
+
+                    memcpy(outputbuf, gzip_magic_header, GZIP_HEADER_SIZE);
+                    *pb++ = crc & 0xFF;
+                    *pb++ = (crc >> 8) & 0xFF;
+                    *pb++ = (crc >> 16) & 0xFF;
+                    *pb++ = (crc >> 24) & 0xFF;
+                    *pb++ = inputsize & 0xFF;
+                    *pb++ = (inputsize >> 8) & 0xFF;
+                    *pb++ = (inputsize >> 16) & 0xFF;
+                    *pb++ = (inputsize >> 24) & 0xFF;
+                }
+
+#endif
+                return 0;
+            }
+
+            *outputsize = 0;
+
+            if (*ret != Z_OK && *ret != Z_BUF_ERROR) {
+                return -3;
+            }
+
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
+            /**
+              * lz4 or lz4hc compression, returns 0 if the output does not fit
+              */
+            int cap = (capacity > INT_MAX) ? INT_MAX : (int)capacity;
+            int level = (clevel > 0) ? 8 : (-clevel);
+
+            if (ctx && zipid == zmLz4 && (ctx->lz4state || (ctx->lz4state = zmat_malloc(al, LZ4_sizeofState())))) {
+                *ret = LZ4_compress_fast_extState(ctx->lz4state, (const char*)inputstr, (char*)outputbuf, inputsize, cap, 1);
+            } else if (ctx && zipid == zmLz4hc && (ctx->lz4hcstate || (ctx->lz4hcstate = zmat_malloc(al, LZ4_sizeofStateHC())))) {
+                *ret = LZ4_compress_HC_extStateHC(ctx->lz4hcstate, (const char*)inputstr, (char*)outputbuf, inputsize, cap, level);
+            } else if (zipid == zmLz4) {
+                *ret = LZ4_compress_default((const char*)inputstr, (char*)outputbuf, inputsize, cap);
+            } else {
+                *ret = zmat_lz4hc_compress(al, (const char*)inputstr, (char*)outputbuf, inputsize, cap, level);
+            }
+
+            if (*ret > 0) {
+                *outputsize = *ret;
+                return 0;
+            }
+
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd) {
+            /**
+              * zstd compression
+              */
+            size_t zret;
+            ZSTD_CCtx* zctx = ctx ? ctx->zstdc : ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+
+            if (ctx && !zctx) {
+                zctx = ctx->zstdc = ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+            }
+
+            if (!zctx) {
+                return -5;
+            }
+
+            ZSTD_CCtx_reset(zctx, ZSTD_reset_session_and_parameters);
+            ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel,
+                                   (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel));
+            nworker = zmat_thread_acquire(nthread);
+            zmat_zstd_workers(zctx, nthread, nworker);
+
+            zret = ZSTD_compress2(zctx, (char*)outputbuf, capacity, (const char*)inputstr, inputsize);
+            zmat_thread_release(nthread);
+
+            if (ctx == NULL) {
+                ZSTD_freeCCtx(zctx);
+            }
+
+            if (!ZSTD_isError(zret)) {
+                *ret = (int)zret;
+                *outputsize = zret;
+                return 0;
+            }
+
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            /**
+              * blosc2 meta-compressor, returns 0 if the output does not fit
+              */
+            unsigned int shuffle = 1, typesize = 4;
+            const char* codecs[] = {"blosclz", "lz4", "lz4hc", "zlib", "zstd"};
+            shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
+            typesize = (flags.param.typesize == 0 || flags.param.typesize == -1) ? 4 : flags.param.typesize;
+
+            /* frames are built by zmat_run and copied */
+            if (inputsize > ZMAT_BLOSC2_CHUNK) {
+                return 1;
+            }
+
+            if (ctx) {
+                int compcode = blosc2_compname_to_compcode(codecs[zipid - zmBlosc2Blosclz]);
+                blosc2_context* cctx;
+
+                if (compcode < 0) {
+                    return -7;
+                }
+
+                if (!(cctx = zmat_ctx_blosc2c(ctx, compcode, (clevel > 0) ? 5 : (-clevel), shuffle, typesize,
+                                              (flags.param.nthread == 0) ? zmat_thread_max() : nthread))) {
+                    return -8;
+                }
+
+                *ret = blosc2_compress_ctx(cctx, inputstr, (int32_t)inputsize, outputbuf, (capacity > INT32_MAX) ? INT32_MAX : (int32_t)capacity);
+            } else if (zmat_blosc2_chunk_encode(zipid, (clevel > 0) ? 5 : (-clevel), shuffle, typesize, nthread,
+                                                inputstr, inputsize, outputbuf, capacity, ret) != 0) {
+                return -7;
+            }
+
+            if (*ret > 0) {
+                *outputsize = *ret;
+                return 0;
+            }
+
+#endif
+        }
+    } else {
+#ifdef NO_ZLIB
+
+        if (zipid == zmZlib) {
+#else
+
+        if (zipid == zmZlib || zipid == zmGzip) {
+#endif
+            /**
+              * zlib (.zip) or gzip (.gz) decompression, the remaining output is
+              * counted with a scratch buffer if outputbuf is too small
+              */
+            z_stream local, *zs;
+            unsigned char* scratch = NULL;
+            size_t counted = 0;
+            int overflow;
+
+            if (zmat_ctx_inflater(ctx, &local, &zs, (zipid == zmZlib) ? 15 : (15 | 32)) != Z_OK) {
+                return -2;
+            }
+
+            zs->next_in = inputstr;
+            zs->avail_in = 0;
+            zs->next_out = (Bytef*)outputbuf;
+            zs->avail_out = 0;
+
+            while (1) {
+                int last;
+
+                /* past capacity, only count the output in the scratch buffer */
+                if (scratch && zs->avail_out == 0) {
+                    counted += ZMAT_STREAM_CHUNK;
+                    zs->avail_out = ZMAT_STREAM_CHUNK;
+                    zs->next_out = (Bytef*)scratch;
+                }
+
+                last = zmat_zstream_feed(zs, inputstr + inputsize, outputbuf + capacity);
+
+                if (zs->avail_out == 0) {
+                    if (!(scratch = (unsigned char*)zmat_malloc(al, ZMAT_STREAM_CHUNK))) {
+                        if (ctx == NULL) {
+                            inflateEnd(zs);
+                        }
+
+                        return -5;
+                    }
+
+                    counted = capacity;
+                    zs->avail_out = ZMAT_STREAM_CHUNK;
+                    zs->next_out = (Bytef*)scratch;
+                }
+
+                *ret = inflate(zs, Z_SYNC_FLUSH);
+
+                if (*ret == Z_STREAM_END) {
+                    break;
+                }
+
+                if ((*ret != Z_OK && *ret != Z_BUF_ERROR) || (last && zs->avail_in == 0 && zs->avail_out > 0)) {
+                    if (ctx == NULL) {
+                        inflateEnd(zs);
+                    }
+
+                    zmat_dealloc(al, scratch);
+                    return -3;
+                }
+            }
+
+            *outputsize = scratch ? counted + (size_t)((unsigned char*)zs->next_out - scratch) : (size_t)((unsigned char*)zs->next_out - outputbuf);
+            overflow = (*outputsize > capacity);
+
+            if (ctx == NULL) {
+                inflateEnd(zs);
+            }
+
+            zmat_dealloc(al, scratch);
+
+            return overflow ? -12 : 0;
+#ifndef NO_LZ4
+        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
             /**
-              * base64 encoding
+              * lz4 or lz4hc decompression, fails if the output does not fit
+              */
+            int cap = (capacity > INT_MAX) ? INT_MAX : (int)capacity;
+
+            *ret = (inputsize > INT_MAX) ? -1 : LZ4_decompress_safe((const char*)inputstr, (char*)outputbuf, (int)inputsize, cap);
+
+            if (*ret >= 0) {
+                *outputsize = *ret;
+                return 0;
+            }
+
+#endif
+#ifndef NO_LZMA
+        } else if (zipid == zmLzma || zipid == zmLzip) {
+            /**
+              * lzma (.lzma) or lzip (.lzip) decompression, if the stream records its decoded length
+              */
+            size_t plan = zmat_lzma_size(inputstr, inputsize, zipid);
+            unsigned char* dest = outputbuf;
+
+            if (plan > 0) {
+                if (plan > capacity) {
+                    *outputsize = plan;
+                    return -12;
+                }
+
+                return zmat_lzma_decode(al, (elzma_file_format)(zipid - 3), inputstr, inputsize, &dest, outputsize, capacity, ret,
+                                        (flags.param.nthread == 0) ? zmat_thread_max() : nthread);
+            }
+
+#ifdef ZMAT_USE_LZMA_SDK
+        } else if (zipid == zmXz) {
+            /**
+              * XZ (.xz) decompression, if the xz index can be read
+              */
+            size_t plan = zmat_xz_size(inputstr, inputsize);
+            unsigned char* dest = outputbuf;
+
+            if (plan > 0) {
+                if (plan > capacity) {
+                    *outputsize = plan;
+                    return -12;
+                }
+
+                if ((*ret = xzDecompress(al, inputstr, inputsize, &dest, outputsize, capacity,
+                                         (flags.param.nthread == 0) ? zmat_thread_max() : nthread)) != SZ_OK) {
+                    *outputsize = 0;
+                    return -4;
+                }
+
+                return 0;
+            }
+
+#endif
+#endif
+#ifndef NO_ZSTD
+        } else if (zipid == zmZstd) {
+            /**
+              * zstd decompression
+              */
+            size_t zret;
+            ZSTD_DCtx* zdctx = ctx ? ctx->zstdd : ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+
+            if (ctx && !zdctx) {
+                zdctx = ctx->zstdd = ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+            }
+
+            if (!zdctx) {
+                return -5;
+            }
+
+            zret = ZSTD_decompressDCtx(zdctx, (void*)outputbuf, capacity, (const void*)inputstr, inputsize);
+
+            if (ctx == NULL) {
+                ZSTD_freeDCtx(zdctx);
+            }
+
+            if (!ZSTD_isError(zret)) {
+                *ret = (int)zret;
+                *outputsize = zret;
+                return 0;
+            }
+
+#endif
+#ifndef NO_BLOSC2
+        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+            /**
+              * blosc2 decompression, the output length is read from the chunk headers or the frame
+              */
+            size_t chunktotal = 0;
+            blosc2_context* dctx = NULL;
+            blosc2_schunk* schunk;
+
+            if ((schunk = zmat_blosc2_frame_open(inputstr, inputsize))) {
+                int res = zmat_blosc2_frame_decode(al, schunk, &outputbuf, outputsize, capacity,
+                                                   (flags.param.nthread == 0) ? zmat_thread_max() : nthread, ret);
+
+                blosc2_schunk_free(schunk);
+                return res;
+            }
+
+            if (zmat_blosc2_chunks(inputstr, inputsize, &chunktotal) > 0) {
+                *outputsize = chunktotal;
+
+                if (chunktotal > capacity) {
+                    return -12;
+                }
+
+                if (ctx && !(dctx = zmat_ctx_blosc2d(ctx, (flags.param.nthread == 0) ? zmat_thread_max() : nthread))) {
+                    *outputsize = 0;
+                    return -8;
+                }
+
+                if (zmat_blosc2_decode_chunks(dctx, (flags.param.nthread == 0) ? zmat_thread_max() : nthread, inputstr, inputsize, outputbuf, ret) != 0) {
+                    *outputsize = 0;
+                    return -8;
+                }
+
+                return 0;
+            }
+
+        } else if (ZMAT_IS_B2ND(zipid)) {
+            /**
+              * b2nd array, the output length is the product of the shape and the typesize
               */
-            *outputbuf = base64_encode((const unsigned char*)inputstr, inputsize, outputsize, clevel);
+            return zmat_b2nd_decode(al, inputstr, inputsize, NULL, NULL, (flags.param.nthread == 0) ? zmat_thread_max() : nthread,
+                                    &outputbuf, outputsize, capacity, ret);
+#endif
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Perform compression/decompression into a caller-owned output buffer
+ *
+ * zlib, gzip, lz4/lz4hc, zstd and blosc2 (and lzma, lzip and xz decompression
+ * when the stream records its decoded length) write directly into outputbuf;
+ * the other methods run zmat_run() and copy the result. A caller that knows
+ * the decoded length, e.g. info.size*info.byte, can pass a buffer of exactly
+ * that length to decode zlib data without growing or copying.
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] outputsize: output length on success; the required length if -12 is returned
+ * @param[out] outputbuf: caller-owned output buffer (may be NULL to query the required length)
+ * @param[in] outputcapacity: length of outputbuf
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: 0: decompression, 1: use default compression level;
+ *             negative interger: set compression level (-1, less, to -9, more compression)
+ * @return return the coarse grained zmat error code; -12 if outputbuf is too small.
+ */
+
+int zmat_run_into(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char* outputbuf, const size_t outputcapacity, const int zipid, int* ret, const int iscompress) {
+    size_t capacity = (outputbuf == NULL) ? 0 : outputcapacity;
+    unsigned char* tmpbuf = NULL;
+    union TZMatFlags flags;
+    int errcode;
+
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (ZMAT_IS_BASE64(zipid) && flags.param.clevel == 0) {
+        unsigned char* buf;
+        size_t len;
+
+        if (!(buf = zmat_base64_decode(&zmat_allocator, inputstr, inputsize, &len, zmat_thread_plan(flags.param.nthread, inputsize)))) {
+            return -5;
+        }
+
+        errcode = zmat_run_into(len, buf, outputsize, outputbuf, outputcapacity, zipid & ~ZMAT_BASE64, ret, iscompress);
+        zmat_dealloc(&zmat_allocator, buf);
+        return errcode;
+    }
+
+    if (ZMAT_IS_BASE64(zipid) && capacity > 0
+            && (errcode = zmat_base64_into(NULL, inputsize, inputstr, outputsize, outputbuf, capacity, zipid & ~ZMAT_BASE64, ret, iscompress)) <= 0) {
+        return errcode;
+    }
+
+    if (ZMAT_IS_FRAME(zipid) && !ZMAT_IS_CONTAINER(zipid) && !ZMAT_IS_BASE64(zipid)) {
+        return zmat_frame_into(inputsize, inputstr, outputsize, outputbuf, capacity, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_CONTAINER(zipid) && flags.param.clevel == 0) {
+        TZMatContainer info;
+        int nthread = (flags.param.nthread == 0) ? zmat_thread_max() : flags.param.nthread;
+
+        *ret = 0;
+
+        if (zmat_container_parse(inputstr, inputsize, &info) != 0) {
+            return -14;
+        }
+
+        if (info.total > capacity) {
+            *outputsize = info.total;
+            return (info.total > 0) ? -12 : 0;
+        }
+
+        errcode = zmat_container_decode(&zmat_allocator, inputstr, &info, 0, info.total, &outputbuf, outputsize, capacity,
+                                        zmat_thread_acquire(nthread), ret);
+        zmat_thread_release(nthread);
+        return errcode;
+    }
+
+    if (capacity > 0 && !ZMAT_IS_CONTAINER(zipid) && !ZMAT_IS_BASE64(zipid) && (errcode = zmat_run_direct(NULL, inputsize, inputstr, outputsize, outputbuf, capacity, zipid, ret, iscompress)) <= 0) {
+        return errcode;
+    }
+
+    /**
+      * all other methods, or the direct attempt above ran out of space: run
+      * zmat_run() to obtain the output (or the detailed error) and copy if it fits
+      */
+    errcode = zmat_run(inputsize, inputstr, outputsize, &tmpbuf, zipid, ret, iscompress);
+
+    if (errcode == 0) {
+        if (*outputsize > capacity) {
+            errcode = -12;
+        } else if (*outputsize > 0) {
+            memcpy(outputbuf, tmpbuf, *outputsize);
+        }
+    }
+
+    zmat_dealloc(&zmat_allocator, tmpbuf);
+    return errcode;
+}
+
+/**
+ * @brief Decode only the bytes [offset, offset + length) of a compressed buffer
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] offset: offset of the first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[out] outputsize: output length, 0 if offset is past the end of the data
+ * @param[out] outputbuf: the decoded bytes (NULL if empty), free with zmat_free()
+ * @param[in] zipid: compression method, see TZipMethod, may carry the ZMAT_FRAME, ZMAT_CONTAINER or ZMAT_BASE64 flag
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_decode_range(const size_t inputsize, unsigned char* inputstr, const size_t offset, const size_t length,
+                      size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret) {
+    const TZMatAllocator* al = &zmat_allocator;
+    int method = (zipid >= 0) ? (zipid & ~(ZMAT_FRAME | ZMAT_INDEX)) : zipid;
+    size_t insize = inputsize, len;
+    unsigned char* in = inputstr;
+    TZMatGzipIndex index;
+#ifndef NO_ZSTD
+    TZMatZstdSeek seek;
+#endif
+    int errcode, shuffled = 0;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (ZMAT_IS_BASE64(zipid)) {
+        unsigned char* buf;
+
+        if (!(buf = zmat_base64_decode(al, inputstr, inputsize, &len, zmat_thread_max()))) {
+            return -5;
+        }
+
+        errcode = zmat_decode_range(len, buf, offset, length, outputsize, outputbuf, zipid & ~ZMAT_BASE64, ret);
+        zmat_dealloc(al, buf);
+        return errcode;
+    }
+
+    if (ZMAT_IS_CONTAINER(zipid)) {
+        return zmat_container_read(inputsize, inputstr, offset, length, outputsize, outputbuf, ret);
+    }
+
+    if (ZMAT_IS_FRAME(zipid)) {
+        TZMatFrame frame;
+
+        if (zmat_peek(inputsize, inputstr, &frame) != 0) {
+            return -14;
+        }
+
+        /* a version 2 payload is shuffled: decode the whole frame, unshuffled, and slice it below */
+        shuffled = (inputstr[4] == 2);
+        method = frame.method;
+        in += frame.headersize;
+        insize -= frame.headersize;
+    }
+
+    if (length == 0 || insize == 0) {
+        return 0;
+    }
+
+    if (!shuffled && method == zmGzip && zmat_gzip_index(in, insize, &index) == 0) {
+        /**
+          * indexed gzip: inflate the blocks covering the range in parallel
+          */
+        int nthread = zmat_thread_max(), nworker = zmat_thread_acquire(nthread);
+
+        errcode = zmat_inflate_indexed(al, in, &index, offset, length, outputbuf, outputsize, 0, nworker, ret);
+        zmat_thread_release(nthread);
+        return errcode;
+    }
+
+#ifndef NO_ZSTD
+
+    if (!shuffled && method == zmZstd && zmat_zstd_seektable(in, insize, &seek) == 0) {
+        /**
+          * zstd seekable: decompress the frames covering the range in parallel
+          */
+        int nthread = zmat_thread_max(), nworker = zmat_thread_acquire(nthread);
+
+        errcode = zmat_zstd_seek_decode(al, in, &seek, offset, length, outputbuf, outputsize, 0, nworker, ret);
+        zmat_thread_release(nthread);
+        return errcode;
+    }
+
+#endif
+
+    if (!shuffled && (method == zmZlib || method == zmGzip)) {
+        return zmat_inflate_range(al, in, insize, method, offset, length, outputbuf, outputsize, ret);
+    }
+
+    /**
+      * other methods and shuffled frames: decode everything and keep the slice
+      */
+    errcode = shuffled ? zmat_frame_run(NULL, inputsize, inputstr, outputsize, outputbuf, zipid & ~ZMAT_INDEX, ret, 0)
+              : zmat_run_with(al, insize, in, outputsize, outputbuf, method, ret, 0);
+
+    if (errcode != 0) {
+        return errcode;
+    }
+
+    len = (offset >= *outputsize) ? 0 : ((length > *outputsize - offset) ? *outputsize - offset : length);
+
+    if (len == 0) {
+        zmat_dealloc(al, *outputbuf);
+        *outputbuf = NULL;
+    } else {
+        memmove(*outputbuf, *outputbuf + offset, len);
+        zmat_shrink_buf(al, outputbuf, len);
+    }
+
+    *outputsize = len;
+    return 0;
+}
+
+/**
+ * @brief Split a buffer into fixed-length chunks and compress them into a zmat container
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] chunksize: decoded length of each chunk, 0 for the default (4 MB)
+ * @param[out] outputsize: container length
+ * @param[out] outputbuf: the container, free with zmat_free()
+ * @param[in] zipid: compression method of the chunks, see TZipMethod
+ * @param[out] ret: encoder specific detailed error code of the first chunk that failed
+ * @param[in] iscompress: packed flags as in zmat_run, must request compression
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_container_write(const size_t inputsize, unsigned char* inputstr, const size_t chunksize, size_t* outputsize,
+                         unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    return zmat_container_encode(&zmat_allocator, inputstr, inputsize, chunksize, outputsize, outputbuf, zipid, ret, iscompress);
+}
+
+/**
+ * @brief Decode the bytes [offset, offset + length) of a zmat container
+ *
+ * Only the chunks overlapping the range are decompressed, in parallel up to
+ * the thread limit, and each is checked against the crc32 in the index.
+ *
+ * @param[in] inputsize: container length
+ * @param[in] inputstr: the container, written by zmat_container_write() or with ZMAT_CONTAINER
+ * @param[in] offset: offset of the first decoded byte to return
+ * @param[in] length: number of decoded bytes to return, clipped at the end of the data
+ * @param[out] outputsize: output length, 0 if offset is past the end of the data
+ * @param[out] outputbuf: the decoded bytes (NULL if empty), free with zmat_free()
+ * @param[out] ret: decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code, -14 if the container or a chunk is invalid.
+ */
+
+int zmat_container_read(const size_t inputsize, unsigned char* inputstr, const size_t offset, const size_t length,
+                        size_t* outputsize, unsigned char** outputbuf, int* ret) {
+    TZMatContainer info;
+    int nthread = zmat_thread_max(), errcode;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (zmat_container_parse(inputstr, inputsize, &info) != 0) {
+        return -14;
+    }
+
+    errcode = zmat_container_decode(&zmat_allocator, inputstr, &info, offset, length, outputbuf, outputsize, 0,
+                                    zmat_thread_acquire(nthread), ret);
+    zmat_thread_release(nthread);
+    return errcode;
+}
+
+/**
+ * @brief Compress an N-dimensional C-order array into a b2nd frame
+ *
+ * The array is cut into chunks of about 4 MB and blocks of about 256 KB along
+ * its longest dimensions, so that zmat_b2nd_slice() only decodes what it needs.
+ *
+ * @param[in] inputsize: input buffer length, must equal prod(shape) * typesize
+ * @param[in] inputstr: input buffer pointer, in C (row-major) order
+ * @param[in] ndim: number of dimensions, 1 to 8
+ * @param[in] shape: length of each dimension, slowest varying first
+ * @param[in] dtype: numpy style dtype string stored with the array (such as "<f4"), or NULL
+ * @param[out] outputsize: frame length
+ * @param[out] outputbuf: the frame, free with zmat_free()
+ * @param[out] ret: encoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run; typesize is inputsize/prod(shape) if not set
+ * @return return the coarse grained zmat error code, -15 if the shape does not match the input.
+ */
+
+int zmat_b2nd_write(const size_t inputsize, unsigned char* inputstr, const int ndim, const size_t* shape,
+                    const char* dtype, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+#ifndef NO_BLOSC2
+    union TZMatFlags flags;
+    int64_t dims[B2ND_MAX_DIM];
+    size_t nelem = 1;
+    int typesize, shuffle, i;
+
+    flags.iscompress = iscompress;
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (!flags.param.clevel || !ZMAT_IS_B2ND(zipid)) {
+        return -999;
+    }
+
+    if (ndim < 1 || ndim > ZMAT_B2ND_MAX_DIM || shape == NULL) {
+        return -15;
+    }
+
+    for (i = 0; i < ndim; i++) {
+        dims[i] = (int64_t)shape[i];
+        nelem *= shape[i];
+    }
+
+    typesize = (flags.param.typesize > 0) ? flags.param.typesize : (nelem ? (int)(inputsize / nelem) : 1);
+    shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
+
+    return zmat_b2nd_encode(&zmat_allocator, inputstr, inputsize, ndim, dims, dtype, zipid,
+                            (flags.param.clevel > 0) ? 5 : (-flags.param.clevel), shuffle, typesize,
+                            (flags.param.nthread == 0) ? zmat_thread_max() : flags.param.nthread, outputbuf, outputsize, ret);
+#else
+    (void)inputsize;
+    (void)inputstr;
+    (void)ndim;
+    (void)shape;
+    (void)dtype;
+    (void)zipid;
+    (void)iscompress;
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+    return -999;
+#endif
+}
+
+/**
+ * @brief Read the shape of a b2nd frame without decoding it
+ *
+ * @param[in] inputsize: frame length
+ * @param[in] inputstr: the frame, written by zmat_b2nd_write() or the b2nd method
+ * @param[out] ndim: number of dimensions
+ * @param[out] shape: length of each dimension, must hold 8 elements
+ * @param[out] typesize: bytes per element
+ * @return return 0 on success, -14 if the frame is not a b2nd array.
+ */
+
+int zmat_b2nd_shape(const size_t inputsize, const unsigned char* inputstr, int* ndim, size_t* shape, int* typesize) {
+#ifndef NO_BLOSC2
+    b2nd_array_t* array;
+    int i;
+
+    *ndim = 0;
+    *typesize = 0;
+
+    if (inputsize == 0 || !(array = zmat_b2nd_open(inputstr, inputsize, 1))) {
+        return -14;
+    }
+
+    *ndim = array->ndim;
+    *typesize = array->sc->typesize;
+
+    for (i = 0; i < array->ndim; i++) {
+        shape[i] = (size_t)array->shape[i];
+    }
+
+    b2nd_free(array);
+    return 0;
+#else
+    (void)inputsize;
+    (void)inputstr;
+    (void)shape;
+    *ndim = 0;
+    *typesize = 0;
+    return -999;
+#endif
+}
+
+/**
+ * @brief Decode the sub-array [start, stop) of a b2nd frame
+ *
+ * Only the chunks, and the blocks inside them, that intersect the slice are
+ * decompressed. The result is returned in C order with shape stop - start.
+ *
+ * @param[in] inputsize: frame length
+ * @param[in] inputstr: the frame, written by zmat_b2nd_write() or the b2nd method
+ * @param[in] start: first index of each dimension, NULL for the whole array
+ * @param[in] stop: one past the last index of each dimension, NULL for the whole array
+ * @param[out] outputsize: output length
+ * @param[out] outputbuf: the decoded slice, free with zmat_free()
+ * @param[out] ret: decoder specific detailed error code (if error occurs)
+ * @param[in] nthread: number of decoding threads, 0 for all cores
+ * @return return the coarse grained zmat error code, -15 if the slice is outside of the array.
+ */
+
+int zmat_b2nd_slice(const size_t inputsize, unsigned char* inputstr, const size_t* start, const size_t* stop,
+                    size_t* outputsize, unsigned char** outputbuf, int* ret, const int nthread) {
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+#ifndef NO_BLOSC2
+    return zmat_b2nd_decode(&zmat_allocator, inputstr, inputsize, start, stop, (nthread > 0) ? nthread : zmat_thread_max(),
+                            outputbuf, outputsize, 0, ret);
+#else
+    (void)inputstr;
+    (void)start;
+    (void)stop;
+    (void)nthread;
+    return -999;
+#endif
+}
+
+/**
+ * @brief Create a context that caches codec states across zmat_run_ctx() calls
+ *
+ * @param[out] ctx: the new context, free it with zmat_ctx_free()
+ * @return 0 on success, -5 if the context can not be allocated
+ */
+
+int zmat_ctx_init(TZMatCtx** ctx) {
+    *ctx = (TZMatCtx*)zmat_malloc(&zmat_allocator, sizeof(TZMatCtx));
+
+    if (*ctx == NULL) {
+        return -5;
+    }
+
+    memset(*ctx, 0, sizeof(TZMatCtx));
+    (*ctx)->alloc = zmat_allocator;
+    (*ctx)->owner = zmat_allocator;
+#if !defined(NO_LZMA) && defined(ZMAT_USE_LZMA_SDK)
+    zmat_sz_init(&(*ctx)->szalloc, &(*ctx)->alloc);
+#endif
+#ifndef NO_BLOSC2
+    zmat_blosc2_init();
+#endif
+    return 0;
+}
+
+/**
+ * @brief Release all codec states cached in a context, keeping the context usable
+ */
+
+static void zmat_ctx_release(TZMatCtx* c) {
+    if (c->deflatebits) {
+        deflateEnd(&c->deflater);
+        c->deflatebits = 0;
+    }
+
+    if (c->inflatebits) {
+        inflateEnd(&c->inflater);
+        c->inflatebits = 0;
+    }
+
+#ifndef NO_LZ4
+    zmat_dealloc(&c->alloc, c->lz4state);
+    zmat_dealloc(&c->alloc, c->lz4hcstate);
+    c->lz4state = c->lz4hcstate = NULL;
+#endif
+#ifndef NO_ZSTD
+    ZSTD_freeCCtx(c->zstdc);
+    ZSTD_freeDCtx(c->zstdd);
+    c->zstdc = NULL;
+    c->zstdd = NULL;
+#endif
+#ifndef NO_BLOSC2
+
+    if (c->bloscc) {
+        blosc2_free_ctx(c->bloscc);
+        c->bloscc = NULL;
+    }
+
+    if (c->bloscd) {
+        blosc2_free_ctx(c->bloscd);
+        c->bloscd = NULL;
+    }
+
+#endif
+#ifndef NO_LZMA
+
+    if (c->lzmaenc) {
+        elzma_compress_free(&c->lzmaenc);
+    }
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+    if (c->xzenc) {
+        XzEnc_Destroy(c->xzenc);
+        c->xzenc = NULL;
+    }
+
+#endif
+#endif
+}
+
+/**
+ * @brief Release a context and all cached codec states
+ *
+ * @param[in,out] ctx: the context to be freed, set to NULL on return
+ */
+
+void zmat_ctx_free(TZMatCtx** ctx) {
+    TZMatAllocator owner;
+
+    if (ctx == NULL || *ctx == NULL) {
+        return;
+    }
+
+    owner = (*ctx)->owner;
+    zmat_ctx_release(*ctx);
+    zmat_dealloc(&owner, *ctx);
+    *ctx = NULL;
+}
+
+/**
+ * @brief Set the allocator used globally or by one context
+ *
+ * Changing the allocator of a context releases its cached codec states, which
+ * are recreated from the new allocator on the next call.
+ *
+ * @param[in] ctx: context created by zmat_ctx_init(), or NULL to set the global allocator
+ * @param[in] allocator: callbacks (copied), or NULL to restore the default (the global allocator for a context)
+ * @return 0 on success, -13 if a callback is missing
+ */
+
+int zmat_set_allocator(TZMatCtx* ctx, const TZMatAllocator* allocator) {
+    TZMatAllocator al = {zmat_std_alloc, zmat_std_realloc, zmat_std_free, NULL};
+
+    if (allocator) {
+        if (allocator->alloc == NULL || allocator->realloc == NULL || allocator->free == NULL) {
+            return -13;
+        }
+
+        al = *allocator;
+    } else if (ctx) {
+        al = zmat_allocator;
+    }
+
+    if (ctx == NULL) {
+        zmat_allocator = al;
+        return 0;
+    }
+
+    zmat_ctx_release(ctx);
+    ctx->alloc = al;
+    return 0;
+}
+
+/**
+ * @brief Perform compression/decompression reusing the codec states cached in ctx
+ *
+ * Same as zmat_run, but the deflate/inflate streams, zstd, lz4hc and blosc2
+ * contexts and the lzma/lzip/xz encoders are created once per context instead
+ * of once per call. Methods without reusable state run zmat_run().
+ *
+ * @param[in] ctx: context created by zmat_ctx_init(), or NULL to behave like zmat_run
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] outputsize: output stream buffer length
+ * @param[out] outputbuf: output stream buffer pointer, free with zmat_free()
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_run_ctx(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al;
+    union TZMatFlags flags;
+    size_t bound;
+    int clevel, errcode, shuffle;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if (ctx == NULL || inputsize == 0) {
+        return zmat_run(inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_BASE64(zipid)) {
+        return zmat_base64_run(ctx, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_CONTAINER(zipid)) {
+        return zmat_container_run(&ctx->alloc, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if (ZMAT_IS_FRAME(zipid)) {
+        return zmat_frame_run(ctx, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    if ((shuffle = zmat_shuffle_mode(zipid, iscompress)) != 0) {
+        return zmat_shuffle_run(ctx, &ctx->alloc, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress, shuffle);
+    }
+
+    if (zmat_dict_uses(inputsize, inputstr, zipid, iscompress)) {
+        return zmat_dict_run(ctx, &ctx->alloc, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+    }
+
+    al = &ctx->alloc;
+    clevel = flags.param.clevel;
+    int nthread = zmat_thread_plan(flags.param.nthread, inputsize);
+
+#ifndef NO_LZMA
+
+    /* lzip with nthread > 1 is compressed in parallel chunks by zmat_run */
+#ifdef ZMAT_USE_LZMA_SDK
+    if (clevel && (zipid == zmLzma || (zipid == zmLzip && nthread <= 1))) {
+#else
+    if (clevel && (zipid == zmLzma || zipid == zmLzip)) {
+#endif
+
+        if (ctx->lzmaenc == NULL) {
+            if ((ctx->lzmaenc = elzma_compress_alloc()) == NULL) {
+                return -5;
+            }
+
+            elzma_compress_set_allocation_callbacks(ctx->lzmaenc, zmat_elzma_alloc, (void*)al, zmat_elzma_free, (void*)al);
+        }
+
+        *ret = simpleCompressHandle(al, ctx->lzmaenc, (elzma_file_format)(zipid - 3), (unsigned char*)inputstr,
+                                    inputsize, outputbuf, outputsize, clevel, nthread);
+
+        if (*ret != ELZMA_E_OK) {
+            *outputbuf = NULL;
+            *outputsize = 0;
+            return -4;
+        }
+
+        return 0;
+    }
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+    if (clevel && zipid == zmXz) {
+        if (ctx->xzenc == NULL && (ctx->xzenc = XzEnc_Create(&ctx->szalloc.vt, &ctx->szalloc.vt)) == NULL) {
+            return -5;
+        }
+
+        int nworker = zmat_thread_acquire(nthread);
+        *ret = xzCompressHandle(al, ctx->xzenc, (unsigned char*)inputstr, inputsize, outputbuf, outputsize,
+                                clevel, nthread, nworker);
+        zmat_thread_release(nthread);
+
+        if (*ret != SZ_OK) {
+            *outputbuf = NULL;
+            *outputsize = 0;
+            return -4;
+        }
+
+        return 0;
+    }
+
+#endif
+#endif
+
+    /**
+      * zlib/gzip decompression has no size bound: grow the output with the cached inflate stream
+      */
+#ifdef NO_ZLIB
+    if (!clevel && zipid == zmZlib) {
+#else
+    if (!clevel && (zipid == zmZlib || zipid == zmGzip)) {
+#endif
+        size_t outalloc = zmat_inflate_plan(inputsize, inputstr, zipid);
+        z_stream local, *zs;
+
+        if (zmat_inflate_mt(al, inputstr, inputsize, zipid, outputbuf, outputsize, 0,
+                            (flags.param.nthread == 0) ? zmat_thread_max() : nthread, ret) == 0) {
+            return 0;
+        }
+
+        if (zmat_ctx_inflater(ctx, &local, &zs, (zipid == zmZlib) ? 15 : (15 | 32)) != Z_OK) {
+            return -2;
+        }
+
+        if (!(*outputbuf = (unsigned char*)zmat_malloc(al, outalloc))) {
+            return -5;
+        }
+
+        if ((errcode = zmat_inflate_all(al, zs, inputstr, inputsize, outputbuf, &outalloc, outputsize, ret)) != 0) {
+            return errcode;
+        }
+
+        zmat_shrink_buf(al, outputbuf, *outputsize);
+        return 0;
+    }
+
+    /**
+      * codecs with a known output bound write straight into a right-sized buffer
+      */
+    bound = (zipid == zmBase64) ? 0 : zmat_outputbound_with(al, inputsize, inputstr, zipid, iscompress);
+
+    if (bound > 0) {
+        if (!(*outputbuf = (unsigned char*)zmat_malloc(al, bound))) {
+            return -5;
+        }
+
+        errcode = zmat_run_direct(ctx, inputsize, inputstr, outputsize, *outputbuf, bound, zipid, ret, iscompress);
+
+        if (errcode == 0) {
+            zmat_shrink_buf(al, outputbuf, *outputsize);
+            return 0;
+        }
+
+        zmat_dealloc(al, *outputbuf);
+        *outputbuf = NULL;
+        *outputsize = 0;
+
+        if (errcode < 0 && errcode != -12) {
+            return errcode;
+        }
+    }
+
+    return zmat_run_with(al, inputsize, inputstr, outputsize, outputbuf, zipid, ret, iscompress);
+}
+
+/**
+ * @brief Write a zmat frame header, see ZMAT_FRAME_HEADER for the layout
+ *
+ * @param[out] header: buffer of at least ZMAT_FRAME_HEADER bytes
+ * @param[in] method: compression method of the payload
+ * @param[in] size: uncompressed length
+ * @param[in] iscompress: packed flags, typesize and shuffle are recorded
+ */
+
+static void zmat_frame_write(unsigned char* header, int method, size_t size, const int iscompress) {
+    union TZMatFlags flags;
+
+    flags.iscompress = iscompress;
+
+    memcpy(header, "ZMAT", 4);
+    header[4] = zmat_shuffle_mode(method, iscompress) ? 2 : 1;
+    header[5] = (unsigned char)method;
+    header[6] = (flags.param.typesize > 0) ? (unsigned char)flags.param.typesize : 0;
+    header[7] = (flags.param.shuffle > 0) ? (unsigned char)flags.param.shuffle : 0;
+    zmat_put_le(header + 8, size, 8);
+}
+
+/**
+ * @brief Read the zmat frame header of a buffer without decoding the payload
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[out] frame: method, uncompressed length, typesize and shuffle recorded in the header
+ * @return 0 on success, -14 if the buffer does not start with a valid zmat frame
+ */
+
+int zmat_peek(const size_t inputsize, const unsigned char* inputstr, TZMatFrame* frame) {
+    unsigned long long size;
+
+    memset(frame, 0, sizeof(TZMatFrame));
+
+    if (inputstr == NULL || inputsize < ZMAT_FRAME_HEADER || memcmp(inputstr, "ZMAT", 4) != 0
+            || inputstr[4] < 1 || inputstr[4] > 2 || inputstr[5] > zmBlosc2Ndlz) {
+        return -14;
+    }
+
+    size = zmat_get_le(inputstr + 8, 8);
+
+    if (size == 0 || (unsigned long long)(size_t)size != size) {
+        return -14;
+    }
+
+    frame->method = inputstr[5];
+    frame->typesize = inputstr[6];
+    frame->shuffle = inputstr[7];
+    frame->size = (size_t)size;
+    frame->headersize = ZMAT_FRAME_HEADER;
+    return 0;
+}
+
+/**
+ * @brief zmat_run/zmat_run_ctx for a zipid carrying ZMAT_FRAME
+ *
+ * Compression writes the codec output after the header, in place when the
+ * output can be bounded; decompression allocates the recorded length once
+ * and fails with -14 if the payload decodes to a different length.
+ */
+
+static int zmat_frame_run(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                          unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    union TZMatFlags flags;
+    TZMatFrame frame;
+    unsigned char* buf;
+    int errcode;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (flags.param.clevel) {
+        int method = zipid & ~ZMAT_FRAME;
+        size_t bound = (method == zmBase64) ? 0 : zmat_outputbound_with(al, inputsize, inputstr, method, iscompress);
+
+        if (bound > 0) {
+            if (!(buf = (unsigned char*)zmat_malloc(al, bound + ZMAT_FRAME_HEADER))) {
+                return -5;
+            }
+
+            errcode = zmat_run_direct(ctx, inputsize, inputstr, outputsize, buf + ZMAT_FRAME_HEADER, bound, method, ret, iscompress);
+
+            if (errcode == 0) {
+                *outputsize += ZMAT_FRAME_HEADER;
+                zmat_shrink_buf(al, &buf, *outputsize);
+                zmat_frame_write(buf, method, inputsize, iscompress);
+                *outputbuf = buf;
+                return 0;
+            }
+
+            zmat_dealloc(al, buf);
+            *outputsize = 0;
+
+            if (errcode < 0 && errcode != -12) {
+                return errcode;
+            }
+        }
+
+        /**
+          * the output length is unknown: run the codec and shift its output behind the header
+          */
+        errcode = ctx ? zmat_run_ctx(ctx, inputsize, inputstr, outputsize, outputbuf, method, ret, iscompress)
+                  : zmat_run_with(al, inputsize, inputstr, outputsize, outputbuf, method, ret, iscompress);
+
+        if (errcode != 0) {
+            return errcode;
+        }
+
+        if (!(buf = (unsigned char*)zmat_realloc(al, *outputbuf, *outputsize + ZMAT_FRAME_HEADER))) {
+            zmat_dealloc(al, *outputbuf);
+            *outputbuf = NULL;
+            *outputsize = 0;
+            return -5;
+        }
+
+        memmove(buf + ZMAT_FRAME_HEADER, buf, *outputsize);
+        zmat_frame_write(buf, method, inputsize, iscompress);
+        *outputbuf = buf;
+        *outputsize += ZMAT_FRAME_HEADER;
+        return 0;
+    }
+
+    if (zmat_peek(inputsize, inputstr, &frame) != 0 || inputsize <= frame.headersize) {
+        return -14;
+    }
+
+    if (frame.size > ZMAT_MAX_ALLOC || !(buf = (unsigned char*)zmat_malloc(al, frame.size))) {
+        return -5;
+    }
+
+    /* version 2 frames hold a payload zmat shuffled, undone as recorded in the header */
+    if (inputstr[4] == 2) {
+        flags.param.shuffle = (char)frame.shuffle;
+        flags.param.typesize = (char)frame.typesize;
+    }
+
+    errcode = zmat_run_direct(ctx, inputsize - frame.headersize, inputstr + frame.headersize, outputsize,
+                              buf, frame.size, frame.method, ret, flags.iscompress);
+
+    if (errcode == 1) {
+        /**
+          * no direct decoder for this method (e.g. base64), decode and check the length
+          */
+        zmat_dealloc(al, buf);
+        errcode = ctx ? zmat_run_ctx(ctx, inputsize - frame.headersize, inputstr + frame.headersize, outputsize, outputbuf, frame.method, ret, flags.iscompress)
+                  : zmat_run_with(al, inputsize - frame.headersize, inputstr + frame.headersize, outputsize, outputbuf, frame.method, ret, flags.iscompress);
+
+        if (errcode == 0 && *outputsize != frame.size) {
+            zmat_dealloc(al, *outputbuf);
+            *outputbuf = NULL;
+            *outputsize = 0;
+            return -14;
+        }
+
+        return errcode;
+    }
+
+    if (errcode == 0 && *outputsize == frame.size) {
+        *outputbuf = buf;
+        return 0;
+    }
+
+    zmat_dealloc(al, buf);
+    *outputsize = 0;
+    return (errcode == 0 || errcode == -12) ? -14 : errcode;
+}
+
+/**
+ * @brief zmat_run_into for a zipid carrying ZMAT_FRAME
+ *
+ * The payload is written behind the header in outputbuf; -12 reports the
+ * framed length when compressing, and the recorded length when decompressing.
+ */
+
+static int zmat_frame_into(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char* outputbuf,
+                           const size_t capacity, const int zipid, int* ret, const int iscompress) {
+    union TZMatFlags flags;
+    TZMatFrame frame;
+    int errcode;
+
+    *outputsize = 0;
+    flags.iscompress = iscompress;
+
+    if (flags.param.clevel) {
+        int method = zipid & ~ZMAT_FRAME;
+        int hasroom = (capacity > ZMAT_FRAME_HEADER);
+
+        errcode = zmat_run_into(inputsize, inputstr, outputsize, hasroom ? outputbuf + ZMAT_FRAME_HEADER : NULL,
+                                hasroom ? capacity - ZMAT_FRAME_HEADER : 0, method, ret, iscompress);
+
+        if (errcode == 0 || errcode == -12) {
+            *outputsize += ZMAT_FRAME_HEADER;
+        }
+
+        if (errcode == 0) {
+            zmat_frame_write(outputbuf, method, inputsize, iscompress);
+        }
+
+        return errcode;
+    }
+
+    if (zmat_peek(inputsize, inputstr, &frame) != 0 || inputsize <= frame.headersize) {
+        return -14;
+    }
+
+    if (frame.size > capacity) {
+        *outputsize = frame.size;
+        return -12;
+    }
+
+    /* version 2 frames hold a payload zmat shuffled, undone as recorded in the header */
+    if (inputstr[4] == 2) {
+        flags.param.shuffle = (char)frame.shuffle;
+        flags.param.typesize = (char)frame.typesize;
+    }
+
+    errcode = zmat_run_into(inputsize - frame.headersize, inputstr + frame.headersize, outputsize, outputbuf,
+                            frame.size, frame.method, ret, flags.iscompress);
+
+    if (errcode == -12 || (errcode == 0 && *outputsize != frame.size)) {
+        *outputsize = 0;
+        return -14;
+    }
+
+    return errcode;
+}
+
+/**
+ * @brief Input length and index of one zmat_run_batch() item, sorted largest first
+ */
+
+typedef struct TZMatBatchOrder {
+    size_t size;
+    size_t index;
+} TZMatBatchOrder;
+
+/**
+ * @brief Shared state of the zmat_run_batch() workers
+ */
+
+typedef struct TZMatBatch {
+    const size_t* inputsize;
+    unsigned char** inputstr;
+    size_t* outputsize;
+    unsigned char** outputbuf;
+    const int* zipid;
+    int* ret;
+    const int* iscompress;
+    int* errcode;
+    TZMatBatchOrder* order;  /**< items sorted by decreasing input length */
+    size_t count;
+    size_t next;             /**< next position in order to be claimed by a worker */
+#ifndef _WIN32
+    pthread_mutex_t lock;
+#endif
+} TZMatBatch;
+
+/**
+ * @brief One zmat_run_batch() worker and its codec context
+ */
+
+typedef struct TZMatBatchWorker {
+    TZMatBatch* batch;
+    TZMatCtx* ctx;
+} TZMatBatchWorker;
+
+static int zmat_batch_cmp(const void* a, const void* b) {
+    const TZMatBatchOrder* x = (const TZMatBatchOrder*)a;
+    const TZMatBatchOrder* y = (const TZMatBatchOrder*)b;
+
+    if (x->size != y->size) {
+        return (x->size > y->size) ? -1 : 1;
+    }
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @brief Worker loop (pool task i): claim the next largest unprocessed item until none is left
+ */
+
+static void zmat_batch_worker(void* arg, size_t id) {
+    TZMatBatchWorker* w = (TZMatBatchWorker*)arg + id;
+    TZMatBatch* b = w->batch;
+    size_t k, i;
+
+    while (1) {
+#ifndef _WIN32
+        pthread_mutex_lock(&b->lock);
+#endif
+        k = b->next++;
+#ifndef _WIN32
+        pthread_mutex_unlock(&b->lock);
+#endif
+
+        if (k >= b->count) {
+            break;
+        }
+
+        i = b->order[k].index;
+        b->errcode[i] = zmat_run_ctx(w->ctx, b->inputsize[i], b->inputstr[i], b->outputsize + i, b->outputbuf + i,
+                                     b->zipid[i], b->ret + i, b->iscompress[i]);
+    }
+}
+
+/**
+ * @brief Compress/decompress many independent buffers in one call
+ *
+ * Items are handed out largest first to up to nthread workers of the shared
+ * pool (the calling thread included), each reusing its own zmat_ctx; codec
+ * threading inside an item is turned off. On Windows the items are processed
+ * serially.
+ *
+ * @param[in] count: number of items
+ * @param[in] inputsize: input length of each item
+ * @param[in] inputstr: input buffer of each item
+ * @param[out] outputsize: output length of each item
+ * @param[out] outputbuf: output buffer of each item (NULL on error), free each with zmat_free()
+ * @param[in] zipid: compression method of each item, see TZipMethod
+ * @param[out] ret: encoder/decoder specific detailed error code of each item
+ * @param[in] iscompress: packed flags of each item as in zmat_run (0: decompression)
+ * @param[out] errcode: coarse grained zmat error code of each item
+ * @param[in] nthread: number of workers, 0 for the library thread limit, 1 or less to process the items in the calling thread
+ * @return 0 if all items succeed, the error code of the first failed item, or -5 if the workers can not be allocated
+ */
+
+int zmat_run_batch(const size_t count, const size_t* inputsize, unsigned char** inputstr, size_t* outputsize, unsigned char** outputbuf,
+                   const int* zipid, int* ret, const int* iscompress, int* errcode, const int nthread) {
+    TZMatBatch b;
+    TZMatBatchWorker* workers;
+    int nplan = (nthread == 0) ? zmat_thread_max() : nthread;
+    size_t i, nctx, nworker;
+    int status = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (nplan > 1 && (size_t)nplan > count) {
+        nplan = (int)count;
+    }
+
+    nworker = (size_t)zmat_thread_acquire(nplan);
+
+    memset(&b, 0, sizeof(b));
+    b.inputsize = inputsize;
+    b.inputstr = inputstr;
+    b.outputsize = outputsize;
+    b.outputbuf = outputbuf;
+    b.zipid = zipid;
+    b.ret = ret;
+    b.iscompress = iscompress;
+    b.errcode = errcode;
+    b.count = count;
+
+    for (i = 0; i < count; i++) {
+        outputbuf[i] = NULL;
+        outputsize[i] = 0;
+        ret[i] = 0;
+        errcode[i] = -5;
+    }
+
+    b.order = (TZMatBatchOrder*)zmat_malloc(&zmat_allocator, count * sizeof(TZMatBatchOrder));
+    workers = (TZMatBatchWorker*)zmat_malloc(&zmat_allocator, nworker * sizeof(TZMatBatchWorker));
+
+    if (b.order == NULL || workers == NULL) {
+        zmat_dealloc(&zmat_allocator, b.order);
+        zmat_dealloc(&zmat_allocator, workers);
+        zmat_thread_release(nplan);
+        return -5;
+    }
+
+    for (i = 0; i < count; i++) {
+        b.order[i].size = inputsize[i];
+        b.order[i].index = i;
+    }
+
+    qsort(b.order, count, sizeof(TZMatBatchOrder), zmat_batch_cmp);
+
+    /**
+      * the contexts are created here so that library-wide initialization runs in one thread
+      */
+    for (i = 0; i < nworker; i++) {
+        workers[i].batch = &b;
+
+        if (zmat_ctx_init(&workers[i].ctx) != 0) {
+            break;
+        }
+    }
+
+    if ((nctx = i) == 0) {
+        zmat_dealloc(&zmat_allocator, b.order);
+        zmat_dealloc(&zmat_allocator, workers);
+        zmat_thread_release(nplan);
+        return -5;
+    }
+
+#ifndef _WIN32
+    pthread_mutex_init(&b.lock, NULL);
+#endif
+
+    /* one task per context; a task that starts late finds the items taken and returns */
+    zmat_pool_run(zmat_batch_worker, workers, nctx, (int)nctx);
+
+#ifndef _WIN32
+    pthread_mutex_destroy(&b.lock);
+#endif
+    zmat_thread_release(nplan);
+
+    for (i = 0; i < nctx; i++) {
+        zmat_ctx_free(&workers[i].ctx);
+    }
+
+    for (i = 0; i < count && status == 0; i++) {
+        status = errcode[i];
+    }
+
+    zmat_dealloc(&zmat_allocator, b.order);
+    zmat_dealloc(&zmat_allocator, workers);
+    return status;
+}
+
+/**
+ * @brief Simplified interface to perform compression (use default compression level)
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] outputsize: output stream buffer length
+ * @param[in] outputbuf: output stream buffer pointer
+ * @param[in] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_encode(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret) {
+    return zmat_run(inputsize, inputstr, outputsize, outputbuf, zipid, ret, 1);
+}
+
+/**
+ * @brief Simplified interface to perform decompression
+ *
+ * @param[in] inputsize: input stream buffer length
+ * @param[in] inputstr: input stream buffer pointer
+ * @param[in] outputsize: output stream buffer length
+ * @param[in] outputbuf: output stream buffer pointer
+ * @param[in] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
+
+int zmat_decode(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret) {
+    return zmat_run(inputsize, inputstr, outputsize, outputbuf, zipid, ret, 0);
+}
+
+/**
+ * @brief Look up a string in a string list and return the index
+ *
+ * @param[in] origkey: string to be looked up
+ * @param[out] table: the dictionary where the string is searched
+ * @return if found, return the index of the string in the dictionary, otherwise -1.
+ */
+
+int zmat_keylookup(char* origkey, const char* table[]) {
+    int i = 0;
+    char* key = (char*)malloc(strlen(origkey) + 1);
+
+    if (key == NULL) {
+        return -1;
+    }
+
+    memcpy(key, origkey, strlen(origkey) + 1);
+
+    while (key[i]) {
+        key[i] = tolower(key[i]);
+        i++;
+    }
+
+    i = 0;
+
+    while (table[i] && table[i][0] != '\0') {
+        if (strcmp(key, table[i]) == 0) {
+            free(key);
+            return i;
+        }
+
+        i++;
+    }
+
+    free(key);
+    return -1;
+}
+
+/**
+ * @brief Free the output buffer to facilitate use in fortran
+ *
+ * @param[in,out] outputbuf: the outputbuf buffer's initial address to be freed
+ */
+
+void zmat_free(unsigned char** outputbuf) {
+    zmat_dealloc(&zmat_allocator, *outputbuf);
+    *outputbuf = NULL;
+}
+
+/*
+ * @brief Base64 encoding/decoding (RFC1341)
+ * @author Copyright (c) 2005-2011, Jouni Malinen <j@w1.fi>
+ *
+ * This software may be distributed under the terms of the BSD license.
+ * See README for more details.
+ */
+
+static const unsigned char base64_table[65] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/**
+ * @brief Value of each base64 character, 0x40 for the '=' pad and 0x80 for the
+ *        characters the decoder skips, such as line feeds
+ */
+
+static const unsigned char base64_dtable[256] = {
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x3e, 0x80, 0x80, 0x80, 0x3f,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x80, 0x80, 0x80, 0x40, 0x80, 0x80,
+    0x80, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+    0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80
+};
+
+/**
+ * @brief Input length encoded by each task of the threaded encoder, a whole number
+ *        of 54-byte input lines (72 characters)
+ */
+
+#define ZMAT_BASE64_BLOCK  (ZMAT_MT_BLOCK / 54 * 54)
+
+/**
+ * @brief SIMD kernels of the base64 codec, picked by zmat_base64_dispatch()
+ *
+ * An encoder codes whole 3-byte groups of in[0..len) into out and returns the
+ * input length it coded, leaving the rest to the scalar loop; a decoder decodes
+ * whole 4-character groups without '=' or skipped characters, writes at most
+ * room bytes (stores may pass the decoded length) and returns the characters used.
+ */
+
+typedef size_t (*TZMatBase64Enc)(const unsigned char* in, size_t len, unsigned char* out);
+typedef size_t (*TZMatBase64Dec)(const unsigned char* in, size_t len, unsigned char* out, size_t room);
+
+static TZMatBase64Enc zmat_base64_enc_simd = NULL;
+static TZMatBase64Dec zmat_base64_dec_simd = NULL;
+static volatile int zmat_base64_ready = 0;
+
+#ifdef ZMAT_SIMD_X86
+
+/*
+ * The x86 kernels follow W. Mula and D. Lemire, "Faster Base64 Encoding and
+ * Decoding Using AVX2 Instructions" (2018) and "Base64 encoding and decoding at
+ * almost the speed of a memory copy" (2019, AVX-512 VBMI).
+ */
+
+__attribute__((target("ssse3")))
+static size_t zmat_base64_enc_ssse3(const unsigned char* in, size_t len, unsigned char* out) {
+    const __m128i split = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t done;
+
+    for (done = 0; done + 16 <= len; done += 12, out += 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(in + done)), split);
+        __m128i idx = _mm_or_si128(_mm_mulhi_epu16(_mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040)),
+                                   _mm_mullo_epi16(_mm_and_si128(v, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010)));
+
+        /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12, then add the offset of the range */
+        v = _mm_or_si128(_mm_subs_epu8(idx, _mm_set1_epi8(51)), _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i*)out, _mm_add_epi8(_mm_shuffle_epi8(shift, v), idx));
+    }
+
+    return done;
+}
+
+__attribute__((target("avx2")))
+static size_t zmat_base64_enc_avx2(const unsigned char* in, size_t len, unsigned char* out) {
+    const __m256i split = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m256i shift = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+    size_t done;
+
+    for (done = 0; done + 28 <= len; done += 24, out += 32) {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + done))),
+                                            _mm_loadu_si128((const __m128i*)(in + done + 12)), 1);
+        __m256i idx;
+
+        v = _mm256_shuffle_epi8(v, split);
+        idx = _mm256_or_si256(_mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040)),
+                              _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010)));
+        v = _mm256_or_si256(_mm256_subs_epu8(idx, _mm256_set1_epi8(51)), _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i*)out, _mm256_add_epi8(_mm256_shuffle_epi8(shift, v), idx));
+    }
+
+    return done;
+}
+
+/*
+ * Decoding looks up the low and high nibble of each character in two bit
+ * tables, whose AND is zero only for the 64 base64 characters, then adds the
+ * offset of the range of the character and packs 4 6-bit values into 3 bytes.
+ */
+
+__attribute__((target("ssse3")))
+static size_t zmat_base64_dec_ssse3(const unsigned char* in, size_t len, unsigned char* out, size_t room) {
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i mask = _mm_set1_epi8(0x2f);
+    size_t done;
+
+    for (done = 0; done + 16 <= len && done / 4 * 3 + 16 <= room; done += 16, out += 12) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + done));
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), mask);
+        __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, _mm_and_si128(v, mask)), _mm_shuffle_epi8(lut_hi, hi));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF) {
+            break;
+        }
+
+        v = _mm_add_epi8(v, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(v, mask), hi)));
+        v = _mm_madd_epi16(_mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140)), _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i*)out, _mm_shuffle_epi8(v, pack));
+    }
+
+    return done;
+}
+
+__attribute__((target("avx2")))
+static size_t zmat_base64_dec_avx2(const unsigned char* in, size_t len, unsigned char* out, size_t room) {
+    const __m256i lut_lo = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A));
+    const __m256i lut_hi = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+    const __m256i lut_roll = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+    const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    const __m256i mask = _mm256_set1_epi8(0x2f);
+    size_t done;
+
+    for (done = 0; done + 32 <= len && done / 4 * 3 + 32 <= room; done += 32, out += 24) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + done));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask);
+
+        if (!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, _mm256_and_si256(v, mask)), _mm256_shuffle_epi8(lut_hi, hi))) {
+            break;
+        }
+
+        v = _mm256_add_epi8(v, _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(v, mask), hi)));
+        v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, pack), _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)out, v);
+    }
+
+    return done;
+}
+
+#ifdef ZMAT_SIMD_AVX512
+
+/*
+ * With VBMI, vpermb gathers the 3-byte groups and translates the 6-bit values
+ * through the 64-byte alphabet, vpmultishiftqb extracts the 6-bit fields, and
+ * vpermi2b looks the characters up in the first 128 entries of base64_dtable.
+ */
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t zmat_base64_enc_avx512(const unsigned char* in, size_t len, unsigned char* out) {
+    const __m512i lut = _mm512_loadu_si512((const void*)base64_table);
+    const __m512i split = _mm512_setr_epi32(0x01020001, 0x04050304, 0x07080607, 0x0a0b090a, 0x0d0e0c0d, 0x10110f10, 0x13141213, 0x16171516,
+                                            0x191a1819, 0x1c1d1b1c, 0x1f201e1f, 0x22232122, 0x25262425, 0x28292728, 0x2b2c2a2b, 0x2e2f2d2e);
+    const __m512i fields = _mm512_set1_epi64(0x3036242a1016040aLL);
+    size_t done;
+
+    for (done = 0; done + 48 <= len; done += 48, out += 64) {
+        __m512i v = _mm512_permutexvar_epi8(split, _mm512_maskz_loadu_epi8(0xFFFFFFFFFFFFULL, in + done));
+
+        _mm512_storeu_si512((void*)out, _mm512_permutexvar_epi8(_mm512_multishift_epi64_epi8(fields, v), lut));
+    }
+
+    return done;
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t zmat_base64_dec_avx512(const unsigned char* in, size_t len, unsigned char* out, size_t room) {
+    const __m512i lut_lo = _mm512_loadu_si512((const void*)base64_dtable);
+    const __m512i lut_hi = _mm512_loadu_si512((const void*)(base64_dtable + 64));
+    const __m512i pack = _mm512_setr_epi32(0x06000102, 0x090a0405, 0x0c0d0e08, 0x16101112, 0x191a1415, 0x1c1d1e18, 0x26202122, 0x292a2425,
+                                           0x2c2d2e28, 0x36303132, 0x393a3435, 0x3c3d3e38, 0, 0, 0, 0);
+    size_t done;
+
+    for (done = 0; done + 64 <= len && done / 4 * 3 + 48 <= room; done += 64, out += 48) {
+        __m512i v = _mm512_loadu_si512((const void*)(in + done));
+        __m512i idx = _mm512_permutex2var_epi8(lut_lo, v, lut_hi);
+
+        /* a non-ASCII character, a '=' or a skipped character ends the run */
+        if (_mm512_movepi8_mask(v) | _mm512_test_epi8_mask(idx, _mm512_set1_epi8((char)0xC0))) {
+            break;
+        }
+
+        idx = _mm512_madd_epi16(_mm512_maddubs_epi16(idx, _mm512_set1_epi32(0x01400140)), _mm512_set1_epi32(0x00011000));
+        _mm512_mask_storeu_epi8(out, 0xFFFFFFFFFFFFULL, _mm512_permutexvar_epi8(pack, idx));
+    }
+
+    return done;
+}
+
+#endif
+#endif
+
+#ifdef ZMAT_SIMD_NEON
+
+/**
+ * @brief Map 16 base64 characters to their 6-bit values, flagging the others in bad
+ */
+
+static inline uint8x16_t zmat_base64_neon_value(uint8x16_t c, uint8x16_t* bad) {
+    uint8x16_t up = vsubq_u8(c, vdupq_n_u8('A')), low = vsubq_u8(c, vdupq_n_u8('a')), digit = vsubq_u8(c, vdupq_n_u8('0'));
+    uint8x16_t isup = vcltq_u8(up, vdupq_n_u8(26)), islow = vcltq_u8(low, vdupq_n_u8(26)), isdigit = vcltq_u8(digit, vdupq_n_u8(10));
+    uint8x16_t isplus = vceqq_u8(c, vdupq_n_u8('+')), isslash = vceqq_u8(c, vdupq_n_u8('/'));
+    uint8x16_t v = vandq_u8(isup, up);
+
+    v = vorrq_u8(v, vandq_u8(islow, vaddq_u8(low, vdupq_n_u8(26))));
+    v = vorrq_u8(v, vandq_u8(isdigit, vaddq_u8(digit, vdupq_n_u8(52))));
+    v = vorrq_u8(v, vandq_u8(isplus, vdupq_n_u8(62)));
+    v = vorrq_u8(v, vandq_u8(isslash, vdupq_n_u8(63)));
+    *bad = vorrq_u8(*bad, vmvnq_u8(vorrq_u8(vorrq_u8(vorrq_u8(isup, islow), vorrq_u8(isdigit, isplus)), isslash)));
+    return v;
+}
+
+static size_t zmat_base64_enc_neon(const unsigned char* in, size_t len, unsigned char* out) {
+    uint8x16x4_t lut;
+    size_t done;
+
+    lut.val[0] = vld1q_u8(base64_table);
+    lut.val[1] = vld1q_u8(base64_table + 16);
+    lut.val[2] = vld1q_u8(base64_table + 32);
+    lut.val[3] = vld1q_u8(base64_table + 48);
+
+    for (done = 0; done + 48 <= len; done += 48, out += 64) {
+        uint8x16x3_t s = vld3q_u8(in + done);
+        uint8x16x4_t d;
+
+        d.val[0] = vshrq_n_u8(s.val[0], 2);
+        d.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(s.val[0], 4), vshrq_n_u8(s.val[1], 4)), vdupq_n_u8(0x3f));
+        d.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(s.val[1], 2), vshrq_n_u8(s.val[2], 6)), vdupq_n_u8(0x3f));
+        d.val[3] = vandq_u8(s.val[2], vdupq_n_u8(0x3f));
+        d.val[0] = vqtbl4q_u8(lut, d.val[0]);
+        d.val[1] = vqtbl4q_u8(lut, d.val[1]);
+        d.val[2] = vqtbl4q_u8(lut, d.val[2]);
+        d.val[3] = vqtbl4q_u8(lut, d.val[3]);
+        vst4q_u8(out, d);
+    }
+
+    return done;
+}
+
+static size_t zmat_base64_dec_neon(const unsigned char* in, size_t len, unsigned char* out, size_t room) {
+    size_t done;
+
+    for (done = 0; done + 64 <= len && done / 4 * 3 + 48 <= room; done += 64, out += 48) {
+        uint8x16x4_t s = vld4q_u8(in + done);
+        uint8x16_t bad = vdupq_n_u8(0);
+        uint8x16x3_t d;
+
+        s.val[0] = zmat_base64_neon_value(s.val[0], &bad);
+        s.val[1] = zmat_base64_neon_value(s.val[1], &bad);
+        s.val[2] = zmat_base64_neon_value(s.val[2], &bad);
+        s.val[3] = zmat_base64_neon_value(s.val[3], &bad);
+
+        if (vmaxvq_u8(bad)) {
+            break;
+        }
+
+        d.val[0] = vorrq_u8(vshlq_n_u8(s.val[0], 2), vshrq_n_u8(s.val[1], 4));
+        d.val[1] = vorrq_u8(vshlq_n_u8(s.val[1], 4), vshrq_n_u8(s.val[2], 2));
+        d.val[2] = vorrq_u8(vshlq_n_u8(s.val[2], 6), s.val[3]);
+        vst3q_u8(out, d);
+    }
+
+    return done;
+}
+
+#endif
+
+/**
+ * @brief Return the widest kernel allowed by ZMAT_SIMD, read once by zmat_base64_dispatch()
+ *
+ * The variable holds scalar, ssse3 (or neon), avx2 or avx512; unset or any
+ * other value allows all kernels.
+ */
+
+static int zmat_simd_cap(void) {
+    const char* env = getenv("ZMAT_SIMD");
+
+    if (env == NULL) {
+        return 3;
+    }
+
+    return (strcmp(env, "scalar") == 0) ? 0 : (strcmp(env, "ssse3") == 0 || strcmp(env, "neon") == 0) ? 1 :
+           (strcmp(env, "avx2") == 0) ? 2 : 3;
+}
+
+/**
+ * @brief Pick the widest base64 kernels the CPU runs, up to the ZMAT_SIMD cap, once per process
+ */
+
+static void zmat_base64_dispatch(void) {
+    int cap;
+
+    if (zmat_base64_ready) {
+        return;
+    }
+
+    cap = zmat_simd_cap();
+    (void)cap;
+
+#ifdef ZMAT_SIMD_X86
+    __builtin_cpu_init();
+
+#ifdef ZMAT_SIMD_AVX512
+
+    if (cap >= 3 && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi")) {
+        zmat_base64_enc_simd = zmat_base64_enc_avx512;
+        zmat_base64_dec_simd = zmat_base64_dec_avx512;
+    } else
+#endif
+        if (cap >= 2 && __builtin_cpu_supports("avx2")) {
+            zmat_base64_enc_simd = zmat_base64_enc_avx2;
+            zmat_base64_dec_simd = zmat_base64_dec_avx2;
+        } else if (cap >= 1 && __builtin_cpu_supports("ssse3")) {
+            zmat_base64_enc_simd = zmat_base64_enc_ssse3;
+            zmat_base64_dec_simd = zmat_base64_dec_ssse3;
+        }
+
+#elif defined(ZMAT_SIMD_NEON)
+
+    if (cap >= 1) {
+        zmat_base64_enc_simd = zmat_base64_enc_neon;
+        zmat_base64_dec_simd = zmat_base64_dec_neon;
+    }
+
+#endif
+    zmat_base64_ready = 1;
+}
+
+/**
+ * @brief Encode len bytes, a multiple of 3, with a line feed after every 72
+ *        characters if wrap is set
+ *
+ * @return the end of the written characters
+ */
+
+static unsigned char* zmat_base64_enc_groups(const unsigned char* in, size_t len, unsigned char* out, int wrap) {
+    size_t step = wrap ? 54 : len, n, done;
+
+    while (len > 0) {
+        n = (len < step) ? len : step;
+        done = zmat_base64_enc_simd ? zmat_base64_enc_simd(in, n, out) : 0;
+        out += done / 3 * 4;
+
+        for (; done < n; done += 3) {
+            *out++ = base64_table[in[done] >> 2];
+            *out++ = base64_table[((in[done] & 0x03) << 4) | (in[done + 1] >> 4)];
+            *out++ = base64_table[((in[done + 1] & 0x0f) << 2) | (in[done + 2] >> 6)];
+            *out++ = base64_table[in[done + 2] & 0x3f];
+        }
+
+        if (wrap && n == 54) {
+            *out++ = '\n';
+        }
+
+        in += n;
+        len -= n;
+    }
+
+    return out;
+}
+
+/**
+ * @brief Shared state of the threaded base64 encoder and decoder
+ */
+
+typedef struct TZMatBase64Job {
+    const unsigned char* src;   /**< input */
+    unsigned char* dest;        /**< output */
+    size_t len;                 /**< input length handled by the tasks */
+    size_t block;               /**< input length of each task */
+    size_t room;                /**< output capacity */
+    size_t* count;              /**< decoding: valid characters of each block, then those before it and the total */
+    size_t* outlen;             /**< decoding: output length of each block */
+    int* rc;                    /**< decoding: zmat_base64_dec_span() result of each block */
+    int mode;                   /**< encoding: line feed mode */
+    int pass;                   /**< decoding: 0 counts the characters, 1 decodes */
+} TZMatBase64Job;
+
+static void zmat_base64_enc_task(void* arg, size_t i) {
+    TZMatBase64Job* job = (TZMatBase64Job*)arg;
+    size_t first = i * job->block, n = (job->len - first < job->block) ? job->len - first : job->block;
+
+    zmat_base64_enc_groups(job->src + first, n, job->dest + first / 3 * 4 + ((job->mode > 1) ? first / 54 : 0), job->mode > 1);
+}
+
+/**
+ * @brief Length of the base64 encoding of len bytes, without the nul terminator
+ */
+
+static size_t zmat_base64_enclen(size_t len, int mode) {
+    size_t ngroup = len / 3, olen = (ngroup + (len % 3 != 0)) * 4;
+
+    if (mode > 1) {
+        olen += ngroup / 18;    /* line feeds */
+    }
+
+    if (mode > 2 && (ngroup % 18 || len % 3)) {
+        olen++;
+    }
+
+    return olen;
+}
+
+/**
+ * @brief Base64 encode into a buffer of zmat_base64_enclen() bytes
+ *
+ * @param[in] nthread: planned thread count, see zmat_thread_plan(); inputs longer
+ *             than ZMAT_BASE64_BLOCK are encoded in blocks of whole lines
+ * @return the end of the written characters
+ */
+
+static unsigned char* zmat_base64_encode_into(const unsigned char* src, size_t len, unsigned char* out, int mode, int nthread) {
+    size_t full = len - len % 3;
+    unsigned char* pos;
+
+    zmat_base64_dispatch();
+
+    if (nthread > 1 && full > ZMAT_BASE64_BLOCK) {
+        TZMatBase64Job job;
+        int nworker;
+
+        memset(&job, 0, sizeof(job));
+        job.src = src;
+        job.dest = out;
+        job.len = full;
+        job.block = ZMAT_BASE64_BLOCK;
+        job.mode = mode;
+
+        nworker = zmat_thread_acquire(nthread);
+        zmat_pool_run(zmat_base64_enc_task, &job, (full + job.block - 1) / job.block, nworker);
+        zmat_thread_release(nthread);
+        pos = out + full / 3 * 4 + ((mode > 1) ? full / 54 : 0);
+    } else {
+        pos = zmat_base64_enc_groups(src, full, out, mode > 1);
+    }
+
+    src += full;
+
+    if (len % 3) {
+        *pos++ = base64_table[src[0] >> 2];
+
+        if (len % 3 == 1) {
+            *pos++ = base64_table[(src[0] & 0x03) << 4];
+            *pos++ = '=';
+        } else {
+            *pos++ = base64_table[((src[0] & 0x03) << 4) | (src[1] >> 4)];
+            *pos++ = base64_table[(src[1] & 0x0f) << 2];
+        }
+
+        *pos++ = '=';
+    }
+
+    if (mode > 2 && ((full / 3) % 18 || len % 3)) {
+        *pos++ = '\n';
+    }
+
+    return pos;
+}
+
+/**
+ * @brief base64_encode - Base64 encode
+ * @src: Data to be encoded
+ * @len: Length of the data to be encoded
+ * @out_len: Pointer to output length variable, or %NULL if not used
+ * @mode: 2 or more adds a line feed after every 72 characters, 3 or more also
+ *        ends the last line with one
+ * @nthread: planned thread count, see zmat_thread_plan()
+ * Returns: Allocated buffer of out_len bytes of encoded data,
+ * or %NULL on failure
+ *
+ * Caller is responsible for freeing the returned buffer. Returned buffer is
+ * nul terminated to make it easier to use as a C string. The nul terminator is
+ * not included in out_len.
+ */
+
+static unsigned char* zmat_base64_encode(const TZMatAllocator* al, const unsigned char* src, size_t len,
+        size_t* out_len, int mode, int nthread) {
+    unsigned char* out, *pos;
+
+    if (len / 3 >= ((size_t)-1) / 6) {
+        return NULL;    /* integer overflow */
+    }
+
+    out = (unsigned char*)zmat_malloc(al, zmat_base64_enclen(len, mode) + 1);
+
+    if (out == NULL) {
+        return NULL;
+    }
+
+    pos = zmat_base64_encode_into(src, len, out, mode, nthread);
+    *pos = '\0';
+
+    if (out_len) {
+        *out_len = pos - out;
+    }
+
+    return out;
+}
+
+unsigned char* base64_encode(const unsigned char* src, size_t len,
+                             size_t* out_len, int mode) {
+    return zmat_base64_encode(&zmat_allocator, src, len, out_len, mode, 1);
+}
+
+/**
+ * @brief Count the characters of a base64 stream that are not skipped, '=' included
+ */
+
+static size_t zmat_base64_count(const unsigned char* src, size_t len) {
+    size_t i, count = 0;
+
+    for (i = 0; i < len; i++) {
+        count += !(base64_dtable[src[i]] & 0x80);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Decode base64 characters, skipping those outside the alphabet
+ *
+ * @param[in] src: characters to decode, starting at a 4-character group
+ * @param[in] len: length of src
+ * @param[in] limit: number of characters to decode, a multiple of 4, or (size_t)-1 to
+ *             decode up to the group holding the '=' pad
+ * @param[out] out: output, of room bytes
+ * @param[out] used: input length read
+ * @param[out] outlen: output length
+ * @param[out] nvalid: characters decoded, '=' included
+ * @return 1 after the padded group, 0 at the end of src or after limit characters,
+ *         -1 for invalid padding or, with a limit, a '='
+ */
+
+static int zmat_base64_dec_span(const unsigned char* src, size_t len, size_t limit, unsigned char* out, size_t room,
+                                size_t* used, size_t* outlen, size_t* nvalid) {
+    unsigned char block[4], tmp, *pos = out;
+    size_t i = 0, count = 0, total = 0, n;
+    int pad = 0, rc = 0;
+
+    while (i < len && total < limit) {
+        if (count == 0 && zmat_base64_dec_simd) {
+            n = zmat_base64_dec_simd(src + i, (len - i < limit - total) ? len - i : limit - total, pos, room - (pos - out));
+            i += n;
+            total += n;
+            pos += n / 4 * 3;
+
+            if (i == len || total == limit) {
+                break;
+            }
+        }
+
+        tmp = base64_dtable[src[i++]];
+
+        if (tmp & 0x80) {
+            continue;
+        }
+
+        if (tmp == 0x40) {
+            if (limit != (size_t)-1) {
+                rc = -1;
+                break;
+            }
+
+            pad++;
+            tmp = 0;
+        }
+
+        block[count] = tmp;
+        count++;
+        total++;
+
+        if (count == 4) {
+            *pos++ = (block[0] << 2) | (block[1] >> 4);
+            *pos++ = (block[1] << 4) | (block[2] >> 2);
+            *pos++ = (block[2] << 6) | block[3];
+            count = 0;
+
+            if (pad) {
+                /* a group of 3 or 4 '=' is invalid padding */
+                pos -= pad;
+                rc = (pad > 2) ? -1 : 1;
+                break;
+            }
+        }
+    }
+
+    *used = i;
+    *outlen = pos - out;
+    *nvalid = total;
+    return rc;
+}
+
+static void zmat_base64_dec_task(void* arg, size_t i) {
+    TZMatBase64Job* job = (TZMatBase64Job*)arg;
+    size_t first = i * job->block, n = (job->len - first < job->block) ? job->len - first : job->block;
+    size_t start, stop, skip, used, nvalid;
+    int last = (first + n == job->len);
+
+    if (job->pass == 0) {
+        job->count[i] = zmat_base64_count(job->src + first, n);
+        return;
+    }
+
+    /* the block decodes the groups starting in it, which may end in the next block */
+    start = (job->count[i] + 3) & ~(size_t)3;
+    stop = last ? (size_t)-1 : (job->count[i + 1] + 3) & ~(size_t)3;
+    job->outlen[i] = 0;
+    job->rc[i] = 0;
+
+    if (start >= job->count[i + 1]) {
+        return;
+    }
+
+    for (skip = start - job->count[i]; skip > 0; first++) {
+        skip -= !(base64_dtable[job->src[first]] & 0x80);
+    }
+
+    job->rc[i] = zmat_base64_dec_span(job->src + first, job->len - first, last ? stop : stop - start, job->dest + start / 4 * 3,
+                                      last ? job->room - start / 4 * 3 : (stop - start) / 4 * 3, &used, job->outlen + i, &nvalid);
+
+    if (job->rc[i] == 0 && !last && nvalid != stop - start) {
+        job->rc[i] = -1;
+    }
+}
+
+/**
+ * @brief Decode a long base64 stream in blocks: count the characters of each block
+ *        in parallel, then decode the groups starting in each block
+ *
+ * @return 0 on success with the output length and character count, -1 if the stream
+ *         must be decoded serially (a '=' before the last block, or a last block
+ *         without a group start)
+ */
+
+static int zmat_base64_decode_mt(const TZMatAllocator* al, const unsigned char* src, size_t len, unsigned char* out,
+                                 size_t room, int nthread, size_t* outlen, size_t* nvalid) {
+    TZMatBase64Job job;
+    size_t ntask, i, sum;
+    int nworker, errcode = 0;
+
+    memset(&job, 0, sizeof(job));
+    job.src = src;
+    job.dest = out;
+    job.len = len;
+    job.block = ZMAT_MT_BLOCK;
+    job.room = room;
+    ntask = (len + job.block - 1) / job.block;
+
+    if (!(job.count = (size_t*)zmat_malloc(al, (ntask + 1) * (2 * sizeof(size_t) + sizeof(int))))) {
+        return -1;
+    }
+
+    job.outlen = job.count + ntask + 1;
+    job.rc = (int*)(job.outlen + ntask);
+
+    nworker = zmat_thread_acquire(nthread);
+    zmat_pool_run(zmat_base64_dec_task, &job, ntask, nworker);
+
+    for (i = 0, sum = 0; i < ntask; i++) {
+        size_t n = job.count[i];
+
+        job.count[i] = sum;
+        sum += n;
+    }
+
+    job.count[ntask] = sum;
+    job.pass = 1;
+    zmat_pool_run(zmat_base64_dec_task, &job, ntask, nworker);
+    zmat_thread_release(nthread);
+
+    for (i = 0; i < ntask; i++) {
+        if (job.rc[i] < 0) {
+            errcode = -1;
+        }
+    }
+
+    /* the last block holds the end of the output, unless no group starts in it */
+    if (((job.count[ntask - 1] + 3) & ~(size_t)3) >= sum) {
+        errcode = -1;
+    }
+
+    *outlen = ((job.count[ntask - 1] + 3) & ~(size_t)3) / 4 * 3 + job.outlen[ntask - 1];
+    *nvalid = sum;
+    zmat_dealloc(al, job.count);
+    return errcode;
+}
+
+/**
+ * base64_decode - Base64 decode
+ * @src: Data to be decoded
+ * @len: Length of the data to be decoded
+ * @out_len: Pointer to output length variable
+ * @nthread: planned thread count, see zmat_thread_plan()
+ * Returns: Allocated buffer of out_len bytes of decoded data,
+ * or %NULL on failure
+ *
+ * Characters outside the base64 alphabet, such as line feeds, are skipped;
+ * decoding stops after the group holding the '=' pad.
+ * Caller is responsible for freeing the returned buffer.
+ */
+
+static unsigned char* zmat_base64_decode(const TZMatAllocator* al, const unsigned char* src, size_t len,
+        size_t* out_len, int nthread) {
+    unsigned char* out;
+    size_t olen = len / 4 * 3, used, outlen = 0, total = 0;
+    int rc = -1;
+
+    if (olen == 0 || !(out = (unsigned char*)zmat_malloc(al, olen))) {
+        return NULL;
+    }
+
+    zmat_base64_dispatch();
+
+    if (nthread > 1 && len > 2 * ZMAT_MT_BLOCK) {
+        rc = zmat_base64_decode_mt(al, src, len, out, olen, nthread, &outlen, &total);
+    }
+
+    if (rc < 0 && (rc = zmat_base64_dec_span(src, len, (size_t)-1, out, olen, &used, &outlen, &total)) == 1) {
+        total += zmat_base64_count(src + used, len - used);
+    }
+
+    if (rc < 0 || total == 0 || total % 4) {
+        zmat_dealloc(al, out);
+        return NULL;
+    }
+
+    zmat_shrink_buf(al, &out, outlen);
+    *out_len = outlen;
+    return out;
+}
+
+unsigned char* base64_decode(const unsigned char* src, size_t len,
+                             size_t* out_len) {
+    return zmat_base64_decode(&zmat_allocator, src, len, out_len, 1);
+}
+
+/**
+ * @brief Nonzero if zipid is coded in ZMAT_BASE64_PIECE pieces between the codec and the base64 text
+ *
+ * zlib, gzip (built with zlib; miniz writes the gzip wrapper separately) and zstd,
+ * when they would run on one thread and without the zmat shuffle or a
+ * dictionary: a compressed stream that is deflated, or inflated, in parallel
+ * blocks is coded whole.
+ */
+
+static int zmat_base64_piped(const int zipid, const size_t inputsize, const int iscompress) {
+    union TZMatFlags flags;
+    int nthread;
+
+    flags.iscompress = iscompress;
+
+#ifdef NO_ZLIB
+    if (zipid != zmZlib && zipid != zmZstd) {
+#else
+    if (zipid != zmZlib && zipid != zmGzip && zipid != zmZstd) {
+#endif
+        return 0;
+    }
+
+#ifdef NO_ZSTD
+
+    if (zipid == zmZstd) {
+        return 0;
+    }
+
+#endif
+
+    if (zmat_shuffle_mode(zipid, iscompress) != 0 || (zmat_dict_active && zipid != zmGzip)) {
+        return 0;
+    }
+
+    nthread = zmat_thread_plan(flags.param.nthread, inputsize);
+
+    if (flags.param.clevel) {
+        return nthread <= 1 || (zipid != zmZstd && inputsize <= ZMAT_DEFLATE_BLOCK);
+    }
+
+    nthread = (flags.param.nthread == 0) ? zmat_thread_max() : nthread;
+    return nthread <= 1 || inputsize / 4 * 3 < 2 * ZMAT_INFLATE_CHUNK;
+}
+
+/**
+ * @brief Base64 encode the whole 3-byte groups of the codec output in piece, or all
+ *        of it once the codec is done, keeping the rest at the start of piece
+ *
+ * @return the end of the text, or NULL if it would pass textend
+ */
+
+static unsigned char* zmat_base64_pipe_flush(unsigned char* piece, size_t* have, unsigned char* pos,
+        const unsigned char* textend, int done) {
+    size_t cut = done ? *have : *have - *have % 3;
+
+    if ((size_t)(textend - pos) < (cut + 2) / 3 * 4) {
+        return NULL;
+    }
+
+    pos = zmat_base64_encode_into(piece, cut, pos, 1, 1);
+    memmove(piece, piece + cut, *have - cut);
+    *have -= cut;
+    return pos;
+}
+
+/**
+ * @brief Compress to zlib, gzip or zstd, base64 encoding each piece of the codec output as it is produced
+ *
+ * @return 0 on success, a zmat error code, or 1 if the text did not fit in capacity bytes
+ */
+
+static int zmat_base64_pipe_encode(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                                   unsigned char* text, const size_t capacity, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    const size_t piecelen = ZMAT_BASE64_PIECE / 4 * 3;
+    union TZMatFlags flags;
+    unsigned char* piece, *pos = text;
+    size_t have = 0;
+    int done = 0, errcode = 0;
+
+    flags.iscompress = iscompress;
+
+    if (!(piece = (unsigned char*)zmat_malloc(al, piecelen))) {
+        return -5;
+    }
+
+    zmat_base64_dispatch();
+
+    if (zipid == zmZlib || zipid == zmGzip) {
+        z_stream local, *zs;
+        int level = (flags.param.clevel > 0) ? Z_DEFAULT_COMPRESSION : (-flags.param.clevel);
+
+        if ((*ret = (zipid == zmZlib) ? zmat_ctx_deflater(ctx, &local, &zs, level, 15, 8)
+                    : zmat_ctx_deflater(ctx, &local, &zs, level, 15 | 16, MAX_MEM_LEVEL)) != Z_OK) {
+            zmat_dealloc(al, piece);
+            return -2;
+        }
+
+        zs->next_in = inputstr;
+        zs->avail_in = 0;
+
+        while (!done && pos) {
+            int last;
+
+            zs->next_out = piece + have;
+            zs->avail_out = (unsigned int)(piecelen - have);
+            last = zmat_zstream_feed(zs, inputstr + inputsize, piece + piecelen);
+            *ret = deflate(zs, last ? Z_FINISH : Z_NO_FLUSH);
+
+            if (*ret != Z_OK && *ret != Z_STREAM_END && *ret != Z_BUF_ERROR) {
+                errcode = -3;
+                break;
+            }
+
+            have = (size_t)(zs->next_out - piece);
+            done = (*ret == Z_STREAM_END);
+            pos = zmat_base64_pipe_flush(piece, &have, pos, text + capacity, done);
+        }
+
+        if (ctx == NULL) {
+            deflateEnd(zs);
+        }
+
+#ifndef NO_ZSTD
+    } else {
+        ZSTD_CCtx* zctx = ctx ? ctx->zstdc : ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+        ZSTD_inBuffer zin = {inputstr, inputsize, 0};
+
+        if (ctx && !zctx) {
+            zctx = ctx->zstdc = ZSTD_createCCtx_advanced(zmat_zstd_mem(al));
+        }
+
+        if (!zctx) {
+            zmat_dealloc(al, piece);
+            return -5;
+        }
+
+        ZSTD_CCtx_reset(zctx, ZSTD_reset_session_and_parameters);
+        ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel, (flags.param.clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-flags.param.clevel));
+        ZSTD_CCtx_setPledgedSrcSize(zctx, inputsize);
+        /* the whole input stays in place, zstd need not copy it into its window buffer */
+        ZSTD_CCtx_setParameter(zctx, ZSTD_c_stableInBuffer, 1);
+
+        while (!done && pos) {
+            ZSTD_outBuffer zout = {piece + have, piecelen - have, 0};
+            size_t zret = ZSTD_compressStream2(zctx, &zout, &zin, ZSTD_e_end);
+
+            *ret = (int)zret;
+
+            if (ZSTD_isError(zret)) {
+                errcode = -9;
+                break;
+            }
+
+            have += zout.pos;
+            done = (zret == 0);
+            pos = zmat_base64_pipe_flush(piece, &have, pos, text + capacity, done);
+        }
+
+        if (ctx == NULL) {
+            ZSTD_freeCCtx(zctx);
+        }
+
+#endif
+    }
+
+    zmat_dealloc(al, piece);
+
+    if (errcode == 0 && pos == NULL) {
+        return 1;
+    }
+
+    *outputsize = errcode ? 0 : (size_t)(pos - text);
+    return errcode;
+}
+
+/**
+ * @brief Last bytes of a base64 stream, decoded from its last 12 characters
+ *
+ * @param[out] tail: at least 9 bytes
+ * @return the number of bytes decoded, 0 if there are fewer characters or they are invalid
+ */
+
+static size_t zmat_base64_tail(const unsigned char* src, size_t len, unsigned char* tail) {
+    unsigned char text[12];
+    size_t n = sizeof(text), used, outlen, nvalid;
+
+    while (len > 0 && n > 0) {
+        if (!(base64_dtable[src[--len]] & 0x80)) {
+            text[--n] = src[len];
+        }
+    }
+
+    if (n > 0 || zmat_base64_dec_span(text, sizeof(text), (size_t)-1, tail, 9, &used, &outlen, &nvalid) < 0) {
+        return 0;
+    }
+
+    return outlen;
+}
+
+/**
+ * @brief Decompress base64 encoded zlib, gzip or zstd data, decoding ZMAT_BASE64_PIECE
+ *        characters at a time into the codec
+ *
+ * The output is sized like zmat_run sizes it, from the length in the gzip
+ * trailer or the zstd frame header, and grown if needed. Decoding stops at
+ * the end of the first gzip member or zlib stream.
+ *
+ * @return 0 on success, a zmat error code, or 1 if zstd frames go past the
+ *         length recorded in the first one and the text must be decoded whole
+ */
+
+static int zmat_base64_pipe_decode(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                                   unsigned char** outputbuf, const int zipid, int* ret) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    const size_t piecelen = ZMAT_BASE64_PIECE / 4 * 3;
+    unsigned char* piece, *out = NULL, tail[9];
+    size_t consumed = 0, total = 0, alloc = 0, outlen = 0, taillen, used, n, nvalid;
+    int rc = 0, rounds = 0, ended = 0, errcode = 0;
+    z_stream local, *zs = NULL;
+#ifndef NO_ZSTD
+    ZSTD_DCtx* zdctx = NULL;
+    size_t zret = 1;
+    int stable = 0;
+#endif
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+
+    if (!(piece = (unsigned char*)zmat_malloc(al, piecelen))) {
+        return -5;
+    }
+
+    zmat_base64_dispatch();
+
+    if (zipid == zmZlib || zipid == zmGzip) {
+        if ((*ret = zmat_ctx_inflater(ctx, &local, &zs, (zipid == zmZlib) ? 15 : (15 | 32))) != Z_OK) {
+            zmat_dealloc(al, piece);
+            return -2;
+        }
+#ifndef NO_ZSTD
+    } else {
+        zdctx = ctx ? ctx->zstdd : ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+
+        if (ctx && !zdctx) {
+            zdctx = ctx->zstdd = ZSTD_createDCtx_advanced(zmat_zstd_mem(al));
+        }
+
+        if (!zdctx) {
+            zmat_dealloc(al, piece);
+            return -5;
+        }
+
+        ZSTD_DCtx_reset(zdctx, ZSTD_reset_session_only);
+#endif
+    }
+
+    while (!ended && errcode == 0) {
+        int last;
+
+        /* a '=' before the end of the piece: decode up to the padded group */
+        if ((rc = zmat_base64_dec_span(inputstr + consumed, inputsize - consumed, ZMAT_BASE64_PIECE, piece, piecelen, &used, &n, &nvalid)) < 0) {
+            rc = zmat_base64_dec_span(inputstr + consumed, inputsize - consumed, (size_t)-1, piece, piecelen, &used, &n, &nvalid);
+        }
+
+        consumed += used;
+        total += nvalid;
+        last = (rc != 0 || nvalid < ZMAT_BASE64_PIECE);
+
+        if (rc == 1) {
+            total += zmat_base64_count(inputstr + consumed, inputsize - consumed);
+        }
+
+        if (rc < 0 || (last && (total == 0 || total % 4))) {
+            errcode = -5;
+            break;
+        }
+
+        if (out == NULL) {
+            /* the first piece holds the zstd frame header, the gzip trailer is decoded from the end of the text */
+            alloc = zmat_initial_outbuf(inputsize / 4 * 3, 4);
+
+#ifndef NO_ZSTD
+
+            if (zdctx) {
+                unsigned long long content = ZSTD_getFrameContentSize(piece, n);
+
+                /* zstd writes straight into an output buffer that is known not to move */
+                if (content < ZMAT_MAX_ALLOC) {
+                    alloc = (content < ZMAT_MIN_OUTBUF) ? ZMAT_MIN_OUTBUF : (size_t)content + 1;
+                    stable = (ZSTD_DCtx_setParameter(zdctx, ZSTD_d_stableOutBuffer, 1) == 0);
+                }
+            }
+
+#endif
+
+            if (zipid == zmGzip && n >= 2 && piece[0] == 0x1F && piece[1] == 0x8B && (taillen = zmat_base64_tail(inputstr, inputsize, tail)) >= 4) {
+                size_t isize = (size_t)zmat_get_le(tail + taillen - 4, 4);
+
+                if (isize < ZMAT_MAX_ALLOC && isize / 1032 <= inputsize / 4 * 3) {
+                    alloc = (isize < ZMAT_MIN_OUTBUF) ? ZMAT_MIN_OUTBUF : isize + 1;
+                }
+            }
+
+            if (!(out = (unsigned char*)zmat_malloc(al, alloc))) {
+                errcode = -5;
+                break;
+            }
+        }
+
+        if (zs) {
+            zs->next_in = piece;
+            zs->avail_in = (unsigned int)n;
+            zs->next_out = out + outlen;
+            zs->avail_out = 0;
+
+            while (1) {
+                zmat_zstream_feed(zs, piece + n, out + alloc);
+
+                if (zs->avail_out == 0) {
+                    if (++rounds > ZMAT_MAX_DECOMPRESS_ROUNDS || zmat_grow_buf(al, &out, &alloc) != 0) {
+                        errcode = -5;
+                        break;
+                    }
+
+                    zs->next_out = out + outlen;
+                    continue;
+                }
+
+                *ret = inflate(zs, Z_SYNC_FLUSH);
+                outlen = (size_t)(zs->next_out - out);
+
+                if (*ret == Z_STREAM_END) {
+                    ended = 1;
+                    break;
+                }
+
+                if (*ret != Z_OK && *ret != Z_BUF_ERROR) {
+                    errcode = -3;
+                    break;
+                }
+
+                if (zs->avail_in == 0 && zs->avail_out > 0) {
+                    break;
+                }
+            }
+        }
+
+#ifndef NO_ZSTD
+        else {
+            ZSTD_inBuffer zin = {piece, n, 0};
+
+            while (1) {
+                ZSTD_outBuffer zout = {out, alloc, outlen};
+
+                zret = ZSTD_decompressStream(zdctx, &zout, &zin);
+                outlen = zout.pos;
+                *ret = (int)zret;
+
+                /* more frames than the first one announced do not fit: decode the text whole instead */
+                if (stable && (ZSTD_isError(zret) || outlen == alloc)) {
+                    errcode = 1;
+                    break;
+                }
+
+                if (ZSTD_isError(zret)) {
+                    errcode = -9;
+                    break;
+                }
+
+                if (zin.pos == zin.size && outlen < alloc) {
+                    break;
+                }
+
+                if (outlen == alloc && (++rounds > ZMAT_MAX_DECOMPRESS_ROUNDS || zmat_grow_buf(al, &out, &alloc) != 0)) {
+                    errcode = -5;
+                    break;
+                }
+            }
+        }
+
+#endif
+
+        if (errcode == 0 && last && !ended) {
+#ifndef NO_ZSTD
+
+            /* zstd frames may follow each other up to the end of the text */
+            if (zdctx && zret == 0) {
+                break;
+            }
+
+#endif
+            errcode = zs ? -3 : -9;
+        }
+    }
+
+    if (zs && ctx == NULL) {
+        inflateEnd(zs);
+    }
+
+#ifndef NO_ZSTD
+
+    if (zdctx && ctx == NULL) {
+        ZSTD_freeDCtx(zdctx);
+    } else if (zdctx) {
+        ZSTD_DCtx_reset(zdctx, ZSTD_reset_session_and_parameters);
+    }
+
+#endif
+
+    zmat_dealloc(al, piece);
+
+    if (errcode != 0) {
+        zmat_dealloc(al, out);
+        return errcode;
+    }
+
+    zmat_shrink_buf(al, &out, outlen);
+    *outputbuf = out;
+    *outputsize = outlen;
+    return 0;
+}
+
+/**
+ * @brief Compress and base64 encode into text, a buffer of capacity bytes (ZMAT_BASE64)
+ *
+ * zlib, gzip and zstd on one thread go through zmat_base64_pipe_encode(); the
+ * other codecs with an output bound write into the end of text, which is then
+ * encoded in place from its start.
+ *
+ * @param[in] zipid: compression method, without ZMAT_BASE64
+ * @return 0 on success, a zmat error code, or 1 if the method is not handled
+ *         here or the text did not fit
+ */
+
+static int zmat_base64_into(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                            unsigned char* text, const size_t capacity, const int zipid, int* ret, const int iscompress) {
+    size_t bound, len = 0;
+    int errcode;
+
+    *outputsize = 0;
+
+    if (zmat_base64_piped(zipid, inputsize, iscompress)) {
+        return zmat_base64_pipe_encode(ctx, inputsize, inputstr, outputsize, text, capacity, zipid, ret, iscompress);
+    }
+
+    bound = (zipid == zmBase64 || ZMAT_IS_FRAME(zipid) || ZMAT_IS_CONTAINER(zipid)) ? 0 : zmat_outputbound_with(ctx ? &ctx->alloc : &zmat_allocator, inputsize, inputstr, zipid, iscompress);
+
+    if (bound == 0 || capacity < ZMAT_BASE64_SLACK || capacity - ZMAT_BASE64_SLACK < (bound + 2) / 3 * 4) {
+        return 1;
+    }
+
+    if ((errcode = zmat_run_direct(ctx, inputsize, inputstr, &len, text + capacity - bound, bound, zipid, ret, iscompress)) != 0) {
+        return (errcode == -12) ? 1 : errcode;
+    }
+
+    zmat_base64_dispatch();
+    *outputsize = (size_t)(zmat_base64_encode_into(text + capacity - bound, len, text, 1, 1) - text);
+    return 0;
+}
+
+/**
+ * @brief zmat_run/zmat_run_ctx for a zipid carrying ZMAT_BASE64
+ *
+ * Codecs that can not write into the text buffer are run whole, and their
+ * output encoded; base64 text that does not go through the zlib, gzip or zstd
+ * pipelines is decoded whole before the codec runs.
+ */
+
+static int zmat_base64_run(TZMatCtx* ctx, const size_t inputsize, unsigned char* inputstr, size_t* outputsize,
+                           unsigned char** outputbuf, const int zipid, int* ret, const int iscompress) {
+    const TZMatAllocator* al = ctx ? &ctx->alloc : &zmat_allocator;
+    int method = zipid & ~ZMAT_BASE64, errcode;
+    union TZMatFlags flags;
+    unsigned char* buf = NULL;
+    size_t len = 0, bound;
+
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+    flags.iscompress = iscompress;
+
+    if (inputsize == 0) {
+        return -1;
+    }
+
+    if (flags.param.clevel == 0) {
+        if (zmat_base64_piped(method, inputsize, iscompress)
+                && (errcode = zmat_base64_pipe_decode(ctx, inputsize, inputstr, outputsize, outputbuf, method, ret)) <= 0) {
+            return errcode;
+        }
+
+        if (!(buf = zmat_base64_decode(al, inputstr, inputsize, &len, zmat_thread_plan(flags.param.nthread, inputsize)))) {
+            return -5;
+        }
+
+        errcode = zmat_run_ctx(ctx, len, buf, outputsize, outputbuf, method, ret, iscompress);
+        zmat_dealloc(al, buf);
+        return errcode;
+    }
+
+    if ((bound = zmat_outputbound_with(al, inputsize, inputstr, zipid, iscompress)) > 0) {
+        if (!(buf = (unsigned char*)zmat_malloc(al, bound + 1))) {
+            return -5;
+        }
+
+        if ((errcode = zmat_base64_into(ctx, inputsize, inputstr, outputsize, buf, bound, method, ret, iscompress)) == 0) {
+            buf[*outputsize] = '\0';
+            zmat_shrink_buf(al, &buf, *outputsize + 1);
+            *outputbuf = buf;
+            return 0;
+        }
+
+        zmat_dealloc(al, buf);
+        *outputsize = 0;
+
+        if (errcode < 0) {
+            return errcode;
+        }
+    }
+
+    if ((errcode = zmat_run_ctx(ctx, inputsize, inputstr, &len, &buf, method, ret, iscompress)) != 0) {
+        return errcode;
+    }
+
+    *outputbuf = zmat_base64_encode(al, buf, len, outputsize, 1, zmat_thread_plan(flags.param.nthread, len));
+    zmat_dealloc(al, buf);
+    return (*outputbuf == NULL) ? -5 : 0;
+}
+
+#ifndef NO_LZMA
+
+/**
+ * @brief Easylzma compression interface
+ */
+
+struct dataStream {
+    const TZMatAllocator* al;   /* allocator of outData */
+    const unsigned char* inData;
+    size_t inLen;
+    size_t consumed;    /* tracks how many input bytes were read (for multi-member lzip) */
+
+    unsigned char* outData;
+    size_t outLen;
+    size_t outCap;      /* allocated length of outData */
+    int fixed;          /* outData is caller-owned: fail instead of growing past outCap */
+};
+
+/**
+ * @brief Easylzma input callback function
+ */
+
+static int
+inputCallback(void* ctx, void* buf, size_t* size) {
+    size_t rd = 0;
+    struct dataStream* ds = (struct dataStream*) ctx;
+    assert(ds != NULL);
+
+    rd = (ds->inLen < *size) ? ds->inLen : *size;
+
+    if (rd > 0) {
+        memcpy(buf, (void*) ds->inData, rd);
+        ds->inData += rd;
+        ds->inLen -= rd;
+        ds->consumed += rd;
+    }
+
+    *size = rd;
+
+    return 0;
+}
+
+/**
+ * @brief Easylzma output callback function
+ */
+
+static size_t
+outputCallback(void* ctx, const void* buf, size_t size) {
+    struct dataStream* ds = (struct dataStream*) ctx;
+    assert(ds != NULL);
+
+    if (size > ds->outCap - ds->outLen) {
+        size_t newcap = ds->outCap * 2;
+        unsigned char* tmp;
+
+        if (ds->fixed || size > (size_t)(-1) - ds->outLen) {
+            return 0;
+        }
+
+        /* grow geometrically instead of once per decoded chunk */
+        if (newcap < ds->outLen + size) {
+            newcap = ds->outLen + size;
+        }
+
+        if (newcap < ZMAT_MIN_OUTBUF) {
+            newcap = ZMAT_MIN_OUTBUF;
+        }
+
+        tmp = (unsigned char*)zmat_realloc(ds->al, ds->outData, newcap);
+
+        if (tmp == NULL) {
+            /* realloc failed — preserve existing data pointer for caller to free */
+            return 0;
+        }
+
+        ds->outData = tmp;
+        ds->outCap = newcap;
+    }
+
+    if (size > 0) {
+        memcpy((void*) (ds->outData + ds->outLen), buf, size);
+        ds->outLen += size;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Easylzma compression with a caller-owned handle that is configured, run and kept
+ *
+ * @param[in] hand: easylzma compression handle, reused across calls by zmat_run_ctx
+ * @return return the fine grained lzma error code.
+ */
+
+static int
+simpleCompressHandle(const TZMatAllocator* al, elzma_compress_handle hand, elzma_file_format format,
+                     const unsigned char* inData, size_t inLen,
+                     unsigned char** outData, size_t* outLen, int level, int nthread) {
+    int rc;
+    unsigned int dictsize = (1 << 20); /* 1mb */
+
+    /* a dictionary larger than the input is never used, but its match finder
+     * tables are cleared on every run; shrink it for small inputs (4kb minimum) */
+    while (dictsize > (1 << 12) && (dictsize >> 1) >= inLen) {
+        dictsize >>= 1;
+    }
+
+    /* set thread count (clamped to 1–2 by SDK; effective only with COMPRESS_MF_MT) */
+    elzma_compress_set_numthreads(hand, nthread);
+
+    rc = elzma_compress_config(hand, ELZMA_LC_DEFAULT,
+                               ELZMA_LP_DEFAULT, ELZMA_PB_DEFAULT,
+                               ((level > 0) ? 5 : -level), dictsize,
+                               format, inLen);
+
+    if (rc != ELZMA_E_OK) {
+        return rc;
+    }
+
+    /* now run the compression */
+    {
+        struct dataStream ds;
+        ds.al = al;
+        ds.inData = inData;
+        ds.inLen = inLen;
+        ds.consumed = 0;
+        ds.outData = NULL;
+        ds.outLen = 0;
+        ds.outCap = 0;
+        ds.fixed = 0;
+
+        rc = elzma_compress_run(hand, inputCallback, (void*) &ds,
+                                outputCallback, (void*) &ds,
+                                NULL, NULL);
+
+        if (rc != ELZMA_E_OK) {
+            zmat_dealloc(al, ds.outData);
+
+            return rc;
+        }
+
+        zmat_shrink_buf(al, &ds.outData, ds.outLen);
+        *outData = ds.outData;
+        *outLen = ds.outLen;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Easylzma interface to perform compression
+ *
+ * @param[in] format: output format (0 for lzip format, 1 for lzma-alone format)
+ * @param[in] inData: input stream buffer pointer
+ * @param[in] inLen: input stream buffer length
+ * @param[in] outData: output stream buffer pointer
+ * @param[in] outLen: output stream buffer length
+ * @param[in] level: positive number: use default compression level (5);
+ *             negative interger: set compression level (-1, less, to -9, more compression)
+ * @return return the fine grained lzma error code.
+ */
+
+int
+simpleCompress(const TZMatAllocator* al, elzma_file_format format, const unsigned char* inData,
+               size_t inLen, unsigned char** outData,
+               size_t* outLen, int level, int nthread) {
+    int rc;
+    elzma_compress_handle hand;
+
+    /* allocate compression handle */
+    hand = elzma_compress_alloc();
+
+    if (hand == NULL) {
+        return ELZMA_E_COMPRESS_ERROR;
+    }
+
+    elzma_compress_set_allocation_callbacks(hand, zmat_elzma_alloc, (void*)al, zmat_elzma_free, (void*)al);
+
+    rc = simpleCompressHandle(al, hand, format, inData, inLen, outData, outLen, level, nthread);
+
+    elzma_compress_free(&hand);
+
+    return rc;
+}
+
+
+
+/**
+ * @brief Easylzma interface to perform decompression
+ *
+ * @param[in] format: output format (0 for lzip format, 1 for lzma-alone format)
+ * @param[in] inData: input stream buffer pointer
+ * @param[in] inLen: input stream buffer length
+ * @param[in,out] outData: output stream buffer pointer; if not NULL on entry, a
+ *             caller-owned buffer of outCap bytes to decode into
+ * @param[out] outLen: output stream buffer length
+ * @param[in] outCap: length of *outData if given, otherwise the planned output length (0 if unknown)
+ * @return return the fine grained lzma error code.
+ */
+
+int
+simpleDecompress(const TZMatAllocator* al, elzma_file_format format, const unsigned char* inData,
+                 size_t inLen, unsigned char** outData,
+                 size_t* outLen, size_t outCap, size_t* consumed) {
+    int rc;
+    elzma_decompress_handle hand;
+
+    hand = elzma_decompress_alloc();
+
+    if (hand == NULL) {
+        return ELZMA_E_DECOMPRESS_ERROR;
+    }
+
+    elzma_decompress_set_allocation_callbacks(hand, zmat_elzma_alloc, (void*)al, zmat_elzma_free, (void*)al);
+
+    /* now run the decompression */
+    {
+        struct dataStream ds;
+        ds.al = al;
+        ds.inData = inData;
+        ds.inLen = inLen;
+        ds.consumed = 0;
+        ds.outData = *outData;
+        ds.outLen = 0;
+        ds.outCap = 0;
+        ds.fixed = (*outData != NULL);
+
+        /* decode into the caller's buffer, or allocate the planned length once */
+        if (ds.fixed) {
+            ds.outCap = outCap;
+        } else if (outCap > 0 && outCap <= ZMAT_MAX_ALLOC && (ds.outData = (unsigned char*)zmat_malloc(al, outCap))) {
+            ds.outCap = outCap;
+        }
+
+        rc = elzma_decompress_run(hand, inputCallback, (void*) &ds,
+                                  outputCallback, (void*) &ds, format);
+
+        if (consumed != NULL) {
+            *consumed = ds.consumed;
+        }
+
+        if (rc != ELZMA_E_OK) {
+            if (!ds.fixed) {
+                zmat_dealloc(al, ds.outData);
+            }
+
+            elzma_decompress_free(&hand);
+            return rc;
+        }
+
+        elzma_decompress_free(&hand);
+
+        if (!ds.fixed && ds.outLen < ds.outCap) {
+            zmat_shrink_buf(al, &ds.outData, ds.outLen);
+        }
+
+        *outData = ds.outData;
+        *outLen = ds.outLen;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Upgrade a v0 lzip member to lzip v1
+ *
+ * Patch the version byte (byte[4]) and append an 8-byte member_size field
+ * after the standard 12-byte footer. The v0 decompressor ignores the version
+ * byte and reads only 12 footer bytes, so v1 members are backward-compatible
+ * with the existing code. Backward-scanning the member_size fields lets the
+ * decompressor locate each member boundary precisely.
+ *
+ * @return 0 on success, -5 if the buffer can not be grown (left as v0)
+ */
+
+static int zmat_lzip_to_v1(const TZMatAllocator* al, unsigned char** buf, size_t* len) {
+    size_t v1_size = *len + 8;
+    unsigned char* tmp;
+
+    if (*buf == NULL || *len <= 18) {
+        return 0;
+    }
+
+    tmp = (unsigned char*)zmat_realloc(al, *buf, v1_size);
+
+    if (tmp == NULL) {
+        return -5;
+    }
+
+    tmp[4] = 1;    /* version 1 */
+
+    /* write member_size as little-endian uint64 */
+    {
+        int k;
+
+        for (k = 0; k < 8; k++) {
+            tmp[*len + k] = (unsigned char)(v1_size >> (8 * k));
+        }
+    }
+
+    *buf = tmp;
+    *len = v1_size;
+    return 0;
+}
+
+#ifdef ZMAT_USE_LZMA_SDK
+
+/* -----------------------------------------------------------------------
+ * XZ stream wrappers — ISeqOutStream / ISeqInStream must have the
+ * vtable function pointer as their FIRST field (C-style interface).
+ * ----------------------------------------------------------------------- */
+
+typedef struct {
+    ISeqOutStream   vt;  /* first field — SDK casts the pointer to ISeqOutStreamPtr */
+    struct dataStream* ds;
+} ZmatXzOutStream;
+
+typedef struct {
+    ISeqInStream    vt;  /* first field */
+    struct dataStream* ds;
+} ZmatXzInStream;
+
+static size_t zmat_xz_write(ISeqOutStreamPtr p, const void* buf, size_t size) {
+    ZmatXzOutStream* s = (ZmatXzOutStream*)(void*)p;
+    return outputCallback(s->ds, buf, size);
+}
+
+static SRes zmat_xz_read(ISeqInStreamPtr p, void* buf, size_t* size) {
+    ZmatXzInStream* s = (ZmatXzInStream*)(void*)p;
+    return (SRes)inputCallback(s->ds, buf, size);
+}
+
+/**
+ * @brief Initialize the CRC32/CRC64 tables used by the xz and lzip check fields
+ *
+ * easylzma only initializes the CRC32 table inside its own compress/decompress
+ * calls; the SDK decoders used directly by zmat need both tables ready.
+ */
+static void zmat_lzma_crc_init(void) {
+    CrcGenerateTable();
+    Crc64GenerateTable();
+}
+
+/**
+ * @brief XZ compression using LZMA2 with native multi-thread block encoding
+ *
+ * nthread sets the block size and so the output; nworker only bounds the number
+ * of block threads the SDK runs at once.
+ */
+int
+xzCompress(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
+           unsigned char** outData, size_t* outLen,
+           int level, int nthread, int nworker) {
+    CXzEncHandle enc;
+    ZmatSzAlloc sz;
+    SRes rc;
+
+    zmat_sz_init(&sz, al);
+    enc = XzEnc_Create(&sz.vt, &sz.vt);
+
+    if (!enc) {
+        return SZ_ERROR_MEM;
+    }
+
+    rc = xzCompressHandle(al, enc, inData, inLen, outData, outLen, level, nthread, nworker);
+
+    XzEnc_Destroy(enc);
+    return rc;
+}
+
+/**
+ * @brief XZ compression with a caller-owned encoder, reused across calls by zmat_run_ctx
+ */
+static int
+xzCompressHandle(const TZMatAllocator* al, CXzEncHandle enc, const unsigned char* inData, size_t inLen,
+                 unsigned char** outData, size_t* outLen,
+                 int level, int nthread, int nworker) {
+    CXzProps props;
+    SRes rc;
+    struct dataStream ds;
+    ZmatXzOutStream outStream;
+    ZmatXzInStream  inStream;
+
+    XzProps_Init(&props);
+    props.lzma2Props.lzmaProps.level      = (level > 0) ? 5 : (-level);
+    props.lzma2Props.lzmaProps.numThreads = 1;              /* no match-finder MT: all parallelism at block level */
+    /* block-level MT; the SDK writes the same stream for any count >= 2, but not for 1 */
+    props.lzma2Props.numBlockThreads_Max  = (nthread > 1 && nworker < 2) ? 2 : nworker;
+    /* explicit block size: split input evenly across threads, 1 MB minimum.
+     * avoids the default 128 MB auto block size (dictSize*4 at level 5)
+     * which leaves small inputs as a single solid block with zero parallelism. */
+    {
+        size_t blk = (inLen + (size_t)nthread - 1) / (size_t)nthread;
+
+        if (blk < (1u << 20)) {
+            blk = (1u << 20);
+        }
+
+        props.lzma2Props.blockSize = (UInt64)blk;
+    }
+    /* lets the SDK shrink the dictionary (and its per-run table setup) for small inputs */
+    props.reduceSize = (UInt64)inLen;
+    props.lzma2Props.lzmaProps.reduceSize = (UInt64)inLen;
+    props.checkId = XZ_CHECK_CRC32;
+
+    ds.al       = al;
+    ds.inData   = inData;
+    ds.inLen    = inLen;
+    ds.consumed = 0;
+    ds.outData  = NULL;
+    ds.outLen   = 0;
+    ds.outCap   = 0;
+    ds.fixed    = 0;
+
+    outStream.vt.Write = zmat_xz_write;
+    outStream.ds       = &ds;
+    inStream.vt.Read   = zmat_xz_read;
+    inStream.ds        = &ds;
+
+    zmat_lzma_crc_init();
+    rc = XzEnc_SetProps(enc, &props);
+
+    if (rc == SZ_OK) {
+        XzEnc_SetDataSize(enc, (UInt64)inLen);
+        rc = XzEnc_Encode(enc, &outStream.vt, &inStream.vt, NULL);
+    }
+
+    if (rc != SZ_OK) {
+        zmat_dealloc(al, ds.outData);
+        return rc;
+    }
+
+    zmat_shrink_buf(al, &ds.outData, ds.outLen);
+    *outData = ds.outData;
+    *outLen  = ds.outLen;
+    return SZ_OK;
+}
+
+/**
+ * @brief Multi-threaded XZ decompression using the SDK XzDecMt block decoder
+ *
+ * Blocks that carry their packed and unpacked sizes in the block header (as
+ * written by the multi-block encoder) are decoded on up to nworker threads; the
+ * SDK falls back to single-thread decoding for other streams. The output is
+ * appended to *accum of *cap bytes, which is grown only if it is not fixed.
+ */
+static SRes
+xzDecompressMT(const TZMatAllocator* al, ZmatSzAlloc* sz, const unsigned char* inData, size_t inLen,
+               unsigned char** accum, size_t* cap, size_t* total, int fixed, int nworker) {
+    CXzDecMtHandle dec;
+    CXzDecMtProps props;
+    CXzStatInfo stat;
+    struct dataStream ds;
+    ZmatXzOutStream outStream;
+    ZmatXzInStream  inStream;
+    int isMT = 0;
+    SRes rc;
+
+    if (!(dec = XzDecMt_Create(&sz->vt, &sz->vt))) {
+        return SZ_ERROR_MEM;
+    }
+
+    XzDecMtProps_Init(&props);
+    props.numThreads = (unsigned)nworker;
+    /* the compressed blocks are already in memory, read them in larger pieces */
+    props.inBufSize_MT = (1 << 20);
+    props.inBufSize_ST = (1 << 20);
+
+    ds.al       = al;
+    ds.inData   = inData;
+    ds.inLen    = inLen;
+    ds.consumed = 0;
+    ds.outData  = *accum;
+    ds.outLen   = 0;
+    ds.outCap   = *cap;
+    ds.fixed    = fixed;
+
+    outStream.vt.Write = zmat_xz_write;
+    outStream.ds       = &ds;
+    inStream.vt.Read   = zmat_xz_read;
+    inStream.ds        = &ds;
+
+    rc = XzDecMt_Decode(dec, &props, NULL, 1, &outStream.vt, &inStream.vt, &stat, &isMT, NULL);
+    XzDecMt_Destroy(dec);
+
+    /* the output callback may have moved or grown the buffer before failing */
+    *accum = ds.outData;
+    *cap   = ds.outCap;
+    *total = ds.outLen;
+
+    if (rc == SZ_ERROR_WRITE && fixed) {
+        rc = SZ_ERROR_OUTPUT_EOF;
+    } else if (rc == SZ_ERROR_WRITE) {
+        rc = SZ_ERROR_MEM;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief XZ decompression using XzUnpacker streaming decoder
+ *
+ * The decoder writes straight into the output buffer: either the caller-owned
+ * *outData of outCap bytes, or a buffer allocated once with the planned length
+ * outCap (usually read from the xz index) and grown only if that is too small.
+ * With nthread > 1, multi-block streams are decoded by xzDecompressMT instead.
+ */
+int
+xzDecompress(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
+             unsigned char** outData, size_t* outLen, size_t outCap, int nthread) {
+    CXzUnpacker xz;
+    ZmatSzAlloc sz;
+    ECoderStatus status = CODER_STATUS_NOT_SPECIFIED;
+    SRes rc = SZ_OK;
+    int fixed = (*outData != NULL), nworker;
+    unsigned char* accum = *outData;
+    size_t cap = outCap;
+    size_t total = 0;
+    const Byte* src = (const Byte*)inData;
+    SizeT srcLeft = (SizeT)inLen;
+
+    if (!fixed) {
+        if (cap == 0 || cap > ZMAT_MAX_ALLOC) {
+            cap = zmat_initial_outbuf(inLen, 4);
+        }
+
+        if (!(accum = (unsigned char*)zmat_malloc(al, cap))) {
+            return SZ_ERROR_MEM;
+        }
+    }
+
+    zmat_lzma_crc_init();
+    zmat_sz_init(&sz, al);
+    nworker = zmat_thread_acquire(nthread);
+
+    if (nworker > 1) {
+        rc = xzDecompressMT(al, &sz, inData, inLen, &accum, &cap, &total, fixed, nworker);
+        zmat_thread_release(nthread);
+
+        if (rc != SZ_OK) {
+            if (!fixed) {
+                zmat_dealloc(al, accum);
+            }
+
+            return rc;
+        }
+
+        if (!fixed && total < cap) {
+            zmat_shrink_buf(al, &accum, total);
+        }
+
+        *outData = accum;
+        *outLen  = total;
+        return SZ_OK;
+    }
+
+    zmat_thread_release(nthread);
+    XzUnpacker_Construct(&xz, &sz.vt);
+    XzUnpacker_Init(&xz);
+
+    while (srcLeft > 0 || status == CODER_STATUS_NOT_FINISHED) {
+        Byte spare;
+        int full = (total == cap);
+        SizeT destLen = full ? 1 : cap - total;
+        SizeT srcUsed = srcLeft;
+
+        /* once the buffer is full, keep decoding into a spare byte: the index
+         * and footer still need to be read, and any output means a larger stream */
+        rc = XzUnpacker_Code(&xz, full ? &spare : accum + total, &destLen, src, &srcUsed,
+                             (srcLeft == 0) ? 1 : 0,
+                             CODER_FINISH_ANY, &status);
+
+        if (rc != SZ_OK) {
+            break;
+        }
+
+        if (full && destLen > 0) {
+            if (fixed) {
+                rc = SZ_ERROR_OUTPUT_EOF;
+                break;
+            }
+
+            if (zmat_grow_buf(al, &accum, &cap) != 0) {
+                rc = SZ_ERROR_MEM;
+                break;
+            }
+
+            accum[total] = spare;
+        }
+
+        total   += destLen;
+        src     += srcUsed;
+        srcLeft -= srcUsed;
+
+        if (status == CODER_STATUS_FINISHED_WITH_MARK) {
+            break;
+        }
+
+        if (srcUsed == 0 && destLen == 0) {
+            break;    /* no progress — avoid infinite loop */
+        }
+    }
+
+    if (rc == SZ_OK && !XzUnpacker_IsStreamWasFinished(&xz)) {
+        rc = SZ_ERROR_DATA;
+    }
+
+    XzUnpacker_Free(&xz);
+
+    if (rc != SZ_OK) {
+        if (!fixed) {
+            zmat_dealloc(al, accum);
+        }
+
+        return rc;
+    }
+
+    if (!fixed && total < cap) {
+        zmat_shrink_buf(al, &accum, total);
+    }
+
+    *outData = accum;
+    *outLen  = total;
+    return SZ_OK;
+}
+
+/* -----------------------------------------------------------------------
+ * Option 3: parallel lzip — compress chunks independently, concatenate
+ * ----------------------------------------------------------------------- */
+
+typedef struct {
+    const TZMatAllocator* al;
+    const unsigned char* in;
+    size_t               inLen;
+    unsigned char*       out;
+    size_t               outLen;
+    int                  level;
+    int                  rc;
+} LzipChunk;
+
+static void lzip_compress_chunk(void* arg, size_t i) {
+    LzipChunk* c = (LzipChunk*)arg + i;
+    c->rc = simpleCompress(c->al, ELZMA_lzip, c->in, c->inLen,
+                           &c->out, &c->outLen, c->level, 1);
+
+    /* Upgrade v0 → lzip v1 so that the decompressor can locate each member
+     * boundary, fixing the consumed-overshoot bug; if realloc fails, leave
+     * as v0 — single-member fallback still works */
+    if (c->rc == ELZMA_E_OK) {
+        zmat_lzip_to_v1(c->al, &c->out, &c->outLen);
+    }
+}
+
+/**
+ * @brief Compress nthread lzip members in parallel on up to nworker pool threads
+ *
+ * The member layout only depends on nthread, so the output is the same for any nworker.
+ */
+int
+simpleCompressLzipMT(const TZMatAllocator* al, const unsigned char* inData, size_t inLen,
+                     unsigned char** outData, size_t* outLen,
+                     int level, int nthread, int nworker) {
+    if (nthread <= 1 || inLen == 0) {
+        return simpleCompress(al, ELZMA_lzip, inData, inLen,
+                              outData, outLen, level, 1);
+    }
+
+    size_t chunk = (inLen + (size_t)nthread - 1) / (size_t)nthread;
+
+    /* Require at least 1 KB per chunk to make parallelism worthwhile.
+     * For small inputs, fall back to single-thread (produces standard v0). */
+    if (chunk < 1024) {
+        return simpleCompress(al, ELZMA_lzip, inData, inLen,
+                              outData, outLen, level, 1);
+    }
+
+    LzipChunk*  chunks  = (LzipChunk*)zmat_malloc(al, (size_t)nthread * sizeof(LzipChunk));
+
+    if (!chunks) {
+        return ELZMA_E_COMPRESS_ERROR;
+    }
+
+    memset(chunks, 0, (size_t)nthread * sizeof(LzipChunk));
+
+    int i;
+
+    for (i = 0; i < nthread; i++) {
+        chunks[i].al    = al;
+        chunks[i].in    = inData + (size_t)i * chunk;
+        chunks[i].inLen = ((size_t)i == (size_t)nthread - 1)
+                          ? (inLen - (size_t)i * chunk) : chunk;
+        chunks[i].level = level;
+    }
+
+    zmat_pool_run(lzip_compress_chunk, chunks, (size_t)nthread, nworker);
+
+    size_t total = 0;
+    int rc = ELZMA_E_OK;
+
+    for (i = 0; i < nthread; i++) {
+        if (chunks[i].rc != ELZMA_E_OK) {
+            rc = chunks[i].rc;
+        }
+
+        total += chunks[i].outLen;
+    }
+
+    if (rc != ELZMA_E_OK) {
+        for (i = 0; i < nthread; i++) {
+            zmat_dealloc(al, chunks[i].out);
+        }
+
+        zmat_dealloc(al, chunks);
+        return rc;
+    }
+
+    unsigned char* buf = (unsigned char*)zmat_malloc(al, total);
+
+    if (!buf) {
+        for (i = 0; i < nthread; i++) {
+            zmat_dealloc(al, chunks[i].out);
+        }
 
-            if (*outputbuf == NULL) {
-                *outputsize = 0;
-                return -5;
-            }
-        } else if (zipid == zmZlib || zipid == zmGzip) {
-            /**
-              * zlib (.zip) or gzip (.gz) compression
-              */
-            if (zipid == zmZlib) {
-                if (deflateInit(&zs,  (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel)) != Z_OK) {
-                    return -2;
-                }
-            } else {
-#ifdef NO_ZLIB
-                /* Initialize streaming buffer context (memset clears all fields) */
-                memset(&zs, '\0', sizeof(zs));
-                zs.next_in  = inputstr;
-                zs.avail_in = inputsize;
+        zmat_dealloc(al, chunks);
+        return ELZMA_E_COMPRESS_ERROR;
+    }
 
-                if (deflateInit2(&zs, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel), Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
-                    return -2;
-                }
+    size_t pos = 0;
 
-#else
+    for (i = 0; i < nthread; i++) {
+        memcpy(buf + pos, chunks[i].out, chunks[i].outLen);
+        zmat_dealloc(al, chunks[i].out);
+        pos += chunks[i].outLen;
+    }
 
-                if (deflateInit2(&zs, (clevel > 0) ? Z_DEFAULT_COMPRESSION : (-clevel), Z_DEFLATED, 15 | 16, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
-                    return -2;
-                }
+    zmat_dealloc(al, chunks);
+    *outData = buf;
+    *outLen  = total;
+    return ELZMA_E_OK;
+}
+
+#endif  /* ZMAT_USE_LZMA_SDK */
 
 #endif
-            }
 
 #ifdef NO_ZLIB
+/*
+ * miniz based gzip compression code was adapted based on the following
+ * https://github.com/atheriel/fluent-bit/blob/8f0002b36601006240d50ea3c86769629d99b1e8/src/flb_gzip.c
+ */
 
-            if (zipid == zmGzip) {
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
 
-                /*
-                 * miniz based gzip compression code was adapted based on the following
-                 * https://github.com/atheriel/fluent-bit/blob/8f0002b36601006240d50ea3c86769629d99b1e8/src/flb_gzip.c
-                 */
-                int flush = Z_NO_FLUSH;
-                void* out_buf;
-                size_t out_size;
-                unsigned char* pb;
-                const unsigned char gzip_magic_header [] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+typedef enum {
+    FTEXT    = 1,
+    FHCRC    = 2,
+    FEXTRA   = 4,
+    FNAME    = 8,
+    FCOMMENT = 16
+} miniz_tinf_gzip_flag;
 
-                /* use deflateBound for safe sizing, plus header + footer */
-                out_size = deflateBound(&zs, inputsize) + GZIP_HEADER_SIZE + 8;
+static unsigned int read_le16(const unsigned char* p) {
+    return ((unsigned int) p[0]) | ((unsigned int) p[1] << 8);
+}
 
-                out_buf = (unsigned char*)malloc(out_size);
+static unsigned int read_le32(const unsigned char* p) {
+    return ((unsigned int) p[0])
+           | ((unsigned int) p[1] << 8)
+           | ((unsigned int) p[2] << 16)
+           | ((unsigned int) p[3] << 24);
+}
 
-                if (out_buf == NULL) {
-                    deflateEnd(&zs);
-                    return -5;
-                }
+/* Uncompress (inflate) GZip data */
+int miniz_gzip_uncompress(const TZMatAllocator* al, void* in_data, size_t in_len,
+                          void** out_data, size_t* out_len) {
+    int status, zrc;
+    unsigned char* p;
+    void* out_buf;
+    size_t out_size = 0;
+    void* zip_data;
+    size_t zip_len;
+    unsigned char flg;
+    unsigned int xlen, hcrc;
+    unsigned int dlen, crc;
+    mz_ulong crc_out;
+    mz_stream stream;
+    const unsigned char* start;
 
-                memcpy(out_buf, gzip_magic_header, GZIP_HEADER_SIZE);
-                pb = (unsigned char*) out_buf + GZIP_HEADER_SIZE;
+    *out_data = NULL;
+    *out_len = 0;
+
+    /* Minimal length: header + crc32 */
+    if (in_len < 18) {
+        return -1;
+    }
+
+    /* Magic bytes */
+    p = (unsigned char*)in_data;
+
+    if (p[0] != 0x1F || p[1] != 0x8B) {
+        return -2;
+    }
+
+    if (p[2] != 8) {
+        return -3;
+    }
+
+    /* Flag byte */
+    flg = p[3];
+
+    /* Reserved bits */
+    if (flg & 0xE0) {
+        return -4;
+    }
+
+    /* Skip base header of 10 bytes */
+    start = p + GZIP_HEADER_SIZE;
+
+    /* Skip extra data if present */
+    if (flg & FEXTRA) {
+        if (start + 2 > p + in_len) {
+            return -5;
+        }
+
+        xlen = read_le16(start);
+
+        if (xlen > in_len - (start - p) - 2) {
+            return -5;
+        }
+
+        start += xlen + 2;
+    }
+
+    /* Skip file name if present */
+    if (flg & FNAME) {
+        do {
+            if (start - p >= (ptrdiff_t)in_len) {
+                return -6;
+            }
+        } while (*start++);
+    }
+
+    /* Skip file comment if present */
+    if (flg & FCOMMENT) {
+        do {
+            if (start - p >= (ptrdiff_t)in_len) {
+                return -6;
+            }
+        } while (*start++);
+    }
+
+    /* Check header crc if present */
+    if (flg & FHCRC) {
+        if (start - p > (ptrdiff_t)(in_len - 2)) {
+            return -7;
+        }
+
+        hcrc = read_le16(start);
+        crc = mz_crc32(MZ_CRC32_INIT, p, start - p) & 0x0000FFFF;
+
+        if (hcrc != crc) {
+            return -8;
+        }
+
+        start += 2;
+    }
+
+    /* Get decompressed length */
+    dlen = read_le32(&p[in_len - 4]);
+
+    /* Get CRC32 checksum of original data */
+    crc = read_le32(&p[in_len - 8]);
+
+    /* Decompress data */
+    if ((p + in_len) - start < 8) {
+        return -9;
+    }
 
-                while (1) {
-                    zs.next_out  = pb + zs.total_out;
-                    zs.avail_out = out_size - GZIP_HEADER_SIZE - 8 - zs.total_out;
+    /* Allocate outgoing buffer, ISIZE is the length modulo 2^32 and only a first guess */
+    out_size = (dlen < ZMAT_MIN_OUTBUF) ? ZMAT_MIN_OUTBUF : dlen;
+    out_buf = zmat_malloc(al, out_size);
+
+    if (!out_buf) {
+        return -10;
+    }
+
+    /* Map zip content */
+    zip_data = (unsigned char*) start;
+    zip_len = (p + in_len) - start - 8;
+
+    zmat_zstream_init(&stream, al);
+
+    status = mz_inflateInit2(&stream, -Z_DEFAULT_WINDOW_BITS);
+
+    if (status != MZ_OK) {
+        zmat_dealloc(al, out_buf);
+        return -11;
+    }
+
+    status = zmat_inflate_all(al, &stream, (const unsigned char*)zip_data, zip_len, (unsigned char**)&out_buf, &out_size, out_len, &zrc);
+
+    /* terminate the stream, it's not longer required */
+    mz_inflateEnd(&stream);
+
+    if (status != 0) {
+        *out_len = 0;
+        return -12;
+    }
+
+    if ((*out_len & 0xFFFFFFFFu) != dlen) {
+        zmat_dealloc(al, out_buf);
+        *out_len = 0;
+        return -13;
+    }
+
+    /* Validate message CRC vs inflated data CRC */
+    crc_out = mz_crc32(MZ_CRC32_INIT, (unsigned char*)out_buf, *out_len);
+
+    if (crc_out != crc) {
+        zmat_dealloc(al, out_buf);
+        *out_len = 0;
+        return -14;
+    }
+
+    /* set the uncompressed data */
+    *out_data = out_buf;
+
+    return 0;
+}
+#endif
+
+/* -----------------------------------------------------------------------
+ * Incremental (streaming) interface: zmat_stream_init/update/finish
+ *
+ * Streaming codecs keep only a bounded amount of state between calls:
+ * zlib/gzip/zstd/lzma/xz-decoding use the native push APIs, while the
+ * block based encoders (lz4 frames, blosc2, lzip, xz) buffer at most one
+ * window of ZMAT_STREAM_WINDOW bytes before emitting an independent block.
+ * ----------------------------------------------------------------------- */
+
+/**
+ * @brief Growable byte buffer used for stream output and pending input
+ */
+
+typedef struct {
+    unsigned char* buf;
+    size_t len;
+    size_t cap;
+    const TZMatAllocator* al;   /**< allocator that owns buf */
+} ZmatBuffer;
+
+/**
+ * @brief Make room for at least extra more bytes in a ZmatBuffer
+ *
+ * @return 0 on success, -5 on failure (the buffer content is untouched)
+ */
+
+static int zmat_buffer_reserve(ZmatBuffer* b, size_t extra) {
+    size_t newcap;
+    unsigned char* tmp;
+
+    if (extra <= b->cap - b->len) {
+        return 0;
+    }
+
+    if (extra > ZMAT_MAX_ALLOC - b->len) {
+        return -5;
+    }
+
+    newcap = (b->cap < ZMAT_STREAM_CHUNK) ? ZMAT_STREAM_CHUNK : b->cap;
+
+    while (newcap - b->len < extra) {
+        newcap = (newcap > ZMAT_MAX_ALLOC / 2) ? ZMAT_MAX_ALLOC : newcap * 2;
+    }
+
+    tmp = (unsigned char*)zmat_realloc(b->al, b->buf, newcap);
+
+    if (tmp == NULL) {
+        return -5;
+    }
 
-                    if (zs.avail_in == 0) {
-                        flush = Z_FINISH;
-                    }
+    b->buf = tmp;
+    b->cap = newcap;
+    return 0;
+}
 
-                    *ret = deflate(&zs, flush);
+static int zmat_buffer_append(ZmatBuffer* b, const void* data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
 
-                    if (*ret == Z_STREAM_END) {
-                        break;
-                    } else if (*ret != Z_OK) {
-                        deflateEnd(&zs);
-                        free(out_buf);
-                        return -3;
-                    }
-                }
+    if (zmat_buffer_reserve(b, len) != 0) {
+        return -5;
+    }
 
-                if (deflateEnd(&zs) != Z_OK) {
-                    free(out_buf);
-                    return -3;
-                }
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+    return 0;
+}
 
-                *outputsize = zs.total_out;
+#if !defined(NO_LZMA) && !defined(_WIN32)
 
-                /* Construct the gzip checksum (CRC32 footer) */
-                int footer_start = GZIP_HEADER_SIZE + *outputsize;
-                pb = (unsigned char*) out_buf + footer_start;
+/**
+ * @brief Rendezvous between zmat_stream_update() and an easylzma encoder thread
+ *
+ * easylzma only offers a pull-style (callback) encoder; to make it push-style,
+ * elzma_compress_run() runs in a helper thread whose read callback blocks until
+ * the caller supplies the next input buffer (or signals the end of input).
+ */
 
-                mz_ulong crc = mz_crc32(MZ_CRC32_INIT, inputstr, inputsize);
-                *pb++ = crc & 0xFF;
-                *pb++ = (crc >> 8) & 0xFF;
-                *pb++ = (crc >> 16) & 0xFF;
-                *pb++ = (crc >> 24) & 0xFF;
-                *pb++ = inputsize & 0xFF;
-                *pb++ = (inputsize >> 8) & 0xFF;
-                *pb++ = (inputsize >> 16) & 0xFF;
-                *pb++ = (inputsize >> 24) & 0xFF;
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const unsigned char* feed;   /**< input block currently offered to the encoder */
+    size_t feedlen;              /**< bytes of feed not yet read by the encoder */
+    int eof;                     /**< set when no more input will be supplied */
+    int done;                    /**< set when elzma_compress_run() has returned */
+    int joined;                  /**< set once the thread has been joined */
+    int rc;                      /**< easylzma return code */
+    ZmatBuffer out;              /**< encoded bytes not yet handed to the caller */
+    elzma_compress_handle hand;
+} ZmatLzmaBridge;
 
-                /* update the final output buffer size */
-                *outputsize += GZIP_HEADER_SIZE + 8;
-                *outputbuf = (unsigned char*)out_buf;
+static int zmat_bridge_read(void* ctx, void* buf, size_t* size) {
+    ZmatLzmaBridge* b = (ZmatLzmaBridge*)ctx;
+    size_t rd;
 
-                /* shrink to actual size */
-                zmat_shrink_buf(outputbuf, *outputsize);
-            } else {
-#endif
-                size_t bound = deflateBound(&zs, inputsize);
-                *outputbuf = (unsigned char*)malloc(bound);
+    pthread_mutex_lock(&b->lock);
 
-                if (*outputbuf == NULL) {
-                    deflateEnd(&zs);
-                    return -5;
-                }
+    while (b->feedlen == 0 && !b->eof) {
+        pthread_cond_wait(&b->cond, &b->lock);
+    }
 
-                zs.avail_in = inputsize;
-                zs.next_in = (Bytef*)inputstr;
-                zs.avail_out = bound;
-                zs.next_out =  (Bytef*)(*outputbuf);
+    rd = (b->feedlen < *size) ? b->feedlen : *size;
 
-                *ret = deflate(&zs, Z_FINISH);
-                *outputsize = zs.total_out;
+    if (rd > 0) {
+        memcpy(buf, b->feed, rd);
+        b->feed += rd;
+        b->feedlen -= rd;
 
-                if (*ret != Z_STREAM_END && *ret != Z_OK) {
-                    deflateEnd(&zs);
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                    *outputsize = 0;
-                    return -3;
-                }
+        if (b->feedlen == 0) {
+            pthread_cond_broadcast(&b->cond);
+        }
+    }
 
-                deflateEnd(&zs);
+    pthread_mutex_unlock(&b->lock);
+    *size = rd;
+    return 0;
+}
 
-                /* shrink to actual size */
-                zmat_shrink_buf(outputbuf, *outputsize);
-#ifdef NO_ZLIB
-            }
+static size_t zmat_bridge_write(void* ctx, const void* buf, size_t size) {
+    ZmatLzmaBridge* b = (ZmatLzmaBridge*)ctx;
+    int res;
 
-#endif
-#ifndef NO_LZMA
-        } else if (zipid == zmLzma || zipid == zmLzip) {
-            /**
-              * lzma (.lzma) or lzip (.lzip) compression
-              * for lzip with nthread>1: compress chunks in parallel (Option 3)
-              */
-#if defined(ZMAT_USE_LZMA_SDK) && !defined(_WIN32)
-            if (zipid == zmLzip && nthread > 1) {
-                *ret = simpleCompressLzipMT((unsigned char*)inputstr, inputsize,
-                                            outputbuf, outputsize, clevel, nthread);
-            } else
-#endif
-            {
-                *ret = simpleCompress((elzma_file_format)(zipid - 3), (unsigned char*)inputstr,
-                                      inputsize, outputbuf, outputsize, clevel, nthread);
-            }
+    pthread_mutex_lock(&b->lock);
+    res = zmat_buffer_append(&b->out, buf, size);
+    pthread_mutex_unlock(&b->lock);
+    return (res == 0) ? size : 0;
+}
 
-            if (*ret != ELZMA_E_OK) {
-                if (*outputbuf) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                }
+static void* zmat_bridge_main(void* arg) {
+    ZmatLzmaBridge* b = (ZmatLzmaBridge*)arg;
+    int rc = elzma_compress_run(b->hand, zmat_bridge_read, (void*)b,
+                                zmat_bridge_write, (void*)b, NULL, NULL);
 
-                *outputsize = 0;
-                return -4;
-            }
+    pthread_mutex_lock(&b->lock);
+    b->rc = rc;
+    b->done = 1;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
 
 #endif
-#if defined(ZMAT_USE_LZMA_SDK) && !defined(NO_LZMA)
-        } else if (zipid == zmXz) {
-            /**
-              * XZ (.xz) compression using LZMA2 with native multi-thread block encoding
-              */
-            *ret = xzCompress((unsigned char*)inputstr, inputsize, outputbuf, outputsize,
-                              clevel, nthread);
-
-            if (*ret != SZ_OK) {
-                if (*outputbuf) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                }
 
-                *outputsize = 0;
-                return -4;
-            }
+/**
+ * @brief Stream handle used by zmat_stream_init/update/finish
+ */
 
+struct TZMatStream {
+    TZMatAllocator alloc;        /**< global allocator when the stream was created */
+    int zipid;                   /**< compression method, see TZipMethod */
+    int clevel;                  /**< compression level as in zmat_run, 0 for decompression */
+    int nthread;                 /**< number of threads passed on to the codec */
+    int shuffle;                 /**< blosc2 shuffle flag */
+    int typesize;                /**< blosc2 element byte size */
+    int stage;                   /**< codec specific parsing/writing state */
+    int substage;                /**< sub-state used by multi-field headers */
+    int finished;                /**< set after zmat_stream_finish() or an error */
+    int members;                 /**< number of members/frames/blocks emitted or decoded */
+    unsigned int hdrflags;       /**< flags parsed from the current frame header */
+    unsigned long long consumed; /**< total input bytes received */
+    unsigned long long count;    /**< uncompressed bytes in the current member/frame */
+    unsigned long long expected; /**< expected member/frame size, (unsigned long long)-1 if unknown */
+    unsigned long checksum;      /**< running crc32 of the current member */
+    size_t need;                 /**< size of the object being gathered/skipped */
+    size_t window;               /**< block size for the block based encoders */
+    ZmatBuffer out;              /**< output produced by the current call */
+    ZmatBuffer pend;             /**< pending input: partial header/block/window */
+    z_stream zs;
+    int zsinit;
+#ifndef NO_ZSTD
+    ZSTD_CCtx* zcctx;
+    ZSTD_DCtx* zdctx;
+    size_t zret;                 /**< last ZSTD_decompressStream return value */
 #endif
 #ifndef NO_LZ4
-        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
-            /**
-              * lz4 or lz4hc compression
-              */
-            *outputsize = LZ4_compressBound(inputsize);
-
-            if (*outputsize == 0) {
-                return -6;
-            }
-
-            if (!(*outputbuf = (unsigned char*)malloc(*outputsize))) {
-                *outputsize = 0;
-                return -5;
-            }
+    XXH32_state_t xxh;           /**< content checksum of the current frame */
+    ZmatBuffer hist;             /**< last 64 KB of output, for linked LZ4 blocks */
+#endif
+#if !defined(NO_LZMA) && defined(ZMAT_USE_LZMA_SDK)
+    CLzmaDec lzdec;
+    int lzinit;
+    int lzipver;                 /**< lzip version of the current member (0 or 1) */
+    CXzUnpacker xzdec;
+    int xzinit;
+    ZmatSzAlloc szalloc;         /**< SDK allocator interface forwarding to alloc */
+#endif
+#if !defined(NO_LZMA) && !defined(_WIN32)
+    ZmatLzmaBridge* bridge;
+#endif
+};
 
-            if (zipid == zmLz4) {
-                *outputsize = LZ4_compress_default((const char*)inputstr, (char*)(*outputbuf), inputsize, *outputsize);
-            } else {
-                *outputsize = LZ4_compress_HC((const char*)inputstr, (char*)(*outputbuf), inputsize, *outputsize, (clevel > 0) ? 8 : (-clevel));
-            }
+#if defined(NO_ZLIB) || !defined(NO_LZ4) || !defined(NO_BLOSC2) || defined(ZMAT_USE_LZMA_SDK)
 
-            *ret = *outputsize;
+/**
+ * @brief Make the first need bytes of the object at the head of the input available
+ *
+ * If the pending buffer is empty and the input holds the whole object, it is
+ * referenced in place without copying; otherwise input bytes are moved to the
+ * pending buffer until it holds need bytes. Call zmat_stream_consume() once
+ * the object has been processed.
+ *
+ * @return 1 when *obj points to need contiguous bytes, 0 when more input is needed, -5 on failure
+ */
 
-            if (*outputsize == 0) {
-                free(*outputbuf);
-                *outputbuf = NULL;
-                return -6;
-            }
+static int zmat_stream_gather(TZMatStream* s, const unsigned char** in, size_t* len, size_t need, const unsigned char** obj) {
+    if (s->pend.len == 0 && *len >= need) {
+        *obj = *in;
+        return 1;
+    }
 
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
+    if (s->pend.len < need) {
+        size_t n = need - s->pend.len;
 
-#endif
-#ifndef NO_ZSTD
-        } else if (zipid == zmZstd) {
-            /**
-              * zstd compression — uses MT worker threads when nthread > 1
-              * (ZSTD_MULTITHREAD is compiled into the bundled zstd)
-              */
-            *outputsize = ZSTD_compressBound(inputsize);
+        n = (n < *len) ? n : *len;
 
-            if (!(*outputbuf = (unsigned char*)malloc(*outputsize))) {
-                *outputsize = 0;
-                return -5;
-            }
+        if (zmat_buffer_append(&s->pend, *in, n) != 0) {
+            return -5;
+        }
 
-            {
-                ZSTD_CCtx* zctx = ZSTD_createCCtx();
+        *in += n;
+        *len -= n;
+    }
 
-                if (!zctx) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                    *outputsize = 0;
-                    return -5;
-                }
+    if (s->pend.len < need) {
+        return 0;
+    }
 
-                ZSTD_CCtx_setParameter(zctx, ZSTD_c_compressionLevel,
-                                       (clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-clevel));
-                /* nbWorkers=0 → single-thread (no overhead); >=1 → MT worker threads */
-                ZSTD_CCtx_setParameter(zctx, ZSTD_c_nbWorkers, (int)nthread > 1 ? (int)nthread : 0);
+    *obj = s->pend.buf;
+    return 1;
+}
 
-                *ret = (int)ZSTD_compress2(zctx, (char*)(*outputbuf), *outputsize,
-                                           (const char*)inputstr, inputsize);
-                ZSTD_freeCCtx(zctx);
-            }
+static void zmat_stream_consume(TZMatStream* s, const unsigned char** in, size_t* len, size_t n) {
+    if (s->pend.len) {
+        s->pend.len = 0;
+    } else {
+        *in += n;
+        *len -= n;
+    }
+}
 
-            if (ZSTD_isError((size_t)*ret)) {
-                free(*outputbuf);
-                *outputbuf = NULL;
-                *outputsize = 0;
-                return -9;
-            }
+#endif
 
-            *outputsize = *ret;
+#if !defined(NO_LZ4) || !defined(NO_BLOSC2) || !defined(NO_LZMA)
 
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
+/**
+ * @brief Block encoder callback used by zmat_stream_blocks()
+ */
 
-#endif
-#ifndef NO_BLOSC2
-        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
-            /**
-              * blosc2 meta-compressor (support various filters and compression codecs)
-              */
-            unsigned int shuffle = 1, typesize = 4;
-            const char* codecs[] = {"blosclz", "lz4", "lz4hc", "zlib", "zstd"};
-            shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
-            typesize = (flags.param.typesize == 0 || flags.param.typesize == -1) ? 4 : flags.param.typesize;
+typedef int (*ZmatBlockEncoder)(TZMatStream* s, const unsigned char* block, size_t len, int last, int* ret);
 
-            if (blosc1_set_compressor(codecs[zipid - zmBlosc2Blosclz]) == -1) {
-                return -7;
-            }
+/**
+ * @brief Split the input stream into window-sized blocks and encode each block
+ *
+ * A full window is only encoded once more input arrives (or at flush), so that
+ * the last block of the stream is known to the encoder.
+ */
 
-            blosc2_set_nthreads(nthread);
+static int zmat_stream_blocks(TZMatStream* s, const unsigned char* in, size_t len, int flush, ZmatBlockEncoder encode, int* ret) {
+    int res;
 
-            *outputsize = inputsize + BLOSC2_MAX_OVERHEAD;
+    while (len > 0) {
+        size_t n;
 
-            if (!(*outputbuf = (unsigned char*)malloc(*outputsize))) {
-                *outputsize = 0;
-                return -5;
+        if (s->pend.len == s->window) {
+            if ((res = encode(s, s->pend.buf, s->pend.len, 0, ret)) != 0) {
+                return res;
             }
 
-            *ret = blosc1_compress((clevel > 0) ? 5 : (-clevel), shuffle, typesize, inputsize, (const void*)inputstr, (void*)(*outputbuf), *outputsize);
+            s->pend.len = 0;
+        }
 
-            if (*ret < 0) {
-                free(*outputbuf);
-                *outputbuf = NULL;
-                *outputsize = 0;
-                return -8;
+        if (s->pend.len == 0 && len > s->window) {
+            if ((res = encode(s, in, s->window, 0, ret)) != 0) {
+                return res;
             }
 
-            *outputsize = *ret;
+            in += s->window;
+            len -= s->window;
+            continue;
+        }
 
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
+        n = s->window - s->pend.len;
+        n = (n < len) ? n : len;
 
-#endif
-        } else {
-            return -999;
+        if (zmat_buffer_append(&s->pend, in, n) != 0) {
+            return -5;
         }
-    } else {
-        /**
-          * perform decompression or decoding
-          */
-        if (zipid == zmBase64) {
-            /**
-              * base64 decoding
-              */
-            *outputbuf = base64_decode((const unsigned char*)inputstr, inputsize, outputsize);
 
-            if (*outputbuf == NULL) {
-                *outputsize = 0;
-                return -5;
-            }
-        } else if (zipid == zmZlib || zipid == zmGzip) {
-            /**
-              * zlib (.zip) or gzip (.gz) decompression
-              */
-            if (zipid == zmZlib) {
-                if (inflateInit(&zs) != Z_OK) {
-                    return -2;
-                }
-            } else {
-#ifndef NO_ZLIB
+        in += n;
+        len -= n;
+    }
 
-                if (inflateInit2(&zs, 15 | 32) != Z_OK) {
-                    return -2;
-                }
+    if (flush && s->pend.len > 0) {
+        res = encode(s, s->pend.buf, s->pend.len, 1, ret);
+        s->pend.len = 0;
+        return res;
+    }
+
+    return 0;
+}
 
 #endif
-            }
 
+/**
+ * @brief zlib/gzip stream compression
+ */
+
+static int zmat_stream_deflate(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
 #ifdef NO_ZLIB
 
-            if (zipid == zmZlib) {
-#endif
-                size_t outalloc = zmat_initial_outbuf(inputsize, 4);
-                *outputbuf = (unsigned char*)malloc(outalloc);
+    if (s->zipid == zmGzip) {
+        if (s->stage == 0) {
+            const unsigned char gzip_magic_header [] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
 
-                if (*outputbuf == NULL) {
-                    inflateEnd(&zs);
-                    return -5;
-                }
+            if (zmat_buffer_append(&s->out, gzip_magic_header, GZIP_HEADER_SIZE) != 0) {
+                return -5;
+            }
 
-                zs.avail_in = inputsize;
-                zs.next_in = inputstr;
-                zs.avail_out = outalloc;
-                zs.next_out =  (Bytef*)(*outputbuf);
+            s->checksum = MZ_CRC32_INIT;
+            s->stage = 1;
+        }
 
-                int rounds = 0;
+        if (len > 0) {
+            s->checksum = mz_crc32(s->checksum, in, len);
+            s->count += len;
+        }
+    }
 
-                while (1) {
-                    *ret = inflate(&zs, Z_SYNC_FLUSH);
+#endif
 
-                    if (*ret == Z_STREAM_END) {
-                        break;
-                    }
+    do {
+        size_t chunk = (len > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : len;
+        int last = (flush && chunk == len);
 
-                    if (*ret != Z_OK && *ret != Z_BUF_ERROR) {
-                        inflateEnd(&zs);
-                        free(*outputbuf);
-                        *outputbuf = NULL;
-                        return -3;
-                    }
+        s->zs.next_in = (Bytef*)in;
+        s->zs.avail_in = (uInt)chunk;
+
+        do {
+            if (zmat_buffer_reserve(&s->out, ZMAT_STREAM_CHUNK) != 0) {
+                return -5;
+            }
+
+            s->zs.next_out = (Bytef*)(s->out.buf + s->out.len);
+            s->zs.avail_out = (uInt)((s->out.cap - s->out.len > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : s->out.cap - s->out.len);
 
-                    /* output buffer full — need to grow */
-                    if (zs.avail_out == 0) {
-                        rounds++;
+            *ret = deflate(&s->zs, last ? Z_FINISH : Z_NO_FLUSH);
+            s->out.len = (unsigned char*)s->zs.next_out - s->out.buf;
 
-                        if (rounds > ZMAT_MAX_DECOMPRESS_ROUNDS) {
-                            inflateEnd(&zs);
-                            free(*outputbuf);
-                            *outputbuf = NULL;
-                            return -5;
-                        }
+            if (*ret != Z_OK && *ret != Z_STREAM_END && *ret != Z_BUF_ERROR) {
+                return -3;
+            }
+        } while (s->zs.avail_out == 0 || (last && *ret != Z_STREAM_END));
 
-                        if (zmat_grow_buf(outputbuf, &outalloc) != 0) {
-                            inflateEnd(&zs);
-                            /* outputbuf already freed and set to NULL by zmat_grow_buf */
-                            return -5;
-                        }
+        in += chunk;
+        len -= chunk;
+    } while (len > 0);
 
-                        zs.next_out = (Bytef*)(*outputbuf + zs.total_out);
-                        zs.avail_out = outalloc - zs.total_out;
-                    }
-                }
+#ifdef NO_ZLIB
 
-                *outputsize = zs.total_out;
+    if (s->zipid == zmGzip && flush) {
+        unsigned char trailer[8];
 
-                if (*ret != Z_STREAM_END && *ret != Z_OK) {
-                    inflateEnd(&zs);
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                    *outputsize = 0;
-                    return -3;
-                }
+        zmat_put_le(trailer, s->checksum, 4);
+        zmat_put_le(trailer + 4, s->count, 4);
 
-                inflateEnd(&zs);
+        if (zmat_buffer_append(&s->out, trailer, 8) != 0) {
+            return -5;
+        }
+    }
 
-                /* shrink to actual size */
-                zmat_shrink_buf(outputbuf, *outputsize);
+#endif
+    return 0;
+}
 
 #ifdef NO_ZLIB
-            } else {
 
-                *ret = miniz_gzip_uncompress(inputstr, inputsize, (void**)outputbuf, outputsize);
+/**
+ * @brief Incrementally parse a gzip member header (miniz has no gzip wrapper)
+ *
+ * @return 1 when the header is complete, 0 if more input is needed, negative zmat error code
+ */
 
-                if (*ret != 0) {
-                    if (*outputbuf) {
-                        free(*outputbuf);
-                        *outputbuf = NULL;
-                    }
+static int zmat_stream_gzip_header(TZMatStream* s, const unsigned char** in, size_t* len, int* ret) {
+    const unsigned char* p;
+    int res;
 
-                    *outputsize = 0;
+    while (1) {
+        switch (s->substage) {
+            case 0:
+                if ((res = zmat_stream_gather(s, in, len, GZIP_HEADER_SIZE, &p)) <= 0) {
+                    return res;
+                }
+
+                if (p[0] != 0x1F || p[1] != 0x8B || p[2] != 8 || (p[3] & 0xE0)) {
+                    *ret = -2;
                     return -10;
                 }
-            }
 
-#endif
+                s->hdrflags = p[3];
+                zmat_stream_consume(s, in, len, GZIP_HEADER_SIZE);
+                s->substage = (s->hdrflags & FEXTRA) ? 1 : 3;
+                break;
 
-#ifndef NO_LZMA
-        } else if (zipid == zmLzma || zipid == zmLzip) {
-            /**
-              * lzma (.lzma) or lzip (.lzip) decompression
-              * lzip supports multi-member streams: loop over members
-              */
-            if (zipid == zmLzip) {
-#if defined(ZMAT_USE_LZMA_SDK) && !defined(_WIN32)
-                /* Attempt v1 backward-scan to locate multi-member boundaries.
-                 * simpleCompressLzipMT() produces lzip v1 members: the version
-                 * byte is 1 and an 8-byte member_size (little-endian uint64)
-                 * is appended after the standard 12-byte footer.  Walking
-                 * backward from the end of the stream using member_size gives
-                 * exact per-member byte ranges.  Passing exact sizes to
-                 * simpleDecompress avoids the consumed-overshoot bug where the
-                 * decompressor reads ahead into subsequent members.
-                 * The v0 decompressor ignores both the version byte and the
-                 * trailing 8 bytes (it reads only the 12-byte footer).
-                 */
-                size_t n_members = 0;
-                size_t* member_starts = NULL;
-                size_t* member_sizes  = NULL;
-
-                {
-                    size_t end  = inputsize;
-                    size_t cap  = 0;
-                    int scan_ok = 1;
-
-                    /* minimum v1 member: 6 header + some LZMA + 12 footer + 8 member_size */
-                    while (end >= 40 && scan_ok) {
-                        /* read 8-byte member_size as little-endian uint64 */
-                        const unsigned char* ms_ptr = inputstr + end - 8;
-                        unsigned long long ms64 = 0;
-                        int k;
-
-                        for (k = 0; k < 8; k++) {
-                            ms64 |= ((unsigned long long)ms_ptr[k]) << (8 * k);
-                        }
+            case 1:
+                if ((res = zmat_stream_gather(s, in, len, 2, &p)) <= 0) {
+                    return res;
+                }
 
-                        if (ms64 < 40 || ms64 > (unsigned long long)end) {
-                            scan_ok = 0;
-                            break;
-                        }
+                s->need = (size_t)zmat_get_le(p, 2);
+                zmat_stream_consume(s, in, len, 2);
+                s->substage = 2;
+                break;
 
-                        size_t ms     = (size_t)ms64;
-                        size_t mstart = end - ms;
-
-                        /* verify lzip magic "LZIP" and version == 1 */
-                        if (mstart + 5 > inputsize ||
-                                inputstr[mstart]     != 'L' ||
-                                inputstr[mstart + 1] != 'Z' ||
-                                inputstr[mstart + 2] != 'I' ||
-                                inputstr[mstart + 3] != 'P' ||
-                                inputstr[mstart + 4] != 1) {
-                            scan_ok = 0;
-                            break;
-                        }
+            case 2:
+                if ((res = zmat_stream_gather(s, in, len, s->need, &p)) <= 0) {
+                    return res;
+                }
 
-                        /* grow member arrays if needed (appending in reverse order) */
-                        if (n_members >= cap) {
-                            size_t newcap = (cap == 0) ? 8 : cap * 2;
-                            size_t* ts = (size_t*)realloc(member_starts, newcap * sizeof(size_t));
-                            size_t* tz = (size_t*)realloc(member_sizes,  newcap * sizeof(size_t));
-
-                            if (!ts || !tz) {
-                                free(ts ? ts : member_starts);
-                                free(tz ? tz : member_sizes);
-                                member_starts = NULL;
-                                member_sizes  = NULL;
-                                n_members     = 0;
-                                scan_ok       = 0;
-                                break;
-                            }
-
-                            member_starts = ts;
-                            member_sizes  = tz;
-                            cap           = newcap;
-                        }
+                zmat_stream_consume(s, in, len, s->need);
+                s->substage = 3;
+                break;
 
-                        member_starts[n_members] = mstart;  /* stored in reverse order */
-                        member_sizes [n_members] = ms;
-                        n_members++;
-                        end = mstart;
+            case 3:
+            case 4:
+                if (s->hdrflags & ((s->substage == 3) ? FNAME : FCOMMENT)) {
+                    while (*len > 0 && **in != '\0') {
+                        (*in)++;
+                        (*len)--;
                     }
 
-                    /* scan succeeds when we consumed ALL input and found >= 2 members */
-                    if (!scan_ok || end != 0 || n_members < 2) {
-                        free(member_starts);
-                        free(member_sizes);
-                        member_starts = NULL;
-                        member_sizes  = NULL;
-                        n_members     = 0;
-                    } else {
-                        /* reverse arrays to restore forward order */
-                        size_t lo = 0, hi = n_members - 1;
-
-                        while (lo < hi) {
-                            size_t ts = member_starts[lo];
-                            member_starts[lo] = member_starts[hi];
-                            member_starts[hi] = ts;
-                            size_t tz = member_sizes[lo];
-                            member_sizes[lo]  = member_sizes[hi];
-                            member_sizes[hi]  = tz;
-                            lo++;
-                            hi--;
-                        }
+                    if (*len == 0) {
+                        return 0;
                     }
+
+                    (*in)++;
+                    (*len)--;
                 }
 
-                if (n_members >= 2) {
-                    /* multi-member v1 path: decompress each member with exact byte range */
-                    size_t total = 0;
-                    unsigned char* accum = NULL;
-                    size_t mi;
-                    *ret = ELZMA_E_OK;
-
-                    for (mi = 0; mi < n_members && *ret == ELZMA_E_OK; mi++) {
-                        unsigned char* chunk = NULL;
-                        size_t chunk_len = 0;
-                        *ret = simpleDecompress(ELZMA_lzip,
-                                                inputstr + member_starts[mi],
-                                                member_sizes[mi],
-                                                &chunk, &chunk_len, NULL);
-
-                        if (*ret == ELZMA_E_OK) {
-                            if (chunk_len > ZMAT_MAX_ALLOC - total) {
-                                free(chunk);
-                                free(accum);
-                                free(member_starts);
-                                free(member_sizes);
-                                *outputsize = 0;
-                                return -5;
-                            }
-
-                            unsigned char* tmp = (unsigned char*)realloc(accum, total + chunk_len);
-
-                            if (!tmp) {
-                                free(chunk);
-                                free(accum);
-                                free(member_starts);
-                                free(member_sizes);
-                                *outputsize = 0;
-                                return -5;
-                            }
-
-                            accum = tmp;
-                            memcpy(accum + total, chunk, chunk_len);
-                            free(chunk);
-                            total += chunk_len;
-                        } else {
-                            free(chunk);
-                        }
+                s->substage++;
+                break;
+
+            default:
+                if (s->hdrflags & FHCRC) {
+                    if ((res = zmat_stream_gather(s, in, len, 2, &p)) <= 0) {
+                        return res;
                     }
 
-                    free(member_starts);
-                    free(member_sizes);
-                    *outputbuf  = accum;
-                    *outputsize = total;
-                } else {
-                    /* single-member or non-v1 stream: decompress directly */
-                    *ret = simpleDecompress(ELZMA_lzip, (unsigned char*)inputstr,
-                                            inputsize, outputbuf, outputsize, NULL);
+                    zmat_stream_consume(s, in, len, 2);
                 }
 
-#else
-                /* without ZMAT_USE_LZMA_SDK, always single-member */
-                *ret = simpleDecompress(ELZMA_lzip, (unsigned char*)inputstr,
-                                        inputsize, outputbuf, outputsize, NULL);
+                s->substage = 0;
+                s->checksum = MZ_CRC32_INIT;
+                s->count = 0;
+                return 1;
+        }
+    }
+}
+
 #endif
-            } else {
-                *ret = simpleDecompress(ELZMA_lzma, (unsigned char*)inputstr,
-                                        inputsize, outputbuf, outputsize, NULL);
-            }
 
-            if (*ret != ELZMA_E_OK) {
-                if (*outputbuf) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                }
+/**
+ * @brief zlib/gzip stream decompression
+ *
+ * stage 0: expecting a gzip header (miniz only), 1: inflating,
+ * 2: expecting the gzip trailer (miniz only), 3: end of the deflate stream
+ */
 
-                *outputsize = 0;
-                return -4;
-            }
+static int zmat_stream_inflate(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    while (len > 0) {
+        size_t chunk;
 
-#endif
-#if defined(ZMAT_USE_LZMA_SDK) && !defined(NO_LZMA)
-        } else if (zipid == zmXz) {
-            /**
-              * XZ (.xz) decompression
-              */
-            *ret = xzDecompress((unsigned char*)inputstr, inputsize, outputbuf, outputsize);
+#ifdef NO_ZLIB
 
-            if (*ret != SZ_OK) {
-                if (*outputbuf) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
+        if (s->zipid == zmGzip && s->stage != 1) {
+            const unsigned char* p;
+            int res;
+
+            if (s->stage == 0) {
+                if ((res = zmat_stream_gzip_header(s, &in, &len, ret)) <= 0) {
+                    return res;
                 }
 
-                *outputsize = 0;
-                return -4;
+                inflateReset(&s->zs);
+                s->stage = 1;
+                continue;
             }
 
-#endif
-#ifndef NO_LZ4
-        } else if (zipid == zmLz4 || zipid == zmLz4hc) {
-            /**
-              * lz4 or lz4hc decompression
-              */
-            size_t outalloc = zmat_initial_outbuf(inputsize, 4);
-            int rounds = 0;
+            if ((res = zmat_stream_gather(s, &in, &len, 8, &p)) <= 0) {
+                return res;
+            }
 
-            if (!(*outputbuf = (unsigned char*)malloc(outalloc))) {
-                return -5;
+            if ((unsigned long)zmat_get_le(p, 4) != (s->checksum & 0xFFFFFFFFUL) || (unsigned int)zmat_get_le(p + 4, 4) != (unsigned int)s->count) {
+                *ret = -14;
+                return -10;
             }
 
-            while ((*ret = LZ4_decompress_safe((const char*)inputstr, (char*)(*outputbuf), inputsize, outalloc)) < 0) {
-                rounds++;
+            zmat_stream_consume(s, &in, &len, 8);
+            s->members++;
+            s->stage = 0;
+            continue;
+        }
 
-                if (rounds > ZMAT_MAX_DECOMPRESS_ROUNDS) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                    *outputsize = 0;
-                    return -6;
-                }
+#endif
 
-                if (zmat_grow_buf(outputbuf, &outalloc) != 0) {
-                    /* outputbuf already freed and set to NULL by zmat_grow_buf */
-                    *outputsize = 0;
-                    return -5;
-                }
+        if (s->stage == 3) {
+            if (s->zipid != zmGzip) {
+                break;    /* ignore trailing data after a zlib stream */
             }
 
-            *outputsize = *ret;
-
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
-
-#endif
-#ifndef NO_ZSTD
-        } else if (zipid == zmZstd) {
-            /**
-              * zstd decompression
-              */
-            {
-                unsigned long long zstd_bound = ZSTD_decompressBound(inputstr, inputsize);
+            inflateReset(&s->zs);    /* concatenated gzip member */
+            s->stage = 1;
+        }
 
-                if (zstd_bound == ZSTD_CONTENTSIZE_ERROR || zstd_bound > ZMAT_MAX_ALLOC) {
-                    *ret = -9;
-                    *outputsize = 0;
-                    return -9;
-                }
+        chunk = (len > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : len;
+        s->zs.next_in = (Bytef*)in;
+        s->zs.avail_in = (uInt)chunk;
 
-                *outputsize = (size_t)zstd_bound;
-            }
+        do {
+            size_t before;
 
-            if (!(*outputbuf = (unsigned char*)malloc(*outputsize))) {
-                *ret = -5;
-                *outputsize = 0;
+            if (zmat_buffer_reserve(&s->out, ZMAT_STREAM_CHUNK) != 0) {
                 return -5;
             }
 
-            *ret = ZSTD_decompress((void*)(*outputbuf), *outputsize, (const void*)inputstr, inputsize);
+            before = s->out.len;
+            s->zs.next_out = (Bytef*)(s->out.buf + s->out.len);
+            s->zs.avail_out = (uInt)((s->out.cap - s->out.len > ZMAT_STREAM_FEED) ? ZMAT_STREAM_FEED : s->out.cap - s->out.len);
 
-            if (ZSTD_isError(*ret)) {
-                free(*outputbuf);
-                *outputbuf = NULL;
-                *outputsize = 0;
-                return -9;
-            }
+            *ret = inflate(&s->zs, Z_NO_FLUSH);
+            s->out.len = (unsigned char*)s->zs.next_out - s->out.buf;
 
-            *outputsize = *ret;
+#ifdef NO_ZLIB
 
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
+            if (s->zipid == zmGzip && s->out.len > before) {
+                s->checksum = mz_crc32(s->checksum, s->out.buf + before, s->out.len - before);
+                s->count += s->out.len - before;
+            }
 
 #endif
-#ifndef NO_BLOSC2
-        } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
-            /**
-              * blosc2 meta-compressor (support various filters and compression codecs)
-              */
-            size_t outalloc = zmat_initial_outbuf(inputsize, 4);
-            int rounds = 0;
+            (void)before;
 
-            if (!(*outputbuf = (unsigned char*)malloc(outalloc))) {
-                return -5;
+            if (*ret == Z_STREAM_END) {
+                break;
             }
 
-            while ((*ret = blosc1_decompress((const char*)inputstr, (char*)(*outputbuf), outalloc)) <= 0) {
-                rounds++;
-
-                if (rounds > ZMAT_MAX_DECOMPRESS_ROUNDS) {
-                    free(*outputbuf);
-                    *outputbuf = NULL;
-                    *outputsize = 0;
-                    return -8;
-                }
-
-                if (zmat_grow_buf(outputbuf, &outalloc) != 0) {
-                    /* outputbuf already freed and set to NULL by zmat_grow_buf */
-                    *outputsize = 0;
-                    return -5;
-                }
+            if (*ret != Z_OK && *ret != Z_BUF_ERROR) {
+                return -3;
             }
+        } while (s->zs.avail_out == 0 || s->zs.avail_in > 0);
 
-            *outputsize = *ret;
+        in += chunk - s->zs.avail_in;
+        len -= chunk - s->zs.avail_in;
 
-            /* shrink to actual size */
-            zmat_shrink_buf(outputbuf, *outputsize);
+        if (*ret == Z_STREAM_END) {
+#ifdef NO_ZLIB
+
+            if (s->zipid == zmGzip) {
+                s->stage = 2;
+                continue;
+            }
 
 #endif
-        } else {
-            return -999;
+            s->members++;
+            s->stage = 3;
         }
     }
 
-    return 0;
-}
-
-/**
- * @brief Simplified interface to perform compression (use default compression level)
- *
- * @param[in] inputsize: input stream buffer length
- * @param[in] inputstr: input stream buffer pointer
- * @param[in] outputsize: output stream buffer length
- * @param[in] outputbuf: output stream buffer pointer
- * @param[in] ret: encoder/decoder specific detailed error code (if error occurs)
- * @return return the coarse grained zmat error code; detailed error code is in ret.
- */
-
-int zmat_encode(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret) {
-    return zmat_run(inputsize, inputstr, outputsize, outputbuf, zipid, ret, 1);
-}
-
-/**
- * @brief Simplified interface to perform decompression
- *
- * @param[in] inputsize: input stream buffer length
- * @param[in] inputstr: input stream buffer pointer
- * @param[in] outputsize: output stream buffer length
- * @param[in] outputbuf: output stream buffer pointer
- * @param[in] ret: encoder/decoder specific detailed error code (if error occurs)
- * @return return the coarse grained zmat error code; detailed error code is in ret.
- */
-
-int zmat_decode(const size_t inputsize, unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, const int zipid, int* ret) {
-    return zmat_run(inputsize, inputstr, outputsize, outputbuf, zipid, ret, 0);
-}
-
-/**
- * @brief Look up a string in a string list and return the index
- *
- * @param[in] origkey: string to be looked up
- * @param[out] table: the dictionary where the string is searched
- * @return if found, return the index of the string in the dictionary, otherwise -1.
- */
-
-int zmat_keylookup(char* origkey, const char* table[]) {
-    int i = 0;
-    char* key = (char*)malloc(strlen(origkey) + 1);
-
-    if (key == NULL) {
-        return -1;
-    }
-
-    memcpy(key, origkey, strlen(origkey) + 1);
-
-    while (key[i]) {
-        key[i] = tolower(key[i]);
-        i++;
-    }
-
-    i = 0;
+    if (flush) {
+        *ret = Z_OK;
 
-    while (table[i] && table[i][0] != '\0') {
-        if (strcmp(key, table[i]) == 0) {
-            free(key);
-            return i;
+        if (s->stage != 3 && !(s->stage == 0 && s->members > 0 && s->pend.len == 0)) {
+            *ret = Z_BUF_ERROR;
+            return -3;
         }
-
-        i++;
     }
 
-    free(key);
-    return -1;
+    return 0;
 }
 
+#ifndef NO_ZSTD
+
 /**
- * @brief Free the output buffer to facilitate use in fortran
- *
- * @param[in,out] outputbuf: the outputbuf buffer's initial address to be freed
+ * @brief zstd stream compression/decompression
  */
 
-void zmat_free(unsigned char** outputbuf) {
-    if (*outputbuf) {
-        free(*outputbuf);
-    }
+static int zmat_stream_zstd(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    ZSTD_inBuffer zin;
+    ZSTD_outBuffer zout;
 
-    *outputbuf = NULL;
-}
+    zin.src = in;
+    zin.size = len;
+    zin.pos = 0;
 
-/*
- * @brief Base64 encoding/decoding (RFC1341)
- * @author Copyright (c) 2005-2011, Jouni Malinen <j@w1.fi>
- *
- * This software may be distributed under the terms of the BSD license.
- * See README for more details.
- */
+    if (s->clevel) {
+        size_t remaining;
 
-static const unsigned char base64_table[65] =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        do {
+            if (zmat_buffer_reserve(&s->out, ZSTD_CStreamOutSize()) != 0) {
+                return -5;
+            }
 
-/**
- * @brief base64_encode - Base64 encode
- * @src: Data to be encoded
- * @len: Length of the data to be encoded
- * @out_len: Pointer to output length variable, or %NULL if not used
- * Returns: Allocated buffer of out_len bytes of encoded data,
- * or %NULL on failure
- *
- * Caller is responsible for freeing the returned buffer. Returned buffer is
- * nul terminated to make it easier to use as a C string. The nul terminator is
- * not included in out_len.
- */
+            zout.dst = s->out.buf + s->out.len;
+            zout.size = s->out.cap - s->out.len;
+            zout.pos = 0;
 
-unsigned char* base64_encode(const unsigned char* src, size_t len,
-                             size_t* out_len, int mode) {
-    unsigned char* out, *pos;
-    const unsigned char* end, *in;
-    size_t olen;
-    size_t line_len;
+            remaining = ZSTD_compressStream2(s->zcctx, &zout, &zin, flush ? ZSTD_e_end : ZSTD_e_continue);
+
+            if (ZSTD_isError(remaining)) {
+                *ret = (int)remaining;
+                return -9;
+            }
 
-    olen = len * 4 / 3 + 4; /* 3-byte blocks to 4-byte */
+            s->out.len += zout.pos;
+        } while (flush ? (remaining != 0) : (zin.pos < zin.size));
 
-    if (olen < len) {
-        return NULL;    /* integer overflow */
+        return 0;
     }
 
-    olen += olen / 72; /* line feeds */
-    olen++; /* nul termination */
+    /* output is fully drained by each update, nothing is left to flush at the end */
+    while (zin.pos < zin.size) {
+        do {
+            if (zmat_buffer_reserve(&s->out, ZSTD_DStreamOutSize()) != 0) {
+                return -5;
+            }
 
-    if (olen < len) {
-        return NULL;    /* integer overflow */
-    }
+            zout.dst = s->out.buf + s->out.len;
+            zout.size = s->out.cap - s->out.len;
+            zout.pos = 0;
 
-    out = (unsigned char*)malloc(olen);
+            s->zret = ZSTD_decompressStream(s->zdctx, &zout, &zin);
 
-    if (out == NULL) {
-        return NULL;
+            if (ZSTD_isError(s->zret)) {
+                *ret = (int)s->zret;
+                return -9;
+            }
+
+            s->out.len += zout.pos;
+        } while (zout.pos == zout.size);
     }
 
-    end = src + len;
-    in = src;
-    pos = out;
-    line_len = 0;
+    if (flush && s->zret != 0) {
+        *ret = (int)s->zret;    /* truncated frame: number of bytes still expected */
+        return -9;
+    }
 
-    while (end - in >= 3) {
-        *pos++ = base64_table[in[0] >> 2];
-        *pos++ = base64_table[((in[0] & 0x03) << 4) | (in[1] >> 4)];
-        *pos++ = base64_table[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
-        *pos++ = base64_table[in[2] & 0x3f];
-        in += 3;
-        line_len += 4;
+    return 0;
+}
 
-        if (mode > 1 && line_len >= 72) {
-            *pos++ = '\n';
-            line_len = 0;
-        }
-    }
+#endif
 
-    if (end - in) {
-        *pos++ = base64_table[in[0] >> 2];
+#ifndef NO_LZ4
 
-        if (end - in == 1) {
-            *pos++ = base64_table[(in[0] & 0x03) << 4];
-            *pos++ = '=';
-        } else {
-            *pos++ = base64_table[((in[0] & 0x03) << 4) |
-                                                  (in[1] >> 4)];
-            *pos++ = base64_table[(in[1] & 0x0f) << 2];
-        }
+/**
+ * @brief Encode one independent block of an LZ4 frame
+ */
 
-        *pos++ = '=';
-        line_len += 4;
-    }
+static int zmat_stream_lz4_block(TZMatStream* s, const unsigned char* block, size_t len, int last, int* ret) {
+    int bound = LZ4_compressBound((int)len);
+    unsigned char* dst;
+    (void)last;
 
-    if (mode > 2 && line_len) {
-        *pos++ = '\n';
+    if (zmat_buffer_reserve(&s->out, 4 + (size_t)bound) != 0) {
+        return -5;
     }
 
-    *pos = '\0';
+    dst = s->out.buf + s->out.len + 4;
 
-    if (out_len) {
-        *out_len = pos - out;
+    if (s->zipid == zmLz4 || (s->zipid == zmLz4f && s->clevel > -3)) {
+        *ret = LZ4_compress_default((const char*)block, (char*)dst, (int)len, bound);
+    } else {
+        *ret = zmat_lz4hc_compress(&s->alloc, (const char*)block, (char*)dst, (int)len, bound, (s->clevel > 0) ? 8 : (-s->clevel));
     }
 
-    return out;
-}
+    if (*ret <= 0 || (size_t)(*ret) >= len) {
+        /* incompressible block: store it uncompressed (highest bit of the block size set) */
+        memcpy(dst, block, len);
+        zmat_put_le(dst - 4, len | 0x80000000U, 4);
+        s->out.len += 4 + len;
+    } else {
+        zmat_put_le(dst - 4, (unsigned long long)(*ret), 4);
+        s->out.len += 4 + (size_t)(*ret);
+    }
 
+    *ret = 0;
+    XXH32_update(&s->xxh, block, len);
+    s->members++;
+    return 0;
+}
 
 /**
- * base64_decode - Base64 decode
- * @src: Data to be decoded
- * @len: Length of the data to be decoded
- * @out_len: Pointer to output length variable
- * Returns: Allocated buffer of out_len bytes of decoded data,
- * or %NULL on failure
+ * @brief lz4/lz4hc stream compression, producing a standard LZ4 frame
  *
- * Caller is responsible for freeing the returned buffer.
+ * Blocks are independent, at most 4 MB, followed by the XXH32 content checksum.
  */
 
-unsigned char* base64_decode(const unsigned char* src, size_t len,
-                             size_t* out_len) {
-    unsigned char dtable[256], *out, *pos, block[4], tmp;
-    size_t i, count, olen;
-    int pad = 0;
+static int zmat_stream_lz4_encode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    int res;
 
-    memset(dtable, 0x80, 256);
+    if (s->stage == 0) {
+        unsigned char header[7] = {0x04, 0x22, 0x4D, 0x18, 0x64, 0x70, 0};
 
-    for (i = 0; i < sizeof(base64_table) - 1; i++) {
-        dtable[base64_table[i]] = (unsigned char) i;
-    }
+        header[6] = (unsigned char)((XXH32(header + 4, 2, 0) >> 8) & 0xFF);
 
-    dtable[(unsigned char)'='] = 0;
+        if (zmat_buffer_append(&s->out, header, sizeof(header)) != 0) {
+            return -5;
+        }
 
-    count = 0;
+        s->stage = 1;
+    }
 
-    for (i = 0; i < len; i++) {
-        if (dtable[src[i]] != 0x80) {
-            count++;
-        }
+    if ((res = zmat_stream_blocks(s, in, len, flush, zmat_stream_lz4_block, ret)) != 0) {
+        return res;
     }
 
-    if (count == 0 || count % 4) {
-        return NULL;
+    if (flush) {
+        unsigned char trailer[8];
+
+        zmat_put_le(trailer, 0, 4);
+        zmat_put_le(trailer + 4, XXH32_digest(&s->xxh), 4);
+        return zmat_buffer_append(&s->out, trailer, sizeof(trailer));
     }
 
-    olen = count / 4 * 3;
-    pos = out = (unsigned char*)malloc(olen);
+    return 0;
+}
 
-    if (out == NULL) {
-        return NULL;
+/**
+ * @brief Decode one LZ4 frame block (compressed or stored)
+ */
+
+static int zmat_stream_lz4_block_decode(TZMatStream* s, const unsigned char* src, size_t srclen, int stored, int* ret) {
+    size_t blockmax = (size_t)1 << (8 + 2 * ((s->hdrflags >> 12) & 0x7));
+    unsigned char* dst;
+    size_t dstlen;
+
+    if (zmat_buffer_reserve(&s->out, blockmax) != 0) {
+        return -5;
     }
 
-    count = 0;
+    dst = s->out.buf + s->out.len;
 
-    for (i = 0; i < len; i++) {
-        tmp = dtable[src[i]];
+    if (stored) {
+        if (srclen > blockmax) {
+            *ret = -1;
+            return -6;
+        }
 
-        if (tmp == 0x80) {
-            continue;
+        memcpy(dst, src, srclen);
+        dstlen = srclen;
+    } else {
+        if (s->hdrflags & 0x20) {
+            *ret = LZ4_decompress_safe((const char*)src, (char*)dst, (int)srclen, (int)blockmax);
+        } else {
+            *ret = LZ4_decompress_safe_usingDict((const char*)src, (char*)dst, (int)srclen, (int)blockmax,
+                                                 (const char*)s->hist.buf, (int)s->hist.len);
         }
 
-        if (src[i] == '=') {
-            pad++;
+        if (*ret < 0) {
+            return -6;
         }
 
-        block[count] = tmp;
-        count++;
+        dstlen = (size_t)(*ret);
+    }
 
-        if (count == 4) {
-            *pos++ = (block[0] << 2) | (block[1] >> 4);
-            *pos++ = (block[1] << 4) | (block[2] >> 2);
-            *pos++ = (block[2] << 6) | block[3];
-            count = 0;
+    if (!(s->hdrflags & 0x20)) {
+        /* linked blocks: keep the last 64 KB of output as the dictionary of the next block */
+        if (dstlen >= 65536) {
+            s->hist.len = 0;
 
-            if (pad) {
-                if (pad == 1) {
-                    pos--;
-                } else if (pad == 2) {
-                    pos -= 2;
-                } else {
-                    /* Invalid padding */
-                    free(out);
-                    return NULL;
-                }
+            if (zmat_buffer_append(&s->hist, dst + dstlen - 65536, 65536) != 0) {
+                return -5;
+            }
+        } else {
+            if (zmat_buffer_append(&s->hist, dst, dstlen) != 0) {
+                return -5;
+            }
 
-                break;
+            if (s->hist.len > 65536) {
+                memmove(s->hist.buf, s->hist.buf + s->hist.len - 65536, 65536);
+                s->hist.len = 65536;
             }
         }
     }
 
-    *out_len = pos - out;
-    return out;
-}
+    if (s->hdrflags & 0x04) {
+        XXH32_update(&s->xxh, dst, dstlen);
+    }
 
-#ifndef NO_LZMA
+    s->out.len += dstlen;
+    s->count += dstlen;
+    *ret = 0;
+    return 0;
+}
 
 /**
- * @brief Easylzma compression interface
+ * @brief Decode the bare LZ4 block written by zmat_run(zmLz4/zmLz4hc), buffered until the end of the input
  */
 
-struct dataStream {
-    const unsigned char* inData;
-    size_t inLen;
-    size_t consumed;    /* tracks how many input bytes were read (for multi-member lzip) */
+static int zmat_stream_lz4_raw(TZMatStream* s, int* ret) {
+    size_t outalloc = zmat_lz4_size(s->pend.buf, s->pend.len);
 
-    unsigned char* outData;
-    size_t outLen;
-};
+    if (s->pend.len > INT_MAX || outalloc > INT_MAX) {
+        *ret = -1;
+        return -6;
+    }
 
-/**
- * @brief Easylzma input callback function
- */
+    outalloc = outalloc ? outalloc : ZMAT_MIN_OUTBUF;
 
-static int
-inputCallback(void* ctx, void* buf, size_t* size) {
-    size_t rd = 0;
-    struct dataStream* ds = (struct dataStream*) ctx;
-    assert(ds != NULL);
+    if (zmat_buffer_reserve(&s->out, outalloc) != 0) {
+        return -5;
+    }
 
-    rd = (ds->inLen < *size) ? ds->inLen : *size;
+    *ret = LZ4_decompress_safe((const char*)s->pend.buf, (char*)(s->out.buf + s->out.len), (int)s->pend.len, (int)outalloc);
 
-    if (rd > 0) {
-        memcpy(buf, (void*) ds->inData, rd);
-        ds->inData += rd;
-        ds->inLen -= rd;
-        ds->consumed += rd;
+    if (*ret < 0) {
+        return -6;
     }
 
-    *size = rd;
-
+    s->out.len += (size_t)(*ret);
+    s->pend.len = 0;
+    s->members++;
+    *ret = 0;
     return 0;
 }
 
 /**
- * @brief Easylzma output callback function
+ * @brief lz4/lz4hc stream decompression of (concatenated) LZ4 frames, or of one bare LZ4 block
+ *
+ * stage 0: frame header, 1: block size, 2: block data, 3: content checksum,
+ * 4: skippable frame payload, 5: bare block, kept whole in the pending buffer
  */
 
-static size_t
-outputCallback(void* ctx, const void* buf, size_t size) {
-    struct dataStream* ds = (struct dataStream*) ctx;
-    assert(ds != NULL);
+static int zmat_stream_lz4_decode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    const unsigned char* p;
+    int res;
 
-    if (size > 0) {
-        unsigned char* tmp = (unsigned char*)realloc(ds->outData, ds->outLen + size);
+    while (len > 0) {
+        if (s->stage == 0) {
+            unsigned int magic;
+            size_t hdrlen;
 
-        if (tmp == NULL) {
-            /* realloc failed — preserve existing data pointer for caller to free */
-            return 0;
-        }
+            if ((res = zmat_stream_gather(s, &in, &len, 4, &p)) <= 0) {
+                return res;
+            }
 
-        ds->outData = tmp;
-        memcpy((void*) (ds->outData + ds->outLen), buf, size);
-        ds->outLen += size;
-    }
+            magic = (unsigned int)zmat_get_le(p, 4);
 
-    return size;
-}
+            if ((magic & 0xFFFFFFF0U) == 0x184D2A50U) {
+                if ((res = zmat_stream_gather(s, &in, &len, 8, &p)) <= 0) {
+                    return res;
+                }
 
-/**
- * @brief Easylzma interface to perform compression
- *
- * @param[in] format: output format (0 for lzip format, 1 for lzma-alone format)
- * @param[in] inData: input stream buffer pointer
- * @param[in] inLen: input stream buffer length
- * @param[in] outData: output stream buffer pointer
- * @param[in] outLen: output stream buffer length
- * @param[in] level: positive number: use default compression level (5);
- *             negative interger: set compression level (-1, less, to -9, more compression)
- * @return return the fine grained lzma error code.
- */
+                s->need = (size_t)zmat_get_le(p + 4, 4);
+                zmat_stream_consume(s, &in, &len, 8);
+                s->stage = 4;
+                continue;
+            }
 
-int
-simpleCompress(elzma_file_format format, const unsigned char* inData,
-               size_t inLen, unsigned char** outData,
-               size_t* outLen, int level, int nthread) {
-    int rc;
-    elzma_compress_handle hand;
+            if (magic != 0x184D2204U) {
+                /* not a frame: zmat_run(zmLz4/zmLz4hc) output, a block without its length */
+                if (s->members == 0 && s->zipid != zmLz4f) {
+                    s->stage = 5;
+                    continue;
+                }
 
-    /* allocate compression handle */
-    hand = elzma_compress_alloc();
+                *ret = -1;
+                return -6;
+            }
 
-    if (hand == NULL) {
-        return ELZMA_E_COMPRESS_ERROR;
-    }
+            if ((res = zmat_stream_gather(s, &in, &len, 6, &p)) <= 0) {
+                return res;
+            }
 
-    /* set thread count (clamped to 1–2 by SDK; effective only with COMPRESS_MF_MT) */
-    elzma_compress_set_numthreads(hand, nthread);
+            hdrlen = 7 + ((p[4] & 0x08) ? 8 : 0) + ((p[4] & 0x01) ? 4 : 0);
 
-    rc = elzma_compress_config(hand, ELZMA_LC_DEFAULT,
-                               ELZMA_LP_DEFAULT, ELZMA_PB_DEFAULT,
-                               ((level > 0) ? 5 : -level), (1 << 20) /* 1mb */,
-                               format, inLen);
+            if ((p[4] >> 6) != 1 || (p[4] & 0x02) || (p[5] & 0x8F) || ((p[5] >> 4) & 0x7) < 4) {
+                *ret = -2;
+                return -6;
+            }
 
-    if (rc != ELZMA_E_OK) {
-        elzma_compress_free(&hand);
-        return rc;
-    }
+            if ((res = zmat_stream_gather(s, &in, &len, hdrlen, &p)) <= 0) {
+                return res;
+            }
 
-    /* now run the compression */
-    {
-        struct dataStream ds;
-        ds.inData = inData;
-        ds.inLen = inLen;
-        ds.consumed = 0;
-        ds.outData = NULL;
-        ds.outLen = 0;
+            if (p[hdrlen - 1] != ((XXH32(p + 4, hdrlen - 5, 0) >> 8) & 0xFF)) {
+                *ret = -3;
+                return -6;
+            }
 
-        rc = elzma_compress_run(hand, inputCallback, (void*) &ds,
-                                outputCallback, (void*) &ds,
-                                NULL, NULL);
+            s->hdrflags = p[4] | ((unsigned int)p[5] << 8);
+            s->expected = (p[4] & 0x08) ? zmat_get_le(p + 6, 8) : (unsigned long long) -1;
+            s->count = 0;
+            s->hist.len = 0;
+            XXH32_reset(&s->xxh, 0);
+            zmat_stream_consume(s, &in, &len, hdrlen);
+            s->stage = 1;
+        } else if (s->stage == 1) {
+            unsigned int bsize;
+
+            if ((res = zmat_stream_gather(s, &in, &len, 4, &p)) <= 0) {
+                return res;
+            }
 
-        if (rc != ELZMA_E_OK) {
-            if (ds.outData != NULL) {
-                free(ds.outData);
+            bsize = (unsigned int)zmat_get_le(p, 4);
+            zmat_stream_consume(s, &in, &len, 4);
+
+            if (bsize == 0) {
+                if (s->expected != (unsigned long long) -1 && s->expected != s->count) {
+                    *ret = -4;
+                    return -6;
+                }
+
+                s->members++;
+                s->stage = (s->hdrflags & 0x04) ? 3 : 0;
+                continue;
             }
 
-            elzma_compress_free(&hand);
-            return rc;
+            s->substage = (bsize & 0x80000000U) ? 1 : 0;
+            s->need = (bsize & 0x7FFFFFFFU) + ((s->hdrflags & 0x10) ? 4 : 0);
+            s->stage = 2;
+        } else if (s->stage == 2) {
+            size_t datalen = s->need - ((s->hdrflags & 0x10) ? 4 : 0);
+
+            if ((res = zmat_stream_gather(s, &in, &len, s->need, &p)) <= 0) {
+                return res;
+            }
+
+            if ((s->hdrflags & 0x10) && zmat_get_le(p + datalen, 4) != XXH32(p, datalen, 0)) {
+                *ret = -5;
+                return -6;
+            }
+
+            if ((res = zmat_stream_lz4_block_decode(s, p, datalen, s->substage, ret)) != 0) {
+                return res;
+            }
+
+            zmat_stream_consume(s, &in, &len, s->need);
+            s->stage = 1;
+        } else if (s->stage == 3) {
+            if ((res = zmat_stream_gather(s, &in, &len, 4, &p)) <= 0) {
+                return res;
+            }
+
+            if ((unsigned int)zmat_get_le(p, 4) != XXH32_digest(&s->xxh)) {
+                *ret = -5;
+                return -6;
+            }
+
+            zmat_stream_consume(s, &in, &len, 4);
+            s->stage = 0;
+        } else if (s->stage == 4) {
+            size_t n = (s->need < len) ? s->need : len;
+
+            in += n;
+            len -= n;
+            s->need -= n;
+
+            if (s->need == 0) {
+                s->stage = 0;
+            }
+        } else {
+            if (zmat_buffer_append(&s->pend, in, len) != 0) {
+                return -5;
+            }
+
+            len = 0;
         }
+    }
 
-        *outData = ds.outData;
-        *outLen = ds.outLen;
+    /* a bare block, or one shorter than a frame magic number */
+    if (flush && (s->stage == 5 || (s->stage == 0 && s->members == 0 && s->pend.len > 0 && s->zipid != zmLz4f))) {
+        return zmat_stream_lz4_raw(s, ret);
     }
 
-    elzma_compress_free(&hand);
+    if (flush && (s->stage != 0 || s->pend.len > 0 || s->members == 0)) {
+        *ret = -6;
+        return -6;
+    }
 
-    return rc;
+    return 0;
 }
 
+#endif
+
+#ifndef NO_BLOSC2
 
 /**
- * @brief Easylzma interface to perform decompression
- *
- * @param[in] format: output format (0 for lzip format, 1 for lzma-alone format)
- * @param[in] inData: input stream buffer pointer
- * @param[in] inLen: input stream buffer length
- * @param[in] outData: output stream buffer pointer
- * @param[in] outLen: output stream buffer length
- * @return return the fine grained lzma error code.
+ * @brief Compress one window into a self-contained blosc2 (blosc1 format) chunk
  */
 
-int
-simpleDecompress(elzma_file_format format, const unsigned char* inData,
-                 size_t inLen, unsigned char** outData,
-                 size_t* outLen, size_t* consumed) {
-    int rc;
-    elzma_decompress_handle hand;
+static int zmat_stream_blosc2_block(TZMatStream* s, const unsigned char* block, size_t len, int last, int* ret) {
+    (void)last;
+
+    if (zmat_buffer_reserve(&s->out, len + BLOSC2_MAX_OVERHEAD) != 0) {
+        return -5;
+    }
+
+    if (zmat_blosc2_chunk_encode(s->zipid, (s->clevel > 0) ? 5 : (-s->clevel), s->shuffle, s->typesize, s->nthread,
+                                 block, len, s->out.buf + s->out.len, len + BLOSC2_MAX_OVERHEAD, ret) != 0) {
+        return -7;
+    }
+
+    if (*ret <= 0) {
+        return -8;
+    }
+
+    s->out.len += (size_t)(*ret);
+    s->members++;
+    return 0;
+}
+
+/**
+ * @brief Decompress a sequence of blosc2 chunks, one chunk at a time
+ */
+
+static int zmat_stream_blosc2_decode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    const unsigned char* p;
+    int res;
 
-    hand = elzma_decompress_alloc();
+    while (len > 0) {
+        size_t nbytes = 0, cbytes = 0, blocksize = 0;
 
-    if (hand == NULL) {
-        return ELZMA_E_DECOMPRESS_ERROR;
-    }
+        if ((res = zmat_stream_gather(s, &in, &len, BLOSC_MIN_HEADER_LENGTH, &p)) <= 0) {
+            return res;
+        }
 
-    /* now run the decompression */
-    {
-        struct dataStream ds;
-        ds.inData = inData;
-        ds.inLen = inLen;
-        ds.consumed = 0;
-        ds.outData = NULL;
-        ds.outLen = 0;
+        blosc1_cbuffer_sizes(p, &nbytes, &cbytes, &blocksize);
 
-        rc = elzma_decompress_run(hand, inputCallback, (void*) &ds,
-                                  outputCallback, (void*) &ds, format);
+        if (cbytes < BLOSC_MIN_HEADER_LENGTH || cbytes > ZMAT_MAX_ALLOC || nbytes > ZMAT_MAX_ALLOC) {
+            *ret = -1;
+            return -8;
+        }
 
-        if (consumed != NULL) {
-            *consumed = ds.consumed;
+        if ((res = zmat_stream_gather(s, &in, &len, cbytes, &p)) <= 0) {
+            return res;
         }
 
-        if (rc != ELZMA_E_OK) {
-            if (ds.outData != NULL) {
-                free(ds.outData);
-            }
+        if (zmat_buffer_reserve(&s->out, nbytes) != 0) {
+            return -5;
+        }
 
-            elzma_decompress_free(&hand);
-            return rc;
+        if (zmat_blosc2_decode_chunks(NULL, s->nthread, p, cbytes, s->out.buf + s->out.len, ret) != 0) {
+            return -8;
         }
 
-        elzma_decompress_free(&hand);
+        s->out.len += nbytes;
+        s->members++;
+        zmat_stream_consume(s, &in, &len, cbytes);
+    }
 
-        *outData = ds.outData;
-        *outLen = ds.outLen;
+    if (flush && (s->pend.len > 0 || s->members == 0)) {
+        *ret = -1;
+        return -8;
     }
 
-    return rc;
+    return 0;
 }
 
-#ifdef ZMAT_USE_LZMA_SDK
+#endif
 
-/* -----------------------------------------------------------------------
- * XZ stream wrappers — ISeqOutStream / ISeqInStream must have the
- * vtable function pointer as their FIRST field (C-style interface).
- * ----------------------------------------------------------------------- */
+#ifndef NO_LZMA
 
-typedef struct {
-    ISeqOutStream   vt;  /* first field — SDK casts the pointer to ISeqOutStreamPtr */
-    struct dataStream* ds;
-} ZmatXzOutStream;
+/**
+ * @brief Compress one window into a standalone lzip member
+ *
+ * Members emitted before the end of the stream are upgraded to lzip v1 so that
+ * zmat_run() can locate the member boundaries; a stream that fits in a single
+ * window produces the same v0 member as zmat_run().
+ */
 
-typedef struct {
-    ISeqInStream    vt;  /* first field */
-    struct dataStream* ds;
-} ZmatXzInStream;
+static int zmat_stream_lzip_block(TZMatStream* s, const unsigned char* block, size_t len, int last, int* ret) {
+    unsigned char* buf = NULL;
+    size_t buflen = 0;
+    int res;
 
-static size_t zmat_xz_write(ISeqOutStreamPtr p, const void* buf, size_t size) {
-    ZmatXzOutStream* s = (ZmatXzOutStream*)(void*)p;
-    return outputCallback(s->ds, buf, size);
-}
+    *ret = simpleCompress(&s->alloc, ELZMA_lzip, block, len, &buf, &buflen, s->clevel, s->nthread);
 
-static SRes zmat_xz_read(ISeqInStreamPtr p, void* buf, size_t* size) {
-    ZmatXzInStream* s = (ZmatXzInStream*)(void*)p;
-    return (SRes)inputCallback(s->ds, buf, size);
+    if (*ret != ELZMA_E_OK) {
+        zmat_dealloc(&s->alloc, buf);
+        return -4;
+    }
+
+    if (!(last && s->members == 0) && zmat_lzip_to_v1(&s->alloc, &buf, &buflen) != 0) {
+        zmat_dealloc(&s->alloc, buf);
+        return -5;
+    }
+
+    res = zmat_buffer_append(&s->out, buf, buflen);
+    zmat_dealloc(&s->alloc, buf);
+    s->members++;
+    return res;
 }
 
+#ifndef _WIN32
+
 /**
- * @brief XZ compression using LZMA2 with native multi-thread block encoding
+ * @brief lzma-alone stream compression through the encoder thread
  */
-int
-xzCompress(const unsigned char* inData, size_t inLen,
-           unsigned char** outData, size_t* outLen,
-           int level, int nthread) {
-    CXzProps props;
-    CXzEncHandle enc;
-    SRes rc;
-    struct dataStream ds;
-    ZmatXzOutStream outStream;
-    ZmatXzInStream  inStream;
 
-    XzProps_Init(&props);
-    props.lzma2Props.lzmaProps.level      = (level > 0) ? 5 : (-level);
-    props.lzma2Props.lzmaProps.numThreads = 1;              /* no match-finder MT: all parallelism at block level */
-    props.lzma2Props.numBlockThreads_Max  = (int)nthread;   /* block-level MT */
-    /* explicit block size: split input evenly across threads, 1 MB minimum.
-     * avoids the default 128 MB auto block size (dictSize*4 at level 5)
-     * which leaves small inputs as a single solid block with zero parallelism. */
-    {
-        size_t blk = (inLen + (size_t)nthread - 1) / (size_t)nthread;
+static int zmat_stream_lzma_encode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    ZmatLzmaBridge* b = s->bridge;
+    ZmatBuffer tmp;
 
-        if (blk < (1u << 20)) {
-            blk = (1u << 20);
-        }
+    pthread_mutex_lock(&b->lock);
 
-        props.lzma2Props.blockSize = (UInt64)blk;
+    if (flush) {
+        b->eof = 1;
+    } else {
+        b->feed = in;
+        b->feedlen = len;
     }
-    props.checkId = XZ_CHECK_CRC32;
 
-    ds.inData   = inData;
-    ds.inLen    = inLen;
-    ds.consumed = 0;
-    ds.outData  = NULL;
-    ds.outLen   = 0;
+    pthread_cond_broadcast(&b->cond);
 
-    outStream.vt.Write = zmat_xz_write;
-    outStream.ds       = &ds;
-    inStream.vt.Read   = zmat_xz_read;
-    inStream.ds        = &ds;
+    while ((flush || b->feedlen > 0) && !b->done) {
+        pthread_cond_wait(&b->cond, &b->lock);
+    }
 
-    enc = XzEnc_Create(&g_Alloc, &g_BigAlloc);
+    b->feedlen = 0;
 
-    if (!enc) {
-        return SZ_ERROR_MEM;
-    }
+    tmp = s->out;
+    s->out = b->out;
+    b->out = tmp;
+    b->out.len = 0;
 
-    rc = XzEnc_SetProps(enc, &props);
+    pthread_mutex_unlock(&b->lock);
 
-    if (rc == SZ_OK) {
-        XzEnc_SetDataSize(enc, (UInt64)inLen);
-        rc = XzEnc_Encode(enc, &outStream.vt, &inStream.vt, NULL);
+    if (b->done && !b->joined) {
+        pthread_join(b->thread, NULL);
+        b->joined = 1;
     }
 
-    XzEnc_Destroy(enc);
-
-    if (rc != SZ_OK) {
-        free(ds.outData);
-        return rc;
+    if (b->done && (b->rc != ELZMA_E_OK || !flush)) {
+        *ret = (b->rc != ELZMA_E_OK) ? b->rc : ELZMA_E_COMPRESS_ERROR;
+        return -4;
     }
 
-    *outData = ds.outData;
-    *outLen  = ds.outLen;
-    return SZ_OK;
+    return 0;
 }
 
+#endif
+
+#ifdef ZMAT_USE_LZMA_SDK
+
 /**
- * @brief XZ decompression using XzUnpacker streaming decoder
+ * @brief Compress one window into a standalone xz stream (xz streams can be concatenated)
  */
-int
-xzDecompress(const unsigned char* inData, size_t inLen,
-             unsigned char** outData, size_t* outLen) {
-    CXzUnpacker xz;
-    ECoderStatus status = CODER_STATUS_NOT_SPECIFIED;
-    SRes rc = SZ_OK;
-    unsigned char* accum = NULL;
-    size_t total = 0;
-    const Byte* src = (const Byte*)inData;
-    SizeT srcLeft = (SizeT)inLen;
 
-#define XZ_DECODE_BUF 65536
-    Byte outBuf[XZ_DECODE_BUF];
+static int zmat_stream_xz_block(TZMatStream* s, const unsigned char* block, size_t len, int last, int* ret) {
+    unsigned char* buf = NULL;
+    size_t buflen = 0;
+    int res, nworker;
+    (void)last;
 
-    XzUnpacker_Construct(&xz, &g_Alloc);
-    XzUnpacker_Init(&xz);
+    nworker = zmat_thread_acquire(s->nthread);
+    *ret = xzCompress(&s->alloc, block, len, &buf, &buflen, s->clevel, s->nthread, nworker);
+    zmat_thread_release(s->nthread);
 
-    while (srcLeft > 0 || status == CODER_STATUS_NOT_FINISHED) {
-        SizeT destLen = XZ_DECODE_BUF;
-        SizeT srcUsed = srcLeft;
+    if (*ret != SZ_OK) {
+        zmat_dealloc(&s->alloc, buf);
+        return -4;
+    }
 
-        rc = XzUnpacker_Code(&xz, outBuf, &destLen, src, &srcUsed,
-                             (srcLeft == 0) ? 1 : 0,
-                             CODER_FINISH_ANY, &status);
+    res = zmat_buffer_append(&s->out, buf, buflen);
+    zmat_dealloc(&s->alloc, buf);
+    s->members++;
+    return res;
+}
 
-        if (rc != SZ_OK) {
-            break;
-        }
+/**
+ * @brief lzma-alone/lzip stream decompression using the push-style LzmaDec decoder
+ *
+ * stage 0: header, 1: lzma data, 2: lzip footer, 3: end of an lzma-alone stream
+ */
 
-        if (destLen > 0) {
-            if (destLen > ZMAT_MAX_ALLOC - total) {
-                rc = SZ_ERROR_MEM;
-                break;
-            }
+static int zmat_stream_lzma_decode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    const unsigned char* p;
+    int res;
 
-            unsigned char* tmp = (unsigned char*)realloc(accum, total + destLen);
+    while (len > 0 && s->stage != 3) {
+        if (s->stage == 0) {
+            unsigned char props[LZMA_PROPS_SIZE];
+            size_t hdrlen = (s->zipid == zmLzip) ? 6 : 13;
 
-            if (!tmp) {
-                rc = SZ_ERROR_MEM;
-                break;
+            if ((res = zmat_stream_gather(s, &in, &len, hdrlen, &p)) <= 0) {
+                return res;
             }
 
-            accum = tmp;
-            memcpy(accum + total, outBuf, destLen);
-            total += destLen;
-        }
+            if (s->zipid == zmLzip) {
+                unsigned int dictsize = 1U << (p[5] & 0x1F);
 
-        src     += srcUsed;
-        srcLeft -= srcUsed;
+                if (memcmp(p, "LZIP", 4) != 0 || p[4] > 1) {
+                    *ret = ELZMA_E_CORRUPT_HEADER;
+                    return -4;
+                }
 
-        if (status == CODER_STATUS_FINISHED_WITH_MARK) {
-            break;
-        }
+                dictsize -= (dictsize / 16) * ((p[5] >> 5) & 0x7);
+                s->lzipver = p[4];
+                props[0] = 93;    /* lc=3, lp=0, pb=2 */
+                zmat_put_le(props + 1, dictsize, 4);
+                s->expected = (unsigned long long) -1;
+            } else {
+                memcpy(props, p, LZMA_PROPS_SIZE);
+                s->expected = zmat_get_le(p + LZMA_PROPS_SIZE, 8);
+            }
 
-        if (srcUsed == 0 && destLen == 0) {
-            break;    /* no progress — avoid infinite loop */
-        }
-    }
+            if (!s->lzinit) {
+                LzmaDec_Construct(&s->lzdec);
+                s->lzinit = 1;
+            }
 
-    if (rc == SZ_OK && !XzUnpacker_IsStreamWasFinished(&xz)) {
-        rc = SZ_ERROR_DATA;
-    }
+            if ((*ret = LzmaDec_Allocate(&s->lzdec, props, LZMA_PROPS_SIZE, &s->szalloc.vt)) != SZ_OK) {
+                return -4;
+            }
 
-    XzUnpacker_Free(&xz);
+            LzmaDec_Init(&s->lzdec);
+            zmat_stream_consume(s, &in, &len, hdrlen);
+            s->checksum = CRC_INIT_VAL;
+            s->count = 0;
+            s->stage = (s->expected == 0) ? 3 : 1;
+        } else if (s->stage == 1) {
+            while (1) {
+                SizeT outlen, inlen = len;
+                ELzmaStatus status;
+                ELzmaFinishMode mode = LZMA_FINISH_ANY;
+
+                if (zmat_buffer_reserve(&s->out, ZMAT_STREAM_CHUNK) != 0) {
+                    return -5;
+                }
 
-    if (rc != SZ_OK) {
-        free(accum);
-        return rc;
-    }
+                outlen = s->out.cap - s->out.len;
 
-    *outData = accum;
-    *outLen  = total;
-    return SZ_OK;
-}
+                if (s->expected != (unsigned long long) -1 && s->expected - s->count <= outlen) {
+                    outlen = (SizeT)(s->expected - s->count);
+                    mode = LZMA_FINISH_END;
+                }
 
-/* -----------------------------------------------------------------------
- * Option 3: parallel lzip — compress chunks independently, concatenate
- * ----------------------------------------------------------------------- */
+                *ret = LzmaDec_DecodeToBuf(&s->lzdec, s->out.buf + s->out.len, &outlen, in, &inlen, mode, &status);
 
-#ifndef _WIN32
+                if (*ret != SZ_OK) {
+                    return -4;
+                }
 
-typedef struct {
-    const unsigned char* in;
-    size_t               inLen;
-    unsigned char*       out;
-    size_t               outLen;
-    int                  level;
-    int                  rc;
-} LzipChunk;
+                if (s->zipid == zmLzip && outlen > 0) {
+                    s->checksum = CrcUpdate((UInt32)s->checksum, s->out.buf + s->out.len, outlen);
+                }
 
-static void* lzip_compress_chunk(void* arg) {
-    LzipChunk* c = (LzipChunk*)arg;
-    c->rc = simpleCompress(ELZMA_lzip, c->in, c->inLen,
-                           &c->out, &c->outLen, c->level, 1);
+                s->out.len += outlen;
+                s->count += outlen;
+                in += inlen;
+                len -= inlen;
+
+                if (status == LZMA_STATUS_FINISHED_WITH_MARK || s->count == s->expected) {
+                    s->stage = (s->zipid == zmLzip) ? 2 : 3;
+                    break;
+                }
 
-    /* Upgrade v0 → lzip v1: patch version byte (byte[4]) and append an
-     * 8-byte member_size field after the standard 12-byte footer.
-     * The v0 decompressor ignores the version byte and reads only 12 footer
-     * bytes, so v1 members are backward-compatible with the existing code.
-     * Backward-scanning the member_size fields lets the decompressor locate
-     * each member boundary precisely, fixing the consumed-overshoot bug. */
-    if (c->rc == ELZMA_E_OK && c->out != NULL && c->outLen > 18) {
-        size_t v1_size = c->outLen + 8;
-        unsigned char* tmp = (unsigned char*)realloc(c->out, v1_size);
+                if (inlen == 0 && outlen == 0) {
+                    break;
+                }
+            }
+        } else {
+            size_t ftrlen = (s->lzipver == 0) ? 12 : 20;
+
+            if ((res = zmat_stream_gather(s, &in, &len, ftrlen, &p)) <= 0) {
+                return res;
+            }
 
-        if (tmp) {
-            int k;
-            c->out    = tmp;
-            c->out[4] = 1;    /* version 1 */
+            if ((UInt32)zmat_get_le(p, 4) != CRC_GET_DIGEST((UInt32)s->checksum)) {
+                *ret = ELZMA_E_CRC32_MISMATCH;
+                return -4;
+            }
 
-            /* write member_size as little-endian uint64 */
-            for (k = 0; k < 8; k++) {
-                c->out[c->outLen + k] = (unsigned char)(v1_size >> (8 * k));
+            if (zmat_get_le(p + 4, 8) != s->count) {
+                *ret = ELZMA_E_SIZE_MISMATCH;
+                return -4;
             }
 
-            c->outLen = v1_size;
+            zmat_stream_consume(s, &in, &len, ftrlen);
+            s->members++;
+            s->stage = 0;
         }
+    }
 
-        /* if realloc fails, leave as v0 — single-member fallback still works */
+    if (flush && s->stage != 3 && !(s->zipid == zmLzip && s->stage == 0 && s->members > 0 && s->pend.len == 0)) {
+        *ret = ELZMA_E_INSUFFICIENT_INPUT;
+        return -4;
     }
 
-    return NULL;
+    return 0;
 }
 
-int
-simpleCompressLzipMT(const unsigned char* inData, size_t inLen,
-                     unsigned char** outData, size_t* outLen,
-                     int level, int nthread) {
-    if (nthread <= 1 || inLen == 0) {
-        return simpleCompress(ELZMA_lzip, inData, inLen,
-                              outData, outLen, level, 1);
-    }
+/**
+ * @brief xz stream decompression using the XzUnpacker push decoder
+ */
 
-    size_t chunk = (inLen + (size_t)nthread - 1) / (size_t)nthread;
+static int zmat_stream_xz_decode(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    while (1) {
+        SizeT outlen, inlen = len;
+        ECoderStatus status;
 
-    /* Require at least 1 KB per chunk to make parallelism worthwhile.
-     * For small inputs, fall back to single-thread (produces standard v0). */
-    if (chunk < 1024) {
-        return simpleCompress(ELZMA_lzip, inData, inLen,
-                              outData, outLen, level, 1);
-    }
+        if (zmat_buffer_reserve(&s->out, ZMAT_STREAM_CHUNK) != 0) {
+            return -5;
+        }
 
-    LzipChunk*  chunks  = (LzipChunk*)calloc((size_t)nthread, sizeof(LzipChunk));
-    pthread_t*  threads = (pthread_t*)calloc((size_t)nthread, sizeof(pthread_t));
+        outlen = s->out.cap - s->out.len;
+        *ret = XzUnpacker_Code(&s->xzdec, s->out.buf + s->out.len, &outlen, in, &inlen,
+                               flush, CODER_FINISH_ANY, &status);
 
-    if (!chunks || !threads) {
-        free(chunks);
-        free(threads);
-        return ELZMA_E_COMPRESS_ERROR;
-    }
+        if (*ret != SZ_OK) {
+            return -4;
+        }
 
-    int i;
+        s->out.len += outlen;
+        in += inlen;
+        len -= inlen;
 
-    for (i = 0; i < nthread; i++) {
-        chunks[i].in    = inData + (size_t)i * chunk;
-        chunks[i].inLen = ((size_t)i == (size_t)nthread - 1)
-                          ? (inLen - (size_t)i * chunk) : chunk;
-        chunks[i].level = level;
+        if (inlen == 0 && outlen == 0) {
+            break;
+        }
+    }
 
-        if (pthread_create(&threads[i], NULL, lzip_compress_chunk, &chunks[i]) != 0) {
-            /* join already-started threads and clean up */
-            int j;
+    if (flush && !XzUnpacker_IsStreamWasFinished(&s->xzdec)) {
+        *ret = SZ_ERROR_INPUT_EOF;
+        return -4;
+    }
 
-            for (j = 0; j < i; j++) {
-                pthread_join(threads[j], NULL);
-                free(chunks[j].out);
-            }
+    return 0;
+}
 
-            free(chunks);
-            free(threads);
-            return ELZMA_E_COMPRESS_ERROR;
-        }
-    }
+#endif
+#endif
 
-    size_t total = 0;
-    int rc = ELZMA_E_OK;
+/**
+ * @brief Dispatch a piece of input (or the final flush) to the codec of a stream
+ */
 
-    for (i = 0; i < nthread; i++) {
-        pthread_join(threads[i], NULL);
+static int zmat_stream_code(TZMatStream* s, const unsigned char* in, size_t len, int flush, int* ret) {
+    if (s->zipid == zmZlib || s->zipid == zmGzip) {
+        return s->clevel ? zmat_stream_deflate(s, in, len, flush, ret) : zmat_stream_inflate(s, in, len, flush, ret);
+#ifndef NO_ZSTD
+    } else if (s->zipid == zmZstd) {
+        return zmat_stream_zstd(s, in, len, flush, ret);
+#endif
+#ifndef NO_LZ4
+    } else if (s->zipid == zmLz4 || s->zipid == zmLz4hc || s->zipid == zmLz4f) {
+        return s->clevel ? zmat_stream_lz4_encode(s, in, len, flush, ret) : zmat_stream_lz4_decode(s, in, len, flush, ret);
+#endif
+#ifndef NO_BLOSC2
+    } else if (s->zipid >= zmBlosc2Blosclz && s->zipid <= zmBlosc2Zstd) {
+        return s->clevel ? zmat_stream_blocks(s, in, len, flush, zmat_stream_blosc2_block, ret) : zmat_stream_blosc2_decode(s, in, len, flush, ret);
+#endif
+#ifndef NO_LZMA
+    } else if (s->zipid == zmLzip && s->clevel) {
+        return zmat_stream_blocks(s, in, len, flush, zmat_stream_lzip_block, ret);
+    } else if (s->zipid == zmLzma && s->clevel) {
+#ifndef _WIN32
+        return zmat_stream_lzma_encode(s, in, len, flush, ret);
+#else
 
-        if (chunks[i].rc != ELZMA_E_OK) {
-            rc = chunks[i].rc;
+        /* no encoder thread: buffer the whole input and compress it at the end, see zmat_stream_init() in zmatlib.h */
+        if (zmat_buffer_append(&s->pend, in, len) != 0) {
+            return -5;
         }
 
-        total += chunks[i].outLen;
-    }
+        if (flush) {
+            unsigned char* buf = NULL;
+            size_t buflen = 0;
+            int res;
 
-    if (rc != ELZMA_E_OK) {
-        for (i = 0; i < nthread; i++) {
-            free(chunks[i].out);
+            *ret = simpleCompress(&s->alloc, ELZMA_lzma, s->pend.buf, s->pend.len, &buf, &buflen, s->clevel, s->nthread);
+
+            if (*ret != ELZMA_E_OK) {
+                zmat_dealloc(&s->alloc, buf);
+                return -4;
+            }
+
+            res = zmat_buffer_append(&s->out, buf, buflen);
+            zmat_dealloc(&s->alloc, buf);
+            return res;
         }
 
-        free(chunks);
-        free(threads);
-        return rc;
+        return 0;
+#endif
+#ifdef ZMAT_USE_LZMA_SDK
+    } else if (s->zipid == zmLzip || s->zipid == zmLzma) {
+        return zmat_stream_lzma_decode(s, in, len, flush, ret);
+    } else if (s->zipid == zmXz) {
+        return s->clevel ? zmat_stream_blocks(s, in, len, flush, zmat_stream_xz_block, ret) : zmat_stream_xz_decode(s, in, len, flush, ret);
+#endif
+#endif
     }
 
-    unsigned char* buf = (unsigned char*)malloc(total);
+    return -999;
+}
 
-    if (!buf) {
-        for (i = 0; i < nthread; i++) {
-            free(chunks[i].out);
-        }
+/**
+ * @brief Hand the output accumulated by the current call over to the caller
+ */
 
-        free(chunks);
-        free(threads);
-        return ELZMA_E_COMPRESS_ERROR;
+static int zmat_stream_output(TZMatStream* s, int res, size_t* outputsize, unsigned char** outputbuf) {
+    if (res != 0) {
+        s->finished = 1;
+        s->out.len = 0;
+        return res;
     }
 
-    size_t pos = 0;
-
-    for (i = 0; i < nthread; i++) {
-        memcpy(buf + pos, chunks[i].out, chunks[i].outLen);
-        free(chunks[i].out);
-        pos += chunks[i].outLen;
+    if (s->out.len > 0) {
+        *outputbuf = s->out.buf;
+        *outputsize = s->out.len;
+        zmat_shrink_buf(&s->alloc, outputbuf, *outputsize);
+        s->out.buf = NULL;
+        s->out.len = s->out.cap = 0;
     }
 
-    free(chunks);
-    free(threads);
-    *outData = buf;
-    *outLen  = total;
-    return ELZMA_E_OK;
+    return 0;
 }
 
-#endif  /* !_WIN32 */
-#endif  /* ZMAT_USE_LZMA_SDK */
-
-#endif
-
-#ifdef NO_ZLIB
-/*
- * miniz based gzip compression code was adapted based on the following
- * https://github.com/atheriel/fluent-bit/blob/8f0002b36601006240d50ea3c86769629d99b1e8/src/flb_gzip.c
- */
-
-/*  Fluent Bit
- *  ==========
- *  Copyright (C) 2019-2020 The Fluent Bit Authors
- *  Copyright (C) 2015-2018 Treasure Data Inc.
- *
- *  Licensed under the Apache License, Version 2.0 (the "License");
- *  you may not use this file except in compliance with the License.
- *  You may obtain a copy of the License at
- *
- *      http://www.apache.org/licenses/LICENSE-2.0
+/**
+ * @brief Create a stream handle for incremental compression/decompression
  *
- *  Unless required by applicable law or agreed to in writing, software
- *  distributed under the License is distributed on an "AS IS" BASIS,
- *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
- *  See the License for the specific language governing permissions and
- *  limitations under the License.
+ * @param[out] stream: the new stream handle, free it with zmat_stream_free()
+ * @param[in] zipid: compression method, see TZipMethod (base64 is not supported)
+ * @param[in] iscompress: packed flags as in zmat_run (0: decompression)
+ * @return 0 on success, otherwise the coarse grained zmat error code
  */
 
-typedef enum {
-    FTEXT    = 1,
-    FHCRC    = 2,
-    FEXTRA   = 4,
-    FNAME    = 8,
-    FCOMMENT = 16
-} miniz_tinf_gzip_flag;
-
-static unsigned int read_le16(const unsigned char* p) {
-    return ((unsigned int) p[0]) | ((unsigned int) p[1] << 8);
-}
-
-static unsigned int read_le32(const unsigned char* p) {
-    return ((unsigned int) p[0])
-           | ((unsigned int) p[1] << 8)
-           | ((unsigned int) p[2] << 16)
-           | ((unsigned int) p[3] << 24);
-}
+int zmat_stream_init(TZMatStream** stream, const int zipid, const int iscompress) {
+    TZMatStream* s;
+    TZMatFlags flags;
+    int res = 0;
 
-/* Uncompress (inflate) GZip data */
-int miniz_gzip_uncompress(void* in_data, size_t in_len,
-                          void** out_data, size_t* out_len) {
-    int status;
-    unsigned char* p;
-    void* out_buf;
-    size_t out_size = 0;
-    void* zip_data;
-    size_t zip_len;
-    unsigned char flg;
-    unsigned int xlen, hcrc;
-    unsigned int dlen, crc;
-    mz_ulong crc_out;
-    mz_stream stream;
-    const unsigned char* start;
+    if (stream == NULL) {
+        return -11;
+    }
 
-    *out_data = NULL;
-    *out_len = 0;
+    *stream = NULL;
+    flags.iscompress = iscompress;
 
-    /* Minimal length: header + crc32 */
-    if (in_len < 18) {
-        return -1;
+    if ((s = (TZMatStream*)zmat_malloc(&zmat_allocator, sizeof(TZMatStream))) == NULL) {
+        return -5;
     }
 
-    /* Magic bytes */
-    p = (unsigned char*)in_data;
+    memset(s, 0, sizeof(TZMatStream));
+    s->alloc = zmat_allocator;
+    s->out.al = s->pend.al = &s->alloc;
+    zmat_zstream_init(&s->zs, &s->alloc);
+#ifndef NO_LZ4
+    s->hist.al = &s->alloc;
+#endif
+#if !defined(NO_LZMA) && defined(ZMAT_USE_LZMA_SDK)
+    zmat_sz_init(&s->szalloc, &s->alloc);
+#endif
+    s->zipid = zipid;
+    s->clevel = flags.param.clevel;
+    s->nthread = zmat_thread_plan(flags.param.nthread, ZMAT_STREAM_WINDOW);
+    s->shuffle = (flags.param.shuffle == 0 || flags.param.shuffle == -1) ? 1 : flags.param.shuffle;
+    s->typesize = (flags.param.typesize == 0 || flags.param.typesize == -1) ? 4 : flags.param.typesize;
+    s->window = ZMAT_STREAM_WINDOW;
 
-    if (p[0] != 0x1F || p[1] != 0x8B) {
-        return -2;
-    }
+    if (zipid == zmZlib || zipid == zmGzip) {
+        if (s->clevel) {
+            int level = (s->clevel > 0) ? Z_DEFAULT_COMPRESSION : (-s->clevel);
 
-    if (p[2] != 8) {
-        return -3;
-    }
+            if (zipid == zmZlib) {
+                res = deflateInit(&s->zs, level);
+            } else {
+#ifdef NO_ZLIB
+                res = deflateInit2(&s->zs, level, Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9, Z_DEFAULT_STRATEGY);
+#else
+                res = deflateInit2(&s->zs, level, Z_DEFLATED, 15 | 16, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+#endif
+            }
+        } else {
+            if (zipid == zmZlib) {
+                res = inflateInit(&s->zs);
+                s->stage = 1;
+            } else {
+#ifdef NO_ZLIB
+                res = inflateInit2(&s->zs, -Z_DEFAULT_WINDOW_BITS);
+#else
+                res = inflateInit2(&s->zs, 15 | 32);
+                s->stage = 1;
+#endif
+            }
+        }
 
-    /* Flag byte */
-    flg = p[3];
+        s->zsinit = (res == Z_OK);
+        res = (res == Z_OK) ? 0 : -2;
+#ifndef NO_ZSTD
+    } else if (zipid == zmZstd) {
+        if (s->clevel) {
+            if ((s->zcctx = ZSTD_createCCtx_advanced(zmat_zstd_mem(&s->alloc))) == NULL) {
+                res = -5;
+            } else {
+                ZSTD_CCtx_setParameter(s->zcctx, ZSTD_c_compressionLevel, (s->clevel > 0) ? ZSTD_CLEVEL_DEFAULT : (-s->clevel));
+                zmat_zstd_workers(s->zcctx, s->nthread, (s->nthread < zmat_thread_max()) ? s->nthread : zmat_thread_max());
+            }
+        } else if ((s->zdctx = ZSTD_createDCtx_advanced(zmat_zstd_mem(&s->alloc))) == NULL) {
+            res = -5;
+        }
 
-    /* Reserved bits */
-    if (flg & 0xE0) {
-        return -4;
-    }
+#endif
+#ifndef NO_LZ4
+    } else if (zipid == zmLz4 || zipid == zmLz4hc || zipid == zmLz4f) {
+        s->window = ZMAT_LZ4_BLOCK;
+        XXH32_reset(&s->xxh, 0);
+#endif
+#ifndef NO_BLOSC2
+    } else if (zipid >= zmBlosc2Blosclz && zipid <= zmBlosc2Zstd) {
+        s->window -= s->window % (size_t)s->typesize;
+#endif
+#ifndef NO_LZMA
+    } else if (zipid == zmLzip && s->clevel) {
+        /* lzip members are produced window by window */
+    } else if (zipid == zmLzma && s->clevel) {
+#ifndef _WIN32
+        ZmatLzmaBridge* b = (ZmatLzmaBridge*)zmat_malloc(&s->alloc, sizeof(ZmatLzmaBridge));
 
-    /* Skip base header of 10 bytes */
-    start = p + GZIP_HEADER_SIZE;
+        if (b == NULL) {
+            res = -5;
+        } else {
+            memset(b, 0, sizeof(ZmatLzmaBridge));
+            b->out.al = &s->alloc;
+            s->bridge = b;
+            pthread_mutex_init(&b->lock, NULL);
+            pthread_cond_init(&b->cond, NULL);
+            b->done = b->joined = 1;
+
+            if ((b->hand = elzma_compress_alloc()) == NULL) {
+                res = -5;
+            } else {
+                elzma_compress_set_allocation_callbacks(b->hand, zmat_elzma_alloc, (void*)&s->alloc, zmat_elzma_free, (void*)&s->alloc);
+                elzma_compress_set_numthreads(b->hand, s->nthread);
 
-    /* Skip extra data if present */
-    if (flg & FEXTRA) {
-        if (start + 2 > p + in_len) {
-            return -5;
-        }
+                /* uncompressed size 0: streamed header, terminated by the end mark */
+                if (elzma_compress_config(b->hand, ELZMA_LC_DEFAULT, ELZMA_LP_DEFAULT, ELZMA_PB_DEFAULT,
+                                          ((s->clevel > 0) ? 5 : -s->clevel), (1 << 20), ELZMA_lzma, 0) != ELZMA_E_OK) {
+                    res = -4;
+                } else {
+                    b->done = b->joined = 0;
 
-        xlen = read_le16(start);
+                    if (pthread_create(&b->thread, NULL, zmat_bridge_main, (void*)b) != 0) {
+                        b->done = b->joined = 1;
+                        res = -4;
+                    }
+                }
+            }
+        }
 
-        if (xlen > in_len - (start - p) - 2) {
-            return -5;
+#endif
+#ifdef ZMAT_USE_LZMA_SDK
+    } else if (zipid == zmLzip || zipid == zmLzma) {
+        zmat_lzma_crc_init();
+    } else if (zipid == zmXz) {
+        if (!s->clevel) {
+            zmat_lzma_crc_init();
+            XzUnpacker_Construct(&s->xzdec, &s->szalloc.vt);
+            XzUnpacker_Init(&s->xzdec);
+            s->xzinit = 1;
         }
 
-        start += xlen + 2;
+#endif
+#endif
+    } else {
+        res = -999;
     }
 
-    /* Skip file name if present */
-    if (flg & FNAME) {
-        do {
-            if (start - p >= (ptrdiff_t)in_len) {
-                return -6;
-            }
-        } while (*start++);
+    if (res != 0) {
+        zmat_stream_free(&s);
+        return res;
     }
 
-    /* Skip file comment if present */
-    if (flg & FCOMMENT) {
-        do {
-            if (start - p >= (ptrdiff_t)in_len) {
-                return -6;
-            }
-        } while (*start++);
-    }
+    *stream = s;
+    return 0;
+}
 
-    /* Check header crc if present */
-    if (flg & FHCRC) {
-        if (start - p > (ptrdiff_t)(in_len - 2)) {
-            return -7;
-        }
+/**
+ * @brief Feed the next piece of input to a stream
+ *
+ * @param[in] stream: stream handle created by zmat_stream_init()
+ * @param[in] inputsize: length of the input piece (may be 0)
+ * @param[in] inputstr: input piece
+ * @param[out] outputsize: length of the output produced by this call (may be 0)
+ * @param[out] outputbuf: output produced by this call (NULL if none), free with zmat_free()
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
 
-        hcrc = read_le16(start);
-        crc = mz_crc32(MZ_CRC32_INIT, p, start - p) & 0x0000FFFF;
+int zmat_stream_update(TZMatStream* stream, const size_t inputsize, const unsigned char* inputstr, size_t* outputsize, unsigned char** outputbuf, int* ret) {
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
 
-        if (hcrc != crc) {
-            return -8;
-        }
+    if (stream == NULL || stream->finished) {
+        return -11;
+    }
 
-        start += 2;
+    if (inputsize == 0) {
+        return 0;
     }
 
-    /* Get decompressed length */
-    dlen = read_le32(&p[in_len - 4]);
+    stream->consumed += inputsize;
+    return zmat_stream_output(stream, zmat_stream_code(stream, inputstr, inputsize, 0, ret), outputsize, outputbuf);
+}
 
-    /* Get CRC32 checksum of original data */
-    crc = read_le32(&p[in_len - 8]);
+/**
+ * @brief Flush the remaining output of a stream and verify that it is complete
+ *
+ * @param[in] stream: stream handle created by zmat_stream_init()
+ * @param[out] outputsize: length of the final output piece (may be 0)
+ * @param[out] outputbuf: final output piece (NULL if none), free with zmat_free()
+ * @param[out] ret: encoder/decoder specific detailed error code (if error occurs)
+ * @return return the coarse grained zmat error code; detailed error code is in ret.
+ */
 
-    /* Decompress data */
-    if ((p + in_len) - start < 8) {
-        return -9;
+int zmat_stream_finish(TZMatStream* stream, size_t* outputsize, unsigned char** outputbuf, int* ret) {
+    *outputbuf = NULL;
+    *outputsize = 0;
+    *ret = 0;
+
+    if (stream == NULL || stream->finished) {
+        return -11;
     }
 
-    /* Allocate outgoing buffer */
-    out_buf = malloc(dlen);
+    stream->finished = 1;
 
-    if (!out_buf) {
-        return -10;
+    if (stream->consumed == 0) {
+        return -1;
     }
 
-    out_size = dlen;
+    return zmat_stream_output(stream, zmat_stream_code(stream, NULL, 0, 1, ret), outputsize, outputbuf);
+}
 
-    /* Map zip content */
-    zip_data = (unsigned char*) start;
-    zip_len = (p + in_len) - start - 8;
+/**
+ * @brief Release a stream handle and all codec state attached to it
+ *
+ * @param[in,out] stream: the stream handle to be freed, set to NULL on return
+ */
 
-    memset(&stream, 0, sizeof(stream));
-    stream.next_in = (unsigned char*)zip_data;
-    stream.avail_in = zip_len;
-    stream.next_out = (unsigned char*)out_buf;
-    stream.avail_out = out_size;
+void zmat_stream_free(TZMatStream** stream) {
+    TZMatStream* s;
 
-    status = mz_inflateInit2(&stream, -Z_DEFAULT_WINDOW_BITS);
+    if (stream == NULL || *stream == NULL) {
+        return;
+    }
 
-    if (status != MZ_OK) {
-        free(out_buf);
-        return -11;
+    s = *stream;
+
+    if (s->zsinit) {
+        if (s->clevel) {
+            deflateEnd(&s->zs);
+        } else {
+            inflateEnd(&s->zs);
+        }
     }
 
-    status = mz_inflate(&stream, MZ_FINISH);
+#ifndef NO_ZSTD
+    ZSTD_freeCCtx(s->zcctx);
+    ZSTD_freeDCtx(s->zdctx);
+#endif
+#ifndef NO_LZ4
+    zmat_dealloc(&s->alloc, s->hist.buf);
+#endif
+#if !defined(NO_LZMA) && defined(ZMAT_USE_LZMA_SDK)
 
-    if (status != MZ_STREAM_END) {
-        mz_inflateEnd(&stream);
-        free(out_buf);
-        return -12;
+    if (s->lzinit) {
+        LzmaDec_Free(&s->lzdec, &s->szalloc.vt);
     }
 
-    if (stream.total_out != dlen) {
-        mz_inflateEnd(&stream);
-        free(out_buf);
-        return -13;
+    if (s->xzinit) {
+        XzUnpacker_Free(&s->xzdec);
     }
 
-    /* terminate the stream, it's not longer required */
-    mz_inflateEnd(&stream);
+#endif
+#if !defined(NO_LZMA) && !defined(_WIN32)
 
-    /* Validate message CRC vs inflated data CRC */
-    crc_out = mz_crc32(MZ_CRC32_INIT, (unsigned char*)out_buf, dlen);
+    if (s->bridge) {
+        ZmatLzmaBridge* b = s->bridge;
 
-    if (crc_out != crc) {
-        free(out_buf);
-        return -14;
-    }
+        /* release an encoder thread that is still waiting for input */
+        pthread_mutex_lock(&b->lock);
+        b->eof = 1;
+        b->feedlen = 0;
+        pthread_cond_broadcast(&b->cond);
+        pthread_mutex_unlock(&b->lock);
 
-    /* set the uncompressed data */
-    *out_len = dlen;
-    *out_data = out_buf;
+        if (!b->joined) {
+            pthread_join(b->thread, NULL);
+        }
 
-    return 0;
+        if (b->hand) {
+            elzma_compress_free(&b->hand);
+        }
+
+        pthread_mutex_destroy(&b->lock);
+        pthread_cond_destroy(&b->cond);
+        zmat_dealloc(&s->alloc, b->out.buf);
+        zmat_dealloc(&s->alloc, b);
+    }
+
+#endif
+    zmat_dealloc(&s->alloc, s->out.buf);
+    zmat_dealloc(&s->alloc, s->pend.buf);
+    zmat_dealloc(&s->alloc, s);
+    *stream = NULL;
 }
-#endif
\ No newline at end of file
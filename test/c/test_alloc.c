@@ -0,0 +1,377 @@
+/***************************************************************************//**
+**  \mainpage ZMat - A portable C-library and MATLAB/Octave toolbox for inline data compression
+**
+**  \author Qianqian Fang <q.fang at neu.edu>
+**  \copyright Qianqian Fang, 2019,2020,2022
+**
+**  Unit test of the custom allocator (zmat_set_allocator/TZMatAllocator): a
+**  counting allocator must see every allocation made by the library, for
+**  successful and failing calls, and get every block back through its free
+**
+**  \section slicense License
+**          GPL v3, see LICENSE.txt for details
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "zmatlib.h"
+
+static const char* methods[] = {"zlib", "gzip", "zstd", "lzma", "lzip", "xz", "lz4", "lz4hc", "lz4f",
+                                "blosc2blosclz", "blosc2lz4", "blosc2lz4hc", "blosc2zlib", "blosc2zstd", "base64"
+                               };
+static const TZipMethod zipids[] = {zmZlib, zmGzip, zmZstd, zmLzma, zmLzip, zmXz, zmLz4, zmLz4hc, zmLz4f,
+                                    zmBlosc2Blosclz, zmBlosc2Lz4, zmBlosc2Lz4hc, zmBlosc2Zlib, zmBlosc2Zstd, zmBase64
+                                   };
+
+static int failed = 0, passed = 0;
+
+#define CHECK(cond, ...) do { \
+        if (cond) { passed++; } else { failed++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } \
+    } while (0)
+
+/**
+ * @brief Allocation counters of one counting allocator; the callbacks may run on worker threads
+ */
+
+typedef struct TCounter {
+    pthread_mutex_t lock;
+    long allocs;   /**< number of blocks handed out */
+    long live;     /**< blocks not yet released */
+    long foreign;  /**< pointers passed to realloc/free that this allocator did not hand out */
+    long failat;   /**< if positive, the failat-th allocation or reallocation from now fails */
+    size_t largest; /**< largest block requested */
+} TCounter;
+
+/**
+ * @brief Count down to an injected allocation failure, return 1 if this call must fail
+ */
+
+static int count_fail(TCounter* c) {
+    int fail;
+
+    pthread_mutex_lock(&c->lock);
+    fail = (c->failat > 0 && --c->failat == 0);
+    pthread_mutex_unlock(&c->lock);
+    return fail;
+}
+
+/* each block carries a header recording its owner, kept at malloc alignment */
+#define HEADER 16
+
+static void count_size(TCounter* c, size_t size) {
+    pthread_mutex_lock(&c->lock);
+    c->largest = (size > c->largest) ? size : c->largest;
+    pthread_mutex_unlock(&c->lock);
+}
+
+static void* count_alloc(void* opaque, size_t size) {
+    TCounter* c = (TCounter*)opaque;
+    unsigned char* p;
+
+    count_size(c, size);
+    p = count_fail(c) ? NULL : (unsigned char*)malloc(size + HEADER);
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    memcpy(p, &c, sizeof(c));
+    pthread_mutex_lock(&c->lock);
+    c->allocs++;
+    c->live++;
+    pthread_mutex_unlock(&c->lock);
+    return p + HEADER;
+}
+
+static int count_owns(TCounter* c, void* ptr) {
+    TCounter* owner;
+
+    memcpy(&owner, (unsigned char*)ptr - HEADER, sizeof(owner));
+    return owner == c;
+}
+
+static void* count_realloc(void* opaque, void* ptr, size_t size) {
+    TCounter* c = (TCounter*)opaque;
+    unsigned char* p;
+
+    if (ptr == NULL) {
+        return count_alloc(opaque, size);
+    }
+
+    if (!count_owns(c, ptr)) {
+        pthread_mutex_lock(&c->lock);
+        c->foreign++;
+        pthread_mutex_unlock(&c->lock);
+        return NULL;
+    }
+
+    count_size(c, size);
+
+    if (count_fail(c)) {
+        return NULL;
+    }
+
+    p = (unsigned char*)realloc((unsigned char*)ptr - HEADER, size + HEADER);
+    return p ? p + HEADER : NULL;
+}
+
+static void count_free(void* opaque, void* ptr) {
+    TCounter* c = (TCounter*)opaque;
+    int owned = (ptr != NULL && count_owns(c, ptr));
+
+    pthread_mutex_lock(&c->lock);
+
+    if (owned) {
+        c->live--;
+    } else {
+        c->foreign++;
+    }
+
+    pthread_mutex_unlock(&c->lock);
+
+    if (owned) {
+        memset((unsigned char*)ptr - HEADER, 0, HEADER);
+        free((unsigned char*)ptr - HEADER);
+    }
+}
+
+/**
+ * @brief Fill buf with compressible pseudo-random text
+ */
+
+static void fill_data(unsigned char* buf, size_t len, unsigned int seed) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = ((seed >> 16) % 4 == 0) ? (unsigned char)(seed >> 8) : (unsigned char)("zmat allocator "[i % 15]);
+    }
+}
+
+/**
+ * @brief Encode, decode and decode a corrupt copy with method i, checking that the counter gets everything back
+ */
+
+static void test_method(TCounter* c, int i, unsigned char* data, size_t len, int nthread) {
+    union TZMatFlags flags = {1};
+    size_t enclen = 0, declen = 0;
+    unsigned char* enc = NULL, *dec = NULL;
+    long allocs = c->allocs;
+    int res, status = 0;
+
+    flags.param.nthread = (char)nthread;
+
+    res = zmat_run(len, data, &enclen, &enc, zipids[i], &status, flags.iscompress);
+    CHECK(res == 0 && c->allocs > allocs && c->live == 1, "%s: encoding is not allocated by the allocator (%d, %ld live)", methods[i], res, c->live);
+
+    if (res == 0) {
+        res = zmat_run(enclen, enc, &declen, &dec, zipids[i], &status, 0);
+        CHECK(res == 0 && declen == len && memcmp(dec, data, len) == 0 && c->live == 2, "%s: decoding fails or leaks (%d, %ld live)", methods[i], res, c->live);
+        zmat_free(&dec);
+
+        /* error path: a truncated and damaged input */
+        if (zipids[i] != zmBase64) {
+            memset(enc + enclen / 4, 0xa5, enclen / 4);
+            res = zmat_run(enclen / 2, enc, &declen, &dec, zipids[i], &status, 0);
+            zmat_free(&dec);
+            CHECK(c->live == 1, "%s: decoding corrupt input (%d) leaks %ld blocks", methods[i], res, c->live - 1);
+        }
+    }
+
+    zmat_free(&enc);
+    CHECK(c->live == 0 && c->foreign == 0, "%s: %ld blocks leaked, %ld foreign pointers released", methods[i], c->live, c->foreign);
+}
+
+/**
+ * @brief Fail each allocation of an encoding and a decoding with method i in turn; nothing may leak
+ */
+
+static void test_oom(TCounter* c, int i, unsigned char* data, size_t len) {
+    size_t enclen = 0, declen = 0;
+    unsigned char* enc = NULL, *dec = NULL;
+    int k, res = -5, status = 0, iscompress;
+
+    for (iscompress = 1; iscompress >= 0; iscompress--) {
+        for (k = 1, res = -5; res != 0 && k < 1000; k++) {
+            c->failat = k;
+            res = iscompress ? zmat_run(len, data, &enclen, &enc, zipids[i], &status, 1)
+                  : zmat_run(enclen, enc, &declen, &dec, zipids[i], &status, 0);
+
+            if (res != 0) {
+                CHECK(c->live == (iscompress ? 0 : 1), "%s: %s with allocation %d failing (%d) leaks %ld blocks",
+                      methods[i], iscompress ? "encoding" : "decoding", k, res, c->live - !iscompress);
+            }
+        }
+
+        c->failat = 0;
+        CHECK(res == 0, "%s: %s fails without an allocation failure (%d)", methods[i], iscompress ? "encoding" : "decoding", res);
+
+        if (res != 0) {
+            break;
+        }
+    }
+
+    zmat_free(&dec);
+    zmat_free(&enc);
+    CHECK(c->live == 0 && c->foreign == 0, "%s: %ld blocks leaked, %ld foreign pointers released", methods[i], c->live, c->foreign);
+}
+
+/**
+ * @brief Run method i through a stream, in 777-byte pieces, then abandon a second stream half way
+ */
+
+static void test_stream(TCounter* c, int i, unsigned char* data, size_t len) {
+    TZMatStream* s = NULL;
+    size_t pos, outlen = 0;
+    unsigned char* out = NULL;
+    long allocs = c->allocs;
+    int res = 0, status = 0, k;
+
+    for (k = 0; k < 2; k++) {
+        if (zmat_stream_init(&s, zipids[i], 1) != 0) {
+            return;
+        }
+
+        for (pos = 0; res == 0 && pos < len && (k == 0 || pos < len / 2); pos += 777) {
+            res = zmat_stream_update(s, (len - pos < 777) ? len - pos : 777, data + pos, &outlen, &out, &status);
+            zmat_free(&out);
+        }
+
+        if (k == 0) {
+            res = zmat_stream_finish(s, &outlen, &out, &status);
+            zmat_free(&out);
+        }
+
+        zmat_stream_free(&s);
+    }
+
+    CHECK(res == 0 && c->allocs > allocs && c->live == 0 && c->foreign == 0,
+          "%s: stream (%d) allocates %ld blocks, leaks %ld, releases %ld foreign", methods[i], res, c->allocs - allocs, c->live, c->foreign);
+}
+
+int main(void) {
+    TCounter global = {PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0}, local = {PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, 0};
+    TZMatAllocator al = {count_alloc, count_realloc, count_free, &global};
+    TZMatAllocator al2 = {count_alloc, count_realloc, count_free, &local};
+    TZMatAllocator bad = {count_alloc, NULL, count_free, &global};
+    size_t len = (9 << 20) + 4321, enclen = 0;
+    unsigned char* data = (unsigned char*)malloc(len), *enc = NULL;
+    TZMatCtx* ctx = NULL;
+    unsigned int i;
+    int status = 0;
+
+    fill_data(data, len, 1);
+
+    CHECK(zmat_set_allocator(NULL, &bad) == -13, "an allocator without realloc is accepted");
+    CHECK(zmat_set_allocator(NULL, &al) == 0, "zmat_set_allocator fails");
+
+    /* the global allocator, single threaded and on the thread pool */
+    for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+        test_method(&global, i, data, 300007, 1);
+        test_method(&global, i, data, len, 4);
+        test_stream(&global, i, data, 300007);
+        test_oom(&global, i, data, 20011);
+    }
+
+    {
+        size_t outlen = 0;
+        unsigned char* out = base64_encode(data, 1000, &outlen, 0);
+
+        CHECK(out != NULL && global.live == 1, "base64_encode does not use the allocator");
+        zmat_free(&out);
+        CHECK(global.live == 0 && global.foreign == 0, "base64_encode output is not released by the allocator");
+    }
+
+    /* a lzma header or lzip footer claiming 4 GB must not size the output buffer of a 1000-byte input */
+    {
+        const TZipMethod lzids[] = {zmLzma, zmLzip};
+        size_t outlen = 0, at;
+        unsigned char* out = NULL;
+        int k;
+
+        zmat_set_max_alloc((size_t)8 << 30);
+
+        for (k = 0; k < 2; k++) {
+            if (zmat_run(1000, data, &enclen, &enc, lzids[k], &status, 1) != 0) {
+                CHECK(0, "%s: encoding fails", methods[3 + k]);
+                continue;
+            }
+
+            /* the decoded length: bytes 5-12 of the lzma header, or the data_size of the lzip footer */
+            at = (lzids[k] == zmLzma) ? 5 : ((enc[4] == 1) ? enclen - 16 : enclen - 8);
+            memset(enc + at, 0, 8);
+            enc[at + 4] = 1;
+            global.largest = 0;
+            zmat_run(enclen, enc, &outlen, &out, lzids[k], &status, 0);
+            CHECK(global.largest < ((size_t)1 << 30), "%s: a recorded length of 4 GB allocates %lu bytes",
+                  methods[3 + k], (unsigned long)global.largest);
+            zmat_free(&out);
+            zmat_free(&enc);
+        }
+
+        zmat_set_max_alloc(0);
+        CHECK(global.live == 0 && global.foreign == 0, "lzma decoding with a false length leaks %ld blocks", global.live);
+    }
+
+    /* a context allocator: codec states and outputs come from al2, nothing from the global one */
+    {
+        long allocs = global.allocs;
+        size_t declen = 0;
+        unsigned char* dec = NULL;
+        TZMatCtx* c = NULL;
+
+        CHECK(zmat_ctx_init(&ctx) == 0 && zmat_set_allocator(ctx, &al2) == 0, "can not set the context allocator");
+        allocs = global.allocs;
+
+        for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+            if (zmat_run_ctx(ctx, 300007, data, &enclen, &enc, zipids[i], &status, 1) == 0) {
+                CHECK(zmat_run_ctx(ctx, enclen, enc, &declen, &dec, zipids[i], &status, 0) == 0 && declen == 300007,
+                      "%s: context decoding fails", methods[i]);
+                al2.free(al2.opaque, dec);
+                memset(enc + enclen / 4, 0xa5, enclen / 4);
+                dec = NULL;
+
+                if (zmat_run_ctx(ctx, enclen / 2, enc, &declen, &dec, zipids[i], &status, 0) == 0 && dec) {
+                    al2.free(al2.opaque, dec);
+                }
+
+                al2.free(al2.opaque, enc);
+            } else {
+                CHECK(0, "%s: context encoding fails", methods[i]);
+            }
+        }
+
+        CHECK(local.allocs > 0 && global.allocs == allocs, "context calls use the global allocator (%ld blocks)", global.allocs - allocs);
+        zmat_ctx_free(&ctx);
+        CHECK(local.live == 0 && local.foreign == 0, "context leaks %ld blocks, releases %ld foreign", local.live, local.foreign);
+
+        /* the context allocator is also released through al2 when the context is freed */
+        CHECK(zmat_ctx_init(&c) == 0, "zmat_ctx_init fails");
+        CHECK(global.live == 1, "zmat_ctx_init does not use the global allocator");
+        zmat_ctx_free(&c);
+        CHECK(global.live == 0, "zmat_ctx_free does not release through the global allocator");
+    }
+
+    /* resetting restores malloc/free: no further calls reach the counting allocator */
+    {
+        long allocs = global.allocs;
+
+        CHECK(zmat_set_allocator(NULL, NULL) == 0, "can not reset the global allocator");
+
+        for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+            if (zmat_run(300007, data, &enclen, &enc, zipids[i], &status, 1) == 0) {
+                free(enc);
+                enc = NULL;
+            }
+        }
+
+        CHECK(global.allocs == allocs && global.live == 0 && global.foreign == 0, "%ld allocations reach the allocator after the reset", global.allocs - allocs);
+    }
+
+    free(data);
+    printf("test_alloc: %d passed, %d failed\n", passed, failed);
+    return failed != 0;
+}
@@ -0,0 +1,244 @@
+/***************************************************************************//**
+**  \mainpage ZMat - A portable C-library and MATLAB/Octave toolbox for inline data compression
+**
+**  \author Qianqian Fang <q.fang at neu.edu>
+**  \copyright Qianqian Fang, 2019,2020,2022
+**
+**  Unit test of the base64 codec: the kernel picked at run time (capped by the
+**  ZMAT_SIMD environment variable, see the Makefile) must match a scalar
+**  reference for every length up to several SIMD blocks, every line mode,
+**  unaligned buffers, skipped characters and the threaded block path
+**
+**  \section slicense License
+**          GPL v3, see LICENSE.txt for details
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zmatlib.h"
+
+/* 3x the widest kernel block (64 characters for AVX-512) plus a tail of partial blocks */
+#define MAX_LEN  (3 * 64 * 3 + 200)
+
+static const unsigned char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int failed = 0, passed = 0;
+
+#define CHECK(cond, ...) do { \
+        if (cond) { passed++; } else { failed++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } \
+    } while (0)
+
+/**
+ * @brief Scalar reference encoder: a line feed after every 72 characters if mode > 1, and after the last line if mode > 2
+ */
+
+static size_t ref_encode(const unsigned char* in, size_t len, unsigned char* out, int mode) {
+    unsigned char* pos = out;
+    size_t i, line = 0;
+
+    for (i = 0; i + 3 <= len; i += 3) {
+        *pos++ = table[in[i] >> 2];
+        *pos++ = table[((in[i] & 0x03) << 4) | (in[i + 1] >> 4)];
+        *pos++ = table[((in[i + 1] & 0x0f) << 2) | (in[i + 2] >> 6)];
+        *pos++ = table[in[i + 2] & 0x3f];
+        line += 4;
+
+        if (mode > 1 && line >= 72) {
+            *pos++ = '\n';
+            line = 0;
+        }
+    }
+
+    if (len - i) {
+        *pos++ = table[in[i] >> 2];
+        *pos++ = table[((in[i] & 0x03) << 4) | ((len - i == 2) ? in[i + 1] >> 4 : 0)];
+        *pos++ = (len - i == 2) ? table[(in[i + 1] & 0x0f) << 2] : '=';
+        *pos++ = '=';
+        line += 4;
+    }
+
+    if (mode > 2 && line) {
+        *pos++ = '\n';
+    }
+
+    return pos - out;
+}
+
+/**
+ * @brief Scalar reference decoder: skips non-base64 characters, -1 if the text can not be decoded
+ */
+
+static long ref_decode(const unsigned char* in, size_t len, unsigned char* out) {
+    unsigned char dtable[256], block[4];
+    size_t i, count = 0;
+    long n = 0;
+    int pad = 0;
+
+    memset(dtable, 0x80, sizeof(dtable));
+
+    for (i = 0; i < 64; i++) {
+        dtable[table[i]] = (unsigned char)i;
+    }
+
+    dtable['='] = 0;
+
+    for (i = 0; i < len; i++) {
+        count += (dtable[in[i]] != 0x80);
+    }
+
+    if (count == 0 || count % 4) {
+        return -1;
+    }
+
+    for (i = 0, count = 0; i < len; i++) {
+        if (dtable[in[i]] == 0x80) {
+            continue;
+        }
+
+        pad += (in[i] == '=');
+        block[count++] = dtable[in[i]];
+
+        if (count == 4) {
+            out[n++] = (unsigned char)((block[0] << 2) | (block[1] >> 4));
+            out[n++] = (unsigned char)((block[1] << 4) | (block[2] >> 2));
+            out[n++] = (unsigned char)((block[2] << 6) | block[3]);
+            count = 0;
+
+            if (pad) {
+                if (pad > 2) {
+                    return -1;
+                }
+
+                n -= pad;
+                break;
+            }
+        }
+    }
+
+    return n;
+}
+
+/**
+ * @brief Decode text with base64_decode and compare with the reference decoder
+ */
+
+static void check_decode(const unsigned char* text, size_t len, const char* what, size_t n) {
+    unsigned char* ref = (unsigned char*)malloc(len / 4 * 3 + 3), *dec;
+    long reflen = ref_decode(text, len, ref);
+    size_t declen = 0;
+
+    dec = base64_decode(text, len, &declen);
+    CHECK((reflen < 0) ? (dec == NULL) : (dec != NULL && declen == (size_t)reflen && memcmp(dec, ref, declen) == 0),
+          "decoding %s of length %lu differs from the scalar reference (%ld bytes, got %s%lu)",
+          what, (unsigned long)n, reflen, dec ? "" : "NULL ", (unsigned long)declen);
+    zmat_free(&dec);
+    free(ref);
+}
+
+int main(void) {
+    size_t biglen = (size_t)9 << 20, len, i, k;
+    unsigned char* data = (unsigned char*)malloc(biglen), *ref = (unsigned char*)malloc(biglen / 3 * 4 + biglen / 54 + 8);
+    unsigned char* buf = (unsigned char*)malloc(4 * MAX_LEN + 256);
+    unsigned int seed = 1;
+    const char* simd = getenv("ZMAT_SIMD");
+    int mode;
+
+    for (i = 0; i < biglen; i++) {
+        seed = seed * 1103515245u + 12345u;
+        data[i] = (unsigned char)(seed >> 16);
+    }
+
+    /* every length, every line mode, and the output decoded back */
+    for (len = 0; len <= MAX_LEN; len++) {
+        for (mode = 0; mode <= 3; mode++) {
+            size_t reflen = ref_encode(data + len, len, ref, mode), enclen = 0;
+            unsigned char* enc = base64_encode(data + len, len, &enclen, mode);
+
+            CHECK(enc != NULL && enclen == reflen && memcmp(enc, ref, reflen) == 0 && enc[enclen] == '\0',
+                  "encoding length %lu in mode %d differs from the scalar reference", (unsigned long)len, mode);
+
+            if (mode == 0 || mode == 3) {
+                check_decode(ref, reflen, "encoded text", len);
+            }
+
+            zmat_free(&enc);
+        }
+    }
+
+    /* unaligned input and output buffers */
+    for (k = 1; k < 64; k++) {
+        size_t reflen = ref_encode(data, MAX_LEN - k, ref, 0), enclen = 0;
+        unsigned char* enc;
+
+        memcpy(buf + k, data, MAX_LEN - k);
+        enc = base64_encode(buf + k, MAX_LEN - k, &enclen, 0);
+        CHECK(enc != NULL && enclen == reflen && memcmp(enc, ref, reflen) == 0, "encoding at offset %lu differs", (unsigned long)k);
+        zmat_free(&enc);
+
+        memcpy(buf + k, ref, reflen);
+        check_decode(buf + k, reflen, "text at an offset", k);
+    }
+
+    /* characters the kernels can not take: skipped whitespace, stray bytes, '=' inside the text, bad padding */
+    for (len = 1; len <= MAX_LEN; len += 7) {
+        static const char junk[] = {'\n', '\r', ' ', '\t', '-', '_', '*', '\0', '\xff', '=', '.'};
+        size_t reflen = ref_encode(data, len, ref, 0);
+
+        for (k = 0; k < sizeof(junk); k++) {
+            size_t at = (len * 31 + k * 17) % (reflen + 1);
+
+            memcpy(buf, ref, at);
+            buf[at] = (unsigned char)junk[k];
+            memcpy(buf + at + 1, ref + at, reflen - at);
+            check_decode(buf, reflen + 1, "text with an inserted character", len);
+        }
+
+        /* every fourth character a line feed */
+        for (i = 0, k = 0; i < reflen; i++) {
+            buf[k++] = ref[i];
+
+            if (i % 4 == 3) {
+                buf[k++] = '\n';
+            }
+        }
+
+        check_decode(buf, k, "text with line feeds", len);
+
+        /* a valid character replaced by '=' */
+        memcpy(buf, ref, reflen);
+        buf[len % reflen] = '=';
+        check_decode(buf, reflen, "text with an early '='", len);
+
+        /* a truncated text */
+        check_decode(ref, reflen - 1, "truncated text", len);
+    }
+
+    /* the threaded path: blocks of whole lines above 4 MB */
+    for (mode = 1; mode <= 3; mode++) {
+        union TZMatFlags flags = {0};
+        size_t reflen, enclen = 0, declen = 0;
+        unsigned char* enc = NULL, *dec = NULL;
+        int status = 0;
+
+        flags.param.clevel = (char)mode;
+        flags.param.nthread = 4;
+        len = biglen - mode;
+        reflen = ref_encode(data, len, ref, mode);
+        CHECK(zmat_run(len, data, &enclen, &enc, zmBase64, &status, flags.iscompress) == 0 && enclen == reflen && memcmp(enc, ref, reflen) == 0,
+              "threaded encoding of %lu bytes in mode %d differs from the scalar reference", (unsigned long)len, mode);
+
+        flags.param.clevel = 0;
+        CHECK(zmat_run(reflen, ref, &declen, &dec, zmBase64, &status, flags.iscompress) == 0 && declen == len && memcmp(dec, data, len) == 0,
+              "threaded decoding of %lu bytes in mode %d fails", (unsigned long)len, mode);
+        zmat_free(&enc);
+        zmat_free(&dec);
+    }
+
+    free(buf);
+    free(ref);
+    free(data);
+    printf("test_base64 (ZMAT_SIMD=%s): %d passed, %d failed\n", simd ? simd : "", passed, failed);
+    return failed != 0;
+}
@@ -0,0 +1,152 @@
+/***************************************************************************//**
+**  \mainpage ZMat - A portable C-library and MATLAB/Octave toolbox for inline data compression
+**
+**  \author Qianqian Fang <q.fang at neu.edu>
+**  \copyright Qianqian Fang, 2019,2020,2022
+**
+**  Unit test of the reusable context (zmat_ctx_init/zmat_run_ctx/zmat_ctx_free):
+**  one context is reused across methods, levels, encoding and decoding, and
+**  every output must match zmat_run
+**
+**  \section slicense License
+**          GPL v3, see LICENSE.txt for details
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zmatlib.h"
+
+static const char* methods[] = {"zlib", "gzip", "zstd", "lzma", "lzip", "xz", "lz4", "lz4hc", "lz4f",
+                                "blosc2blosclz", "blosc2lz4", "blosc2lz4hc", "blosc2zlib", "blosc2zstd", "base64"
+                               };
+static const TZipMethod zipids[] = {zmZlib, zmGzip, zmZstd, zmLzma, zmLzip, zmXz, zmLz4, zmLz4hc, zmLz4f,
+                                    zmBlosc2Blosclz, zmBlosc2Lz4, zmBlosc2Lz4hc, zmBlosc2Zlib, zmBlosc2Zstd, zmBase64
+                                   };
+
+static int failed = 0, passed = 0;
+
+#define CHECK(cond, ...) do { \
+        if (cond) { passed++; } else { failed++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } \
+    } while (0)
+
+/**
+ * @brief Fill buf with compressible pseudo-random 32-bit values
+ */
+
+static void fill_data(unsigned char* buf, size_t len, unsigned int seed) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (i % 4 == 3) ? (unsigned char)((seed >> 16) & 0x7) : (unsigned char)(i / 4 % 251 * (i % 4));
+    }
+}
+
+/**
+ * @brief Encode and decode data with method i through ctx, comparing each output with zmat_run
+ */
+
+static void test_method(TZMatCtx* ctx, int i, unsigned char* data, size_t len, int iscompress) {
+    union TZMatFlags flags;
+    size_t ctxlen = 0, runlen = 0, declen = 0;
+    unsigned char* ctxbuf = NULL, *runbuf = NULL, *decbuf = NULL;
+    int res, res2, status = 0, clevel;
+
+    flags.iscompress = iscompress;
+    clevel = flags.param.clevel;
+
+    res = zmat_run_ctx(ctx, len, data, &ctxlen, &ctxbuf, zipids[i], &status, iscompress);
+    res2 = zmat_run(len, data, &runlen, &runbuf, zipids[i], &status, iscompress);
+    CHECK(res == 0 && res2 == 0 && ctxlen == runlen && memcmp(ctxbuf, runbuf, runlen) == 0,
+          "%s: level %d typesize %d: zmat_run_ctx encoding (%d, %lu bytes) differs from zmat_run (%d, %lu bytes)",
+          methods[i], clevel, flags.param.typesize, res, (unsigned long)ctxlen, res2, (unsigned long)runlen);
+
+    if (res == 0) {
+        flags.param.clevel = 0; /* decoding keeps shuffle and typesize to reverse the shuffle */
+        res = zmat_run_ctx(ctx, ctxlen, ctxbuf, &declen, &decbuf, zipids[i], &status, flags.iscompress);
+        CHECK(res == 0 && declen == len && memcmp(decbuf, data, len) == 0,
+              "%s: level %d typesize %d: zmat_run_ctx does not decode its own output (%d)", methods[i], clevel, flags.param.typesize, res);
+        zmat_free(&decbuf);
+    }
+
+    zmat_free(&ctxbuf);
+    zmat_free(&runbuf);
+}
+
+int main(void) {
+    const int levels[] = {1, -1, -5, -9};
+    size_t len = 300007, j;
+    unsigned char* data = (unsigned char*)malloc(len);
+    TZMatCtx* ctx = NULL;
+    unsigned int i, pass;
+
+    fill_data(data, len, 1);
+
+    CHECK(zmat_ctx_init(&ctx) == 0 && ctx != NULL, "zmat_ctx_init fails");
+
+    /* the same context is used for every call; the second pass runs on the cached states */
+    for (pass = 0; pass < 2; pass++) {
+        for (j = 0; j < sizeof(levels) / sizeof(levels[0]); j++) {
+            for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+                union TZMatFlags flags = {0};
+
+                flags.param.clevel = (char)levels[j];
+                test_method(ctx, i, data, len, flags.iscompress);
+
+                /* a byte shuffle of 4-byte elements, and a different input length */
+                flags.param.shuffle = 1;
+                flags.param.typesize = 4;
+                test_method(ctx, i, data, len - 3 - pass * 1000, flags.iscompress);
+            }
+        }
+    }
+
+    /* decoding corrupt input must fail without spoiling the context */
+    {
+        size_t enclen = 0, declen = 0;
+        unsigned char* enc = NULL, *dec = NULL;
+        int status = 0;
+
+        for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+            if (zipids[i] == zmBase64 || zmat_run_ctx(ctx, len, data, &enclen, &enc, zipids[i], &status, 1) != 0) {
+                zmat_free(&enc);
+                continue;
+            }
+
+            memset(enc + enclen / 3, 0x5a, enclen / 3);
+            CHECK(zmat_run_ctx(ctx, enclen, enc, &declen, &dec, zipids[i], &status, 0) != 0 || declen != len || memcmp(dec, data, len) != 0,
+                  "%s: corrupt input is decoded", methods[i]);
+            zmat_free(&dec);
+            zmat_free(&enc);
+            test_method(ctx, i, data, len, 1);
+        }
+    }
+
+    /* an indexed stream can not record a shuffle, so the combination is rejected */
+    {
+        union TZMatFlags flags = {0};
+        size_t enclen = 0;
+        unsigned char* enc = NULL;
+        int status = 0;
+
+        flags.param.clevel = 1;
+        flags.param.shuffle = 1;
+        flags.param.typesize = 4;
+        CHECK(zmat_run_ctx(ctx, len, data, &enclen, &enc, zmGzip | ZMAT_INDEX, &status, flags.iscompress) == -16
+              && zmat_run(len, data, &enclen, &enc, zmZstd | ZMAT_INDEX, &status, flags.iscompress) == -16,
+              "a shuffle with ZMAT_INDEX is not rejected");
+        zmat_free(&enc);
+    }
+
+    zmat_ctx_free(&ctx);
+    CHECK(ctx == NULL, "zmat_ctx_free does not reset the handle");
+
+    /* a NULL context behaves like zmat_run */
+    test_method(NULL, 0, data, len, 1);
+
+    free(data);
+    printf("test_ctx: %d passed, %d failed\n", passed, failed);
+    return failed != 0;
+}
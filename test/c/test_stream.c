@@ -0,0 +1,216 @@
+/***************************************************************************//**
+**  \mainpage ZMat - A portable C-library and MATLAB/Octave toolbox for inline data compression
+**
+**  \author Qianqian Fang <q.fang at neu.edu>
+**  \copyright Qianqian Fang, 2019,2020,2022
+**
+**  Unit test of the streaming interface (zmat_stream_*): every method is
+**  encoded and decoded piece by piece, with 1-byte, odd and whole-buffer
+**  pieces, and checked against zmat_run in both directions
+**
+**  \section slicense License
+**          GPL v3, see LICENSE.txt for details
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zmatlib.h"
+
+static const char* methods[] = {"zlib", "gzip", "zstd", "lzma", "lzip", "xz", "lz4", "lz4hc", "lz4f",
+                                "blosc2blosclz", "blosc2lz4", "blosc2lz4hc", "blosc2zlib", "blosc2zstd"
+                               };
+static const TZipMethod zipids[] = {zmZlib, zmGzip, zmZstd, zmLzma, zmLzip, zmXz, zmLz4, zmLz4hc, zmLz4f,
+                                    zmBlosc2Blosclz, zmBlosc2Lz4, zmBlosc2Lz4hc, zmBlosc2Zlib, zmBlosc2Zstd
+                                   };
+
+static int failed = 0, passed = 0;
+
+#define CHECK(cond, ...) do { \
+        if (cond) { passed++; } else { failed++; printf("FAIL %s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } \
+    } while (0)
+
+/**
+ * @brief Fill buf with compressible pseudo-random text (repeated words and random bytes)
+ */
+
+static void fill_data(unsigned char* buf, size_t len, unsigned int seed) {
+    static const char* words[] = {"zmat ", "stream ", "chunk ", "window ", "0123456789", "\n"};
+    size_t i = 0;
+
+    while (i < len) {
+        seed = seed * 1103515245u + 12345u;
+
+        if ((seed >> 16) % 8 == 0) {
+            buf[i++] = (unsigned char)(seed >> 8);
+        } else {
+            const char* w = words[(seed >> 16) % 6];
+            size_t n = strlen(w);
+
+            n = (n > len - i) ? len - i : n;
+            memcpy(buf + i, w, n);
+            i += n;
+        }
+    }
+}
+
+/**
+ * @brief Run a whole buffer through a stream in pieces of step bytes (0: one piece)
+ *
+ * @return the coarse zmat error code of the first failing call, 0 on success
+ */
+
+static int stream_run(TZipMethod zipid, int iscompress, const unsigned char* in, size_t len, size_t step,
+                      size_t* outlen, unsigned char** out) {
+    TZMatStream* s = NULL;
+    size_t pos = 0, piecelen = 0, cap = 0;
+    unsigned char* piece = NULL;
+    int res, status = 0;
+
+    *outlen = 0;
+    *out = NULL;
+
+    if ((res = zmat_stream_init(&s, zipid, iscompress)) != 0) {
+        return res;
+    }
+
+    if (step == 0) {
+        step = (len > 0) ? len : 1;
+    }
+
+    do {
+        size_t n = (len - pos < step) ? len - pos : step;
+
+        if (pos < len) {
+            res = zmat_stream_update(s, n, in + pos, &piecelen, &piece, &status);
+            pos += n;
+        } else {
+            res = zmat_stream_finish(s, &piecelen, &piece, &status);
+            pos++;
+        }
+
+        if (res == 0 && piecelen > 0) {
+            if (*outlen + piecelen > cap) {
+                cap = (*outlen + piecelen) * 2;
+                *out = (unsigned char*)realloc(*out, cap);
+            }
+
+            memcpy(*out + *outlen, piece, piecelen);
+            *outlen += piecelen;
+        }
+
+        zmat_free(&piece);
+    } while (res == 0 && pos <= len);
+
+    zmat_stream_free(&s);
+    return res;
+}
+
+/**
+ * @brief Encode/decode data with method i through the stream and zmat_run, in pieces of step bytes
+ */
+
+static void test_method(int i, const unsigned char* data, size_t len, size_t step) {
+    union TZMatFlags flags = {1};
+    size_t enclen = 0, declen = 0, runlen = 0;
+    unsigned char* enc = NULL, *dec = NULL, *run = NULL;
+    int res, status = 0;
+
+    /* stream encode, zmat_run decode */
+    res = stream_run(zipids[i], flags.iscompress, data, len, step, &enclen, &enc);
+    CHECK(res == 0, "%s: stream encode of %lu bytes in %lu-byte pieces returns %d", methods[i], (unsigned long)len, (unsigned long)step, res);
+
+    if (res == 0) {
+        res = zmat_run(enclen, enc, &runlen, &run, zipids[i], &status, 0);
+        CHECK(res == 0 && runlen == len && memcmp(run, data, len) == 0,
+              "%s: zmat_run does not decode the stream output (%lu bytes, step %lu, error %d)", methods[i], (unsigned long)len, (unsigned long)step, res);
+        zmat_free(&run);
+    }
+
+    /* stream encode, stream decode */
+    if (res == 0) {
+        res = stream_run(zipids[i], 0, enc, enclen, step, &declen, &dec);
+        CHECK(res == 0 && declen == len && memcmp(dec, data, len) == 0,
+              "%s: stream round trip of %lu bytes in %lu-byte pieces failed (error %d)", methods[i], (unsigned long)len, (unsigned long)step, res);
+        free(dec);
+        dec = NULL;
+    }
+
+    free(enc);
+    enc = NULL;
+
+    /* zmat_run encode (for lz4/lz4hc a bare block), stream decode */
+    if (zmat_run(len, (unsigned char*)data, &runlen, &run, zipids[i], &status, flags.iscompress) == 0) {
+        res = stream_run(zipids[i], 0, run, runlen, step, &declen, &dec);
+        CHECK(res == 0 && declen == len && memcmp(dec, data, len) == 0,
+              "%s: stream does not decode the zmat_run output (%lu bytes, step %lu, error %d)", methods[i], (unsigned long)len, (unsigned long)step, res);
+        free(dec);
+    } else {
+        CHECK(0, "%s: zmat_run fails to encode %lu bytes", methods[i], (unsigned long)len);
+    }
+
+    zmat_free(&run);
+}
+
+int main(void) {
+    const size_t smallsteps[] = {1, 7, 4099, 0};
+    const size_t largesteps[] = {65521, 0};
+    size_t smalllen = 20011, largelen = (5 << 20) + 12345, j;
+    unsigned char* data = (unsigned char*)malloc(largelen);
+    unsigned int i;
+
+    fill_data(data, largelen, 1);
+
+    for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+        TZMatStream* s = NULL;
+
+        if (zmat_stream_init(&s, zipids[i], 1) != 0) {
+            printf("skip %s: not supported by this build\n", methods[i]);
+            continue;
+        }
+
+        zmat_stream_free(&s);
+
+        /* an empty stream is rejected like an empty zmat_run input */
+        {
+            size_t outlen = 0;
+            unsigned char* out = NULL;
+
+            CHECK(stream_run(zipids[i], 1, data, 0, 0, &outlen, &out) == -1, "%s: empty stream is not rejected", methods[i]);
+            free(out);
+        }
+
+        for (j = 0; j < sizeof(smallsteps) / sizeof(smallsteps[0]); j++) {
+            test_method(i, data, smalllen, smallsteps[j]);
+        }
+
+        /* larger than ZMAT_STREAM_WINDOW, so the block based encoders emit several blocks */
+        for (j = 0; j < sizeof(largesteps) / sizeof(largesteps[0]); j++) {
+            test_method(i, data, largelen, largesteps[j]);
+        }
+    }
+
+    /* a truncated stream must be reported by zmat_stream_finish */
+    {
+        size_t enclen = 0, declen = 0;
+        unsigned char* enc = NULL, *dec = NULL;
+
+        for (i = 0; i < sizeof(zipids) / sizeof(zipids[0]); i++) {
+            if (stream_run(zipids[i], 1, data, smalllen, 0, &enclen, &enc) != 0) {
+                free(enc);
+                enc = NULL;
+                continue;
+            }
+
+            CHECK(stream_run(zipids[i], 0, enc, enclen / 2, 1000, &declen, &dec) != 0, "%s: truncated stream is accepted", methods[i]);
+            free(enc);
+            free(dec);
+            enc = dec = NULL;
+        }
+    }
+
+    free(data);
+    printf("test_stream: %d passed, %d failed\n", passed, failed);
+    return failed != 0;
+}
@@ -31,28 +31,97 @@ function varargout = zmat(varargin)
 %             input using the info stored in the info structure.
 %      method: (optional) compression method, currently, zmat supports the below methods
 %             'zlib': zlib/zip based data compression (default)
-%             'gzip': gzip formatted data compression
-%             'lzip': lzip formatted data compression (nthread>1 compresses chunks in parallel)
+%             'gzip': gzip formatted data compression (zlib and gzip compress 1 MB
+%                     blocks in parallel when nthread>1, as one standard stream;
+%                     streams over 4 MB are also decompressed in parallel)
+%             'lzip': lzip formatted data compression (nthread>1 compresses chunks
+%                     in parallel; multi-member streams are also decoded in parallel)
 %             'lzma': lzma formatted data compression
 %             'xz':   xz (.xz) compression via LZMA2; nthread sets parallel block threads
+%                     for both compression and decompression of multi-block streams
 %             'lz4':  lz4 formatted data compression
 %             'lz4hc':lz4hc (LZ4 with high-compression ratio) formatted data compression
+%             'lz4f': LZ4 frame (.lz4) format with independent 4 MB blocks, the
+%                     content size and block checksums; blocks are compressed and
+%                     decompressed in parallel when nthread>1 (lz4hc for levels 3+)
 %             'zstd':  zstd formatted data compression
 %             'blosc2blosclz':  blosc2 meta-compressor with blosclz compression
 %             'blosc2lz4':  blosc2 meta-compressor with lz4 compression
 %             'blosc2lz4hc':  blosc2 meta-compressor with lz4hc compression
 %             'blosc2zlib':  blosc2 meta-compressor with zlib/zip compression
 %             'blosc2zstd':  blosc2 meta-compressor with zstd compression
+%             'b2nd': blosc2 N-dimensional array (zstd codec) storing the shape of
+%                     the input, cut into multi-dimensional chunks and blocks so
+%                     that the 'slice' option decodes a sub-array without
+%                     decompressing the rest
+%             'blosc2zfp-acc', 'blosc2zfp-prec', 'blosc2zfp-rate': lossy zfp
+%                     compression of single/double arrays of 1 to 4 dimensions with
+%                     an absolute error bound, a bit precision or a fixed rate; the
+%                     zfp codec needs the array shape, so these write 'b2nd' arrays
+%             'blosc2ndlz': lossless ndlz compression of 2-D arrays, also
+%                     written as 'b2nd' arrays
 %             'base64': encode or decode use base64 format
 %     options: a series of ('name', value) pairs, supported options include
-%             'nthread': number of threads (default 4); used by lzip, lzma, xz, zstd, blosc2
+%             'nthread': number of threads (default 4, 1 inside parfor workers);
+%                   used by zlib, gzip, lzip, lzma, xz, lz4f, zstd, blosc2; 0 picks one thread per
+%                   4 MB of input; all calls share a pool capped by the
+%                   ZMAT_NUM_THREADS or OMP_NUM_THREADS variable or the CPU count
 %             'typesize': followed by an integer specifying the number of bytes per data element (used for shuffle)
-%             'shuffle': 0 to disable (default for non-blosc2), 1 to enable byte-shuffle.
-%                     For blosc2 methods the shuffle is applied inside the C layer.
-%                     For all other methods, when [output,info]=zmat(...) is called,
-%                     the shuffle is applied in MATLAB before compression and reversed
-%                     after decompression; the info struct records 'shuffle' and
-%                     'typesize' so that zmat(compressed, info) restores the original array.
+%             'shuffle': 0 to disable (default for non-blosc2), 1 to enable byte-shuffle,
+%                     2 to enable bit-shuffle. blosc2 methods shuffle each block.
+%                     For zlib, gzip, lzma, lzip, xz, lz4 and zstd, the whole input
+%                     is shuffled before the codec when [output,info]=zmat(...) is
+%                     called or with 'frame'/'container'; the info struct (or header)
+%                     records 'shuffle' and 'typesize' (and 'bitshuffle'=1 for a bit
+%                     shuffle; without it any positive 'shuffle' is a byte shuffle, as
+%                     in older info structs) so that zmat(compressed, info) restores
+%                     the original array. Ignored with 'index'.
+%             'frame': 1 to prepend a 16-byte zmat frame header recording the method,
+%                     uncompressed length, typesize and shuffle, so that the output can
+%                     be decoded with zmat(output,0,method,'frame',1) without the info
+%                     struct (the method stored in the header is used); default 0.
+%             'index': 'gzip' and 'zstd' only, 1 to compress in independent blocks
+%                     whose offsets are stored in the gzip header or a zstd seek
+%                     table, so that decompression runs in parallel and the C
+%                     function zmat_decode_range() can read a slice; the output
+%                     remains a standard gzip or zstd stream; default 0.
+%             'container': 1 to split the input into 4 MB chunks, compress each
+%                     with the given method and append an index of their offsets
+%                     and crc32s; the chunks are compressed and decompressed in
+%                     parallel and the C function zmat_container_read() can read
+%                     a slice; also needed when decompressing (or set in info);
+%                     default 0.
+%             'base64': 1 to output the compressed data as one line of base64
+%                     text, as stored in JData _ArrayZipData_, in a single pass;
+%                     zlib, gzip and zstd are encoded piece by piece as the codec
+%                     writes them; also needed when decompressing (or set in
+%                     info); default 0.
+%             'dict': 'zlib', 'zstd', 'lz4' and 'lz4hc' only, a uint8 vector of
+%                     dictionary bytes, e.g. trained from many small, similar
+%                     records by the C zmat_dict_train(), Python
+%                     zmat.dict_train() or 'zstd --train'; it is
+%                     digested once and reused while the following calls pass
+%                     the same bytes; the same dictionary is needed to
+%                     decompress; default [] (none)
+%             'slice': 'b2nd' (and zfp/ndlz) only, a 2xN matrix [start; stop] of 1-based, inclusive
+%                     indices of each dimension; only the chunks and blocks that
+%                     intersect the sub-array are decompressed, and with the info
+%                     struct the output is reshaped to stop-start+1.
+%             'filters': blosc2 and 'b2nd' only, the filter pipeline run on each
+%                     block before the codec, replacing 'shuffle'; a cell array of
+%                     up to 6 names, or a vector of ids, among 'nofilter' (0),
+%                     'shuffle' (1), 'bitshuffle' (2), 'delta' (3) and 'truncprec' (4)
+%             'filtersmeta': the parameter of each filter, e.g. the number of
+%                     mantissa bits kept by 'truncprec' (lossy) for single/double
+%             'blocksize': blosc2 block length in bytes, 0 (default) lets blosc2
+%                     choose; ignored by 'b2nd', whose blocks follow the array shape
+%             'splitmode': 1 to always split blosc2 blocks into one stream per
+%                     byte, 2 never, 3 auto; 0 (default) uses the blosc2 default
+%             'compmeta': the parameter of the zfp and ndlz codecs, 0 (default)
+%                     for: the absolute error bound 10^compmeta of 'blosc2zfp-acc'
+%                     (-3), the bit precision of 'blosc2zfp-prec' (16), the output
+%                     size in percent of the input of 'blosc2zfp-rate' (25), or
+%                     the cell size, 4 or 8, of 'blosc2ndlz' (4)
 %
 % output:
 %      output: a uint8 row vector, storing the compressed or decompressed data;
@@ -82,6 +151,12 @@ function varargout = zmat(varargin)
 %            'matrixclass': (optional) original element class for diagonal and sparse types
 %            'matrixsize': (optional) original [rows, cols] dimensions
 %            'sparsecount': (optional) number of nonzero elements for sparse type
+%            'frame': (optional) 1 if the output starts with a zmat frame header
+%            'container': (optional) 1 if the output is a chunked zmat container
+%            'base64': (optional) 1 if the output is base64 text
+%
+%     no output buffer grows past 64 GB (1 GB in 32-bit MATLAB/Octave); to change
+%     it, call setenv('ZMAT_MAX_ALLOC','200G') before the first zmat call
 %
 % example:
 %
@@ -97,6 +172,16 @@ function varargout = zmat(varargin)
 %   A2=zmat(ss, info);
 %   assert(nnz(A-A2)==0);
 %
+%   % decode a sub-array of a b2nd array
+%   [ss, info]=zmat(rand(100,200,50,'single'),1,'b2nd');
+%   sub=zmat(ss, info, 'b2nd', 'slice', [11 1 5; 20 200 5]);  % 10x200 single
+%
+%   % blosc2 with a delta and bit-shuffle filter pipeline
+%   ss=zmat(uint16(magic(100)),1,'blosc2zstd','filters',{'delta','bitshuffle'},'typesize',2);
+%
+%   % lossy zfp compression of a volume with a 1e-4 absolute error bound
+%   [ss, info]=zmat(rand(64,64,64,'single'),1,'blosc2zfp-acc','compmeta',-4);
+%
 % -- this function is part of the ZMAT toolbox (https://github.com/NeuroJSON/zmat)
 %
 
@@ -112,6 +197,7 @@ end
 input = varargin{1};
 iscompress = 1;
 zipmethod = 'zlib';
+sizehint = 0;
 
 if (~(ischar(input) || islogical(input) || (isnumeric(input) && isreal(input))))
     error('input must be a char, non-complex numeric or logical vector or N-D array');
@@ -199,6 +285,10 @@ if (nargin > 1)
         inputinfo = varargin{2};
         iscompress = 0;
         zipmethod = inputinfo.method;
+        %% the decoded length lets zipmat decode into a right-sized buffer
+        if (isfield(inputinfo, 'size') && isfield(inputinfo, 'byte') && ~isfield(inputinfo, 'matrixtype'))
+            sizehint = prod(inputinfo.size) * inputinfo.byte;
+        end
     end
 end
 
@@ -211,14 +301,69 @@ if (nargin > 4 && ischar(varargin{4}) && bitand(length(varargin), 1) == 1)
     opt = cell2struct(varargin(5:2:end), varargin(4:2:end), 2);
 end
 
-shuffle = 0;
-if (strfind(zipmethod, 'blosc2'))
-    shuffle = 1;
+isblosc2 = (~isempty(strfind(zipmethod, 'blosc2')) || strcmp(zipmethod, 'b2nd'));
+shuffle = double(isblosc2);
+
+%% the info struct records the shuffle the C library applied to the other codecs;
+% older structs byte-shuffled for any positive 'shuffle', 'bitshuffle' marks a bit shuffle
+if (nargin > 1 && isstruct(varargin{2}) && isfield(inputinfo, 'shuffle') && isfield(inputinfo, 'typesize'))
+    shuffle = double(inputinfo.shuffle > 0);
+    if (shuffle && isfield(inputinfo, 'bitshuffle') && inputinfo.bitshuffle)
+        shuffle = 2;
+    end
+    typesize = inputinfo.typesize;
 end
 
-nthread = getoption('nthread', 4, opt);
+% inside parfor/batch workers, every worker already owns a core
+nthread = 4;
+if (exist('getCurrentTask', 'file') && ~isempty(getCurrentTask()))
+    nthread = 1;
+end
+nthread = getoption('nthread', nthread, opt);
 shuffle = getoption('shuffle', shuffle, opt);
 typesize = getoption('typesize', typesize, opt);
+frame = 0;
+if (isfield(inputinfo, 'frame'))
+    frame = inputinfo.frame;
+end
+frame = getoption('frame', frame, opt);
+index = getoption('index', 0, opt);
+container = 0;
+if (isfield(inputinfo, 'container'))
+    container = inputinfo.container;
+end
+container = getoption('container', container, opt);
+b64 = 0;
+if (isfield(inputinfo, 'base64'))
+    b64 = inputinfo.base64;
+end
+b64 = getoption('base64', b64, opt);
+slice = getoption('slice', [], opt);
+dict = getoption('dict', [], opt);
+filters = getoption('filters', [], opt);
+if (iscell(filters) || ischar(filters))
+    [isfilter, filters] = ismember(filters, {'nofilter', 'shuffle', 'bitshuffle', 'delta', 'truncprec'});
+    if (~all(isfilter))
+        error('unsupported blosc2 filter name');
+    end
+    filters = filters - 1;
+end
+filtersmeta = getoption('filtersmeta', [], opt);
+blocksize = getoption('blocksize', 0, opt);
+splitmode = getoption('splitmode', 0, opt);
+compmeta = getoption('compmeta', 0, opt);
+
+%% b2nd stores the dimensions of dense arrays; a slice is returned with its own size
+shape = [];
+if (ismember(zipmethod, {'b2nd', 'blosc2zfp-acc', 'blosc2zfp-prec', 'blosc2zfp-rate', 'blosc2ndlz'}) && iscompress ~= 0 && isempty(specialtype) && ~frame && ~container && ~b64)
+    shape = size(input);
+end
+if (~isempty(slice))
+    sizehint = 0;
+    if (isfield(inputinfo, 'size'))
+        inputinfo.size = slice(2, :) - slice(1, :) + 1;
+    end
+end
 
 iscompress = round(iscompress);
 
@@ -226,33 +371,32 @@ if ((strcmp(zipmethod, 'zlib') || strcmp(zipmethod, 'gzip')) && iscompress <= -1
     iscompress = -9;
 end
 
-%% wrapper-level byte shuffle: applies to non-blosc2 codecs when info is requested
-do_wrapper_shuffle = (nargout > 1 && shuffle > 0 && iscompress ~= 0 && ...
-                      isempty(strfind(zipmethod, 'blosc2')) && ...
-                      ~strcmp(zipmethod, 'base64') && ...
-                      isempty(specialtype) && typesize > 1);
+%% the other codecs are shuffled only if the info struct, frame or container records it
+if (iscompress ~= 0 && ~isblosc2 && (index || ~(nargout > 1 || frame || container) || ~isempty(specialtype)))
+    shuffle = 0;
+end
 
-if (do_wrapper_shuffle)
-    %% convert input to bytes, apply byte shuffle, then compress
-    orig_class = class(input);
-    orig_size  = size(input);
-    if (~isa(input, 'uint8'))
-        raw_bytes = typecast(input(:)', 'uint8');
-    else
-        raw_bytes = input(:)';
-    end
-    nelems = numel(raw_bytes) / typesize;
-    M = reshape(raw_bytes, typesize, nelems);   % typesize x nelems: col = one element
-    shuffled_bytes = reshape(M', 1, []);        % flatten row-major: all byte-0s, then byte-1s...
-    [varargout{1:max(1, nargout)}] = zipmat(shuffled_bytes, iscompress, zipmethod, nthread, 0, 1);
-    %% overwrite info with original array metadata and record shuffle state
-    varargout{2}.type     = orig_class;
-    varargout{2}.size     = orig_size;
-    varargout{2}.byte     = typesize;
-    varargout{2}.shuffle  = shuffle;
+[varargout{1:max(1, nargout)}] = zipmat(input, iscompress, zipmethod, nthread, shuffle, typesize, sizehint, frame, index, container, shape, slice, ...
+                                         double(filters), double(filtersmeta), blocksize, splitmode, compmeta, b64, uint8(dict));
+
+if (nargout > 1 && iscompress ~= 0 && ~isblosc2 && ~strcmp(zipmethod, 'base64') && ~index && shuffle > 0 && typesize > 1)
+    varargout{2}.shuffle = shuffle;
     varargout{2}.typesize = typesize;
-else
-    [varargout{1:max(1, nargout)}] = zipmat(input, iscompress, zipmethod, nthread, shuffle, typesize);
+    if (shuffle == 2)
+        varargout{2}.bitshuffle = 1;
+    end
+end
+
+if (nargout > 1 && frame)
+    varargout{2}.frame = 1;
+end
+
+if (nargout > 1 && container)
+    varargout{2}.container = 1;
+end
+
+if (nargout > 1 && b64)
+    varargout{2}.base64 = 1;
 end
 
 %% store special matrix type info in the output info struct
@@ -328,17 +472,6 @@ if (exist('inputinfo', 'var') && isfield(inputinfo, 'type'))
         end
     end
 
-    %% unshuffle if compression applied wrapper-level byte shuffle
-    if (isfield(inputinfo, 'shuffle') && inputinfo.shuffle > 0 && ...
-        isfield(inputinfo, 'typesize') && inputinfo.typesize > 1 && ...
-        isempty(strfind(inputinfo.method, 'blosc2')))
-        ts = inputinfo.typesize;
-        raw_bytes = varargout{1}(:)';
-        nelems = numel(raw_bytes) / ts;
-        M = reshape(raw_bytes, nelems, ts);     % nelems x ts: col = one byte position
-        varargout{1} = reshape(M', 1, []);      % flatten row-major: bytes of e1, then e2...
-    end
-
     if (strcmp(inputinfo.type, 'logical'))
         varargout{1} = logical(varargout{1});
     else